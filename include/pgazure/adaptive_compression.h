@@ -0,0 +1,28 @@
+/*-------------------------------------------------------------------------
+ *
+ * adaptive_compression.h
+ *	  Compression that picks a format and level based on a sample of the
+ *	  data and the upload bandwidth.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef ADAPTIVE_COMPRESSION_H
+#define ADAPTIVE_COMPRESSION_H
+
+#include "postgres.h"
+
+#include "pgazure/byte_io.h"
+
+
+extern int AdaptiveCompressionSampleSize;
+extern int AdaptiveCompressionUploadBandwidth;
+
+
+ByteSink * CreateAdaptiveCompressor(ByteSink *byteSink, ByteSink *blobSink,
+                                    char *compressionString);
+
+
+#endif
@@ -0,0 +1,60 @@
+/*-------------------------------------------------------------------------
+ *
+ * binary_codec.h
+ *	  Utilities for encoding and decoding tuples in COPY binary format
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef BINARY_CODEC_H
+#define BINARY_CODEC_H
+
+
+#include "access/tupdesc.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/codecs.h"
+
+
+/* size of the preallocated buffers used by the binary encoder and decoder */
+#define BINARY_CODEC_BUFFER_SIZE 65536
+
+/* length of the COPY binary file header (signature, flags, extension length) */
+#define BINARY_SIGNATURE_LENGTH 11
+#define BINARY_HEADER_LENGTH (BINARY_SIGNATURE_LENGTH + 2 * sizeof(int32))
+
+
+/*
+ * BinaryFieldType identifies types for which the binary codec reads and
+ * writes the COPY binary representation directly instead of going through
+ * the send/receive functions of the type.
+ */
+typedef enum BinaryFieldType
+{
+	BINARY_FIELD_GENERIC,
+	BINARY_FIELD_BOOL,
+	BINARY_FIELD_INT2,
+	BINARY_FIELD_INT4,
+	BINARY_FIELD_INT8,
+	BINARY_FIELD_FLOAT4,
+	BINARY_FIELD_FLOAT8,
+	BINARY_FIELD_DATE,
+	BINARY_FIELD_TIMESTAMP,
+	BINARY_FIELD_UUID,
+	BINARY_FIELD_TEXT
+} BinaryFieldType;
+
+
+extern const char BinaryCopySignature[BINARY_SIGNATURE_LENGTH];
+
+
+TupleEncoder * CreateBinaryEncoder(ByteSink *byteSink, TupleDesc tupleDescriptor);
+TupleDecoder * CreateBinaryDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor,
+                                   bool *projectedColumns, TupleDecoderFilter *filter);
+BinaryFieldType BinaryFieldTypeFromTypeId(Oid typeId);
+int BinaryFieldTypeLength(BinaryFieldType fieldType);
+int * BinaryFieldColumnIndexes(TupleDesc tupleDescriptor, int *fieldCount);
+
+
+#endif
@@ -0,0 +1,28 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_estimates.h
+ *	  Planner estimates for functions that read from blob storage.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef BLOB_ESTIMATES_H
+#define BLOB_ESTIMATES_H
+
+
+extern double BlobRequestCost;
+extern double BlobTransferCost;
+extern int BlobMetadataCacheTTL;
+
+
+bool EstimateBlobSize(char *accountString, char *containerName, char *path,
+                      char *decoderString, char *compressionString,
+                      double *storedBytes, double *rowCount);
+bool EstimatePrefixSize(char *accountString, char *containerName, char *prefix,
+                        char *decoderString, char *compressionString,
+                        double *blobCount, double *storedBytes, double *rowCount);
+
+
+#endif
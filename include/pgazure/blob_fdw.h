@@ -0,0 +1,107 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_fdw.h
+ *	  Foreign data wrapper for tables in blob storage.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef BLOB_FDW_H
+#define BLOB_FDW_H
+
+
+#include "foreign/fdwapi.h"
+#include "pgazure/blob_prefetcher.h"
+#include "pgazure/codecs.h"
+
+
+/* size after which inserts continue in a new blob */
+#define DEFAULT_MAX_BLOB_SIZE INT64CONST(1073741824)
+
+
+extern int MaxAsyncBlobDownloads;
+extern int AnalyzeSampleBlobSize;
+
+
+/*
+ * BlobFdwOptions contains the options of a foreign table and its server.
+ */
+typedef struct BlobFdwOptions
+{
+	char *accountString;
+	char *containerName;
+	char *path;
+	char *prefix;
+
+	/* template of blob paths that contain partition columns, or NULL */
+	char *pathTemplate;
+
+	/* whether paths spell integer and date partition values canonically */
+	bool canonicalPartitionValues;
+
+	char *decoderString;
+	char *compressionString;
+
+	/* suffix of the names of blobs written by inserts, or NULL */
+	char *suffix;
+
+	/* size after which inserts continue in a new blob */
+	int64 maxBlobSize;
+
+	/* number of rows encoded at once by batch inserts */
+	int batchSize;
+
+	/* whether inserts write statistics sidecars, with bloom filters on columns */
+	bool writeStats;
+	char *bloomColumns;
+
+	/* whether the planner lists or inspects blobs to estimate their size */
+	bool useRemoteEstimate;
+} BlobFdwOptions;
+
+
+BlobFdwOptions * GetBlobFdwOptions(Oid foreignTableId);
+List * ListBlobPaths(char *connectionString, BlobFdwOptions *options, List *prefixList,
+                     char ***statsBlobETags);
+TupleDecoder * OpenBlobDecoder(char *connectionString, BlobFdwOptions *options,
+                               char *path, TupleDesc tupleDescriptor,
+                               bool *projectedColumns, char *byteRanges,
+                               uint64 *byteCount, BlobPrefetcher **prefetcher);
+
+void AddBlobAggregatePath(PlannerInfo *root, UpperRelationKind stage,
+                          RelOptInfo *inputRel, RelOptInfo *outputRel,
+                          double blobCount);
+ForeignScan * BlobFdwGetAggregatePlan(PlannerInfo *root, RelOptInfo *upperRel,
+                                      ForeignPath *bestPath, List *targetList,
+                                      Plan *outerPlan);
+void BlobFdwBeginAggregateScan(ForeignScanState *node, int eflags);
+TupleTableSlot * BlobFdwIterateAggregateScan(ForeignScanState *node);
+void BlobFdwReScanAggregateScan(ForeignScanState *node);
+void BlobFdwEndAggregateScan(ForeignScanState *node);
+void BlobFdwExplainAggregateScan(ForeignScanState *node, struct ExplainState *es);
+
+int BlobFdwIsForeignRelUpdatable(Relation relation);
+void BlobFdwBeginForeignModify(ModifyTableState *modifyTableState,
+                               ResultRelInfo *resultRelInfo, List *fdwPrivate,
+                               int subplanIndex, int eflags);
+TupleTableSlot * BlobFdwExecForeignInsert(EState *executorState,
+                                          ResultRelInfo *resultRelInfo,
+                                          TupleTableSlot *slot,
+                                          TupleTableSlot *planSlot);
+void BlobFdwEndForeignModify(EState *executorState, ResultRelInfo *resultRelInfo);
+void BlobFdwBeginForeignInsert(ModifyTableState *modifyTableState,
+                               ResultRelInfo *resultRelInfo);
+void BlobFdwEndForeignInsert(EState *executorState, ResultRelInfo *resultRelInfo);
+#if PG_VERSION_NUM >= 140000
+TupleTableSlot ** BlobFdwExecForeignBatchInsert(EState *executorState,
+                                                ResultRelInfo *resultRelInfo,
+                                                TupleTableSlot **slots,
+                                                TupleTableSlot **planSlots,
+                                                int *slotCount);
+int BlobFdwGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo);
+#endif
+
+
+#endif
@@ -0,0 +1,33 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_prefetcher.h
+ *	  Background downloads of block blobs
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BLOB_PREFETCHER_H
+#define BLOB_PREFETCHER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "pgazure/byte_io.h"
+
+
+typedef struct BlobPrefetcher BlobPrefetcher;
+
+
+BlobPrefetcher * ReadBlockBlobPrefetched(char *connectionString, char *containerName,
+                                         char *path, ByteSource *byteSource);
+bool BlobPrefetcherHasData(BlobPrefetcher *prefetcher);
+int BlobPrefetcherEventFd(BlobPrefetcher *prefetcher);
+void FreeBlobPrefetcher(BlobPrefetcher *prefetcher);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
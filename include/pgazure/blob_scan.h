@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_scan.h
+ *	  Custom scan for reading tuples from blobs.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef BLOB_SCAN_H
+#define BLOB_SCAN_H
+
+
+#include "nodes/pathnodes.h"
+
+
+extern bool EnableBlobScan;
+
+
+void InitializeBlobScan(void);
+List * ProjectedColumnList(RelOptInfo *rel, int columnCount);
+
+
+#endif
@@ -0,0 +1,84 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_stats.h
+ *	  Column statistics sidecars that are used to skip blobs.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef BLOB_STATS_H
+#define BLOB_STATS_H
+
+
+#include "access/tupdesc.h"
+#include "nodes/execnodes.h"
+#include "nodes/pg_list.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/codecs.h"
+
+
+/* suffix of the name of the statistics sidecar of a blob */
+#define BLOB_STATS_SUFFIX ".pgazure_stats"
+
+/* number of rows in a block that has its own statistics */
+#define BLOB_STATS_BLOCK_ROWS 8192
+
+/* size of a buffer for the ETag of a blob, which is compared with the sidecar */
+#define BLOB_ETAG_BUFFER_LENGTH 128
+
+
+extern bool EnableBlobStats;
+extern bool WriteBlobStats;
+extern char *BlobStatsBloomColumns;
+
+
+typedef struct BlobStatsWriter BlobStatsWriter;
+typedef struct BlobStats BlobStats;
+
+/*
+ * BlobColumnStats contains the statistics of a column in a blob or a block.
+ */
+typedef struct BlobColumnStats
+{
+	/* whether the sidecar has statistics for the column */
+	bool known;
+
+	uint64 nullCount;
+	uint64 valueCount;
+
+	/* smallest and largest non-NULL value, if hasRange */
+	bool hasRange;
+	Datum minValue;
+	Datum maxValue;
+} BlobColumnStats;
+
+
+/* writing statistics */
+BlobStatsWriter * CreateBlobStatsWriter(TupleDesc tupleDescriptor, char *bloomColumns);
+ByteSink * BlobStatsCountStoredBytes(BlobStatsWriter *writer, ByteSink *byteSink);
+ByteSink * BlobStatsCountEncodedBytes(BlobStatsWriter *writer, ByteSink *byteSink,
+                                      bool recordBlocks);
+void BlobStatsAddRow(BlobStatsWriter *writer, Datum *columnValues, bool *columnNulls);
+void BlobStatsAddBatch(BlobStatsWriter *writer, TupleBatch *batch);
+void BlobStatsRowsEncoded(BlobStatsWriter *writer, TupleEncoder *encoder);
+void WriteBlobStatsSidecar(BlobStatsWriter *writer, char *connectionString,
+                           char *containerName, char *path);
+
+/* using statistics */
+bool IsBlobStatsPath(const char *path);
+bool CanReadBlobRanges(char *decoderString, char *compressionString);
+List * BuildBlobStatsPredicates(List *clauseList, Index relationId,
+                                TupleDesc tupleDescriptor, ExprContext *exprContext);
+BlobStats * ReadBlobStats(char *connectionString, char *containerName, char *path,
+                          const char *blobETag, TupleDesc tupleDescriptor);
+bool BlobStatsSelectRanges(BlobStats *stats, List *predicateList, char **byteRanges);
+uint64 BlobStatsRowCount(BlobStats *stats);
+BlobColumnStats * BlobStatsColumn(BlobStats *stats, int columnIndex);
+BlobStats * CollectBlobStats(TupleDecoder *decoder, TupleDesc tupleDescriptor);
+void ReadBlockBlobRanges(char *connectionString, char *containerName, char *path,
+                         char *byteRanges, ByteSource *byteSource);
+
+
+#endif
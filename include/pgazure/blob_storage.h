@@ -34,7 +34,20 @@ typedef struct CloudBlob
 
 
 void ReadBlockBlob(char *connectionString, char *containerName, char *path, ByteSource *byteSource);
+void ReadBlockBlobParallel(char *connectionString, char *containerName, char *path,
+                           size_t blobSize, int parallelism, ByteSource *byteSource);
 void WriteBlockBlob(char *connectionString, char *containerName, char *path, ByteSink *byteSink);
+void SetBlockBlobContentEncoding(ByteSink *blobSink, const char *contentEncoding);
+void SetBlockBlobMetadata(ByteSink *blobSink, const char *key, const char *value);
+size_t GetBlobSize(char *connectionString, char *containerName, char *path);
+void GetBlobContentEncoding(char *connectionString, char *containerName, char *path,
+                            char *contentEncoding, int maxLength);
+void GetBlobETag(char *connectionString, char *containerName, char *path, char *etag,
+                 int maxLength);
+bool GetBlobSizeIfExists(char *connectionString, char *containerName, char *path,
+                         size_t *size);
+int ReadBlockBlobRange(char *connectionString, char *containerName, char *path,
+                       size_t offset, char *buffer, int length);
 void ListBlobs(char *connectionString, char *containerName, char *prefix, void (*processBlob)(void *, CloudBlob *), void *processBlobContext);
 
 #ifdef __cplusplus
@@ -12,8 +12,22 @@
 #define BLOB_STORAGE_UTILS_H
 
 
+#include "lib/stringinfo.h"
+#include "pgazure/byte_io.h"
+
+
+extern bool DetectContentEncoding;
+
+
 char * CodecStringFromFileName(char *path);
+char * CompressionStringFromFileName(char *path);
+char * CompressionStringFromContentEncoding(const char *contentEncoding);
+char * CompressionStringForBlob(char *connectionString, char *containerName,
+                                char *path);
 bool HasSuffix(const char *filename, const char *suffix);
+bool HasCodecSuffix(const char *path, const char *extension);
+ByteSource * CreateMemoryByteSource(char *data, int length);
+StringInfo ReadBlobContents(char *connectionString, char *containerName, char *path);
 
 
 #endif
@@ -31,6 +31,14 @@ typedef struct ByteSink
 } ByteSink;
 
 
+#ifndef __cplusplus
+
+/* wrappers that count the bytes passing through, see byte_io.c */
+ByteSource * CreateCountingByteSource(ByteSource *byteSource, uint64 *byteCount);
+ByteSink * CreateCountingByteSink(ByteSink *byteSink, uint64 *byteCount);
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,8 +28,49 @@ typedef enum TupleCodecType
 	TUPLE_CODEC_FULL_TEXT,
 } TupleCodecType;
 
+/* default number of rows in a TupleBatch */
+#define TUPLE_BATCH_SIZE 1024
+
+/*
+ * TupleBatch holds a batch of tuples in column-major order, such that
+ * columnValues[columnIndex][rowIndex] is the value of a column in a row.
+ */
+typedef struct TupleBatch
+{
+	int columnCount;
+
+	/* number of rows that fit in the batch and number of rows it holds */
+	int maxRows;
+	int rowCount;
+
+	/* values and null flags of each column */
+	Datum **columnValues;
+	bool **columnNulls;
+
+	/* row-major arrays used when converting from/to per-row calls */
+	Datum *rowValues;
+	bool *rowNulls;
+} TupleBatch;
+
+/*
+ * TupleDecoderFilter is a filter that decoders apply to each row after
+ * converting only the columns in filterColumns. When matches returns false,
+ * the row is skipped without converting the other columns.
+ */
+typedef struct TupleDecoderFilter
+{
+	bool *filterColumns;
+	bool (*matches) (void *context, Datum *columnValues, bool *columnNulls);
+	void *context;
+} TupleDecoderFilter;
+
 /*
  * TupleEncoder represents the mechanism for encoding tuples.
+ *
+ * pushBatch is optional and encodes all rows in a batch at once.
+ *
+ * flush is optional and writes all rows that were pushed so far to the byte
+ * sink, such that the number of bytes written marks a row boundary.
  */
 typedef struct TupleEncoder
 {
@@ -40,12 +81,19 @@ typedef struct TupleEncoder
 
 	void (*start) (void *state);
 	void (*push) (void *state, Datum *columnValues, bool *columnNulls);
+	void (*pushBatch) (void *state, TupleBatch *batch);
+	void (*flush) (void *state);
 	void (*finish) (void *state);
 
 } TupleEncoder;
 
 /*
  * TupleDecoder represents the mechanism for decoding tuples.
+ *
+ * nextBatch is optional and decodes up to batch->maxRows rows into the batch.
+ * It returns false when there are no more rows. The batch can be empty when
+ * all rows were rejected by a filter. Values in the batch remain valid until
+ * the next call.
  */
 typedef struct TupleDecoder
 {
@@ -55,6 +103,7 @@ typedef struct TupleDecoder
 
 	void (*start) (void *state);
 	bool (*next) (void *state, Datum *columnValues, bool *columnNulls);
+	bool (*nextBatch) (void *state, TupleBatch *batch);
 	void (*finish) (void *state);
 
 } TupleDecoder;
@@ -63,10 +112,19 @@ typedef struct TupleDecoder
 TupleEncoder * CreateTupleEncoder(TupleDesc tupleDescriptor);
 TupleDecoder * CreateTupleDecoder(TupleDesc tupleDescriptor);
 
+TupleBatch * CreateTupleBatch(TupleDesc tupleDescriptor, int maxRows);
+void TupleBatchAppendRow(TupleBatch *batch, Datum *columnValues, bool *columnNulls);
+void TupleBatchGetRow(TupleBatch *batch, int rowIndex, Datum *columnValues,
+					  bool *columnNulls);
+void TupleEncoderPushBatch(TupleEncoder *encoder, TupleBatch *batch);
+bool TupleDecoderNextBatch(TupleDecoder *decoder, TupleBatch *batch);
+
 TupleEncoder * BuildTupleEncoder(char *encoderString, TupleDesc tupleDescriptor,
 								 ByteSink *byteSink);
+bool CodecStringHasHeader(char *codecString);
 TupleDecoder * BuildTupleDecoder(char *decoderString, TupleDesc tupleDescriptor,
-								 ByteSource *byteSource);
+								 ByteSource *byteSource, bool *projectedColumns,
+								 TupleDecoderFilter *filter);
 
 
 #endif
@@ -24,13 +24,31 @@ typedef enum CompressionType
 #ifdef HAVE_LIBZ
 	/* in a HAVE_LIBZ block to make sure we don't use it otherwise */
 	COMPRESSION_GZIP,
+#endif
+#ifdef USE_ZSTD
+	COMPRESSION_ZSTD,
+#endif
+#ifdef USE_LZ4
+	COMPRESSION_LZ4,
 #endif
 	COMPRESSION_NONE
 } CompressionType;
 
 
+/* level argument that compresses at the configured level of the format */
+#define COMPRESSION_DEFAULT_LEVEL (-1)
+
+
 ByteSink * BuildCompressor(char *compressionString, ByteSink *byteSink);
+ByteSink * BuildBlobCompressor(char *compressionString, ByteSink *byteSink,
+                               ByteSink *blobSink, char *connectionString,
+                               char *containerName);
+ByteSink * BuildCompressorWithLevel(char *compressionString, int level,
+                                    ByteSink *byteSink);
 ByteSource * BuildDecompressor(char *compressionString, ByteSource *byteSource);
+ByteSource * BuildBlobDecompressor(char *compressionString, ByteSource *byteSource,
+                                   char *connectionString, char *containerName,
+                                   char *path);
 
 
 #endif
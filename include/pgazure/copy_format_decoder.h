@@ -26,12 +26,37 @@ typedef struct CopyFormatDecoderState
 	List *copyOptions;
 	TupleDesc tupleDescriptor;
 	EState *executorState;
+
+	/* number of fields in each line and the column index of each field */
+	int fieldCount;
+	int *columnIndexes;
+
+	/*
+	 * Fields that are converted before and after applying the filter, other
+	 * fields are skipped and returned as NULL.
+	 */
+	int filterFieldCount;
+	int *filterFieldIndexes;
+	int remainingFieldCount;
+	int *remainingFieldIndexes;
+
+	/* filter applied to the filter fields of each row, or NULL */
+	TupleDecoderFilter *filter;
+
+	/* whether the first line is a header that has not been skipped yet */
+	bool skipHeader;
+
+	/* input functions of the columns */
+	FmgrInfo *inputFunctions;
+	Oid *typeIOParams;
 } CopyFormatDecoderState;
 
 
 TupleDecoder * CreateCopyFormatDecoder(ByteSource *byteSource,
                                        TupleDesc tupleDescriptor,
-                                       List *copyOptions);
+                                       List *copyOptions,
+                                       bool *projectedColumns,
+                                       TupleDecoderFilter *filter);
 void CopyFormatDecoderStart(void *state);
 bool CopyFormatDecoderNext(void *state, Datum *columnValues, bool *columnNulls);
 void CopyFormatDecoderFinish(void *state);
@@ -0,0 +1,27 @@
+/*-------------------------------------------------------------------------
+ *
+ * get_blob.h
+ *	  Functions for reading tuples from blobs.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef GET_BLOB_H
+#define GET_BLOB_H
+
+
+#include "access/tupdesc.h"
+#include "pgazure/codecs.h"
+
+
+TupleDecoder * BuildBlobTupleDecoder(char *connectionString, char *containerName,
+									 char *path, char *decoderString,
+									 char *compressionString,
+									 TupleDesc tupleDescriptor,
+									 bool *projectedColumns,
+									 TupleDecoderFilter *filter);
+
+
+#endif
@@ -0,0 +1,27 @@
+/*-------------------------------------------------------------------------
+ *
+ * gzip_engine.h
+ *	  Libraries that can compress and decompress gzip.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef GZIP_ENGINE_H
+#define GZIP_ENGINE_H
+
+
+/*
+ * GzipEngineType is a deflate library. Engines other than zlib can only be
+ * used when pgazure is built with them.
+ */
+typedef enum GzipEngineType
+{
+	GZIP_ENGINE_ZLIB,
+	GZIP_ENGINE_LIBDEFLATE,
+	GZIP_ENGINE_ISAL
+} GzipEngineType;
+
+
+#endif
@@ -0,0 +1,66 @@
+/*-------------------------------------------------------------------------
+ *
+ * gzip_index.h
+ *	  Checkpoint index sidecars for random access into gzip blobs.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef GZIP_INDEX_H
+#define GZIP_INDEX_H
+
+
+#include "postgres.h"
+
+
+/* suffix of the name of the gzip index sidecar of a blob */
+#define GZIP_INDEX_SUFFIX ".pgazure_gzindex"
+
+/* size of the deflate window that is stored with each checkpoint */
+#define GZIP_INDEX_WINDOW_SIZE 32768
+
+
+/*
+ * GzipIndexPoint is a position in a gzip blob at which decompression can
+ * start, which is the start of a deflate block.
+ */
+typedef struct GzipIndexPoint
+{
+	/* offset of the first byte of the block that is not shared with the previous */
+	uint64 compressedOffset;
+
+	/* number of bits of the block in the byte before compressedOffset */
+	int bits;
+
+	/* number of decompressed bytes before the block */
+	uint64 uncompressedOffset;
+
+	/* last decompressed bytes before the block, compressed with zlib */
+	char *window;
+	int windowLength;
+} GzipIndexPoint;
+
+/*
+ * GzipIndex is the list of checkpoints of a gzip blob.
+ */
+typedef struct GzipIndex
+{
+	/* size of the blob the index belongs to */
+	uint64 compressedSize;
+	uint64 uncompressedSize;
+
+	int pointCount;
+	GzipIndexPoint *points;
+} GzipIndex;
+
+
+bool IsGzipIndexPath(const char *path);
+GzipIndex * ReadGzipIndex(char *connectionString, char *containerName, char *path,
+                          int64 blobSize);
+int ReadGzipIndexedRange(char *connectionString, char *containerName, char *path,
+                         GzipIndex *index, uint64 offset, char *buffer, int length);
+
+
+#endif
@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * isal_compression.h
+ *	  Utilities for compressing streams of bytes as gzip using ISA-L.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef ISAL_COMPRESSION_H
+#define ISAL_COMPRESSION_H
+
+#include "postgres.h"
+
+#ifdef USE_ISAL
+#include "pgazure/byte_io.h"
+
+
+ByteSink * CreateIsalCompressor(ByteSink *byteSink);
+ByteSource * CreateIsalDecompressor(ByteSource *byteSource);
+
+
+#endif
+#endif
@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * lz4_compression.h
+ *	  Utilities for compressing streams of bytes using the LZ4 frame format.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef LZ4_COMPRESSION_H
+#define LZ4_COMPRESSION_H
+
+#include "postgres.h"
+
+#ifdef USE_LZ4
+#include "pgazure/byte_io.h"
+
+
+ByteSink * CreateLZ4Compressor(ByteSink *byteSink);
+ByteSource * CreateLZ4Decompressor(ByteSource *byteSource);
+
+
+#endif
+#endif
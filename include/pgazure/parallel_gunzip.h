@@ -0,0 +1,38 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_gunzip.h
+ *	  gzip decompression of multi-member streams on a pool of threads
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARALLEL_GUNZIP_H
+#define PARALLEL_GUNZIP_H
+
+#include "pgazure/gzip_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct ParallelGunzip ParallelGunzip;
+
+
+ParallelGunzip * CreateParallelGunzip(int workerCount, GzipEngineType engine);
+void ParallelGunzipAddCheckpoint(ParallelGunzip *decompressor, size_t compressedOffset,
+                                 int bits, size_t uncompressedOffset, const char *window,
+                                 int windowLength);
+void ParallelGunzipWrite(ParallelGunzip *decompressor, const char *data, int length);
+void ParallelGunzipFinish(ParallelGunzip *decompressor);
+int ParallelGunzipPendingChunks(ParallelGunzip *decompressor);
+bool ParallelGunzipTakeOutput(ParallelGunzip *decompressor, bool wait, const char **data,
+                              int *length);
+void FreeParallelGunzip(ParallelGunzip *decompressor);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
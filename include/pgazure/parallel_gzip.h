@@ -0,0 +1,36 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_gzip.h
+ *	  gzip compression on a pool of threads
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARALLEL_GZIP_H
+#define PARALLEL_GZIP_H
+
+#include "pgazure/gzip_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct ParallelGzip ParallelGzip;
+
+
+ParallelGzip * CreateParallelGzip(int workerCount, int level, bool shareDictionary,
+                                  GzipEngineType engine);
+void ParallelGzipWrite(ParallelGzip *compressor, const char *data, int length);
+void ParallelGzipFinish(ParallelGzip *compressor);
+int ParallelGzipPendingChunks(ParallelGzip *compressor);
+bool ParallelGzipTakeOutput(ParallelGzip *compressor, bool wait, const char **data,
+                            int *length);
+void FreeParallelGzip(ParallelGzip *compressor);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
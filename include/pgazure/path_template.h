@@ -0,0 +1,46 @@
+/*-------------------------------------------------------------------------
+ *
+ * path_template.h
+ *	  Hive-style partition columns in blob paths.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef PATH_TEMPLATE_H
+#define PATH_TEMPLATE_H
+
+
+#include "nodes/pg_list.h"
+
+
+/* path value that represents NULL in Hive-style layouts */
+#define DEFAULT_PARTITION_VALUE "__HIVE_DEFAULT_PARTITION__"
+
+
+/*
+ * PathTemplate is a parsed path template such as
+ * events/date={date}/region={region}/, in which each placeholder names
+ * a column whose value is taken from the path of a blob.
+ */
+typedef struct PathTemplate
+{
+	/* number of placeholders */
+	int placeholderCount;
+
+	/* column name of each placeholder */
+	char **columnNames;
+
+	/* text before, between and after the placeholders (placeholderCount + 1) */
+	char **literals;
+} PathTemplate;
+
+
+PathTemplate * ParsePathTemplate(char *templateString);
+bool MatchPathTemplate(PathTemplate *pathTemplate, char *path, char **values);
+List * PathTemplateListingPrefixes(PathTemplate *pathTemplate, List **candidateValues,
+                                   int maxPrefixCount);
+
+
+#endif
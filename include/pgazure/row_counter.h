@@ -0,0 +1,56 @@
+/*-------------------------------------------------------------------------
+ *
+ * row_counter.h
+ *	  Counting the rows in a stream of csv or tsv bytes without decoding.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef ROW_COUNTER_H
+#define ROW_COUNTER_H
+
+
+#include "nodes/pg_list.h"
+
+
+/*
+ * RowCounterMode determines what ends a row.
+ */
+typedef enum RowCounterMode
+{
+	/* a newline outside double quotes (csv) */
+	ROW_COUNTER_CSV,
+
+	/* any newline (tsv, since newlines in values are escaped) */
+	ROW_COUNTER_LINES,
+
+	/* nothing, the whole stream is one row (json, xml, text) */
+	ROW_COUNTER_WHOLE
+} RowCounterMode;
+
+/*
+ * RowCountRange contains the number and lengths of the rows in a range of
+ * the stream. Ranges start and end at row boundaries.
+ */
+typedef struct RowCountRange
+{
+	uint64 startOffset;
+	uint64 endOffset;
+	uint64 rowCount;
+
+	/* length in bytes of the shortest and longest row, including newline */
+	uint64 minRowLength;
+	uint64 maxRowLength;
+} RowCountRange;
+
+typedef struct RowCounter RowCounter;
+
+
+RowCounter * CreateRowCounter(RowCounterMode mode, uint64 rangeSize);
+void RowCounterAddBytes(RowCounter *counter, const char *buffer, int length);
+List * RowCounterFinish(RowCounter *counter);
+
+
+#endif
@@ -0,0 +1,38 @@
+/*-------------------------------------------------------------------------
+ *
+ * sample_blob.h
+ *	  Sampling rows from random byte ranges of a blob.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef SAMPLE_BLOB_H
+#define SAMPLE_BLOB_H
+
+
+#include "access/tupdesc.h"
+#include "pgazure/gzip_index.h"
+#include "pgazure/zstd_seek_table.h"
+
+
+/* number of bytes that are read from a blob for each sampled range */
+#define BLOB_SAMPLE_RANGE_SIZE (64 * 1024)
+
+
+/* function that receives each sampled row */
+typedef void (*BlobSampleRowFunc) (void *context, Datum *columnValues,
+                                   bool *columnNulls);
+
+
+bool CanSampleBlob(char *decoderString, char *compressionString);
+uint64 SampleBlobRanges(char *connectionString, char *containerName, char *path,
+                        uint64 blobSize, GzipIndex *gzipIndex,
+                        ZstdSeekTable *zstdSeekTable, char *decoderString,
+                        TupleDesc tupleDescriptor, int rangeCount, int rowsPerRange,
+                        BlobSampleRowFunc processRow, void *processRowContext,
+                        double *estimatedRowCount);
+
+
+#endif
@@ -20,6 +20,7 @@ typedef struct StorageAccount
 
 
 char * AccountStringToConnectionString(char *accountString);
+bool IsConnectionString(const char *accountString);
 StorageAccount * GetStorageAccount(const char *accountName);
 
 
@@ -18,7 +18,8 @@
 
 
 TupleEncoder * CreateTextEncoder(ByteSink *byteSink, TupleDesc tupleDescriptor);
-TupleDecoder * CreateTextDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor);
+TupleDecoder * CreateTextDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor,
+                                 bool *projectedColumns, TupleDecoderFilter *filter);
 
 
 #endif
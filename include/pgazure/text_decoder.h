@@ -25,7 +25,8 @@ typedef struct TextDecoderState
 } TextDecoderState;
 
 
-TupleDecoder * CreateTextDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor);
+TupleDecoder * CreateTextDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor,
+                                 bool *projectedColumns, TupleDecoderFilter *filter);
 void TextDecoderStart(void *state);
 bool TextDecoderNext(void *state, Datum *columnValues, bool *columnNulls);
 void TextDecoderFinish(void *state);
@@ -0,0 +1,24 @@
+/*-------------------------------------------------------------------------
+ *
+ * utf8_validation.h
+ *	  Utilities for validating UTF-8 data in bulk.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef UTF8_VALIDATION_H
+#define UTF8_VALIDATION_H
+
+
+#include "pgazure/byte_io.h"
+
+
+bool Utf8IsValid(const char *buffer, int length);
+void Utf8VerifyBuffer(const char *buffer, int length);
+int Utf8IncompleteSuffixLength(const char *buffer, int length);
+ByteSource * CreateUtf8ValidatingSource(ByteSource *byteSource);
+
+
+#endif
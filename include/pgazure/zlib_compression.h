@@ -13,12 +13,27 @@
 
 #include "postgres.h"
 
-#ifdef HAVE_LIBZ
 #include "pgazure/byte_io.h"
+#include "pgazure/gzip_engine.h"
+#include "pgazure/gzip_index.h"
+
+
+extern int GzipEngine;
+extern int GzipWorkers;
+extern bool GzipShareDictionary;
+extern int GzipDecompressionWorkers;
+
 
+GzipEngineType ActiveGzipEngine(void);
+
+
+#ifdef HAVE_LIBZ
 
-ByteSink * CreateZLibCompressor(ByteSink *byteSink);
+ByteSink * CreateZLibCompressor(ByteSink *byteSink, int level);
+ByteSink * CreateParallelZLibCompressor(ByteSink *byteSink, int workerCount, int level);
 ByteSource * CreateZLibDecompressor(ByteSource *byteSource);
+ByteSource * CreateParallelZLibDecompressor(ByteSource *byteSource, int workerCount,
+                                            GzipIndex *gzipIndex);
 
 
 #endif
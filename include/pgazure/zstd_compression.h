@@ -0,0 +1,33 @@
+/*-------------------------------------------------------------------------
+ *
+ * zstd_compression.h
+ *	  Utilities for compressing streams of bytes using zstd.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef ZSTD_COMPRESSION_H
+#define ZSTD_COMPRESSION_H
+
+#include "postgres.h"
+
+#include "pgazure/byte_io.h"
+
+
+extern int ZstdCompressionLevel;
+extern int ZstdWorkers;
+extern bool ZstdLongDistanceMatching;
+extern int ZstdFrameSize;
+
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+
+ByteSink * CreateZstdCompressor(ByteSink *byteSink, int level, ZSTD_CDict *dictionary);
+ByteSource * CreateZstdDecompressor(ByteSource *byteSource, char *connectionString,
+                                    char *containerName);
+
+#endif
+#endif
@@ -0,0 +1,46 @@
+/*-------------------------------------------------------------------------
+ *
+ * zstd_dictionary.h
+ *	  Trained zstd dictionaries for compressing many small blobs.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef ZSTD_DICTIONARY_H
+#define ZSTD_DICTIONARY_H
+
+
+#include "postgres.h"
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+
+/* directory in a container in which dictionaries are stored by ID */
+#define ZSTD_DICTIONARY_DIRECTORY "pgazure_zstd_dictionaries/"
+
+/* suffix of the name of a dictionary blob */
+#define ZSTD_DICTIONARY_SUFFIX ".pgazure_zstddict"
+
+/* metadata key that records the dictionary a blob is compressed with */
+#define ZSTD_DICTIONARY_METADATA_KEY "pgazure_zstd_dictionary"
+
+
+extern int ZstdDictionaryId;
+
+
+bool IsZstdDictionaryPath(const char *path);
+char * ZstdDictionaryPath(uint32 dictionaryId);
+
+#ifdef USE_ZSTD
+
+ZSTD_CDict * GetZstdCompressionDictionary(char *connectionString, char *containerName,
+                                          uint32 dictionaryId, int level);
+ZSTD_DDict * GetZstdDecompressionDictionary(char *connectionString,
+                                            char *containerName, uint32 dictionaryId);
+
+#endif
+#endif
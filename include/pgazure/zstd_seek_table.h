@@ -0,0 +1,43 @@
+/*-------------------------------------------------------------------------
+ *
+ * zstd_seek_table.h
+ *	  Random access into zstd blobs through the seek table of the seekable
+ *	  format.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+
+#ifndef ZSTD_SEEK_TABLE_H
+#define ZSTD_SEEK_TABLE_H
+
+
+#include "postgres.h"
+
+
+/*
+ * ZstdSeekTable is the list of frames of a zstd blob in the seekable format.
+ * frameOffsets has frameCount + 1 entries, the last one being the end of the
+ * frames.
+ */
+typedef struct ZstdSeekTable
+{
+	/* size of the blob the seek table belongs to */
+	uint64 compressedSize;
+	uint64 uncompressedSize;
+
+	int frameCount;
+	uint64 *compressedOffsets;
+	uint64 *uncompressedOffsets;
+} ZstdSeekTable;
+
+
+ZstdSeekTable * ReadZstdSeekTable(char *connectionString, char *containerName,
+                                  char *path, uint64 blobSize);
+int ReadZstdSeekableRange(char *connectionString, char *containerName, char *path,
+                          ZstdSeekTable *seekTable, uint64 offset, char *buffer,
+                          int length);
+
+
+#endif
@@ -0,0 +1,81 @@
+CREATE FUNCTION blob_storage_get_blob_support(internal)
+    RETURNS internal
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$blob_storage_get_blob_support$$;
+COMMENT ON FUNCTION blob_storage_get_blob_support(internal)
+    IS 'planner support function for blob_storage_get_blob';
+
+ALTER FUNCTION blob_storage_get_blob(text,text,text,text,text)
+    SUPPORT blob_storage_get_blob_support;
+ALTER FUNCTION blob_storage_get_blob(text,text,text,anyelement,text,text)
+    SUPPORT blob_storage_get_blob_support;
+
+CREATE FUNCTION blob_storage_list_blobs_support(internal)
+    RETURNS internal
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$blob_storage_list_blobs_support$$;
+COMMENT ON FUNCTION blob_storage_list_blobs_support(internal)
+    IS 'planner support function for blob_storage_list_blobs';
+
+ALTER FUNCTION blob_storage_list_blobs(text,text,text)
+    SUPPORT blob_storage_list_blobs_support;
+
+CREATE FUNCTION azure_blob_fdw_handler()
+    RETURNS fdw_handler
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$azure_blob_fdw_handler$$;
+COMMENT ON FUNCTION azure_blob_fdw_handler()
+    IS 'foreign data wrapper handler for azure_blob';
+
+CREATE FUNCTION azure_blob_fdw_validator(text[], oid)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$azure_blob_fdw_validator$$;
+COMMENT ON FUNCTION azure_blob_fdw_validator(text[],oid)
+    IS 'foreign data wrapper validator for azure_blob';
+
+CREATE FOREIGN DATA WRAPPER azure_blob
+    HANDLER azure_blob_fdw_handler
+    VALIDATOR azure_blob_fdw_validator;
+
+CREATE FUNCTION blob_storage_count_rows(connection_string text, container_name text, path text, decoder text default 'auto', compression text default 'auto', range_size bigint default NULL, parallelism int default 1, OUT range_start bigint, OUT range_end bigint, OUT row_count bigint, OUT min_row_length bigint, OUT max_row_length bigint, OUT avg_row_length double precision)
+    RETURNS SETOF record
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$blob_storage_count_rows$$;
+COMMENT ON FUNCTION blob_storage_count_rows(text,text,text,text,text,bigint,int)
+    IS 'count the rows in a blob without decoding them';
+
+CREATE FUNCTION blob_storage_sample_blob(connection_string text, container_name text, path text, sample_ranges int default 100, rows_per_range int default 10, decoder text default 'auto', compression text default 'auto')
+    RETURNS SETOF record
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$blob_storage_sample_blob$$;
+COMMENT ON FUNCTION blob_storage_sample_blob(text,text,text,int,int,text,text)
+    IS 'get a sample of rows from random ranges of a blob';
+
+CREATE FUNCTION blob_storage_sample_blob(connection_string text, container_name text, path text, rec anyelement, sample_ranges int default 100, rows_per_range int default 10, decoder text default 'auto', compression text default 'auto')
+    RETURNS SETOF anyelement
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$blob_storage_sample_blob_anyelement$$;
+COMMENT ON FUNCTION blob_storage_sample_blob(text,text,text,anyelement,int,int,text,text)
+    IS 'get a sample of rows from random ranges of a blob';
+
+CREATE FUNCTION blob_storage_infer_schema(connection_string text, container_name text, path text, decoder text default 'auto', compression text default 'auto', header boolean default NULL, type_name text default NULL, sample_size int default 4194304, OUT column_number int, OUT column_name text, OUT data_type text)
+    RETURNS SETOF record
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$blob_storage_infer_schema$$;
+COMMENT ON FUNCTION blob_storage_infer_schema(text,text,text,text,text,boolean,text,int)
+    IS 'infer the columns of a csv or tsv blob from its first bytes';
+
+CREATE FUNCTION blob_storage_build_gzip_index(connection_string text, container_name text, path text, span_size bigint default 4194304)
+    RETURNS bigint
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$blob_storage_build_gzip_index$$;
+COMMENT ON FUNCTION blob_storage_build_gzip_index(text,text,text,bigint)
+    IS 'write a checkpoint index for random access into a gzip blob';
+
+CREATE FUNCTION blob_storage_train_zstd_dictionary(connection_string text, container_name text, prefix text, sample_blobs int default 1000, dictionary_size int default 112640)
+    RETURNS bigint
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$blob_storage_train_zstd_dictionary$$;
+COMMENT ON FUNCTION blob_storage_train_zstd_dictionary(text,text,text,int,int)
+    IS 'train a zstd dictionary on a sample of the blobs under a prefix';
@@ -0,0 +1,481 @@
+/*-------------------------------------------------------------------------
+ *
+ * adaptive_compressor.c
+ *     Compressor that picks the format and level that minimize the time to
+ *     compress and upload a blob.
+ *
+ * The first azure.adaptive_compression_sample_size bytes are buffered and
+ * compressed with each candidate. The time a candidate takes per byte plus
+ * the time to upload its output at the upload bandwidth estimates the time
+ * it takes to export the whole blob. The output of the fastest candidate
+ * for the sample is uploaded as is, and a new compressor in the same format
+ * compresses the rest of the blob into a second gzip member or zstd or LZ4
+ * frame, such that the sample is only compressed once. The format is
+ * recorded in the content-encoding of the blob.
+ *
+ * Readers go by the suffix of the blob name, so a blob whose name ends in a
+ * compression suffix is only compressed in that format, and only the level
+ * is picked. Other blobs can get any format, which readers only find in the
+ * content-encoding with azure.detect_content_encoding on.
+ *
+ * The upload bandwidth is measured while writing a blob and used for the
+ * next blob in the same session. The first blob uses
+ * azure.adaptive_compression_upload_bandwidth.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "lib/stringinfo.h"
+#include "pgazure/adaptive_compression.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/compression.h"
+#include "pgazure/zstd_compression.h"
+#include "portability/instr_time.h"
+#include "utils/memutils.h"
+
+
+/* number of bytes that are compressed with each candidate, in kB */
+int AdaptiveCompressionSampleSize = 4096;
+
+/* upload bandwidth assumed before it is measured, in MB/s */
+int AdaptiveCompressionUploadBandwidth = 100;
+
+/* minimum number of uploaded bytes from which the bandwidth is measured */
+#define MIN_MEASURED_UPLOAD_BYTES (1024 * 1024)
+
+
+/*
+ * AdaptiveCandidate is a combination of a compression format and level
+ * that the adaptive compressor can pick.
+ */
+typedef struct AdaptiveCandidate
+{
+	char *compressionString;
+	int level;
+
+	/* content-encoding of blobs in the format, or NULL if uncompressed */
+	char *contentEncoding;
+} AdaptiveCandidate;
+
+static const AdaptiveCandidate AdaptiveCandidates[] = {
+	{ "none", COMPRESSION_DEFAULT_LEVEL, NULL },
+#ifdef HAVE_LIBZ
+	{ "gzip", 1, "gzip" },
+	{ "gzip", 6, "gzip" },
+#endif
+#ifdef USE_ZSTD
+	{ "zstd", 1, "zstd" },
+	{ "zstd", 3, "zstd" },
+	{ "zstd", 9, "zstd" },
+#endif
+#ifdef USE_LZ4
+	{ "lz4", COMPRESSION_DEFAULT_LEVEL, "lz4" },
+#endif
+};
+
+/*
+ * AdaptiveCompressorState contains the internal state that is passed to
+ * the write and close functions of the ByteSink.
+ */
+typedef struct AdaptiveCompressorState
+{
+	/* sink to which the compressed bytes are written */
+	ByteSink *byteSink;
+
+	/* blob writer at the end of byteSink, to set the content-encoding */
+	ByteSink *blobSink;
+
+	/* format that candidates must have, or NULL to consider all candidates */
+	char *compressionString;
+
+	/* memory context in which the compressor is built */
+	MemoryContext memoryContext;
+
+	/* bytes written before a candidate is picked */
+	StringInfo sample;
+	int sampleSize;
+
+	/* compressor of the picked candidate, or NULL while sampling */
+	ByteSink *compressor;
+
+	/* time spent writing to byteSink, to measure the upload bandwidth */
+	uint64 uploadedBytes;
+	instr_time uploadTime;
+} AdaptiveCompressorState;
+
+
+/* upload bandwidth measured by the last blob in bytes per second, or 0 */
+static double MeasuredUploadBandwidth = 0;
+
+
+static void AdaptiveWrite(void *context, void *buffer, int bytesToWrite);
+static void AdaptiveClose(void *context);
+static void PickCompression(AdaptiveCompressorState *state, bool endOfInput);
+static bool CanContinueAfterSample(const AdaptiveCandidate *candidate);
+static double MeasureCompressionTime(const AdaptiveCandidate *candidate,
+                                     StringInfo sample, StringInfo output);
+static void CaptureCompressedBytes(void *context, void *buffer, int bytesToWrite);
+static void CloseCompressedByteCapture(void *context);
+static void TimedUploadWrite(void *context, void *buffer, int bytesToWrite);
+static void TimedUploadClose(void *context);
+
+
+/*
+ * CreateAdaptiveCompressor creates a ByteSink that compresses the bytes that
+ * are written to it in the format that is fastest to export, and writes the
+ * compressed bytes to byteSink. blobSink is the blob writer at the end of
+ * byteSink, on which the content-encoding is set. If compressionString is
+ * not "none", only the levels of that format are considered.
+ */
+ByteSink *
+CreateAdaptiveCompressor(ByteSink *byteSink, ByteSink *blobSink,
+                         char *compressionString)
+{
+	bool hasCandidate = false;
+
+	for (int candidateIndex = 0; candidateIndex < lengthof(AdaptiveCandidates);
+		 candidateIndex++)
+	{
+		if (strcmp(AdaptiveCandidates[candidateIndex].compressionString,
+		           compressionString) == 0)
+		{
+			hasCandidate = true;
+		}
+	}
+
+	if (!hasCandidate)
+	{
+		ereport(ERROR, (errmsg("adaptive compression does not support %s",
+		                       compressionString)));
+	}
+
+	AdaptiveCompressorState *state = palloc0(sizeof(AdaptiveCompressorState));
+	state->byteSink = byteSink;
+	state->blobSink = blobSink;
+	state->compressionString = strcmp(compressionString, "none") != 0 ?
+							   compressionString : NULL;
+	state->memoryContext = CurrentMemoryContext;
+	state->sample = makeStringInfo();
+	state->sampleSize = AdaptiveCompressionSampleSize * 1024;
+	INSTR_TIME_SET_ZERO(state->uploadTime);
+
+	ByteSink *compressor = palloc0(sizeof(ByteSink));
+	compressor->context = state;
+	compressor->write = AdaptiveWrite;
+	compressor->close = AdaptiveClose;
+
+	return compressor;
+}
+
+
+/*
+ * AdaptiveWrite adds the given buffer to the sample until it is full, and
+ * compresses it with the picked candidate from then on.
+ */
+static void
+AdaptiveWrite(void *context, void *buffer, int bytesToWrite)
+{
+	AdaptiveCompressorState *state = (AdaptiveCompressorState *) context;
+	char *input = (char *) buffer;
+
+	if (state->compressor == NULL)
+	{
+		int sampleBytes = Min(bytesToWrite, state->sampleSize - state->sample->len);
+
+		appendBinaryStringInfo(state->sample, input, sampleBytes);
+
+		input += sampleBytes;
+		bytesToWrite -= sampleBytes;
+
+		if (state->sample->len < state->sampleSize)
+		{
+			return;
+		}
+
+		PickCompression(state, false);
+	}
+
+	if (bytesToWrite > 0)
+	{
+		ByteSink *compressor = state->compressor;
+
+		compressor->write(compressor->context, input, bytesToWrite);
+	}
+}
+
+
+/*
+ * AdaptiveClose picks a candidate based on all bytes if the blob is smaller
+ * than the sample, and closes its compressor, or only the upload if the
+ * whole blob was in the sample.
+ */
+static void
+AdaptiveClose(void *context)
+{
+	AdaptiveCompressorState *state = (AdaptiveCompressorState *) context;
+
+	if (state->compressor == NULL)
+	{
+		PickCompression(state, true);
+	}
+
+	ByteSink *compressor = state->compressor;
+
+	compressor->close(compressor->context);
+
+	if (state->uploadedBytes >= MIN_MEASURED_UPLOAD_BYTES &&
+		INSTR_TIME_GET_DOUBLE(state->uploadTime) > 0)
+	{
+		MeasuredUploadBandwidth = state->uploadedBytes /
+								  INSTR_TIME_GET_DOUBLE(state->uploadTime);
+	}
+}
+
+
+/*
+ * PickCompression compresses the sample with each candidate, and uploads
+ * the output of the one that minimizes the time to compress and upload.
+ * Unless endOfInput is set, it then builds a compressor in the same format
+ * for the rest of the blob.
+ */
+static void
+PickCompression(AdaptiveCompressorState *state, bool endOfInput)
+{
+	StringInfo sample = state->sample;
+	double uploadBandwidth = MeasuredUploadBandwidth;
+	const AdaptiveCandidate *bestCandidate = NULL;
+	double bestExportTime = 0;
+	StringInfo bestOutput = NULL;
+
+	if (uploadBandwidth <= 0)
+	{
+		uploadBandwidth = (double) AdaptiveCompressionUploadBandwidth * 1024 * 1024;
+	}
+
+	for (int candidateIndex = 0; candidateIndex < lengthof(AdaptiveCandidates);
+		 candidateIndex++)
+	{
+		const AdaptiveCandidate *candidate = &AdaptiveCandidates[candidateIndex];
+
+		if (state->compressionString != NULL &&
+		    strcmp(candidate->compressionString, state->compressionString) != 0)
+		{
+			continue;
+		}
+
+		StringInfo output = makeStringInfo();
+
+		double compressionTime = MeasureCompressionTime(candidate, sample, output);
+		double exportTime = compressionTime + output->len / uploadBandwidth;
+
+		ereport(DEBUG2, (errmsg("adaptive compression with %s at level %d: "
+		                        "%d to %d bytes, estimated export time %.3f s",
+		                        candidate->compressionString, candidate->level,
+		                        sample->len, output->len, exportTime)));
+
+		if (bestOutput == NULL || exportTime < bestExportTime)
+		{
+			if (bestOutput != NULL)
+			{
+				pfree(bestOutput->data);
+				pfree(bestOutput);
+			}
+
+			bestCandidate = candidate;
+			bestExportTime = exportTime;
+			bestOutput = output;
+		}
+		else
+		{
+			pfree(output->data);
+			pfree(output);
+		}
+	}
+
+	ereport(DEBUG1, (errmsg("adaptive compression picked %s at level %d",
+	                        bestCandidate->compressionString, bestCandidate->level),
+	                 errdetail("The sample of %d bytes compressed to %d bytes, "
+	                           "assuming an upload bandwidth of %.0f bytes per "
+	                           "second.", sample->len, bestOutput->len,
+	                           uploadBandwidth)));
+
+	if (bestCandidate->contentEncoding != NULL)
+	{
+		SetBlockBlobContentEncoding(state->blobSink, bestCandidate->contentEncoding);
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(state->memoryContext);
+
+	ByteSink *timedSink = palloc0(sizeof(ByteSink));
+	timedSink->context = state;
+	timedSink->write = TimedUploadWrite;
+	timedSink->close = TimedUploadClose;
+
+	if (endOfInput)
+	{
+		/* the output of the sample is the whole blob, only the upload is left */
+		state->compressor = timedSink;
+	}
+	else
+	{
+		state->compressor = BuildCompressorWithLevel(bestCandidate->compressionString,
+		                                             bestCandidate->level, timedSink);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (endOfInput || CanContinueAfterSample(bestCandidate))
+	{
+		if (bestOutput->len > 0)
+		{
+			timedSink->write(timedSink->context, bestOutput->data, bestOutput->len);
+		}
+	}
+	else if (sample->len > 0)
+	{
+		ByteSink *compressor = state->compressor;
+
+		compressor->write(compressor->context, sample->data, sample->len);
+	}
+
+	pfree(bestOutput->data);
+	pfree(bestOutput);
+
+	pfree(sample->data);
+	pfree(sample);
+	state->sample = NULL;
+}
+
+
+/*
+ * CanContinueAfterSample returns whether the output of the candidate for
+ * the sample can be followed by the output of another compressor. That is
+ * the case for concatenated gzip members and zstd and LZ4 frames, but not
+ * for the zstd seekable format, whose seek table has to cover all frames.
+ */
+static bool
+CanContinueAfterSample(const AdaptiveCandidate *candidate)
+{
+	if (strcmp(candidate->compressionString, "zstd") == 0 && ZstdFrameSize > 0)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * MeasureCompressionTime compresses the sample with the given candidate,
+ * appends the output to the given StringInfo, and returns the time it took
+ * in seconds.
+ */
+static double
+MeasureCompressionTime(const AdaptiveCandidate *candidate, StringInfo sample,
+                       StringInfo output)
+{
+	instr_time startTime;
+	instr_time duration;
+
+	/* compressors free their library contexts when the trial context is deleted */
+	MemoryContext trialContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                                   "adaptive compression trial",
+	                                                   ALLOCSET_DEFAULT_SIZES);
+	MemoryContext oldContext = MemoryContextSwitchTo(trialContext);
+
+	ByteSink *byteCapture = palloc0(sizeof(ByteSink));
+	byteCapture->context = output;
+	byteCapture->write = CaptureCompressedBytes;
+	byteCapture->close = CloseCompressedByteCapture;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	ByteSink *compressor = BuildCompressorWithLevel(candidate->compressionString,
+	                                                candidate->level, byteCapture);
+
+	if (sample->len > 0)
+	{
+		compressor->write(compressor->context, sample->data, sample->len);
+	}
+
+	compressor->close(compressor->context);
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(trialContext);
+
+	return INSTR_TIME_GET_DOUBLE(duration);
+}
+
+
+/*
+ * CaptureCompressedBytes appends the bytes written by a trial compressor
+ * to the StringInfo in context, which lives outside the trial context.
+ */
+static void
+CaptureCompressedBytes(void *context, void *buffer, int bytesToWrite)
+{
+	StringInfo output = (StringInfo) context;
+
+	appendBinaryStringInfo(output, buffer, bytesToWrite);
+}
+
+
+/*
+ * CloseCompressedByteCapture does nothing, since the output is kept for
+ * the caller.
+ */
+static void
+CloseCompressedByteCapture(void *context)
+{
+}
+
+
+/*
+ * TimedUploadWrite writes the given buffer to the byteSink and measures
+ * how long it takes.
+ */
+static void
+TimedUploadWrite(void *context, void *buffer, int bytesToWrite)
+{
+	AdaptiveCompressorState *state = (AdaptiveCompressorState *) context;
+	ByteSink *byteSink = state->byteSink;
+	instr_time startTime;
+	instr_time endTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	byteSink->write(byteSink->context, buffer, bytesToWrite);
+
+	INSTR_TIME_SET_CURRENT(endTime);
+	INSTR_TIME_ACCUM_DIFF(state->uploadTime, endTime, startTime);
+
+	state->uploadedBytes += bytesToWrite;
+}
+
+
+/*
+ * TimedUploadClose closes the byteSink, which uploads the last block, and
+ * includes it in the upload time.
+ */
+static void
+TimedUploadClose(void *context)
+{
+	AdaptiveCompressorState *state = (AdaptiveCompressorState *) context;
+	ByteSink *byteSink = state->byteSink;
+	instr_time startTime;
+	instr_time endTime;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	byteSink->close(byteSink->context);
+
+	INSTR_TIME_SET_CURRENT(endTime);
+	INSTR_TIME_ACCUM_DIFF(state->uploadTime, endTime, startTime);
+}
@@ -0,0 +1,184 @@
+/*-------------------------------------------------------------------------
+ *
+ * binary_codec.c
+ *		Utility functions shared by the binary tuple encoder and decoder.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/tupdesc.h"
+#include "catalog/pg_type.h"
+#include "mb/pg_wchar.h"
+#include "pgazure/binary_codec.h"
+#include "utils/uuid.h"
+
+
+/* signature at the start of every file in COPY binary format */
+const char BinaryCopySignature[BINARY_SIGNATURE_LENGTH] = "PGCOPY\n\377\r\n\0";
+
+
+/*
+ * BinaryFieldTypeFromTypeId returns the binary field type for the given type,
+ * or BINARY_FIELD_GENERIC if values of the type should be converted using its
+ * send and receive functions.
+ *
+ * Domains are deliberately treated as generic, since their receive function
+ * checks the domain constraints.
+ */
+BinaryFieldType
+BinaryFieldTypeFromTypeId(Oid typeId)
+{
+	switch (typeId)
+	{
+		case BOOLOID:
+		{
+			return BINARY_FIELD_BOOL;
+		}
+
+		case INT2OID:
+		{
+			return BINARY_FIELD_INT2;
+		}
+
+		case INT4OID:
+		{
+			return BINARY_FIELD_INT4;
+		}
+
+		case INT8OID:
+		{
+			return BINARY_FIELD_INT8;
+		}
+
+		case FLOAT4OID:
+		{
+			return BINARY_FIELD_FLOAT4;
+		}
+
+		case FLOAT8OID:
+		{
+			return BINARY_FIELD_FLOAT8;
+		}
+
+		case DATEOID:
+		{
+			return BINARY_FIELD_DATE;
+		}
+
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+		{
+			/* both are sent as an int64 number of microseconds */
+			return BINARY_FIELD_TIMESTAMP;
+		}
+
+		case UUIDOID:
+		{
+			return BINARY_FIELD_UUID;
+		}
+
+		case TEXTOID:
+		{
+			/*
+			 * text is sent in the client encoding, so we can only copy the
+			 * bytes directly when no conversion is needed.
+			 */
+			if (pg_get_client_encoding() != GetDatabaseEncoding())
+			{
+				return BINARY_FIELD_GENERIC;
+			}
+
+			return BINARY_FIELD_TEXT;
+		}
+
+		default:
+		{
+			return BINARY_FIELD_GENERIC;
+		}
+	}
+}
+
+
+/*
+ * BinaryFieldTypeLength returns the number of bytes in the binary
+ * representation of a fixed-width field type, or -1 for generic fields.
+ */
+int
+BinaryFieldTypeLength(BinaryFieldType fieldType)
+{
+	switch (fieldType)
+	{
+		case BINARY_FIELD_BOOL:
+		{
+			return 1;
+		}
+
+		case BINARY_FIELD_INT2:
+		{
+			return sizeof(int16);
+		}
+
+		case BINARY_FIELD_INT4:
+		case BINARY_FIELD_FLOAT4:
+		case BINARY_FIELD_DATE:
+		{
+			return sizeof(int32);
+		}
+
+		case BINARY_FIELD_INT8:
+		case BINARY_FIELD_FLOAT8:
+		case BINARY_FIELD_TIMESTAMP:
+		{
+			return sizeof(int64);
+		}
+
+		case BINARY_FIELD_UUID:
+		{
+			return UUID_LEN;
+		}
+
+		case BINARY_FIELD_TEXT:
+		case BINARY_FIELD_GENERIC:
+		default:
+		{
+			return -1;
+		}
+	}
+}
+
+
+/*
+ * BinaryFieldColumnIndexes returns the indexes of the columns in the tuple
+ * descriptor that appear as fields in the binary format, which excludes
+ * dropped and generated columns. The number of fields is written to
+ * fieldCount.
+ */
+int *
+BinaryFieldColumnIndexes(TupleDesc tupleDescriptor, int *fieldCount)
+{
+	int *columnIndexes = palloc0(tupleDescriptor->natts * sizeof(int));
+	int fieldIndex = 0;
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (attr->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| attr->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		columnIndexes[fieldIndex++] = columnIndex;
+	}
+
+	*fieldCount = fieldIndex;
+
+	return columnIndexes;
+}
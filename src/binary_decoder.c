@@ -0,0 +1,760 @@
+/*-------------------------------------------------------------------------
+ *
+ * binary_decoder.c
+ *     Tuple decoder that reads tuples in COPY binary format. Values of
+ *     common fixed-width types are loaded directly from the input buffer,
+ *     other types go through their receive functions.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
+#include "pgazure/binary_codec.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/codecs.h"
+#include "pgazure/utf8_validation.h"
+#include "port/pg_bswap.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/uuid.h"
+
+
+/*
+ * The input buffer grows to fit the largest row, and is shrunk back to
+ * BINARY_CODEC_BUFFER_SIZE when it grew beyond this size.
+ */
+#define BINARY_DECODER_MAX_BUFFER_SIZE (4 * BINARY_CODEC_BUFFER_SIZE)
+
+
+/*
+ * BinaryDecoderState contains the internal state that is passed to the
+ * decoder functions.
+ */
+typedef struct BinaryDecoderState
+{
+	/* the decoder reads from this byte source */
+	ByteSource *byteSource;
+
+	/* number of columns in the tuple descriptor */
+	int columnCount;
+
+	/* number of fields in each row and the column index of each field */
+	int fieldCount;
+	int *columnIndexes;
+
+	/*
+	 * Fields that are converted before and after applying the filter, other
+	 * fields are skipped and returned as NULL.
+	 */
+	int filterFieldCount;
+	int *filterFieldIndexes;
+	int remainingFieldCount;
+	int *remainingFieldIndexes;
+
+	/* filter applied to the filter fields of each row, or NULL */
+	TupleDecoderFilter *filter;
+
+	/* how to decode each field */
+	BinaryFieldType *fieldTypes;
+	FmgrInfo *receiveFunctions;
+	Oid *typeIOParams;
+	int32 *typeModifiers;
+
+	/*
+	 * Input buffer, the bytes between bufferOffset and bufferLength have not
+	 * been consumed yet. bufferOffset always points to the start of a row.
+	 */
+	char *buffer;
+	int bufferSize;
+	int bufferOffset;
+	int bufferLength;
+	bool endOfInputReached;
+
+	/* whether the file trailer was read */
+	bool trailerReached;
+
+	/* location of the fields of the current row relative to bufferOffset */
+	int *fieldOffsets;
+	int32 *fieldLengths;
+	int rowLength;
+
+	/* buffer passed to receive functions */
+	StringInfoData fieldBuffer;
+
+	/* memory context for decoded values, reset for every row */
+	MemoryContext rowContext;
+} BinaryDecoderState;
+
+
+static void BinaryDecoderStart(void *state);
+static bool BinaryDecoderNext(void *state, Datum *columnValues, bool *columnNulls);
+static bool BinaryDecoderNextBatch(void *state, TupleBatch *batch);
+static void BinaryDecoderFinish(void *state);
+static bool LocateNextRow(BinaryDecoderState *decoder);
+static bool DecodeRow(BinaryDecoderState *decoder, Datum *columnValues,
+                      bool *columnNulls);
+static inline void DecodeFields(BinaryDecoderState *decoder, int *fieldIndexes,
+                                int fieldCount, Datum *columnValues, bool *columnNulls);
+static Datum DecodeField(BinaryDecoderState *decoder, int fieldIndex, bool *isNull);
+static Datum ReceiveGenericField(BinaryDecoderState *decoder, int fieldIndex,
+                                 char *fieldData, int32 fieldLength);
+static bool FillBuffer(BinaryDecoderState *decoder, int byteCount);
+static inline uint16 LoadUInt16(const char *data);
+static inline uint32 LoadUInt32(const char *data);
+static inline uint64 LoadUInt64(const char *data);
+
+
+/*
+ * CreateBinaryDecoder creates a tuple decoder that reads tuples from the
+ * byte source in the format produced by COPY .. TO .. WITH (format 'binary').
+ * Fields of columns that are not in projectedColumns are skipped, and the
+ * other fields of a row are only converted when the filter fields match.
+ */
+TupleDecoder *
+CreateBinaryDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor,
+                    bool *projectedColumns, TupleDecoderFilter *filter)
+{
+	BinaryDecoderState *state = palloc0(sizeof(BinaryDecoderState));
+	state->byteSource = byteSource;
+	state->columnCount = tupleDescriptor->natts;
+	state->columnIndexes = BinaryFieldColumnIndexes(tupleDescriptor,
+	                                                &state->fieldCount);
+
+	int fieldCount = state->fieldCount;
+
+	state->fieldTypes = palloc0(fieldCount * sizeof(BinaryFieldType));
+	state->receiveFunctions = palloc0(fieldCount * sizeof(FmgrInfo));
+	state->typeIOParams = palloc0(fieldCount * sizeof(Oid));
+	state->typeModifiers = palloc0(fieldCount * sizeof(int32));
+	state->fieldOffsets = palloc0(fieldCount * sizeof(int));
+	state->fieldLengths = palloc0(fieldCount * sizeof(int32));
+	state->filterFieldIndexes = palloc0(fieldCount * sizeof(int));
+	state->filterFieldCount = 0;
+	state->remainingFieldIndexes = palloc0(fieldCount * sizeof(int));
+	state->remainingFieldCount = 0;
+	state->filter = filter;
+
+	for (int fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+	{
+		int columnIndex = state->columnIndexes[fieldIndex];
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+		BinaryFieldType fieldType = BinaryFieldTypeFromTypeId(attr->atttypid);
+
+		/*
+		 * timestamp(n) and timestamptz(n) need rounding to the precision of
+		 * the column, which their receive functions do for us.
+		 */
+		if (fieldType == BINARY_FIELD_TIMESTAMP && attr->atttypmod >= 0)
+		{
+			fieldType = BINARY_FIELD_GENERIC;
+		}
+
+		if (projectedColumns != NULL && !projectedColumns[columnIndex])
+		{
+			continue;
+		}
+
+		if (filter != NULL && filter->filterColumns[columnIndex])
+		{
+			state->filterFieldIndexes[state->filterFieldCount++] = fieldIndex;
+		}
+		else
+		{
+			state->remainingFieldIndexes[state->remainingFieldCount++] = fieldIndex;
+		}
+
+		state->fieldTypes[fieldIndex] = fieldType;
+		state->typeModifiers[fieldIndex] = attr->atttypmod;
+
+		if (fieldType == BINARY_FIELD_GENERIC)
+		{
+			Oid receiveFunctionId = InvalidOid;
+
+			getTypeBinaryInputInfo(attr->atttypid, &receiveFunctionId,
+			                       &state->typeIOParams[fieldIndex]);
+			fmgr_info(receiveFunctionId, &state->receiveFunctions[fieldIndex]);
+		}
+	}
+
+	state->bufferSize = BINARY_CODEC_BUFFER_SIZE;
+	state->buffer = palloc(state->bufferSize);
+	initStringInfo(&state->fieldBuffer);
+	state->rowContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                          "Binary Decoder Row Context",
+	                                          ALLOCSET_DEFAULT_SIZES);
+
+	TupleDecoder *decoder = CreateTupleDecoder(tupleDescriptor);
+	decoder->state = state;
+	decoder->start = BinaryDecoderStart;
+	decoder->next = BinaryDecoderNext;
+	decoder->nextBatch = BinaryDecoderNextBatch;
+	decoder->finish = BinaryDecoderFinish;
+
+	return decoder;
+}
+
+
+/*
+ * BinaryDecoderStart reads and checks the COPY binary file header.
+ *
+ * Based on BeginCopyFrom in copy.c.
+ */
+static void
+BinaryDecoderStart(void *state)
+{
+	BinaryDecoderState *decoder = (BinaryDecoderState *) state;
+
+	if (!FillBuffer(decoder, BINARY_HEADER_LENGTH) ||
+		memcmp(decoder->buffer, BinaryCopySignature, BINARY_SIGNATURE_LENGTH) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+		                errmsg("COPY file signature not recognized")));
+	}
+
+	int32 flags = (int32) LoadUInt32(decoder->buffer + BINARY_SIGNATURE_LENGTH);
+	if ((flags & (1 << 16)) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+		                errmsg("invalid COPY file header (WITH OIDS)")));
+	}
+
+	flags &= ~(1 << 16);
+	if ((flags >> 16) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+		                errmsg("unrecognized critical flags in COPY file header")));
+	}
+
+	int32 extensionLength = (int32) LoadUInt32(decoder->buffer +
+	                                           BINARY_SIGNATURE_LENGTH +
+	                                           sizeof(int32));
+	if (extensionLength < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+		                errmsg("invalid COPY file header (missing length)")));
+	}
+
+	/* skip the header extension */
+	if (!FillBuffer(decoder, BINARY_HEADER_LENGTH + extensionLength))
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+		                errmsg("invalid COPY file header (wrong length)")));
+	}
+
+	decoder->bufferOffset += BINARY_HEADER_LENGTH + extensionLength;
+}
+
+
+/*
+ * BinaryDecoderNext decodes the next row that matches the filter into
+ * columnValues and columnNulls. It returns false when there are no more rows.
+ */
+static bool
+BinaryDecoderNext(void *state, Datum *columnValues, bool *columnNulls)
+{
+	BinaryDecoderState *decoder = (BinaryDecoderState *) state;
+
+	for (;;)
+	{
+		/* free memory used by the previous row */
+		MemoryContextReset(decoder->rowContext);
+
+		if (!LocateNextRow(decoder))
+		{
+			return false;
+		}
+
+		if (DecodeRow(decoder, columnValues, columnNulls))
+		{
+			return true;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+
+/*
+ * BinaryDecoderNextBatch decodes the rows that match the filter among the
+ * next batch->maxRows rows into the batch. It returns false when there are
+ * no more rows.
+ */
+static bool
+BinaryDecoderNextBatch(void *state, TupleBatch *batch)
+{
+	BinaryDecoderState *decoder = (BinaryDecoderState *) state;
+	int rowsRead = 0;
+
+	/* free memory used by the previous batch */
+	MemoryContextReset(decoder->rowContext);
+
+	batch->rowCount = 0;
+
+	/*
+	 * We limit the number of rows read rather than the number of rows that
+	 * match, since memory used by rejected rows is only freed per batch.
+	 */
+	while (rowsRead < batch->maxRows && LocateNextRow(decoder))
+	{
+		if (DecodeRow(decoder, batch->rowValues, batch->rowNulls))
+		{
+			TupleBatchAppendRow(batch, batch->rowValues, batch->rowNulls);
+		}
+
+		rowsRead++;
+	}
+
+	return rowsRead > 0;
+}
+
+
+/*
+ * BinaryDecoderFinish closes the byte source of the decoder.
+ */
+static void
+BinaryDecoderFinish(void *state)
+{
+	BinaryDecoderState *decoder = (BinaryDecoderState *) state;
+	ByteSource *byteSource = decoder->byteSource;
+
+	byteSource->close(byteSource->context);
+
+	MemoryContextDelete(decoder->rowContext);
+}
+
+
+/*
+ * LocateNextRow makes sure the next row is fully available in the buffer
+ * and records the offset and length of each of its fields. It returns
+ * false if there are no more rows.
+ */
+static bool
+LocateNextRow(BinaryDecoderState *decoder)
+{
+	if (decoder->trailerReached)
+	{
+		return false;
+	}
+
+	if (!FillBuffer(decoder, sizeof(int16)))
+	{
+		if (decoder->bufferLength > decoder->bufferOffset)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+			                errmsg("unexpected EOF in COPY data")));
+		}
+
+		/* end of file without a trailer, same as COPY */
+		return false;
+	}
+
+	int16 fieldCount = (int16) LoadUInt16(decoder->buffer + decoder->bufferOffset);
+	if (fieldCount == -1)
+	{
+		decoder->trailerReached = true;
+		return false;
+	}
+
+	if (fieldCount != decoder->fieldCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+		                errmsg("row field count is %d, expected %d",
+		                       (int) fieldCount, decoder->fieldCount)));
+	}
+
+	int rowLength = sizeof(int16);
+
+	for (int fieldIndex = 0; fieldIndex < decoder->fieldCount; fieldIndex++)
+	{
+		if (!FillBuffer(decoder, rowLength + sizeof(int32)))
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+			                errmsg("unexpected EOF in COPY data")));
+		}
+
+		int32 fieldLength = (int32) LoadUInt32(decoder->buffer + decoder->bufferOffset +
+		                                       rowLength);
+		if (fieldLength < -1)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+			                errmsg("invalid field size")));
+		}
+
+		rowLength += sizeof(int32);
+
+		decoder->fieldOffsets[fieldIndex] = rowLength;
+		decoder->fieldLengths[fieldIndex] = fieldLength;
+
+		if (fieldLength > 0)
+		{
+			if (fieldLength > MaxAllocSize - rowLength)
+			{
+				ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+				                errmsg("invalid field size")));
+			}
+
+			rowLength += fieldLength;
+		}
+	}
+
+	if (!FillBuffer(decoder, rowLength))
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+		                errmsg("unexpected EOF in COPY data")));
+	}
+
+	decoder->rowLength = rowLength;
+
+	return true;
+}
+
+
+/*
+ * DecodeRow converts the fields of the row located by LocateNextRow into
+ * columnValues and columnNulls, and moves past the row. If there is a filter,
+ * the filter fields are converted first, and the remaining fields are only
+ * converted if the row matches. Returns whether the row matches.
+ */
+static bool
+DecodeRow(BinaryDecoderState *decoder, Datum *columnValues, bool *columnNulls)
+{
+	TupleDecoderFilter *filter = decoder->filter;
+	bool rowMatches = true;
+
+	MemoryContext oldContext = MemoryContextSwitchTo(decoder->rowContext);
+
+	/* dropped and skipped columns are NULL */
+	memset(columnNulls, true, decoder->columnCount * sizeof(bool));
+
+	if (filter != NULL)
+	{
+		DecodeFields(decoder, decoder->filterFieldIndexes, decoder->filterFieldCount,
+		             columnValues, columnNulls);
+
+		rowMatches = filter->matches(filter->context, columnValues, columnNulls);
+	}
+
+	if (rowMatches)
+	{
+		DecodeFields(decoder, decoder->remainingFieldIndexes,
+		             decoder->remainingFieldCount, columnValues, columnNulls);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	/* move past the row */
+	decoder->bufferOffset += decoder->rowLength;
+
+	return rowMatches;
+}
+
+
+/*
+ * DecodeFields converts the given fields of the current row.
+ */
+static inline void
+DecodeFields(BinaryDecoderState *decoder, int *fieldIndexes, int fieldCount,
+             Datum *columnValues, bool *columnNulls)
+{
+	for (int index = 0; index < fieldCount; index++)
+	{
+		int fieldIndex = fieldIndexes[index];
+		int columnIndex = decoder->columnIndexes[fieldIndex];
+
+		columnValues[columnIndex] = DecodeField(decoder, fieldIndex,
+		                                        &columnNulls[columnIndex]);
+	}
+}
+
+
+/*
+ * DecodeField converts the field at fieldIndex in the current row into a Datum.
+ */
+static Datum
+DecodeField(BinaryDecoderState *decoder, int fieldIndex, bool *isNull)
+{
+	BinaryFieldType fieldType = decoder->fieldTypes[fieldIndex];
+	int32 fieldLength = decoder->fieldLengths[fieldIndex];
+	char *fieldData = decoder->buffer + decoder->bufferOffset +
+					  decoder->fieldOffsets[fieldIndex];
+
+	if (fieldType == BINARY_FIELD_GENERIC)
+	{
+		Datum value = ReceiveGenericField(decoder, fieldIndex, fieldData, fieldLength);
+
+		*isNull = (fieldLength == -1);
+		return value;
+	}
+
+	if (fieldLength == -1)
+	{
+		*isNull = true;
+		return (Datum) 0;
+	}
+
+	if (fieldType == BINARY_FIELD_TEXT)
+	{
+		/* client and server encodings match, so we only need to validate */
+		if (GetDatabaseEncoding() == PG_UTF8)
+		{
+			Utf8VerifyBuffer(fieldData, fieldLength);
+		}
+		else
+		{
+			pg_verifymbstr(fieldData, fieldLength, false);
+		}
+
+		*isNull = false;
+		return PointerGetDatum(cstring_to_text_with_len(fieldData, fieldLength));
+	}
+
+	if (fieldLength != BinaryFieldTypeLength(fieldType))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+		                errmsg("incorrect binary data format in field %d",
+		                       fieldIndex + 1)));
+	}
+
+	*isNull = false;
+
+	switch (fieldType)
+	{
+		case BINARY_FIELD_BOOL:
+		{
+			return BoolGetDatum(*fieldData != 0);
+		}
+
+		case BINARY_FIELD_INT2:
+		{
+			return Int16GetDatum((int16) LoadUInt16(fieldData));
+		}
+
+		case BINARY_FIELD_INT4:
+		{
+			return Int32GetDatum((int32) LoadUInt32(fieldData));
+		}
+
+		case BINARY_FIELD_INT8:
+		{
+			return Int64GetDatum((int64) LoadUInt64(fieldData));
+		}
+
+		case BINARY_FIELD_FLOAT4:
+		{
+			union
+			{
+				float4 floatValue;
+				uint32 intValue;
+			} swap;
+
+			swap.intValue = LoadUInt32(fieldData);
+			return Float4GetDatum(swap.floatValue);
+		}
+
+		case BINARY_FIELD_FLOAT8:
+		{
+			union
+			{
+				float8 floatValue;
+				uint64 intValue;
+			} swap;
+
+			swap.intValue = LoadUInt64(fieldData);
+			return Float8GetDatum(swap.floatValue);
+		}
+
+		case BINARY_FIELD_DATE:
+		{
+			DateADT date = (DateADT) LoadUInt32(fieldData);
+
+			/* same check as date_recv */
+			if (!DATE_NOT_FINITE(date) && !IS_VALID_DATE(date))
+			{
+				ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				                errmsg("date out of range in field %d",
+				                       fieldIndex + 1)));
+			}
+
+			return DateADTGetDatum(date);
+		}
+
+		case BINARY_FIELD_TIMESTAMP:
+		{
+			Timestamp timestamp = (Timestamp) LoadUInt64(fieldData);
+
+			/* same check as timestamp_recv, typmods are handled as generic fields */
+			if (!TIMESTAMP_NOT_FINITE(timestamp) && !IS_VALID_TIMESTAMP(timestamp))
+			{
+				ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				                errmsg("timestamp out of range in field %d",
+				                       fieldIndex + 1)));
+			}
+
+			return TimestampGetDatum(timestamp);
+		}
+
+		case BINARY_FIELD_UUID:
+		{
+			pg_uuid_t *uuid = palloc(sizeof(pg_uuid_t));
+
+			memcpy(uuid->data, fieldData, UUID_LEN);
+			return UUIDPGetDatum(uuid);
+		}
+
+		default:
+		{
+			ereport(ERROR, (errmsg("unexpected binary field type %d", fieldType)));
+		}
+	}
+}
+
+
+/*
+ * ReceiveGenericField converts a field by calling the receive function of
+ * its type.
+ *
+ * Based on CopyReadBinaryAttribute in copy.c.
+ */
+static Datum
+ReceiveGenericField(BinaryDecoderState *decoder, int fieldIndex, char *fieldData,
+                    int32 fieldLength)
+{
+	FmgrInfo *receiveFunction = &decoder->receiveFunctions[fieldIndex];
+	Oid typeIOParam = decoder->typeIOParams[fieldIndex];
+	int32 typeModifier = decoder->typeModifiers[fieldIndex];
+	StringInfo fieldBuffer = &decoder->fieldBuffer;
+
+	if (fieldLength == -1)
+	{
+		/* let domain receive functions check for NOT NULL constraints */
+		return ReceiveFunctionCall(receiveFunction, NULL, typeIOParam, typeModifier);
+	}
+
+	resetStringInfo(fieldBuffer);
+	appendBinaryStringInfo(fieldBuffer, fieldData, fieldLength);
+
+	Datum value = ReceiveFunctionCall(receiveFunction, fieldBuffer, typeIOParam,
+	                                  typeModifier);
+
+	/* trouble if it didn't eat the whole buffer */
+	if (fieldBuffer->cursor != fieldBuffer->len)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+		                errmsg("incorrect binary data format in field %d",
+		                       fieldIndex + 1)));
+	}
+
+	return value;
+}
+
+
+/*
+ * FillBuffer reads from the byte source until at least byteCount bytes
+ * are available after bufferOffset, moving unconsumed bytes to the start of
+ * the buffer and enlarging it when needed. A buffer that a large row made
+ * larger than BINARY_DECODER_MAX_BUFFER_SIZE is shrunk again once the rows
+ * fit in the default size. It returns false if the end of the input is
+ * reached first.
+ */
+static bool
+FillBuffer(BinaryDecoderState *decoder, int byteCount)
+{
+	ByteSource *byteSource = decoder->byteSource;
+	int bytesAvailable = decoder->bufferLength - decoder->bufferOffset;
+
+	if (bytesAvailable >= byteCount)
+	{
+		return true;
+	}
+
+	if (decoder->bufferSize > BINARY_DECODER_MAX_BUFFER_SIZE &&
+		Max(byteCount, bytesAvailable) <= BINARY_CODEC_BUFFER_SIZE)
+	{
+		/* a large row enlarged the buffer, give the memory back */
+		char *newBuffer = MemoryContextAlloc(GetMemoryChunkContext(decoder->buffer),
+		                                     BINARY_CODEC_BUFFER_SIZE);
+
+		memcpy(newBuffer, decoder->buffer + decoder->bufferOffset, bytesAvailable);
+		pfree(decoder->buffer);
+
+		decoder->buffer = newBuffer;
+		decoder->bufferSize = BINARY_CODEC_BUFFER_SIZE;
+		decoder->bufferOffset = 0;
+		decoder->bufferLength = bytesAvailable;
+	}
+	else if (decoder->bufferOffset > 0)
+	{
+		memmove(decoder->buffer, decoder->buffer + decoder->bufferOffset,
+		        bytesAvailable);
+		decoder->bufferOffset = 0;
+		decoder->bufferLength = bytesAvailable;
+	}
+
+	if (byteCount > decoder->bufferSize)
+	{
+		int newBufferSize = Max(byteCount, 2 * decoder->bufferSize);
+
+		decoder->buffer = repalloc(decoder->buffer, newBufferSize);
+		decoder->bufferSize = newBufferSize;
+	}
+
+	while (decoder->bufferLength < byteCount && !decoder->endOfInputReached)
+	{
+		int bytesRead = byteSource->read(byteSource->context,
+		                                 decoder->buffer + decoder->bufferLength,
+		                                 byteCount - decoder->bufferLength,
+		                                 decoder->bufferSize - decoder->bufferLength);
+		if (bytesRead == 0)
+		{
+			decoder->endOfInputReached = true;
+		}
+
+		decoder->bufferLength += bytesRead;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return decoder->bufferLength >= byteCount;
+}
+
+
+/* Load an int16 in network byte order. */
+static inline uint16
+LoadUInt16(const char *data)
+{
+	uint16 networkValue;
+
+	memcpy(&networkValue, data, sizeof(networkValue));
+	return pg_ntoh16(networkValue);
+}
+
+
+/* Load an int32 in network byte order. */
+static inline uint32
+LoadUInt32(const char *data)
+{
+	uint32 networkValue;
+
+	memcpy(&networkValue, data, sizeof(networkValue));
+	return pg_ntoh32(networkValue);
+}
+
+
+/* Load an int64 in network byte order. */
+static inline uint64
+LoadUInt64(const char *data)
+{
+	uint64 networkValue;
+
+	memcpy(&networkValue, data, sizeof(networkValue));
+	return pg_ntoh64(networkValue);
+}
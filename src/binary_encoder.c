@@ -0,0 +1,452 @@
+/*-------------------------------------------------------------------------
+ *
+ * binary_encoder.c
+ *     Tuple encoder that writes tuples in COPY binary format. Values of
+ *     common fixed-width types are written directly into a preallocated
+ *     buffer, other types go through their send functions.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "pgazure/binary_codec.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/codecs.h"
+#include "pgazure/copy_utils.h"
+#include "port/pg_bswap.h"
+#include "utils/date.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/uuid.h"
+
+
+/*
+ * BinaryEncoderState contains the internal state that is passed to the
+ * encoder functions.
+ */
+typedef struct BinaryEncoderState
+{
+	/* the encoder writes to this byte sink */
+	ByteSink *byteSink;
+
+	/* number of fields in each row and the column index of each field */
+	int fieldCount;
+	int *columnIndexes;
+
+	/* how to encode each column */
+	BinaryFieldType *fieldTypes;
+	FmgrInfo *sendFunctions;
+
+	/* buffer holding encoded rows that have not been written to the sink */
+	char *buffer;
+	int bufferLength;
+
+	/* memory context for send function results, reset for every row */
+	MemoryContext rowContext;
+} BinaryEncoderState;
+
+
+static void BinaryEncoderStart(void *state);
+static void BinaryEncoderPush(void *state, Datum *columnValues, bool *columnNulls);
+static void BinaryEncoderPushBatch(void *state, TupleBatch *batch);
+static void BinaryEncoderFinish(void *state);
+static inline void AppendField(BinaryEncoderState *encoder, int fieldIndex,
+                               Datum value, bool isNull);
+static void AppendGenericField(BinaryEncoderState *encoder, FmgrInfo *sendFunction,
+                               Datum value);
+static void AppendTextField(BinaryEncoderState *encoder, Datum value);
+static void AppendVariableLengthField(BinaryEncoderState *encoder, const char *data,
+                                      int dataLength);
+static void FlushBuffer(BinaryEncoderState *encoder);
+static inline void EnsureBufferSpace(BinaryEncoderState *encoder, int byteCount);
+static inline void AppendBytes(BinaryEncoderState *encoder, const void *data,
+                               int byteCount);
+static inline void AppendInt16(BinaryEncoderState *encoder, int16 value);
+static inline void AppendInt32(BinaryEncoderState *encoder, int32 value);
+static inline void AppendInt64(BinaryEncoderState *encoder, int64 value);
+
+
+/*
+ * CreateBinaryEncoder creates a tuple encoder that writes tuples to the
+ * byte sink in the format produced by COPY .. TO .. WITH (format 'binary').
+ */
+TupleEncoder *
+CreateBinaryEncoder(ByteSink *byteSink, TupleDesc tupleDescriptor)
+{
+	BinaryEncoderState *state = palloc0(sizeof(BinaryEncoderState));
+	state->byteSink = byteSink;
+	state->columnIndexes = BinaryFieldColumnIndexes(tupleDescriptor,
+	                                                &state->fieldCount);
+	state->fieldTypes = palloc0(state->fieldCount * sizeof(BinaryFieldType));
+	state->sendFunctions = ColumnOutputFunctions(tupleDescriptor, true);
+	state->buffer = palloc(BINARY_CODEC_BUFFER_SIZE);
+	state->bufferLength = 0;
+	state->rowContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                          "Binary Encoder Row Context",
+	                                          ALLOCSET_DEFAULT_SIZES);
+
+	for (int fieldIndex = 0; fieldIndex < state->fieldCount; fieldIndex++)
+	{
+		int columnIndex = state->columnIndexes[fieldIndex];
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		state->fieldTypes[fieldIndex] = BinaryFieldTypeFromTypeId(attr->atttypid);
+	}
+
+	TupleEncoder *encoder = CreateTupleEncoder(tupleDescriptor);
+	encoder->state = state;
+	encoder->start = BinaryEncoderStart;
+	encoder->push = BinaryEncoderPush;
+	encoder->pushBatch = BinaryEncoderPushBatch;
+	encoder->finish = BinaryEncoderFinish;
+
+	return encoder;
+}
+
+
+/*
+ * BinaryEncoderStart appends the COPY binary file header to the buffer.
+ */
+static void
+BinaryEncoderStart(void *state)
+{
+	BinaryEncoderState *encoder = (BinaryEncoderState *) state;
+
+	EnsureBufferSpace(encoder, BINARY_HEADER_LENGTH);
+
+	/* signature */
+	AppendBytes(encoder, BinaryCopySignature, BINARY_SIGNATURE_LENGTH);
+
+	/* flags field (no OIDs) */
+	AppendInt32(encoder, 0);
+
+	/* no header extension */
+	AppendInt32(encoder, 0);
+}
+
+
+/*
+ * BinaryEncoderPush encodes a single tuple in COPY binary format and appends
+ * it to the buffer, which is written to the byte sink when it fills up.
+ */
+static void
+BinaryEncoderPush(void *state, Datum *columnValues, bool *columnNulls)
+{
+	BinaryEncoderState *encoder = (BinaryEncoderState *) state;
+
+	/* free memory used by send functions for the previous row */
+	MemoryContextReset(encoder->rowContext);
+
+	EnsureBufferSpace(encoder, sizeof(int16));
+	AppendInt16(encoder, encoder->fieldCount);
+
+	for (int fieldIndex = 0; fieldIndex < encoder->fieldCount; fieldIndex++)
+	{
+		int columnIndex = encoder->columnIndexes[fieldIndex];
+
+		AppendField(encoder, fieldIndex, columnValues[columnIndex],
+		            columnNulls[columnIndex]);
+	}
+}
+
+
+/*
+ * BinaryEncoderPushBatch encodes all tuples in a batch. The memory used by
+ * send functions is only freed once per batch.
+ */
+static void
+BinaryEncoderPushBatch(void *state, TupleBatch *batch)
+{
+	BinaryEncoderState *encoder = (BinaryEncoderState *) state;
+
+	/* free memory used by send functions for the previous batch */
+	MemoryContextReset(encoder->rowContext);
+
+	for (int rowIndex = 0; rowIndex < batch->rowCount; rowIndex++)
+	{
+		EnsureBufferSpace(encoder, sizeof(int16));
+		AppendInt16(encoder, encoder->fieldCount);
+
+		for (int fieldIndex = 0; fieldIndex < encoder->fieldCount; fieldIndex++)
+		{
+			int columnIndex = encoder->columnIndexes[fieldIndex];
+
+			AppendField(encoder, fieldIndex, batch->columnValues[columnIndex][rowIndex],
+			            batch->columnNulls[columnIndex][rowIndex]);
+		}
+	}
+}
+
+
+/*
+ * BinaryEncoderFinish writes the file trailer and remaining buffered data,
+ * and closes the byte sink.
+ */
+static void
+BinaryEncoderFinish(void *state)
+{
+	BinaryEncoderState *encoder = (BinaryEncoderState *) state;
+	ByteSink *byteSink = encoder->byteSink;
+
+	EnsureBufferSpace(encoder, sizeof(int16));
+	AppendInt16(encoder, -1);
+
+	FlushBuffer(encoder);
+
+	byteSink->close(byteSink->context);
+
+	MemoryContextDelete(encoder->rowContext);
+}
+
+
+/*
+ * AppendField appends a single field in COPY binary format to the buffer.
+ */
+static inline void
+AppendField(BinaryEncoderState *encoder, int fieldIndex, Datum value, bool isNull)
+{
+	int columnIndex = encoder->columnIndexes[fieldIndex];
+	BinaryFieldType fieldType = encoder->fieldTypes[fieldIndex];
+
+	if (isNull)
+	{
+		EnsureBufferSpace(encoder, sizeof(int32));
+		AppendInt32(encoder, -1);
+		return;
+	}
+
+	if (fieldType == BINARY_FIELD_GENERIC)
+	{
+		AppendGenericField(encoder, &encoder->sendFunctions[columnIndex], value);
+		return;
+	}
+
+	if (fieldType == BINARY_FIELD_TEXT)
+	{
+		AppendTextField(encoder, value);
+		return;
+	}
+
+	int fieldLength = BinaryFieldTypeLength(fieldType);
+
+	EnsureBufferSpace(encoder, sizeof(int32) + fieldLength);
+	AppendInt32(encoder, fieldLength);
+
+	switch (fieldType)
+	{
+		case BINARY_FIELD_BOOL:
+		{
+			char boolValue = DatumGetBool(value) ? 1 : 0;
+
+			AppendBytes(encoder, &boolValue, 1);
+			break;
+		}
+
+		case BINARY_FIELD_INT2:
+		{
+			AppendInt16(encoder, DatumGetInt16(value));
+			break;
+		}
+
+		case BINARY_FIELD_INT4:
+		{
+			AppendInt32(encoder, DatumGetInt32(value));
+			break;
+		}
+
+		case BINARY_FIELD_INT8:
+		{
+			AppendInt64(encoder, DatumGetInt64(value));
+			break;
+		}
+
+		case BINARY_FIELD_FLOAT4:
+		{
+			union
+			{
+				float4 floatValue;
+				int32 intValue;
+			} swap;
+
+			swap.floatValue = DatumGetFloat4(value);
+			AppendInt32(encoder, swap.intValue);
+			break;
+		}
+
+		case BINARY_FIELD_FLOAT8:
+		{
+			union
+			{
+				float8 floatValue;
+				int64 intValue;
+			} swap;
+
+			swap.floatValue = DatumGetFloat8(value);
+			AppendInt64(encoder, swap.intValue);
+			break;
+		}
+
+		case BINARY_FIELD_DATE:
+		{
+			AppendInt32(encoder, DatumGetDateADT(value));
+			break;
+		}
+
+		case BINARY_FIELD_TIMESTAMP:
+		{
+			AppendInt64(encoder, DatumGetTimestamp(value));
+			break;
+		}
+
+		case BINARY_FIELD_UUID:
+		{
+			pg_uuid_t *uuid = DatumGetUUIDP(value);
+
+			AppendBytes(encoder, uuid->data, UUID_LEN);
+			break;
+		}
+
+		default:
+		{
+			ereport(ERROR, (errmsg("unexpected binary field type %d", fieldType)));
+		}
+	}
+}
+
+
+/*
+ * AppendGenericField calls the send function of a column and appends the
+ * result to the buffer.
+ */
+static void
+AppendGenericField(BinaryEncoderState *encoder, FmgrInfo *sendFunction, Datum value)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(encoder->rowContext);
+
+	bytea *outputBytes = SendFunctionCall(sendFunction, value);
+
+	MemoryContextSwitchTo(oldContext);
+
+	AppendVariableLengthField(encoder, VARDATA(outputBytes),
+	                          VARSIZE(outputBytes) - VARHDRSZ);
+}
+
+
+/*
+ * AppendTextField appends the bytes of a text value to the buffer. Since
+ * the client and server encodings are the same, this is what textsend would
+ * produce, without copying the value into a bytea first.
+ */
+static void
+AppendTextField(BinaryEncoderState *encoder, Datum value)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(encoder->rowContext);
+
+	text *textValue = DatumGetTextPP(value);
+
+	MemoryContextSwitchTo(oldContext);
+
+	AppendVariableLengthField(encoder, VARDATA_ANY(textValue),
+	                          VARSIZE_ANY_EXHDR(textValue));
+}
+
+
+/*
+ * AppendVariableLengthField appends a length-prefixed field to the buffer.
+ * Values that do not fit in the buffer are written to the byte sink directly.
+ */
+static void
+AppendVariableLengthField(BinaryEncoderState *encoder, const char *data,
+                          int dataLength)
+{
+	EnsureBufferSpace(encoder, sizeof(int32));
+	AppendInt32(encoder, dataLength);
+
+	if (dataLength > BINARY_CODEC_BUFFER_SIZE)
+	{
+		ByteSink *byteSink = encoder->byteSink;
+
+		FlushBuffer(encoder);
+		byteSink->write(byteSink->context, (char *) data, dataLength);
+	}
+	else
+	{
+		EnsureBufferSpace(encoder, dataLength);
+		AppendBytes(encoder, data, dataLength);
+	}
+}
+
+
+/*
+ * FlushBuffer writes the buffered bytes to the byte sink.
+ */
+static void
+FlushBuffer(BinaryEncoderState *encoder)
+{
+	ByteSink *byteSink = encoder->byteSink;
+
+	if (encoder->bufferLength > 0)
+	{
+		byteSink->write(byteSink->context, encoder->buffer, encoder->bufferLength);
+		encoder->bufferLength = 0;
+	}
+}
+
+
+/*
+ * EnsureBufferSpace flushes the buffer if fewer than byteCount bytes are
+ * available. byteCount cannot exceed BINARY_CODEC_BUFFER_SIZE.
+ */
+static inline void
+EnsureBufferSpace(BinaryEncoderState *encoder, int byteCount)
+{
+	Assert(byteCount <= BINARY_CODEC_BUFFER_SIZE);
+
+	if (encoder->bufferLength + byteCount > BINARY_CODEC_BUFFER_SIZE)
+	{
+		FlushBuffer(encoder);
+	}
+}
+
+
+/* Append raw bytes to the buffer, the caller ensures there is space. */
+static inline void
+AppendBytes(BinaryEncoderState *encoder, const void *data, int byteCount)
+{
+	memcpy(encoder->buffer + encoder->bufferLength, data, byteCount);
+	encoder->bufferLength += byteCount;
+}
+
+
+/* Append an int16 in network byte order to the buffer. */
+static inline void
+AppendInt16(BinaryEncoderState *encoder, int16 value)
+{
+	uint16 networkValue = pg_hton16((uint16) value);
+
+	AppendBytes(encoder, &networkValue, sizeof(networkValue));
+}
+
+
+/* Append an int32 in network byte order to the buffer. */
+static inline void
+AppendInt32(BinaryEncoderState *encoder, int32 value)
+{
+	uint32 networkValue = pg_hton32((uint32) value);
+
+	AppendBytes(encoder, &networkValue, sizeof(networkValue));
+}
+
+
+/* Append an int64 in network byte order to the buffer. */
+static inline void
+AppendInt64(BinaryEncoderState *encoder, int64 value)
+{
+	uint64 networkValue = pg_hton64((uint64) value);
+
+	AppendBytes(encoder, &networkValue, sizeof(networkValue));
+}
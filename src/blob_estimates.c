@@ -0,0 +1,934 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_estimates.c
+ *     Planner support functions for blob_storage_get_blob and
+ *     blob_storage_list_blobs.
+ *
+ * Without a support function, the planner assumes every set-returning
+ * function returns 1000 rows. For blobs, we can do much better: the size
+ * of the blob is known from its properties, and the number of rows per byte
+ * can be estimated by decoding the first range of the blob. The results are
+ * kept in a backend-local cache, such that repeated planning of the same
+ * query does not go to blob storage every time.
+ *
+ * Estimates are only made when the arguments are known at plan time. If
+ * any request to blob storage fails or the data is malformed, we fall back
+ * to the default estimates rather than failing the query. The requests run
+ * in a subtransaction, and other errors are raised as usual.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <math.h>
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "pgazure/binary_codec.h"
+#include "pgazure/blob_estimates.h"
+#include "pgazure/blob_stats.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/compression.h"
+#include "pgazure/cpp_utils.h"
+#include "pgazure/gzip_index.h"
+#include "pgazure/storage_account.h"
+#include "pgazure/zstd_dictionary.h"
+#include "port/pg_bswap.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+#include "utils/timestamp.h"
+
+
+/* number of bytes read from the start of a blob to estimate the row width */
+#define BLOB_SAMPLE_SIZE 65536
+
+/* maximum number of decompressed bytes we look at in the sample */
+#define MAX_DECOMPRESSED_SAMPLE_SIZE (16 * BLOB_SAMPLE_SIZE)
+
+/* number of blobs returned per list request, see ListEntireBlobTree */
+#define BLOBS_PER_LIST_REQUEST 1000
+
+/* maximum length of a cache key, longer keys are not cached */
+#define BLOB_CACHE_KEY_LENGTH 1024
+
+/* blob names can be up to 1024 characters */
+#define BLOB_NAME_BUFFER_LENGTH 1025
+
+#define BLOB_CACHE_INITIAL_SIZE 64
+
+
+/*
+ * BlobEstimate is an entry in the backend-local cache of blob metadata,
+ * keyed by the account, container and path (or prefix) of the blob(s).
+ */
+typedef struct BlobEstimate
+{
+	char key[BLOB_CACHE_KEY_LENGTH];
+
+	/* time at which the metadata was fetched */
+	TimestampTz fetchedAt;
+
+	/* number of bytes stored in blob storage */
+	double storedBytes;
+
+	/* number of rows in the blob or number of blobs in the listing */
+	double rowCount;
+
+	/* for listings, name of a non-empty blob to sample, or empty string */
+	char sampleBlobName[BLOB_NAME_BUFFER_LENGTH];
+} BlobEstimate;
+
+/* cost of a single request to blob storage */
+double BlobRequestCost = 1000.0;
+
+/* cost of transferring a page of 8kB from blob storage */
+double BlobTransferCost = 4.0;
+
+/* number of seconds for which blob metadata is cached */
+int BlobMetadataCacheTTL = 60;
+
+
+static bool GetBlobArguments(Node *callExpression, PlannerInfo *plannerInfo,
+                             char **accountString, char **containerName, char **path,
+                             char **decoderString, char **compressionString);
+static bool GetListBlobsArguments(Node *callExpression, PlannerInfo *plannerInfo,
+                                  char **accountString, char **containerName,
+                                  char **prefix);
+static bool GetConstantTextArgument(List *arguments, int argumentIndex,
+                                    PlannerInfo *plannerInfo, char **value);
+static BlobEstimate * GetBlobEstimate(char *accountString, char *containerName,
+                                      char *path, char *decoderString,
+                                      char *compressionString);
+static BlobEstimate * GetListBlobsEstimate(char *accountString, char *containerName,
+                                           char *prefix);
+static bool IsIgnorableEstimateError(ErrorData *errorData);
+static BlobEstimate * LookupBlobEstimate(char *kind, char *accountString,
+                                         char *containerName, char *path,
+                                         bool *found);
+static void EstimateBlobRows(BlobEstimate *estimate, char *connectionString,
+                             char *containerName, char *path, char *decoderString,
+                             char *compressionString);
+static double CountSampleRows(char *decoderString, char *sample, int sampleLength,
+                              bool isCompleteBlob);
+static double CountBinarySampleRows(char *sample, int sampleLength);
+static void EstimateListBlobs(BlobEstimate *estimate, char *connectionString,
+                              char *containerName, char *prefix);
+static void CountListedBlob(void *context, CloudBlob *blob);
+static double BlobTransferCostForBytes(double byteCount);
+
+
+/* backend-local cache of blob metadata */
+static HTAB *BlobEstimateCache = NULL;
+
+
+PG_FUNCTION_INFO_V1(blob_storage_get_blob_support);
+PG_FUNCTION_INFO_V1(blob_storage_list_blobs_support);
+
+
+/*
+ * blob_storage_get_blob_support is the planner support function of both
+ * variants of blob_storage_get_blob. It estimates the number of rows from
+ * the size of the blob and a sample of its first bytes, and the cost from
+ * the number of bytes that need to be transferred.
+ */
+Datum
+blob_storage_get_blob_support(PG_FUNCTION_ARGS)
+{
+	Node *rawRequest = (Node *) PG_GETARG_POINTER(0);
+	Node *result = NULL;
+
+	char *accountString = NULL;
+	char *containerName = NULL;
+	char *path = NULL;
+	char *decoderString = NULL;
+	char *compressionString = NULL;
+
+	if (IsA(rawRequest, SupportRequestRows))
+	{
+		SupportRequestRows *request = (SupportRequestRows *) rawRequest;
+
+		if (GetBlobArguments(request->node, request->root, &accountString,
+		                     &containerName, &path, &decoderString,
+		                     &compressionString))
+		{
+			BlobEstimate *estimate = GetBlobEstimate(accountString, containerName, path,
+			                                         decoderString, compressionString);
+			if (estimate != NULL)
+			{
+				request->rows = estimate->rowCount;
+				result = (Node *) request;
+			}
+		}
+	}
+	else if (IsA(rawRequest, SupportRequestCost))
+	{
+		SupportRequestCost *request = (SupportRequestCost *) rawRequest;
+
+		if (GetBlobArguments(request->node, request->root, &accountString,
+		                     &containerName, &path, &decoderString,
+		                     &compressionString))
+		{
+			BlobEstimate *estimate = GetBlobEstimate(accountString, containerName, path,
+			                                         decoderString, compressionString);
+			if (estimate != NULL)
+			{
+				/* the blob is fully read before the first row is returned */
+				request->startup = BlobRequestCost +
+				                   BlobTransferCostForBytes(estimate->storedBytes) +
+				                   estimate->rowCount * cpu_operator_cost;
+				request->per_tuple = 0;
+				result = (Node *) request;
+			}
+		}
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+
+/*
+ * blob_storage_list_blobs_support is the planner support function of
+ * blob_storage_list_blobs. It estimates the number of rows by listing
+ * the blobs with the given prefix.
+ */
+Datum
+blob_storage_list_blobs_support(PG_FUNCTION_ARGS)
+{
+	Node *rawRequest = (Node *) PG_GETARG_POINTER(0);
+	Node *result = NULL;
+
+	char *accountString = NULL;
+	char *containerName = NULL;
+	char *prefix = NULL;
+
+	if (IsA(rawRequest, SupportRequestRows))
+	{
+		SupportRequestRows *request = (SupportRequestRows *) rawRequest;
+
+		if (GetListBlobsArguments(request->node, request->root, &accountString,
+		                          &containerName, &prefix))
+		{
+			BlobEstimate *estimate = GetListBlobsEstimate(accountString, containerName,
+			                                              prefix);
+			if (estimate != NULL)
+			{
+				request->rows = estimate->rowCount;
+				result = (Node *) request;
+			}
+		}
+	}
+	else if (IsA(rawRequest, SupportRequestCost))
+	{
+		SupportRequestCost *request = (SupportRequestCost *) rawRequest;
+
+		if (GetListBlobsArguments(request->node, request->root, &accountString,
+		                          &containerName, &prefix))
+		{
+			BlobEstimate *estimate = GetListBlobsEstimate(accountString, containerName,
+			                                              prefix);
+			if (estimate != NULL)
+			{
+				double requestCount =
+					floor(estimate->rowCount / BLOBS_PER_LIST_REQUEST) + 1;
+
+				request->startup = requestCount * BlobRequestCost;
+				request->per_tuple = 0;
+				result = (Node *) request;
+			}
+		}
+	}
+
+	PG_RETURN_POINTER(result);
+}
+
+
+/*
+ * EstimateBlobSize sets the number of bytes stored in a blob and the estimated
+ * number of rows in it. Returns false if the blob could not be inspected.
+ */
+bool
+EstimateBlobSize(char *accountString, char *containerName, char *path,
+                 char *decoderString, char *compressionString,
+                 double *storedBytes, double *rowCount)
+{
+	if (strcmp(decoderString, "auto") == 0)
+	{
+		decoderString = CodecStringFromFileName(path);
+	}
+
+	BlobEstimate *estimate = GetBlobEstimate(accountString, containerName, path,
+	                                         decoderString, compressionString);
+	if (estimate == NULL)
+	{
+		return false;
+	}
+
+	*storedBytes = estimate->storedBytes;
+	*rowCount = estimate->rowCount;
+
+	return true;
+}
+
+
+/*
+ * EstimatePrefixSize sets the number of blobs with the given prefix, the number
+ * of bytes stored in them, and the estimated number of rows in them based on
+ * a sample of one of the blobs. Returns false if the blobs could not be
+ * inspected.
+ */
+bool
+EstimatePrefixSize(char *accountString, char *containerName, char *prefix,
+                   char *decoderString, char *compressionString,
+                   double *blobCount, double *storedBytes, double *rowCount)
+{
+	BlobEstimate *listEstimate = GetListBlobsEstimate(accountString, containerName,
+	                                                  prefix);
+	if (listEstimate == NULL)
+	{
+		return false;
+	}
+
+	*blobCount = listEstimate->rowCount;
+	*storedBytes = listEstimate->storedBytes;
+	*rowCount = 0;
+
+	if (listEstimate->sampleBlobName[0] == '\0')
+	{
+		/* all blobs are empty */
+		return true;
+	}
+
+	char *sampleBlobName = pstrdup(listEstimate->sampleBlobName);
+	double sampleBytes = 0;
+	double sampleRows = 0;
+
+	if (!EstimateBlobSize(accountString, containerName, sampleBlobName, decoderString,
+	                      compressionString, &sampleBytes, &sampleRows))
+	{
+		return false;
+	}
+
+	if (sampleBytes > 0)
+	{
+		*rowCount = sampleRows * (*storedBytes) / sampleBytes;
+	}
+
+	return true;
+}
+
+
+/*
+ * GetBlobArguments extracts the arguments of a blob_storage_get_blob call
+ * and returns whether all of them are known at plan time.
+ */
+static bool
+GetBlobArguments(Node *callExpression, PlannerInfo *plannerInfo, char **accountString,
+                 char **containerName, char **path, char **decoderString,
+                 char **compressionString)
+{
+	if (callExpression == NULL || !IsA(callExpression, FuncExpr))
+	{
+		return false;
+	}
+
+	List *arguments = ((FuncExpr *) callExpression)->args;
+
+	/* the anyelement variant has the record argument in the middle */
+	int decoderIndex = list_length(arguments) == 6 ? 4 : 3;
+	int compressionIndex = decoderIndex + 1;
+
+	*decoderString = "auto";
+	*compressionString = "auto";
+
+	if (!GetConstantTextArgument(arguments, 0, plannerInfo, accountString) ||
+	    !GetConstantTextArgument(arguments, 1, plannerInfo, containerName) ||
+	    !GetConstantTextArgument(arguments, 2, plannerInfo, path))
+	{
+		return false;
+	}
+
+	/* default arguments are normally inserted by the planner */
+	if (list_length(arguments) > decoderIndex &&
+	    !GetConstantTextArgument(arguments, decoderIndex, plannerInfo, decoderString))
+	{
+		return false;
+	}
+
+	if (list_length(arguments) > compressionIndex &&
+	    !GetConstantTextArgument(arguments, compressionIndex, plannerInfo,
+	                             compressionString))
+	{
+		return false;
+	}
+
+	if (strcmp(*decoderString, "auto") == 0)
+	{
+		*decoderString = CodecStringFromFileName(*path);
+	}
+
+	return true;
+}
+
+
+/*
+ * GetListBlobsArguments extracts the arguments of a blob_storage_list_blobs
+ * call and returns whether all of them are known at plan time.
+ */
+static bool
+GetListBlobsArguments(Node *callExpression, PlannerInfo *plannerInfo,
+                      char **accountString, char **containerName, char **prefix)
+{
+	if (callExpression == NULL || !IsA(callExpression, FuncExpr))
+	{
+		return false;
+	}
+
+	List *arguments = ((FuncExpr *) callExpression)->args;
+
+	return GetConstantTextArgument(arguments, 0, plannerInfo, accountString) &&
+	       GetConstantTextArgument(arguments, 1, plannerInfo, containerName) &&
+	       GetConstantTextArgument(arguments, 2, plannerInfo, prefix);
+}
+
+
+/*
+ * GetConstantTextArgument sets value to the text value of the argument at
+ * the given index if it can be reduced to a non-NULL constant at plan time.
+ */
+static bool
+GetConstantTextArgument(List *arguments, int argumentIndex, PlannerInfo *plannerInfo,
+                        char **value)
+{
+	if (argumentIndex >= list_length(arguments))
+	{
+		return false;
+	}
+
+	Node *argument = (Node *) list_nth(arguments, argumentIndex);
+
+	if (plannerInfo != NULL)
+	{
+		argument = estimate_expression_value(plannerInfo, argument);
+	}
+
+	if (!IsA(argument, Const))
+	{
+		return false;
+	}
+
+	Const *constArgument = (Const *) argument;
+	if (constArgument->constisnull || constArgument->consttype != TEXTOID)
+	{
+		return false;
+	}
+
+	*value = TextDatumGetCString(constArgument->constvalue);
+
+	return true;
+}
+
+
+/*
+ * GetBlobEstimate returns the estimated size and row count of a blob, using
+ * the cache if possible. Returns NULL if the blob could not be inspected.
+ */
+static BlobEstimate *
+GetBlobEstimate(char *accountString, char *containerName, char *path,
+                char *decoderString, char *compressionString)
+{
+	bool found = false;
+	BlobEstimate *estimate = LookupBlobEstimate("blob", accountString, containerName,
+	                                            path, &found);
+	if (found)
+	{
+		return estimate;
+	}
+
+	BlobEstimate localEstimate;
+	MemoryContext oldContext = CurrentMemoryContext;
+	ResourceOwner oldOwner = CurrentResourceOwner;
+	volatile bool succeeded = true;
+
+	memset(&localEstimate, 0, sizeof(localEstimate));
+
+	/* looking up the account uses SPI, which is cleaned up by the rollback */
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldContext);
+
+	PG_TRY();
+	{
+		char *connectionString = AccountStringToConnectionString(accountString);
+
+		EstimateBlobRows(&localEstimate, connectionString, containerName, path,
+		                 decoderString, compressionString);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldContext);
+		CurrentResourceOwner = oldOwner;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldContext);
+
+		ErrorData *errorData = CopyErrorData();
+
+		FlushErrorState();
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldContext);
+		CurrentResourceOwner = oldOwner;
+
+		if (!IsIgnorableEstimateError(errorData))
+		{
+			ReThrowError(errorData);
+		}
+
+		ereport(DEBUG1, (errmsg("could not estimate size of blob %s: %s", path,
+		                        errorData->message)));
+
+		FreeErrorData(errorData);
+		succeeded = false;
+	}
+	PG_END_TRY();
+
+	if (!succeeded)
+	{
+		return NULL;
+	}
+
+	if (estimate == NULL)
+	{
+		/* key is too long to cache */
+		estimate = palloc0(sizeof(BlobEstimate));
+	}
+
+	estimate->storedBytes = localEstimate.storedBytes;
+	estimate->rowCount = localEstimate.rowCount;
+	estimate->fetchedAt = GetCurrentTimestamp();
+
+	return estimate;
+}
+
+
+/*
+ * GetListBlobsEstimate returns the number of blobs with the given prefix,
+ * using the cache if possible. Returns NULL if the blobs could not be listed.
+ */
+static BlobEstimate *
+GetListBlobsEstimate(char *accountString, char *containerName, char *prefix)
+{
+	bool found = false;
+	BlobEstimate *estimate = LookupBlobEstimate("list", accountString, containerName,
+	                                            prefix, &found);
+	if (found)
+	{
+		return estimate;
+	}
+
+	BlobEstimate localEstimate;
+	MemoryContext oldContext = CurrentMemoryContext;
+	ResourceOwner oldOwner = CurrentResourceOwner;
+	volatile bool succeeded = true;
+
+	memset(&localEstimate, 0, sizeof(localEstimate));
+
+	/* looking up the account uses SPI, which is cleaned up by the rollback */
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldContext);
+
+	PG_TRY();
+	{
+		char *connectionString = AccountStringToConnectionString(accountString);
+
+		EstimateListBlobs(&localEstimate, connectionString, containerName, prefix);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldContext);
+		CurrentResourceOwner = oldOwner;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldContext);
+
+		ErrorData *errorData = CopyErrorData();
+
+		FlushErrorState();
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldContext);
+		CurrentResourceOwner = oldOwner;
+
+		if (!IsIgnorableEstimateError(errorData))
+		{
+			ReThrowError(errorData);
+		}
+
+		ereport(DEBUG1, (errmsg("could not list blobs with prefix %s: %s", prefix,
+		                        errorData->message)));
+
+		FreeErrorData(errorData);
+		succeeded = false;
+	}
+	PG_END_TRY();
+
+	if (!succeeded)
+	{
+		return NULL;
+	}
+
+	if (estimate == NULL)
+	{
+		/* key is too long to cache */
+		estimate = palloc0(sizeof(BlobEstimate));
+	}
+
+	estimate->storedBytes = localEstimate.storedBytes;
+	estimate->rowCount = localEstimate.rowCount;
+	estimate->fetchedAt = GetCurrentTimestamp();
+	strlcpy(estimate->sampleBlobName, localEstimate.sampleBlobName,
+	        BLOB_NAME_BUFFER_LENGTH);
+
+	return estimate;
+}
+
+
+/*
+ * IsIgnorableEstimateError returns whether an error while estimating can
+ * be ignored in favour of the default estimates. Only errors from blob
+ * storage and malformed data are, anything else (e.g. cancellation, out of
+ * memory, or an unknown storage account) is raised at plan time.
+ */
+static bool
+IsIgnorableEstimateError(ErrorData *errorData)
+{
+	return errorData->sqlerrcode == ERRCODE_EXTERNAL_ROUTINE_EXCEPTION ||
+		   ERRCODE_TO_CATEGORY(errorData->sqlerrcode) == ERRCODE_DATA_EXCEPTION;
+}
+
+
+/*
+ * LookupBlobEstimate finds or creates the cache entry for a blob or listing.
+ * found is set to true if the entry exists and has not expired. Returns NULL
+ * if the key is too long to be cached.
+ */
+static BlobEstimate *
+LookupBlobEstimate(char *kind, char *accountString, char *containerName, char *path,
+                   bool *found)
+{
+	char key[BLOB_CACHE_KEY_LENGTH];
+
+	*found = false;
+
+	int keyLength = snprintf(key, BLOB_CACHE_KEY_LENGTH, "%s:%s/%s/%s", kind,
+	                         accountString, containerName, path);
+	if (keyLength >= BLOB_CACHE_KEY_LENGTH)
+	{
+		return NULL;
+	}
+
+	/* pad the key with zeroes, since it is compared as a whole */
+	memset(key + keyLength, 0, BLOB_CACHE_KEY_LENGTH - keyLength);
+
+	if (BlobEstimateCache == NULL)
+	{
+		HASHCTL info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = BLOB_CACHE_KEY_LENGTH;
+		info.entrysize = sizeof(BlobEstimate);
+		info.hcxt = CacheMemoryContext;
+
+		BlobEstimateCache = hash_create("pgazure blob estimates",
+		                                BLOB_CACHE_INITIAL_SIZE, &info,
+		                                HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	bool entryExists = false;
+	BlobEstimate *estimate = hash_search(BlobEstimateCache, key, HASH_ENTER,
+	                                     &entryExists);
+
+	if (!entryExists)
+	{
+		estimate->fetchedAt = 0;
+		estimate->storedBytes = 0;
+		estimate->rowCount = 0;
+		estimate->sampleBlobName[0] = '\0';
+	}
+	else if (!TimestampDifferenceExceeds(estimate->fetchedAt, GetCurrentTimestamp(),
+	                                     BlobMetadataCacheTTL * 1000))
+	{
+		*found = true;
+	}
+
+	return estimate;
+}
+
+
+/*
+ * EstimateBlobRows gets the size of a blob and estimates the number of rows
+ * from the number of rows per stored byte in the first range of the blob.
+ */
+static void
+EstimateBlobRows(BlobEstimate *estimate, char *connectionString, char *containerName,
+                 char *path, char *decoderString, char *compressionString)
+{
+	double blobSize = (double) GetBlobSize(connectionString, containerName, path);
+
+	estimate->storedBytes = blobSize;
+	estimate->rowCount = 1;
+
+	if (strcmp(decoderString, "json") == 0 ||
+	    strcmp(decoderString, "xml") == 0 ||
+	    strcmp(decoderString, "text") == 0)
+	{
+		/* the whole blob is a single value */
+		return;
+	}
+
+	if (blobSize == 0)
+	{
+		estimate->rowCount = 0;
+		return;
+	}
+
+	if (strcmp(compressionString, "auto") == 0)
+	{
+		compressionString = CompressionStringForBlob(connectionString, containerName,
+		                                             path);
+	}
+
+	int sampleLength = (int) Min(blobSize, BLOB_SAMPLE_SIZE);
+	char *sample = palloc(sampleLength);
+
+	sampleLength = ReadBlockBlobRange(connectionString, containerName, path, 0,
+	                                  sample, sampleLength);
+
+	bool isCompleteBlob = sampleLength >= blobSize;
+
+	/* decompress the sample, keeping up to MAX_DECOMPRESSED_SAMPLE_SIZE bytes */
+	ByteSource *byteSource = CreateMemoryByteSource(sample, sampleLength);
+	byteSource = BuildBlobDecompressor(compressionString, byteSource, connectionString,
+	                                   containerName, NULL);
+
+	char *decompressedSample = palloc(MAX_DECOMPRESSED_SAMPLE_SIZE);
+	int decompressedLength = 0;
+	double totalDecompressedLength = 0;
+
+	while (true)
+	{
+		char *readBuffer = decompressedSample + decompressedLength;
+		int maxRead = MAX_DECOMPRESSED_SAMPLE_SIZE - decompressedLength;
+
+		if (maxRead == 0)
+		{
+			/* buffer is full, only count the remaining bytes */
+			readBuffer = decompressedSample;
+			maxRead = BLOB_SAMPLE_SIZE;
+		}
+
+		int bytesRead = byteSource->read(byteSource->context, readBuffer, 0, maxRead);
+		if (bytesRead == 0)
+		{
+			break;
+		}
+
+		if (decompressedLength < MAX_DECOMPRESSED_SAMPLE_SIZE)
+		{
+			decompressedLength += bytesRead;
+		}
+
+		totalDecompressedLength += bytesRead;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	byteSource->close(byteSource->context);
+
+	bool isCompleteSample = decompressedLength == totalDecompressedLength;
+
+	double sampleRows = CountSampleRows(decoderString, decompressedSample,
+	                                    decompressedLength,
+	                                    isCompleteBlob && isCompleteSample);
+
+	if (!isCompleteSample && decompressedLength > 0)
+	{
+		/* extrapolate to the part of the sample that we did not keep */
+		sampleRows = sampleRows * totalDecompressedLength / decompressedLength;
+	}
+
+	if (isCompleteBlob)
+	{
+		estimate->rowCount = sampleRows;
+	}
+	else
+	{
+		/* a sample without a complete row means rows are wider than the sample */
+		estimate->rowCount = Max(sampleRows, 1) * blobSize / sampleLength;
+	}
+
+	pfree(decompressedSample);
+	pfree(sample);
+}
+
+
+/*
+ * CountSampleRows counts the number of rows in a decompressed sample of
+ * a blob. If the sample is the complete blob, a trailing row without
+ * a newline is counted as well.
+ */
+static double
+CountSampleRows(char *decoderString, char *sample, int sampleLength,
+                bool isCompleteBlob)
+{
+	if (strcmp(decoderString, "binary") == 0)
+	{
+		return CountBinarySampleRows(sample, sampleLength);
+	}
+
+	/* CSV and TSV have a row per line (ignoring quoted newlines) */
+	double rowCount = 0;
+	char *current = sample;
+	char *end = sample + sampleLength;
+
+	while (current < end)
+	{
+		char *newline = memchr(current, '\n', end - current);
+		if (newline == NULL)
+		{
+			break;
+		}
+
+		rowCount++;
+		current = newline + 1;
+	}
+
+	if (isCompleteBlob && current < end)
+	{
+		rowCount++;
+	}
+
+	return rowCount;
+}
+
+
+/*
+ * CountBinarySampleRows counts the number of complete rows in a sample
+ * in COPY binary format by following the field length prefixes.
+ */
+static double
+CountBinarySampleRows(char *sample, int sampleLength)
+{
+	double rowCount = 0;
+	int offset = BINARY_HEADER_LENGTH;
+
+	if (sampleLength < BINARY_HEADER_LENGTH ||
+	    memcmp(sample, BinaryCopySignature, BINARY_SIGNATURE_LENGTH) != 0)
+	{
+		return 0;
+	}
+
+	/* skip the header extension */
+	uint32 extensionLength = 0;
+	memcpy(&extensionLength, sample + BINARY_SIGNATURE_LENGTH + sizeof(int32),
+	       sizeof(int32));
+	offset += pg_ntoh32(extensionLength);
+
+	while (offset + (int) sizeof(int16) <= sampleLength)
+	{
+		uint16 rawFieldCount = 0;
+		memcpy(&rawFieldCount, sample + offset, sizeof(int16));
+		int16 fieldCount = (int16) pg_ntoh16(rawFieldCount);
+
+		offset += sizeof(int16);
+
+		if (fieldCount < 0)
+		{
+			/* file trailer */
+			break;
+		}
+
+		for (int fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+		{
+			if (offset + (int) sizeof(int32) > sampleLength)
+			{
+				return rowCount;
+			}
+
+			uint32 rawFieldLength = 0;
+			memcpy(&rawFieldLength, sample + offset, sizeof(int32));
+			int32 fieldLength = (int32) pg_ntoh32(rawFieldLength);
+
+			offset += sizeof(int32);
+
+			if (fieldLength > 0)
+			{
+				if (fieldLength > sampleLength - offset)
+				{
+					return rowCount;
+				}
+
+				offset += fieldLength;
+			}
+		}
+
+		rowCount++;
+	}
+
+	return rowCount;
+}
+
+
+/*
+ * EstimateListBlobs counts the blobs with the given prefix and their total
+ * size.
+ */
+static void
+EstimateListBlobs(BlobEstimate *estimate, char *connectionString, char *containerName,
+                  char *prefix)
+{
+	estimate->rowCount = 0;
+	estimate->storedBytes = 0;
+
+	ListBlobs(connectionString, containerName, prefix, CountListedBlob, estimate);
+}
+
+
+/*
+ * CountListedBlob adds a listed blob to the estimate passed in context.
+ */
+static void
+CountListedBlob(void *context, CloudBlob *blob)
+{
+	BlobEstimate *estimate = (BlobEstimate *) context;
+
+	estimate->rowCount++;
+	estimate->storedBytes += blob->size;
+
+	if (estimate->sampleBlobName[0] == '\0' && blob->size > 0 &&
+	    strlen(blob->name) < BLOB_NAME_BUFFER_LENGTH && !IsBlobStatsPath(blob->name) &&
+	    !IsGzipIndexPath(blob->name) && !IsZstdDictionaryPath(blob->name))
+	{
+		strlcpy(estimate->sampleBlobName, blob->name, BLOB_NAME_BUFFER_LENGTH);
+	}
+}
+
+
+/*
+ * BlobTransferCostForBytes returns the cost of transferring the given number
+ * of bytes from blob storage.
+ */
+static double
+BlobTransferCostForBytes(double byteCount)
+{
+	return ceil(byteCount / BLCKSZ) * BlobTransferCost;
+}
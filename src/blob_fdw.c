@@ -0,0 +1,3023 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_fdw.c
+ *     Foreign data wrapper for reading tables from blob storage.
+ *
+ * A foreign table maps to a single blob (path option) or to all blobs with
+ * a given prefix (prefix option). Blobs are read through the same pipeline
+ * as blob_storage_get_blob: the blob is opened as a ByteSource, wrapped in
+ * a decompressor and decoded by a TupleDecoder. Only the columns used by
+ * the query are decoded.
+ *
+ * Scans over a prefix can run in parallel. The leader lists the blobs once
+ * when the scan starts and copies the list into dynamic shared memory, after
+ * which each participant claims whole blobs from a shared counter.
+ *
+ * A path_template such as events/date={date}/region={region}/ makes the
+ * placeholder columns partition columns, whose values are parsed from the
+ * path of each blob instead of being decoded. Equality filters on text
+ * partition columns narrow the prefixes under which blobs are listed, and
+ * other filters on partition columns skip listed blobs before they are
+ * downloaded.
+ *
+ * Blobs that were written with a statistics sidecar (see blob_stats.c) are
+ * skipped when the scan filters show that none of their rows can match, and
+ * only the matching blocks of uncompressed csv and tsv blobs are read.
+ *
+ * Scans below an Append, such as those of a partitioned table with one
+ * foreign table per partition, run asynchronously on PostgreSQL 14 and
+ * later. Each of them downloads its current blob in a background thread,
+ * and the Append takes rows from whichever scan has data available, such
+ * that downloads of all partitions overlap.
+ *
+ * Inserts are implemented in blob_fdw_modify.c.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <limits.h>
+#include <math.h>
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "access/parallel.h"
+#include "access/reloptions.h"
+#include "access/sysattr.h"
+#include "catalog/pg_foreign_server.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_type.h"
+#include "catalog/pg_user_mapping.h"
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#include "commands/vacuum.h"
+#if PG_VERSION_NUM >= 140000
+#include "executor/execAsync.h"
+#endif
+#include "executor/executor.h"
+#include "foreign/fdwapi.h"
+#include "foreign/foreign.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/planmain.h"
+#include "optimizer/restrictinfo.h"
+#include "pgazure/blob_estimates.h"
+#include "pgazure/blob_fdw.h"
+#include "pgazure/blob_prefetcher.h"
+#include "pgazure/blob_scan.h"
+#include "pgazure/blob_stats.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/codecs.h"
+#include "pgazure/compression.h"
+#include "pgazure/gzip_index.h"
+#include "pgazure/path_template.h"
+#include "pgazure/sample_blob.h"
+#include "pgazure/storage_account.h"
+#include "pgazure/zstd_dictionary.h"
+#include "port/atomics.h"
+#include "storage/latch.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/sampling.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
+
+
+/* number of pages assumed when the size of the blobs cannot be determined */
+#define DEFAULT_BLOB_PAGES 10
+
+/* maximum number of prefixes under which blobs of a path template are listed */
+#define MAX_LISTING_PREFIXES 64
+
+/* number of rows ANALYZE decodes from each sampled range of a blob */
+#define ANALYZE_ROWS_PER_RANGE 100
+
+
+/*
+ * BlobFdwOption describes a valid option and the catalog in which it can
+ * be specified.
+ */
+typedef struct BlobFdwOption
+{
+	const char *optionName;
+	Oid optionContextId;
+} BlobFdwOption;
+
+/*
+ * BlobFdwPlanState contains the size estimates of a foreign table, which are
+ * computed in GetForeignRelSize and used in GetForeignPaths.
+ */
+typedef struct BlobFdwPlanState
+{
+	BlobFdwOptions *options;
+	double blobCount;
+	double storedBytes;
+
+	/* prefixes under which to list blobs, as String nodes */
+	List *listingPrefixes;
+
+	/* attribute numbers of the columns in the path template */
+	Bitmapset *partitionColumns;
+} BlobFdwPlanState;
+
+/*
+ * BlobFdwPartitioning describes the columns of a foreign table whose values
+ * are parsed from the paths of its blobs rather than decoded from them.
+ */
+typedef struct BlobFdwPartitioning
+{
+	PathTemplate *pathTemplate;
+
+	/* attribute number of the column of each placeholder */
+	AttrNumber *partitionColumns;
+
+	/* descriptor of the columns that are stored in the blobs */
+	TupleDesc blobTupleDescriptor;
+
+	/* attribute number of each column that is stored in the blobs */
+	AttrNumber *blobColumns;
+} BlobFdwPartitioning;
+
+/*
+ * BlobFdwSharedState is the state of a parallel scan in dynamic shared memory.
+ *
+ * data contains the connection string followed by the paths of the blobs,
+ * each terminated by a zero byte, and the ETags of the blobs that have a
+ * statistics sidecar (see BlobFdwScanState), each preceded by '?' if it is
+ * not known and '=' otherwise, and terminated by a zero byte.
+ */
+typedef struct BlobFdwSharedState
+{
+	/* index of the next blob to read */
+	pg_atomic_uint32 nextBlobIndex;
+
+	/* number of blobs and bytes read by all participants */
+	pg_atomic_uint64 blobsRead;
+	pg_atomic_uint64 bytesRead;
+
+	/* number of blobs skipped based on their statistics */
+	pg_atomic_uint64 blobsSkipped;
+
+	int blobCount;
+	char data[FLEXIBLE_ARRAY_MEMBER];
+} BlobFdwSharedState;
+
+/*
+ * BlobFdwScanState is the execution state of a foreign scan.
+ */
+typedef struct BlobFdwScanState
+{
+	BlobFdwOptions *options;
+	char *connectionString;
+
+	/* descriptor of the foreign table */
+	TupleDesc tupleDescriptor;
+
+	/* columns parsed from blob paths, or NULL if there is no path template */
+	BlobFdwPartitioning *partitioning;
+
+	/* descriptor of the columns that are decoded from the blobs */
+	TupleDesc blobTupleDescriptor;
+
+	/* for each decoded column, whether the query uses it */
+	bool *projectedColumns;
+
+	/* values of the partition columns of the current blob */
+	Datum *partitionValues;
+	bool *partitionNulls;
+
+	/* decoded values of a row, if there is a path template */
+	Datum *blobValues;
+	bool *blobNulls;
+
+	/* blobs to read */
+	int blobCount;
+	char **blobPaths;
+
+	/*
+	 * ETag of each blob if it has a statistics sidecar, an empty string if it
+	 * does not, or NULL if that is not known from the listing.
+	 */
+	char **statsBlobETags;
+
+	/* scan filters and the predicates derived from them for statistics */
+	List *statsClauses;
+	Index relationId;
+	ExprContext *exprContext;
+	MemoryContext statsContext;
+	List *statsPredicates;
+	bool statsPredicatesBuilt;
+
+	/* index of the next blob to read if the scan is not parallel */
+	int nextBlobIndex;
+
+	/* shared state if the scan is parallel, NULL otherwise */
+	BlobFdwSharedState *sharedState;
+
+	/* memory context for the state of the current blob */
+	MemoryContext blobContext;
+
+	/* whether blobs are downloaded in the background */
+	bool asyncCapable;
+
+	/* download of the current blob if done in the background, or NULL */
+	BlobPrefetcher *prefetcher;
+
+	/* decoder of the current blob, or NULL if no blob is open */
+	TupleDecoder *decoder;
+	bool decoderStarted;
+	TupleBatch *batch;
+	int batchRowIndex;
+
+	/* number of bytes read from the current blob */
+	uint64 currentBlobBytes;
+
+	/* statistics for EXPLAIN ANALYZE */
+	uint64 blobsRead;
+	uint64 bytesRead;
+	uint64 blobsPruned;
+	uint64 blobsSkipped;
+} BlobFdwScanState;
+
+/*
+ * BlobFdwSampleState is the state of collecting sample rows for ANALYZE.
+ */
+typedef struct BlobFdwSampleState
+{
+	TupleDesc tupleDescriptor;
+	HeapTuple *rows;
+	int targetRowCount;
+	int sampleRowCount;
+
+	/* number of rows seen so far, including the rows that sampled rows stand for */
+	double totalRowCount;
+
+	/* number of rows to skip before the next row replaces one in the sample */
+	double rowsToSkip;
+	ReservoirStateData reservoirState;
+} BlobFdwSampleState;
+
+/*
+ * BlobFdwSampledRows collects the rows that ANALYZE sampled from a blob.
+ */
+typedef struct BlobFdwSampledRows
+{
+	TupleDesc tupleDescriptor;
+	List *tupleList;
+} BlobFdwSampledRows;
+
+/*
+ * ListBlobPathsContext is passed to AddBlobPath via ListBlobs.
+ */
+typedef struct ListBlobPathsContext
+{
+	List *blobPathList;
+	MemoryContext memoryContext;
+
+	/* ETags of the blobs in blobPathList */
+	char **blobETags;
+	int maxBlobCount;
+
+	/* paths of the blobs that have a statistics sidecar */
+	List *statsPathList;
+} ListBlobPathsContext;
+
+
+static void CheckServerAccountOption(char *accountString);
+static List * UserMappingOptionList(Oid serverId);
+static void BlobFdwGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel,
+                                     Oid foreignTableId);
+static void BlobFdwGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel,
+                                   Oid foreignTableId);
+static double ParallelDivisor(int workerCount);
+static void BlobFdwGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+                                        RelOptInfo *inputRel, RelOptInfo *outputRel,
+                                        void *extra);
+static ForeignScan * BlobFdwGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel,
+                                           Oid foreignTableId, ForeignPath *bestPath,
+                                           List *targetList, List *scanClauses,
+                                           Plan *outerPlan);
+static bool BlobFdwIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
+                                             RangeTblEntry *rte);
+static void BlobFdwBeginForeignScan(ForeignScanState *node, int eflags);
+static bool IsAggregateScan(ForeignScanState *node);
+static TupleTableSlot * BlobFdwIterateForeignScan(ForeignScanState *node);
+static bool OpenNextBlob(BlobFdwScanState *scanState);
+static bool SelectBlobRanges(BlobFdwScanState *scanState, int blobIndex,
+                             char **byteRanges);
+static void CloseCurrentBlob(BlobFdwScanState *scanState);
+static void BlobFdwReScanForeignScan(ForeignScanState *node);
+static void BlobFdwEndForeignScan(ForeignScanState *node);
+static void BlobFdwShutdownForeignScan(ForeignScanState *node);
+static void BlobFdwExplainForeignScan(ForeignScanState *node, ExplainState *es);
+static Size BlobFdwEstimateDSMForeignScan(ForeignScanState *node,
+                                          ParallelContext *parallelContext);
+static void BlobFdwInitializeDSMForeignScan(ForeignScanState *node,
+                                            ParallelContext *parallelContext,
+                                            void *coordinate);
+static void BlobFdwReInitializeDSMForeignScan(ForeignScanState *node,
+                                              ParallelContext *parallelContext,
+                                              void *coordinate);
+static void BlobFdwInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc,
+                                               void *coordinate);
+static bool BlobFdwAnalyzeForeignTable(Relation relation,
+                                       AcquireSampleRowsFunc *acquireSampleRowsFunc,
+                                       BlockNumber *totalPages);
+static int BlobFdwAcquireSampleRows(Relation relation, int logLevel, HeapTuple *rows,
+                                    int targetRowCount, double *totalRowCount,
+                                    double *totalDeadRowCount);
+static bool ShouldSampleBlob(char *connectionString, BlobFdwOptions *options,
+                             char *path, int rangeCount, uint64 *blobSize,
+                             GzipIndex **gzipIndex, ZstdSeekTable **zstdSeekTable);
+static void CollectSampledRow(void *context, Datum *columnValues, bool *columnNulls);
+static void AddSampleRow(BlobFdwSampleState *sampleState, Datum *columnValues,
+                         bool *columnNulls, double rowCount);
+static bool EstimateSizeFromRelationStats(RelOptInfo *baserel, BlobFdwOptions *options,
+                                          double *blobCount, double *storedBytes,
+                                          double *rowCount);
+static bool EstimateListingSize(BlobFdwOptions *options, List *prefixList,
+                                double *blobCount, double *storedBytes,
+                                double *rowCount);
+static List * PartitionListingPrefixes(RelOptInfo *baserel, Oid foreignTableId,
+                                       PathTemplate *pathTemplate,
+                                       bool canonicalPartitionValues,
+                                       Bitmapset **partitionColumns);
+static List * PartitionEqualityValues(Expr *clause, Index relationId,
+                                      AttrNumber attributeNumber, Oid columnTypeId);
+static char * PartitionValueString(Datum value, Oid typeId);
+static bool IsColumnReference(Node *node, Index relationId, AttrNumber attributeNumber);
+static List * PartitionFilterClauses(RelOptInfo *baserel, List *scanClauses,
+                                     Bitmapset *partitionColumns);
+static bool ContainsExecParams(Node *node, void *context);
+static BlobFdwPartitioning * BuildPartitioning(TupleDesc tupleDescriptor,
+                                               char *pathTemplateString);
+static bool ParsePartitionValues(BlobFdwPartitioning *partitioning,
+                                 TupleDesc tupleDescriptor, char *path,
+                                 Datum *values, bool *nulls);
+static void GetPartitionedRow(BlobFdwPartitioning *partitioning, Datum *blobValues,
+                              bool *blobNulls, Datum *partitionValues,
+                              bool *partitionNulls, Datum *values, bool *nulls);
+static List * PruneBlobPaths(ForeignScanState *node, List *blobPathList,
+                             char **statsBlobETags);
+static void AddBlobPath(void *context, CloudBlob *blob);
+#if PG_VERSION_NUM >= 140000
+static bool BlobFdwIsForeignPathAsyncCapable(ForeignPath *path);
+static void BlobFdwForeignAsyncRequest(AsyncRequest *areq);
+static void BlobFdwForeignAsyncConfigureWait(AsyncRequest *areq);
+static void BlobFdwForeignAsyncNotify(AsyncRequest *areq);
+static bool ScanHasDataAvailable(ForeignScanState *node);
+#endif
+static void FreeBlobPrefetcherCallback(void *arg);
+
+
+/*
+ * Options that can be specified for servers, user mappings and foreign tables.
+ * Servers only take an account name, connection strings with credentials go
+ * in a user mapping.
+ */
+static const BlobFdwOption ValidBlobFdwOptions[] = {
+	{ "account", ForeignServerRelationId },
+	{ "account", UserMappingRelationId },
+	{ "container", ForeignServerRelationId },
+	{ "container", ForeignTableRelationId },
+	{ "path", ForeignTableRelationId },
+	{ "prefix", ForeignTableRelationId },
+	{ "path_template", ForeignTableRelationId },
+	{ "canonical_partition_values", ForeignTableRelationId },
+	{ "decoder", ForeignTableRelationId },
+	{ "compression", ForeignTableRelationId },
+	{ "suffix", ForeignTableRelationId },
+	{ "max_blob_size", ForeignTableRelationId },
+	{ "batch_size", ForeignServerRelationId },
+	{ "batch_size", ForeignTableRelationId },
+	{ "write_stats", ForeignTableRelationId },
+	{ "bloom_columns", ForeignTableRelationId },
+	{ "use_remote_estimate", ForeignServerRelationId },
+	{ "use_remote_estimate", ForeignTableRelationId },
+	{ NULL, InvalidOid }
+};
+
+
+/* maximum number of blobs downloaded in the background by a backend */
+int MaxAsyncBlobDownloads = 16;
+
+/* size in kB above which ANALYZE samples ranges of a blob, or -1 */
+int AnalyzeSampleBlobSize = 65536;
+
+/* number of blobs currently downloaded in the background */
+static int ActiveAsyncBlobDownloads = 0;
+
+PG_FUNCTION_INFO_V1(azure_blob_fdw_handler);
+PG_FUNCTION_INFO_V1(azure_blob_fdw_validator);
+
+
+/*
+ * azure_blob_fdw_handler returns the callbacks of the azure_blob foreign
+ * data wrapper.
+ */
+Datum
+azure_blob_fdw_handler(PG_FUNCTION_ARGS)
+{
+	FdwRoutine *fdwRoutine = makeNode(FdwRoutine);
+
+	fdwRoutine->GetForeignRelSize = BlobFdwGetForeignRelSize;
+	fdwRoutine->GetForeignPaths = BlobFdwGetForeignPaths;
+	fdwRoutine->GetForeignPlan = BlobFdwGetForeignPlan;
+	fdwRoutine->GetForeignUpperPaths = BlobFdwGetForeignUpperPaths;
+	fdwRoutine->BeginForeignScan = BlobFdwBeginForeignScan;
+	fdwRoutine->IterateForeignScan = BlobFdwIterateForeignScan;
+	fdwRoutine->ReScanForeignScan = BlobFdwReScanForeignScan;
+	fdwRoutine->EndForeignScan = BlobFdwEndForeignScan;
+	fdwRoutine->ShutdownForeignScan = BlobFdwShutdownForeignScan;
+	fdwRoutine->ExplainForeignScan = BlobFdwExplainForeignScan;
+	fdwRoutine->AnalyzeForeignTable = BlobFdwAnalyzeForeignTable;
+	fdwRoutine->IsForeignScanParallelSafe = BlobFdwIsForeignScanParallelSafe;
+	fdwRoutine->EstimateDSMForeignScan = BlobFdwEstimateDSMForeignScan;
+	fdwRoutine->InitializeDSMForeignScan = BlobFdwInitializeDSMForeignScan;
+	fdwRoutine->ReInitializeDSMForeignScan = BlobFdwReInitializeDSMForeignScan;
+	fdwRoutine->InitializeWorkerForeignScan = BlobFdwInitializeWorkerForeignScan;
+	fdwRoutine->IsForeignRelUpdatable = BlobFdwIsForeignRelUpdatable;
+	fdwRoutine->BeginForeignModify = BlobFdwBeginForeignModify;
+	fdwRoutine->ExecForeignInsert = BlobFdwExecForeignInsert;
+	fdwRoutine->EndForeignModify = BlobFdwEndForeignModify;
+	fdwRoutine->BeginForeignInsert = BlobFdwBeginForeignInsert;
+	fdwRoutine->EndForeignInsert = BlobFdwEndForeignInsert;
+#if PG_VERSION_NUM >= 140000
+	fdwRoutine->ExecForeignBatchInsert = BlobFdwExecForeignBatchInsert;
+	fdwRoutine->GetForeignModifyBatchSize = BlobFdwGetForeignModifyBatchSize;
+	fdwRoutine->IsForeignPathAsyncCapable = BlobFdwIsForeignPathAsyncCapable;
+	fdwRoutine->ForeignAsyncRequest = BlobFdwForeignAsyncRequest;
+	fdwRoutine->ForeignAsyncConfigureWait = BlobFdwForeignAsyncConfigureWait;
+	fdwRoutine->ForeignAsyncNotify = BlobFdwForeignAsyncNotify;
+#endif
+
+	PG_RETURN_POINTER(fdwRoutine);
+}
+
+
+/*
+ * azure_blob_fdw_validator checks the options of azure_blob servers and
+ * foreign tables.
+ */
+Datum
+azure_blob_fdw_validator(PG_FUNCTION_ARGS)
+{
+	List *optionList = untransformRelOptions(PG_GETARG_DATUM(0));
+	Oid optionContextId = PG_GETARG_OID(1);
+	bool hasPath = false;
+	bool hasPrefix = false;
+	bool hasPathTemplate = false;
+	ListCell *optionCell = NULL;
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+		bool optionValid = false;
+
+		for (const BlobFdwOption *validOption = ValidBlobFdwOptions;
+		     validOption->optionName != NULL; validOption++)
+		{
+			if (validOption->optionContextId == optionContextId &&
+			    strcmp(validOption->optionName, option->defname) == 0)
+			{
+				optionValid = true;
+				break;
+			}
+		}
+
+		if (!optionValid)
+		{
+			StringInfo validOptionNames = makeStringInfo();
+
+			for (const BlobFdwOption *validOption = ValidBlobFdwOptions;
+			     validOption->optionName != NULL; validOption++)
+			{
+				if (validOption->optionContextId != optionContextId)
+				{
+					continue;
+				}
+
+				appendStringInfo(validOptionNames, "%s%s",
+				                 validOptionNames->len > 0 ? ", " : "",
+				                 validOption->optionName);
+			}
+
+			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+			                errmsg("invalid option \"%s\"", option->defname),
+			                validOptionNames->len > 0 ?
+			                errhint("Valid options in this context are: %s",
+			                        validOptionNames->data) :
+			                errhint("There are no valid options in this context.")));
+		}
+
+		if (strcmp(option->defname, "account") == 0 &&
+		    optionContextId == ForeignServerRelationId)
+		{
+			CheckServerAccountOption(defGetString(option));
+		}
+		else if (strcmp(option->defname, "path") == 0)
+		{
+			hasPath = true;
+		}
+		else if (strcmp(option->defname, "prefix") == 0)
+		{
+			hasPrefix = true;
+		}
+		else if (strcmp(option->defname, "path_template") == 0)
+		{
+			hasPathTemplate = true;
+
+			/* throws an error if the template is malformed */
+			ParsePathTemplate(defGetString(option));
+		}
+		else if (strcmp(option->defname, "max_blob_size") == 0 ||
+		         strcmp(option->defname, "batch_size") == 0)
+		{
+			if (defGetInt64(option) <= 0)
+			{
+				ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+				                errmsg("%s requires a positive integer value",
+				                       option->defname)));
+			}
+		}
+		else if (strcmp(option->defname, "write_stats") == 0 ||
+		         strcmp(option->defname, "use_remote_estimate") == 0 ||
+		         strcmp(option->defname, "canonical_partition_values") == 0)
+		{
+			/* throws an error if the value is not a boolean */
+			defGetBoolean(option);
+		}
+	}
+
+	if (hasPath + hasPrefix + hasPathTemplate > 1)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+		                errmsg("only one of the path, prefix, and path_template options "
+		                       "can be used")));
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * CheckServerAccountOption throws an error if the account option of a server
+ * is a connection string, since server options are visible to every user
+ * with USAGE on the server.
+ */
+static void
+CheckServerAccountOption(char *accountString)
+{
+	if (IsConnectionString(accountString))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+		                errmsg("account option of azure_blob servers must be the "
+		                       "name of a storage account"),
+		                errhint("Store the connection string using "
+		                        "azure.add_storage_account or in the account "
+		                        "option of a user mapping.")));
+	}
+}
+
+
+/*
+ * UserMappingOptionList returns the options of the user mapping for the
+ * current user on the given server, or of the PUBLIC user mapping, or NIL
+ * if there is neither. Unlike GetUserMapping, a missing user mapping is not
+ * an error.
+ */
+static List *
+UserMappingOptionList(Oid serverId)
+{
+	HeapTuple userMappingTuple = SearchSysCache2(USERMAPPINGUSERSERVER,
+	                                             ObjectIdGetDatum(GetUserId()),
+	                                             ObjectIdGetDatum(serverId));
+	List *optionList = NIL;
+	bool isNull = false;
+
+	if (!HeapTupleIsValid(userMappingTuple))
+	{
+		userMappingTuple = SearchSysCache2(USERMAPPINGUSERSERVER,
+		                                   ObjectIdGetDatum(InvalidOid),
+		                                   ObjectIdGetDatum(serverId));
+		if (!HeapTupleIsValid(userMappingTuple))
+		{
+			return NIL;
+		}
+	}
+
+	Datum optionsDatum = SysCacheGetAttr(USERMAPPINGUSERSERVER, userMappingTuple,
+	                                     Anum_pg_user_mapping_umoptions, &isNull);
+	if (!isNull)
+	{
+		optionList = untransformRelOptions(optionsDatum);
+	}
+
+	ReleaseSysCache(userMappingTuple);
+
+	return optionList;
+}
+
+
+/*
+ * GetBlobFdwOptions returns the options of a foreign table, including the
+ * options of its server and the account of the user mapping. Options of the
+ * foreign table take precedence over those of the server, and the account of
+ * the user mapping over that of the server.
+ */
+BlobFdwOptions *
+GetBlobFdwOptions(Oid foreignTableId)
+{
+	ForeignTable *foreignTable = GetForeignTable(foreignTableId);
+	ForeignServer *foreignServer = GetForeignServer(foreignTable->serverid);
+	List *optionList = list_concat(list_copy(foreignServer->options),
+	                               foreignTable->options);
+	List *userMappingOptionList = UserMappingOptionList(foreignServer->serverid);
+	ListCell *optionCell = NULL;
+
+	BlobFdwOptions *options = palloc0(sizeof(BlobFdwOptions));
+	options->decoderString = "auto";
+	options->compressionString = "auto";
+	options->maxBlobSize = DEFAULT_MAX_BLOB_SIZE;
+	options->batchSize = TUPLE_BATCH_SIZE;
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strcmp(option->defname, "account") == 0)
+		{
+			/* servers created before connection strings were rejected */
+			options->accountString = defGetString(option);
+			CheckServerAccountOption(options->accountString);
+		}
+		else if (strcmp(option->defname, "container") == 0)
+		{
+			options->containerName = defGetString(option);
+		}
+		else if (strcmp(option->defname, "path") == 0)
+		{
+			options->path = defGetString(option);
+		}
+		else if (strcmp(option->defname, "prefix") == 0)
+		{
+			options->prefix = defGetString(option);
+		}
+		else if (strcmp(option->defname, "path_template") == 0)
+		{
+			options->pathTemplate = defGetString(option);
+
+			/* all blobs that match the template are under its leading text */
+			options->prefix = ParsePathTemplate(options->pathTemplate)->literals[0];
+		}
+		else if (strcmp(option->defname, "decoder") == 0)
+		{
+			options->decoderString = defGetString(option);
+		}
+		else if (strcmp(option->defname, "compression") == 0)
+		{
+			options->compressionString = defGetString(option);
+		}
+		else if (strcmp(option->defname, "suffix") == 0)
+		{
+			options->suffix = defGetString(option);
+		}
+		else if (strcmp(option->defname, "max_blob_size") == 0)
+		{
+			options->maxBlobSize = defGetInt64(option);
+		}
+		else if (strcmp(option->defname, "batch_size") == 0)
+		{
+			options->batchSize = (int) Min(defGetInt64(option), INT_MAX);
+		}
+		else if (strcmp(option->defname, "write_stats") == 0)
+		{
+			options->writeStats = defGetBoolean(option);
+		}
+		else if (strcmp(option->defname, "bloom_columns") == 0)
+		{
+			options->bloomColumns = defGetString(option);
+		}
+		else if (strcmp(option->defname, "use_remote_estimate") == 0)
+		{
+			options->useRemoteEstimate = defGetBoolean(option);
+		}
+		else if (strcmp(option->defname, "canonical_partition_values") == 0)
+		{
+			options->canonicalPartitionValues = defGetBoolean(option);
+		}
+	}
+
+	foreach(optionCell, userMappingOptionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strcmp(option->defname, "account") == 0)
+		{
+			options->accountString = defGetString(option);
+		}
+	}
+
+	if (options->accountString == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+		                errmsg("account option is required for azure_blob servers "
+		                       "or user mappings")));
+	}
+
+	if (options->containerName == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+		                errmsg("container option is required for azure_blob "
+		                       "servers or foreign tables")));
+	}
+
+	if (options->path == NULL && options->prefix == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+		                errmsg("path, prefix, or path_template option is required for "
+		                       "azure_blob foreign tables")));
+	}
+
+	return options;
+}
+
+
+/*
+ * BlobFdwGetForeignRelSize estimates the number of rows in the foreign table
+ * from the size of the blobs and a sample of one of them, or from the row
+ * density found by ANALYZE.
+ */
+static void
+BlobFdwGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId)
+{
+	BlobFdwOptions *options = GetBlobFdwOptions(foreignTableId);
+	List *listingPrefixList = NIL;
+	Bitmapset *partitionColumns = NULL;
+	double blobCount = 1;
+	double storedBytes = 0;
+	double rowCount = 0;
+	bool estimated = false;
+
+	if (options->path == NULL)
+	{
+		if (options->pathTemplate != NULL)
+		{
+			PathTemplate *pathTemplate = ParsePathTemplate(options->pathTemplate);
+
+			listingPrefixList = PartitionListingPrefixes(baserel, foreignTableId,
+			                                             pathTemplate,
+			                                             options->canonicalPartitionValues,
+			                                             &partitionColumns);
+		}
+		else
+		{
+			listingPrefixList = list_make1(makeString(options->prefix));
+		}
+	}
+
+	if (!options->useRemoteEstimate)
+	{
+		/* use the size found by ANALYZE, if any, without network requests */
+		estimated = EstimateSizeFromRelationStats(baserel, options, &blobCount,
+		                                          &storedBytes, &rowCount);
+	}
+	else if (options->path != NULL)
+	{
+		estimated = EstimateBlobSize(options->accountString, options->containerName,
+		                             options->path, options->decoderString,
+		                             options->compressionString, &storedBytes,
+		                             &rowCount);
+	}
+	else
+	{
+		estimated = EstimateListingSize(options, listingPrefixList, &blobCount,
+		                                &storedBytes, &rowCount);
+	}
+
+	if (!estimated)
+	{
+		blobCount = 1;
+		storedBytes = DEFAULT_BLOB_PAGES * BLCKSZ;
+		rowCount = -1;
+	}
+
+	double pageCount = Max(ceil(storedBytes / BLCKSZ), 1);
+	double tupleCount = 0;
+
+	if (baserel->pages > 0)
+	{
+		/* use the density found by ANALYZE for the current size */
+		double density = baserel->tuples / baserel->pages;
+
+		tupleCount = clamp_row_est(density * pageCount);
+	}
+	else if (rowCount >= 0)
+	{
+		tupleCount = clamp_row_est(rowCount);
+	}
+	else
+	{
+		int tupleWidth = MAXALIGN(baserel->reltarget->width) +
+		                 MAXALIGN(SizeofHeapTupleHeader);
+
+		tupleCount = clamp_row_est(storedBytes / tupleWidth);
+	}
+
+	double selectivity = clauselist_selectivity(root, baserel->baserestrictinfo, 0,
+	                                            JOIN_INNER, NULL);
+
+	baserel->tuples = tupleCount;
+	baserel->rows = clamp_row_est(tupleCount * selectivity);
+
+	BlobFdwPlanState *planState = palloc0(sizeof(BlobFdwPlanState));
+	planState->options = options;
+	planState->blobCount = Max(blobCount, 1);
+	planState->storedBytes = storedBytes;
+	planState->listingPrefixes = listingPrefixList;
+	planState->partitionColumns = partitionColumns;
+
+	baserel->fdw_private = planState;
+}
+
+
+/*
+ * BlobFdwGetForeignPaths adds a path that reads all blobs, and a partial path
+ * that spreads the blobs across parallel workers.
+ *
+ * The cost of a scan is a request per blob, the cost of transferring the
+ * bytes, and the CPU cost of producing and filtering the tuples.
+ */
+static void
+BlobFdwGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId)
+{
+	BlobFdwPlanState *planState = (BlobFdwPlanState *) baserel->fdw_private;
+	double pageCount = Max(ceil(planState->storedBytes / BLCKSZ), 1);
+
+	Cost startupCost = baserel->baserestrictcost.startup + BlobRequestCost;
+	Cost cpuPerTuple = cpu_tuple_cost + baserel->baserestrictcost.per_tuple;
+	Cost runCost = (planState->blobCount - 1) * BlobRequestCost +
+	               pageCount * BlobTransferCost +
+	               cpuPerTuple * baserel->tuples;
+
+	List *fdwPrivate = list_make2(ProjectedColumnList(baserel, baserel->max_attr),
+	                              planState->listingPrefixes);
+
+#if PG_VERSION_NUM >= 170000
+	ForeignPath *path = create_foreignscan_path(root, baserel, NULL, baserel->rows,
+	                                            startupCost, startupCost + runCost,
+	                                            NIL, NULL, NULL, NIL, fdwPrivate);
+#else
+	ForeignPath *path = create_foreignscan_path(root, baserel, NULL, baserel->rows,
+	                                            startupCost, startupCost + runCost,
+	                                            NIL, NULL, NULL, fdwPrivate);
+#endif
+
+	add_path(baserel, (Path *) path);
+
+	if (!baserel->consider_parallel || planState->blobCount < 2)
+	{
+		return;
+	}
+
+	/* each participant reads whole blobs */
+	int workerCount = compute_parallel_worker(baserel, pageCount, -1,
+	                                          max_parallel_workers_per_gather);
+	workerCount = Min(workerCount, (int) planState->blobCount);
+
+	if (workerCount <= 0)
+	{
+		return;
+	}
+
+	double parallelDivisor = ParallelDivisor(workerCount);
+	double partialRows = clamp_row_est(baserel->rows / parallelDivisor);
+	Cost partialRunCost = runCost / parallelDivisor;
+
+#if PG_VERSION_NUM >= 170000
+	ForeignPath *partialPath = create_foreignscan_path(root, baserel, NULL, partialRows,
+	                                                   startupCost,
+	                                                   startupCost + partialRunCost,
+	                                                   NIL, NULL, NULL, NIL, fdwPrivate);
+#else
+	ForeignPath *partialPath = create_foreignscan_path(root, baserel, NULL, partialRows,
+	                                                   startupCost,
+	                                                   startupCost + partialRunCost,
+	                                                   NIL, NULL, NULL, fdwPrivate);
+#endif
+
+	partialPath->path.parallel_aware = true;
+	partialPath->path.parallel_safe = true;
+	partialPath->path.parallel_workers = workerCount;
+
+	add_partial_path(baserel, (Path *) partialPath);
+}
+
+
+/*
+ * ParallelDivisor returns the number of participants that share the work of
+ * a parallel scan, in the same way as the cost model for parallel sequential
+ * scans.
+ */
+static double
+ParallelDivisor(int workerCount)
+{
+	double parallelDivisor = workerCount;
+
+	if (parallel_leader_participation)
+	{
+		double leaderContribution = 1.0 - (0.3 * workerCount);
+
+		if (leaderContribution > 0)
+		{
+			parallelDivisor += leaderContribution;
+		}
+	}
+
+	return parallelDivisor;
+}
+
+
+/*
+ * BlobFdwGetForeignUpperPaths adds a path that computes aggregates over a
+ * foreign table from blob statistics (see blob_fdw_aggregate.c). Tables with
+ * a path template are excluded, since their partition columns are not in the
+ * statistics.
+ */
+static void
+BlobFdwGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+                            RelOptInfo *inputRel, RelOptInfo *outputRel, void *extra)
+{
+	BlobFdwPlanState *planState = (BlobFdwPlanState *) inputRel->fdw_private;
+
+	if ((stage != UPPERREL_GROUP_AGG && stage != UPPERREL_PARTIAL_GROUP_AGG) ||
+	    !IS_SIMPLE_REL(inputRel) || planState == NULL ||
+	    planState->options->pathTemplate != NULL)
+	{
+		return;
+	}
+
+	AddBlobAggregatePath(root, stage, inputRel, outputRel, planState->blobCount);
+}
+
+
+/*
+ * BlobFdwGetForeignPlan creates a foreign scan plan. All filters are
+ * evaluated by the executor. Filters that only involve partition columns
+ * are also passed in fdw_exprs, to skip blobs based on their paths.
+ */
+static ForeignScan *
+BlobFdwGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
+                      ForeignPath *bestPath, List *targetList, List *scanClauses,
+                      Plan *outerPlan)
+{
+	if (IS_UPPER_REL(baserel))
+	{
+		return BlobFdwGetAggregatePlan(root, baserel, bestPath, targetList, outerPlan);
+	}
+
+	BlobFdwPlanState *planState = (BlobFdwPlanState *) baserel->fdw_private;
+	List *partitionFilterList = PartitionFilterClauses(baserel, scanClauses,
+	                                                   planState->partitionColumns);
+
+	scanClauses = extract_actual_clauses(scanClauses, false);
+
+	return make_foreignscan(targetList, scanClauses, baserel->relid,
+	                        partitionFilterList, bestPath->fdw_private, NIL, NIL,
+	                        outerPlan);
+}
+
+
+/*
+ * EstimateSizeFromRelationStats estimates the number of blobs and bytes from
+ * the number of pages that ANALYZE stored for the foreign table. The number
+ * of blobs is not known, so we assume the blobs are as large as inserts make
+ * them. Returns false if the table has not been analyzed.
+ */
+static bool
+EstimateSizeFromRelationStats(RelOptInfo *baserel, BlobFdwOptions *options,
+                              double *blobCount, double *storedBytes,
+                              double *rowCount)
+{
+	if (baserel->pages == 0)
+	{
+		return false;
+	}
+
+	*storedBytes = (double) baserel->pages * BLCKSZ;
+	*blobCount = options->path != NULL ? 1 :
+				 Max(ceil(*storedBytes / options->maxBlobSize), 1);
+
+	/* the row count follows from the density of the table */
+	*rowCount = -1;
+
+	return true;
+}
+
+
+/*
+ * EstimateListingSize estimates the number of blobs, bytes, and rows under
+ * the given prefixes. Returns false if an estimate could not be obtained.
+ */
+static bool
+EstimateListingSize(BlobFdwOptions *options, List *prefixList, double *blobCount,
+                    double *storedBytes, double *rowCount)
+{
+	ListCell *prefixCell = NULL;
+
+	*blobCount = 0;
+	*storedBytes = 0;
+	*rowCount = 0;
+
+	foreach(prefixCell, prefixList)
+	{
+		char *prefix = strVal(lfirst(prefixCell));
+		double prefixBlobCount = 0;
+		double prefixStoredBytes = 0;
+		double prefixRowCount = 0;
+
+		if (!EstimatePrefixSize(options->accountString, options->containerName, prefix,
+		                        options->decoderString, options->compressionString,
+		                        &prefixBlobCount, &prefixStoredBytes, &prefixRowCount))
+		{
+			return false;
+		}
+
+		*blobCount += prefixBlobCount;
+		*storedBytes += prefixStoredBytes;
+		*rowCount += prefixRowCount;
+	}
+
+	return true;
+}
+
+
+/*
+ * PartitionListingPrefixes returns the prefixes under which the blobs that
+ * can satisfy the equality filters on the partition columns are listed, as
+ * String nodes. The attribute numbers of the partition columns are returned
+ * in partitionColumns.
+ *
+ * Only text columns narrow the prefixes, unless canonicalPartitionValues is
+ * set. The input functions of other types accept several spellings, such as
+ * hour=07 for 7, which a prefix built from the value would miss.
+ */
+static List *
+PartitionListingPrefixes(RelOptInfo *baserel, Oid foreignTableId,
+                         PathTemplate *pathTemplate, bool canonicalPartitionValues,
+                         Bitmapset **partitionColumns)
+{
+	List **candidateValues = palloc0(pathTemplate->placeholderCount * sizeof(List *));
+	List *prefixList = NIL;
+	ListCell *prefixCell = NULL;
+
+	for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+	     placeholderIndex++)
+	{
+		char *columnName = pathTemplate->columnNames[placeholderIndex];
+		AttrNumber attributeNumber = get_attnum(foreignTableId, columnName);
+		ListCell *restrictInfoCell = NULL;
+
+		if (attributeNumber == InvalidAttrNumber)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FDW_COLUMN_NAME_NOT_FOUND),
+			                errmsg("column \"%s\" of path_template does not exist",
+			                       columnName)));
+		}
+
+		*partitionColumns = bms_add_member(*partitionColumns, attributeNumber);
+
+		Oid columnTypeId = get_atttype(foreignTableId, attributeNumber);
+
+		if (!canonicalPartitionValues && columnTypeId != TEXTOID &&
+		    columnTypeId != VARCHAROID)
+		{
+			/* filters on the column only skip blobs after listing */
+			continue;
+		}
+
+		foreach(restrictInfoCell, baserel->baserestrictinfo)
+		{
+			RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+			List *valueList = PartitionEqualityValues(restrictInfo->clause,
+			                                          baserel->relid, attributeNumber,
+			                                          columnTypeId);
+
+			if (valueList != NIL)
+			{
+				candidateValues[placeholderIndex] = valueList;
+				break;
+			}
+		}
+	}
+
+	foreach(prefixCell, PathTemplateListingPrefixes(pathTemplate, candidateValues,
+	                                                MAX_LISTING_PREFIXES))
+	{
+		prefixList = lappend(prefixList, makeString((char *) lfirst(prefixCell)));
+	}
+
+	return prefixList;
+}
+
+
+/*
+ * PartitionEqualityValues returns the values to which a clause of the form
+ * column = value or column IN (value, ...) restricts a partition column of
+ * the given type, as they appear in blob paths, or NIL if the clause has a
+ * different form or the type has no path spelling (see PartitionValueString).
+ * For text, only deterministic collations are considered, since otherwise
+ * equal values can be spelled differently.
+ */
+static List *
+PartitionEqualityValues(Expr *clause, Index relationId, AttrNumber attributeNumber,
+                        Oid columnTypeId)
+{
+	TypeCacheEntry *typeEntry = lookup_type_cache(columnTypeId, TYPECACHE_EQ_OPR);
+	Oid equalityOperatorId = typeEntry->eq_opr;
+	List *valueList = NIL;
+
+	if (!OidIsValid(equalityOperatorId))
+	{
+		return NIL;
+	}
+
+	if (IsA(clause, OpExpr))
+	{
+		OpExpr *opExpr = (OpExpr *) clause;
+
+		if (opExpr->opno != equalityOperatorId || list_length(opExpr->args) != 2 ||
+		    (OidIsValid(opExpr->inputcollid) &&
+		     !get_collation_isdeterministic(opExpr->inputcollid)))
+		{
+			return NIL;
+		}
+
+		Node *columnNode = (Node *) linitial(opExpr->args);
+		Node *valueNode = (Node *) lsecond(opExpr->args);
+
+		if (!IsColumnReference(columnNode, relationId, attributeNumber))
+		{
+			columnNode = (Node *) lsecond(opExpr->args);
+			valueNode = (Node *) linitial(opExpr->args);
+		}
+
+		if (!IsColumnReference(columnNode, relationId, attributeNumber) ||
+		    !IsA(valueNode, Const) || ((Const *) valueNode)->constisnull)
+		{
+			return NIL;
+		}
+
+		Const *valueConst = (Const *) valueNode;
+		char *valueString = PartitionValueString(valueConst->constvalue,
+		                                         valueConst->consttype);
+		if (valueString == NULL)
+		{
+			return NIL;
+		}
+
+		valueList = list_make1(valueString);
+	}
+	else if (IsA(clause, ScalarArrayOpExpr))
+	{
+		ScalarArrayOpExpr *arrayOpExpr = (ScalarArrayOpExpr *) clause;
+
+		if (!arrayOpExpr->useOr || arrayOpExpr->opno != equalityOperatorId ||
+		    (OidIsValid(arrayOpExpr->inputcollid) &&
+		     !get_collation_isdeterministic(arrayOpExpr->inputcollid)))
+		{
+			return NIL;
+		}
+
+		Node *columnNode = (Node *) linitial(arrayOpExpr->args);
+		Node *arrayNode = (Node *) lsecond(arrayOpExpr->args);
+
+		if (!IsColumnReference(columnNode, relationId, attributeNumber) ||
+		    !IsA(arrayNode, Const) || ((Const *) arrayNode)->constisnull)
+		{
+			return NIL;
+		}
+
+		ArrayType *array = DatumGetArrayTypeP(((Const *) arrayNode)->constvalue);
+		Oid elementTypeId = ARR_ELEMTYPE(array);
+		Datum *elements = NULL;
+		bool *elementNulls = NULL;
+		int elementCount = 0;
+		int16 elementLength = 0;
+		bool elementByValue = false;
+		char elementAlign = 0;
+
+		get_typlenbyvalalign(elementTypeId, &elementLength, &elementByValue,
+		                     &elementAlign);
+		deconstruct_array(array, elementTypeId, elementLength, elementByValue,
+		                  elementAlign, &elements, &elementNulls, &elementCount);
+
+		for (int elementIndex = 0; elementIndex < elementCount; elementIndex++)
+		{
+			if (elementNulls[elementIndex])
+			{
+				continue;
+			}
+
+			char *valueString = PartitionValueString(elements[elementIndex],
+			                                         elementTypeId);
+			if (valueString == NULL)
+			{
+				return NIL;
+			}
+
+			valueList = lappend(valueList, valueString);
+		}
+	}
+
+	return valueList;
+}
+
+
+/*
+ * PartitionValueString returns how a value of a partition column is spelled
+ * in blob paths, or NULL if the type has no single spelling that does not
+ * depend on settings. Text is used as is, integers as printed by PostgreSQL
+ * and dates in ISO format, regardless of DateStyle.
+ */
+static char *
+PartitionValueString(Datum value, Oid typeId)
+{
+	switch (typeId)
+	{
+		case TEXTOID:
+		case VARCHAROID:
+		{
+			return TextDatumGetCString(value);
+		}
+
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		{
+			Oid outputFunctionId = InvalidOid;
+			bool isVarlena = false;
+
+			getTypeOutputInfo(typeId, &outputFunctionId, &isVarlena);
+
+			return OidOutputFunctionCall(outputFunctionId, value);
+		}
+
+		case DATEOID:
+		{
+			DateADT date = DatumGetDateADT(value);
+			struct pg_tm tm;
+			char *dateString = palloc(MAXDATELEN + 1);
+
+			if (DATE_NOT_FINITE(date))
+			{
+				return NULL;
+			}
+
+			j2date(date + POSTGRES_EPOCH_JDATE, &tm.tm_year, &tm.tm_mon, &tm.tm_mday);
+			EncodeDateOnly(&tm, USE_ISO_DATES, dateString);
+
+			return dateString;
+		}
+
+		default:
+		{
+			return NULL;
+		}
+	}
+}
+
+
+/*
+ * IsColumnReference returns whether a node is a reference to the given
+ * column, possibly with a binary-compatible cast such as varchar to text.
+ */
+static bool
+IsColumnReference(Node *node, Index relationId, AttrNumber attributeNumber)
+{
+	while (node != NULL && IsA(node, RelabelType))
+	{
+		node = (Node *) ((RelabelType *) node)->arg;
+	}
+
+	if (node == NULL || !IsA(node, Var))
+	{
+		return false;
+	}
+
+	Var *var = (Var *) node;
+
+	return var->varno == relationId && var->varattno == attributeNumber &&
+	       var->varlevelsup == 0;
+}
+
+
+/*
+ * PartitionFilterClauses returns the scan clauses that only involve partition
+ * columns and can be evaluated when the scan starts, before any blob is read.
+ */
+static List *
+PartitionFilterClauses(RelOptInfo *baserel, List *scanClauses,
+                       Bitmapset *partitionColumns)
+{
+	List *filterList = NIL;
+	ListCell *clauseCell = NULL;
+
+	if (partitionColumns == NULL)
+	{
+		return NIL;
+	}
+
+	foreach(clauseCell, scanClauses)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(clauseCell);
+		Node *clause = (Node *) restrictInfo->clause;
+		Bitmapset *columns = NULL;
+		bool onlyPartitionColumns = true;
+		int member = -1;
+
+		if (restrictInfo->pseudoconstant)
+		{
+			continue;
+		}
+
+		pull_varattnos(clause, baserel->relid, &columns);
+
+		if (bms_is_empty(columns))
+		{
+			continue;
+		}
+
+		while ((member = bms_next_member(columns, member)) >= 0)
+		{
+			AttrNumber attributeNumber = member + FirstLowInvalidHeapAttributeNumber;
+
+			if (attributeNumber <= 0 ||
+			    !bms_is_member(attributeNumber, partitionColumns))
+			{
+				onlyPartitionColumns = false;
+				break;
+			}
+		}
+
+		if (!onlyPartitionColumns || contain_volatile_functions(clause) ||
+		    ContainsExecParams(clause, NULL))
+		{
+			continue;
+		}
+
+		filterList = lappend(filterList, restrictInfo->clause);
+	}
+
+	return filterList;
+}
+
+
+/*
+ * ContainsExecParams returns whether an expression depends on values that
+ * are only known while the query runs, such as the outputs of other nodes.
+ */
+static bool
+ContainsExecParams(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Param))
+	{
+		return ((Param *) node)->paramkind != PARAM_EXTERN;
+	}
+
+	if (IsA(node, SubPlan) || IsA(node, AlternativeSubPlan))
+	{
+		return true;
+	}
+
+	return expression_tree_walker(node, ContainsExecParams, context);
+}
+
+
+/*
+ * BlobFdwIsForeignScanParallelSafe returns true, since blobs can be read
+ * from any process.
+ */
+static bool
+BlobFdwIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
+                                 RangeTblEntry *rte)
+{
+	return true;
+}
+
+
+/*
+ * BlobFdwBeginForeignScan sets up the scan state and lists the blobs to read.
+ * Workers of a parallel scan instead get the list from shared memory in
+ * BlobFdwInitializeWorkerForeignScan.
+ */
+static void
+BlobFdwBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	ForeignScan *foreignScan = (ForeignScan *) node->ss.ps.plan;
+
+	if (foreignScan->scan.scanrelid == 0)
+	{
+		BlobFdwBeginAggregateScan(node, eflags);
+		return;
+	}
+
+	Relation relation = node->ss.ss_currentRelation;
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	List *projectedColumnList = (List *) linitial(foreignScan->fdw_private);
+	List *listingPrefixList = (List *) lsecond(foreignScan->fdw_private);
+	ListCell *columnCell = NULL;
+
+	BlobFdwScanState *scanState = palloc0(sizeof(BlobFdwScanState));
+	scanState->options = GetBlobFdwOptions(RelationGetRelid(relation));
+	scanState->partitioning = BuildPartitioning(tupleDescriptor,
+	                                            scanState->options->pathTemplate);
+	scanState->tupleDescriptor = tupleDescriptor;
+	scanState->blobTupleDescriptor = tupleDescriptor;
+
+	bool *projectedColumns = palloc0(tupleDescriptor->natts * sizeof(bool));
+
+	foreach(columnCell, projectedColumnList)
+	{
+		AttrNumber attributeNumber = (AttrNumber) lfirst_int(columnCell);
+
+		projectedColumns[attributeNumber - 1] = true;
+	}
+
+	scanState->projectedColumns = projectedColumns;
+
+	if (scanState->partitioning != NULL)
+	{
+		BlobFdwPartitioning *partitioning = scanState->partitioning;
+		TupleDesc blobTupleDescriptor = partitioning->blobTupleDescriptor;
+
+		scanState->blobTupleDescriptor = blobTupleDescriptor;
+		scanState->projectedColumns = palloc0(Max(blobTupleDescriptor->natts, 1) *
+		                                      sizeof(bool));
+
+		for (int blobColumnIndex = 0; blobColumnIndex < blobTupleDescriptor->natts;
+		     blobColumnIndex++)
+		{
+			AttrNumber attributeNumber = partitioning->blobColumns[blobColumnIndex];
+
+			scanState->projectedColumns[blobColumnIndex] =
+				projectedColumns[attributeNumber - 1];
+		}
+	}
+
+	node->fdw_state = scanState;
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+	{
+		return;
+	}
+
+	scanState->blobContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                               "azure_blob scan",
+	                                               ALLOCSET_DEFAULT_SIZES);
+	scanState->batch = CreateTupleBatch(scanState->blobTupleDescriptor,
+	                                    TUPLE_BATCH_SIZE);
+	scanState->statsClauses = foreignScan->scan.plan.qual;
+	scanState->relationId = foreignScan->scan.scanrelid;
+	scanState->exprContext = node->ss.ps.ps_ExprContext;
+	scanState->statsContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                                "azure_blob statistics",
+	                                                ALLOCSET_DEFAULT_SIZES);
+
+	if (scanState->partitioning != NULL)
+	{
+		int columnCount = tupleDescriptor->natts;
+		int blobColumnCount = Max(scanState->blobTupleDescriptor->natts, 1);
+
+		scanState->partitionValues = palloc0(columnCount * sizeof(Datum));
+		scanState->partitionNulls = palloc0(columnCount * sizeof(bool));
+		scanState->blobValues = palloc0(blobColumnCount * sizeof(Datum));
+		scanState->blobNulls = palloc0(blobColumnCount * sizeof(bool));
+	}
+#if PG_VERSION_NUM >= 140000
+	scanState->asyncCapable = foreignScan->scan.plan.async_capable;
+#endif
+
+	if (foreignScan->scan.plan.parallel_aware && IsParallelWorker())
+	{
+		/* the list of blobs is read from shared memory */
+		return;
+	}
+
+	scanState->connectionString =
+		AccountStringToConnectionString(scanState->options->accountString);
+
+	List *blobPathList = ListBlobPaths(scanState->connectionString,
+	                                   scanState->options, listingPrefixList,
+	                                   &scanState->statsBlobETags);
+	ListCell *blobPathCell = NULL;
+	int blobIndex = 0;
+
+	if (scanState->partitioning != NULL)
+	{
+		blobPathList = PruneBlobPaths(node, blobPathList, scanState->statsBlobETags);
+	}
+
+	scanState->blobCount = list_length(blobPathList);
+	scanState->blobPaths = palloc0(Max(scanState->blobCount, 1) * sizeof(char *));
+
+	foreach(blobPathCell, blobPathList)
+	{
+		scanState->blobPaths[blobIndex++] = (char *) lfirst(blobPathCell);
+	}
+}
+
+
+/*
+ * IsAggregateScan returns whether a foreign scan computes aggregates rather
+ * than scanning the table.
+ */
+static bool
+IsAggregateScan(ForeignScanState *node)
+{
+	return ((ForeignScan *) node->ss.ps.plan)->scan.scanrelid == 0;
+}
+
+
+/*
+ * BlobFdwIterateForeignScan returns the next row of the current blob, moving
+ * on to the next blob when the current one is exhausted.
+ */
+static TupleTableSlot *
+BlobFdwIterateForeignScan(ForeignScanState *node)
+{
+	if (IsAggregateScan(node))
+	{
+		return BlobFdwIterateAggregateScan(node);
+	}
+
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	TupleBatch *batch = scanState->batch;
+
+	ExecClearTuple(slot);
+
+	while (scanState->decoder == NULL || scanState->batchRowIndex >= batch->rowCount)
+	{
+		if (scanState->decoder == NULL && !OpenNextBlob(scanState))
+		{
+			return slot;
+		}
+
+		MemoryContext oldContext = MemoryContextSwitchTo(scanState->blobContext);
+
+		if (!scanState->decoderStarted)
+		{
+			scanState->decoder->start(scanState->decoder->state);
+			scanState->decoderStarted = true;
+		}
+
+		bool batchFound = TupleDecoderNextBatch(scanState->decoder, batch);
+
+		MemoryContextSwitchTo(oldContext);
+
+		if (!batchFound)
+		{
+			CloseCurrentBlob(scanState);
+		}
+
+		scanState->batchRowIndex = 0;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (scanState->partitioning != NULL)
+	{
+		TupleBatchGetRow(batch, scanState->batchRowIndex, scanState->blobValues,
+		                 scanState->blobNulls);
+		GetPartitionedRow(scanState->partitioning, scanState->blobValues,
+		                  scanState->blobNulls, scanState->partitionValues,
+		                  scanState->partitionNulls, slot->tts_values,
+		                  slot->tts_isnull);
+	}
+	else
+	{
+		TupleBatchGetRow(batch, scanState->batchRowIndex, slot->tts_values,
+		                 slot->tts_isnull);
+	}
+
+	scanState->batchRowIndex++;
+
+	return ExecStoreVirtualTuple(slot);
+}
+
+
+/*
+ * OpenNextBlob claims the next blob that has not been read by any participant
+ * and opens a decoder for it. Returns false if there are no more blobs.
+ *
+ * The decoder is started on the first fetch, since starting it may wait for
+ * the download of the blob.
+ */
+static bool
+OpenNextBlob(BlobFdwScanState *scanState)
+{
+	int blobIndex = 0;
+	char *byteRanges = NULL;
+
+	do
+	{
+		if (scanState->sharedState != NULL)
+		{
+			blobIndex =
+				(int) pg_atomic_fetch_add_u32(&scanState->sharedState->nextBlobIndex, 1);
+		}
+		else
+		{
+			blobIndex = scanState->nextBlobIndex++;
+		}
+
+		if (blobIndex >= scanState->blobCount)
+		{
+			return false;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+	while (!SelectBlobRanges(scanState, blobIndex, &byteRanges));
+
+	MemoryContext oldContext = MemoryContextSwitchTo(scanState->blobContext);
+	BlobPrefetcher **prefetcher = NULL;
+
+	/* ranged reads are issued by the decoder as it goes */
+	if (scanState->asyncCapable && byteRanges == NULL &&
+	    ActiveAsyncBlobDownloads < MaxAsyncBlobDownloads)
+	{
+		prefetcher = &scanState->prefetcher;
+	}
+
+	scanState->currentBlobBytes = 0;
+	scanState->decoder = OpenBlobDecoder(scanState->connectionString,
+	                                     scanState->options,
+	                                     scanState->blobPaths[blobIndex],
+	                                     scanState->blobTupleDescriptor,
+	                                     scanState->projectedColumns, byteRanges,
+	                                     &scanState->currentBlobBytes, prefetcher);
+	scanState->decoderStarted = false;
+	scanState->batch->rowCount = 0;
+	scanState->batchRowIndex = 0;
+
+	if (scanState->partitioning != NULL)
+	{
+		BlobFdwPartitioning *partitioning = scanState->partitioning;
+		PathTemplate *pathTemplate = partitioning->pathTemplate;
+
+		for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+		     placeholderIndex++)
+		{
+			AttrNumber attributeNumber = partitioning->partitionColumns[placeholderIndex];
+
+			scanState->partitionNulls[attributeNumber - 1] = true;
+		}
+
+		ParsePartitionValues(partitioning, scanState->tupleDescriptor,
+		                     scanState->blobPaths[blobIndex],
+		                     scanState->partitionValues, scanState->partitionNulls);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	return true;
+}
+
+
+/*
+ * SelectBlobRanges checks the statistics sidecar of a blob, if it has one,
+ * against the scan filters. Returns false if no row of the blob can match,
+ * and otherwise sets byteRanges to the parts of the blob to read, or NULL
+ * to read all of it.
+ */
+static bool
+SelectBlobRanges(BlobFdwScanState *scanState, int blobIndex, char **byteRanges)
+{
+	BlobFdwOptions *options = scanState->options;
+	char *statsBlobETag = scanState->statsBlobETags != NULL ?
+						  scanState->statsBlobETags[blobIndex] : NULL;
+	bool mayMatch = true;
+
+	*byteRanges = NULL;
+
+	if (!EnableBlobStats || (statsBlobETag != NULL && *statsBlobETag == '\0') ||
+	    scanState->statsClauses == NIL)
+	{
+		return true;
+	}
+
+	if (!scanState->statsPredicatesBuilt)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(scanState->statsContext);
+
+		scanState->statsPredicates =
+			BuildBlobStatsPredicates(scanState->statsClauses, scanState->relationId,
+			                         scanState->tupleDescriptor, scanState->exprContext);
+		scanState->statsPredicatesBuilt = true;
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	if (scanState->statsPredicates == NIL)
+	{
+		return true;
+	}
+
+	char *path = scanState->blobPaths[blobIndex];
+	MemoryContext oldContext = MemoryContextSwitchTo(scanState->blobContext);
+
+	BlobStats *stats = ReadBlobStats(scanState->connectionString,
+	                                 options->containerName, path, statsBlobETag,
+	                                 scanState->blobTupleDescriptor);
+
+	if (stats != NULL)
+	{
+		mayMatch = BlobStatsSelectRanges(stats, scanState->statsPredicates, byteRanges);
+
+		if (*byteRanges != NULL)
+		{
+			char *decoderString = options->decoderString;
+			char *compressionString = options->compressionString;
+
+			if (strcmp(decoderString, "auto") == 0)
+			{
+				decoderString = CodecStringFromFileName(path);
+			}
+
+			if (strcmp(compressionString, "auto") == 0)
+			{
+				compressionString = CompressionStringForBlob(scanState->connectionString,
+				                                             options->containerName, path);
+			}
+
+			/* the decoder options of the table may differ from the writer's */
+			if (!CanReadBlobRanges(decoderString, compressionString))
+			{
+				*byteRanges = NULL;
+			}
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (!mayMatch)
+	{
+		if (scanState->sharedState != NULL)
+		{
+			pg_atomic_fetch_add_u64(&scanState->sharedState->blobsSkipped, 1);
+		}
+		else
+		{
+			scanState->blobsSkipped++;
+		}
+
+		MemoryContextReset(scanState->blobContext);
+	}
+
+	return mayMatch;
+}
+
+
+/*
+ * CloseCurrentBlob finishes the decoder of the current blob, if any, and
+ * adds the bytes read to the statistics.
+ */
+static void
+CloseCurrentBlob(BlobFdwScanState *scanState)
+{
+	TupleDecoder *decoder = scanState->decoder;
+
+	if (decoder == NULL)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(scanState->blobContext);
+
+	if (!scanState->decoderStarted)
+	{
+		decoder->start(decoder->state);
+	}
+
+	decoder->finish(decoder->state);
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (scanState->sharedState != NULL)
+	{
+		pg_atomic_fetch_add_u64(&scanState->sharedState->blobsRead, 1);
+		pg_atomic_fetch_add_u64(&scanState->sharedState->bytesRead,
+		                        scanState->currentBlobBytes);
+	}
+	else
+	{
+		scanState->blobsRead++;
+		scanState->bytesRead += scanState->currentBlobBytes;
+	}
+
+	scanState->decoder = NULL;
+	scanState->decoderStarted = false;
+	scanState->batch->rowCount = 0;
+	scanState->batchRowIndex = 0;
+	scanState->currentBlobBytes = 0;
+
+	/* the reset also stops and frees the prefetcher */
+	scanState->prefetcher = NULL;
+
+	MemoryContextReset(scanState->blobContext);
+}
+
+
+/*
+ * BlobFdwReScanForeignScan closes the current blob, such that the scan
+ * starts from the first blob on the next fetch. For parallel scans, the
+ * shared counter is reset in BlobFdwReInitializeDSMForeignScan.
+ */
+static void
+BlobFdwReScanForeignScan(ForeignScanState *node)
+{
+	if (IsAggregateScan(node))
+	{
+		BlobFdwReScanAggregateScan(node);
+		return;
+	}
+
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+
+	CloseCurrentBlob(scanState);
+
+	scanState->nextBlobIndex = 0;
+
+	/* the filters may depend on parameters that changed */
+	scanState->statsPredicates = NIL;
+	scanState->statsPredicatesBuilt = false;
+	MemoryContextReset(scanState->statsContext);
+}
+
+
+/*
+ * BlobFdwEndForeignScan closes the current blob if the scan stopped early.
+ */
+static void
+BlobFdwEndForeignScan(ForeignScanState *node)
+{
+	if (IsAggregateScan(node))
+	{
+		BlobFdwEndAggregateScan(node);
+		return;
+	}
+
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+
+	if (scanState == NULL || scanState->blobContext == NULL)
+	{
+		return;
+	}
+
+	CloseCurrentBlob(scanState);
+
+	MemoryContextDelete(scanState->blobContext);
+	scanState->blobContext = NULL;
+}
+
+
+/*
+ * BlobFdwShutdownForeignScan closes the current blob and, in the leader of
+ * a parallel scan, copies the statistics out of shared memory before it is
+ * released.
+ */
+static void
+BlobFdwShutdownForeignScan(ForeignScanState *node)
+{
+	if (IsAggregateScan(node))
+	{
+		return;
+	}
+
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+
+	if (scanState == NULL || scanState->blobContext == NULL)
+	{
+		return;
+	}
+
+	CloseCurrentBlob(scanState);
+
+	if (scanState->sharedState != NULL && !IsParallelWorker())
+	{
+		BlobFdwSharedState *sharedState = scanState->sharedState;
+
+		scanState->blobsRead = pg_atomic_read_u64(&sharedState->blobsRead);
+		scanState->bytesRead = pg_atomic_read_u64(&sharedState->bytesRead);
+		scanState->blobsSkipped = pg_atomic_read_u64(&sharedState->blobsSkipped);
+		scanState->sharedState = NULL;
+	}
+}
+
+
+#if PG_VERSION_NUM >= 140000
+
+/*
+ * BlobFdwIsForeignPathAsyncCapable returns true for scans, which can download
+ * their blobs in the background, but not for aggregates.
+ */
+static bool
+BlobFdwIsForeignPathAsyncCapable(ForeignPath *path)
+{
+	return !IS_UPPER_REL(path->path.parent);
+}
+
+
+/*
+ * BlobFdwForeignAsyncRequest returns the next row if it can be produced
+ * without waiting for blob storage, and otherwise marks the request as
+ * pending until BlobFdwForeignAsyncNotify.
+ */
+static void
+BlobFdwForeignAsyncRequest(AsyncRequest *areq)
+{
+	ForeignScanState *node = (ForeignScanState *) areq->requestee;
+
+	if (!ScanHasDataAvailable(node))
+	{
+		ExecAsyncRequestPending(areq);
+		return;
+	}
+
+	ExecAsyncRequestDone(areq, ExecProcNode((PlanState *) node));
+}
+
+
+/*
+ * BlobFdwForeignAsyncConfigureWait waits for data of the current blob of
+ * a pending request.
+ */
+static void
+BlobFdwForeignAsyncConfigureWait(AsyncRequest *areq)
+{
+	ForeignScanState *node = (ForeignScanState *) areq->requestee;
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+
+	Assert(areq->callback_pending);
+	Assert(scanState->prefetcher != NULL);
+
+	AddWaitEventToSet(areq->requestor->as_eventset, WL_SOCKET_READABLE,
+	                  BlobPrefetcherEventFd(scanState->prefetcher), NULL, areq);
+}
+
+
+/*
+ * BlobFdwForeignAsyncNotify is called when data of the current blob arrived
+ * and produces the next row.
+ */
+static void
+BlobFdwForeignAsyncNotify(AsyncRequest *areq)
+{
+	BlobFdwForeignAsyncRequest(areq);
+}
+
+
+/*
+ * ScanHasDataAvailable returns whether the next fetch can start without
+ * waiting for blob storage, opening the next blob if needed such that its
+ * download starts.
+ */
+static bool
+ScanHasDataAvailable(ForeignScanState *node)
+{
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+
+	if (scanState->decoder == NULL && !OpenNextBlob(scanState))
+	{
+		/* the fetch returns the end of the scan */
+		return true;
+	}
+
+	if (scanState->batchRowIndex < scanState->batch->rowCount)
+	{
+		return true;
+	}
+
+	if (scanState->prefetcher == NULL)
+	{
+		/* the blob is read synchronously */
+		return true;
+	}
+
+	return BlobPrefetcherHasData(scanState->prefetcher);
+}
+
+
+#endif
+
+
+/*
+ * BlobFdwExplainForeignScan shows the blobs that are scanned and, for EXPLAIN
+ * ANALYZE, the number of blobs and bytes that were read and the number of
+ * blobs that were skipped based on their paths.
+ */
+static void
+BlobFdwExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+	if (IsAggregateScan(node))
+	{
+		BlobFdwExplainAggregateScan(node, es);
+		return;
+	}
+
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+	BlobFdwOptions *options = scanState->options;
+
+	ExplainPropertyText("Blob Container", options->containerName, es);
+
+	if (options->path != NULL)
+	{
+		ExplainPropertyText("Blob Path", options->path, es);
+	}
+	else if (options->pathTemplate != NULL)
+	{
+		ForeignScan *foreignScan = (ForeignScan *) node->ss.ps.plan;
+		List *listingPrefixList = (List *) lsecond(foreignScan->fdw_private);
+		List *prefixNameList = NIL;
+		ListCell *prefixCell = NULL;
+
+		foreach(prefixCell, listingPrefixList)
+		{
+			prefixNameList = lappend(prefixNameList, strVal(lfirst(prefixCell)));
+		}
+
+		ExplainPropertyText("Blob Path Template", options->pathTemplate, es);
+		ExplainPropertyList("Blob Prefixes", prefixNameList, es);
+	}
+	else
+	{
+		ExplainPropertyText("Blob Prefix", options->prefix, es);
+	}
+
+	if (es->analyze)
+	{
+		ExplainPropertyInteger("Blobs Read", NULL, scanState->blobsRead, es);
+		ExplainPropertyInteger("Bytes Read", NULL, scanState->bytesRead, es);
+
+		if (options->pathTemplate != NULL)
+		{
+			ExplainPropertyInteger("Blobs Pruned", NULL, scanState->blobsPruned, es);
+		}
+
+		if (scanState->blobsSkipped > 0)
+		{
+			ExplainPropertyInteger("Blobs Skipped", NULL, scanState->blobsSkipped, es);
+		}
+	}
+}
+
+
+/*
+ * BlobFdwEstimateDSMForeignScan returns the size of the shared state, which
+ * holds the connection string and the list of blobs.
+ */
+static Size
+BlobFdwEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *parallelContext)
+{
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+	Size sharedStateSize = offsetof(BlobFdwSharedState, data);
+
+	sharedStateSize = add_size(sharedStateSize, strlen(scanState->connectionString) + 1);
+
+	for (int blobIndex = 0; blobIndex < scanState->blobCount; blobIndex++)
+	{
+		sharedStateSize = add_size(sharedStateSize,
+		                           strlen(scanState->blobPaths[blobIndex]) + 1);
+	}
+
+	for (int blobIndex = 0; blobIndex < scanState->blobCount; blobIndex++)
+	{
+		char *statsBlobETag = scanState->statsBlobETags[blobIndex];
+
+		sharedStateSize = add_size(sharedStateSize,
+		                           (statsBlobETag != NULL ? strlen(statsBlobETag) : 0) + 2);
+	}
+
+	return sharedStateSize;
+}
+
+
+/*
+ * BlobFdwInitializeDSMForeignScan copies the connection string and the list
+ * of blobs into shared memory and makes the leader claim blobs from the
+ * shared counter.
+ */
+static void
+BlobFdwInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *parallelContext,
+                                void *coordinate)
+{
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+	BlobFdwSharedState *sharedState = (BlobFdwSharedState *) coordinate;
+
+	pg_atomic_init_u32(&sharedState->nextBlobIndex, 0);
+	pg_atomic_init_u64(&sharedState->blobsRead, 0);
+	pg_atomic_init_u64(&sharedState->bytesRead, 0);
+	pg_atomic_init_u64(&sharedState->blobsSkipped, 0);
+	sharedState->blobCount = scanState->blobCount;
+
+	char *data = sharedState->data;
+	int length = strlen(scanState->connectionString) + 1;
+
+	memcpy(data, scanState->connectionString, length);
+	data += length;
+
+	for (int blobIndex = 0; blobIndex < scanState->blobCount; blobIndex++)
+	{
+		length = strlen(scanState->blobPaths[blobIndex]) + 1;
+
+		memcpy(data, scanState->blobPaths[blobIndex], length);
+		data += length;
+	}
+
+	for (int blobIndex = 0; blobIndex < scanState->blobCount; blobIndex++)
+	{
+		char *statsBlobETag = scanState->statsBlobETags[blobIndex];
+
+		*data++ = statsBlobETag != NULL ? '=' : '?';
+
+		length = (statsBlobETag != NULL ? strlen(statsBlobETag) : 0) + 1;
+		memcpy(data, statsBlobETag != NULL ? statsBlobETag : "", length);
+		data += length;
+	}
+
+	scanState->sharedState = sharedState;
+}
+
+
+/*
+ * BlobFdwReInitializeDSMForeignScan resets the shared counter for a rescan.
+ */
+static void
+BlobFdwReInitializeDSMForeignScan(ForeignScanState *node,
+                                  ParallelContext *parallelContext, void *coordinate)
+{
+	BlobFdwSharedState *sharedState = (BlobFdwSharedState *) coordinate;
+
+	pg_atomic_write_u32(&sharedState->nextBlobIndex, 0);
+}
+
+
+/*
+ * BlobFdwInitializeWorkerForeignScan reads the connection string and the list
+ * of blobs from shared memory in a parallel worker.
+ */
+static void
+BlobFdwInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc,
+                                   void *coordinate)
+{
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+	BlobFdwSharedState *sharedState = (BlobFdwSharedState *) coordinate;
+	char *data = sharedState->data;
+
+	scanState->connectionString = data;
+	data += strlen(data) + 1;
+
+	scanState->blobCount = sharedState->blobCount;
+	scanState->blobPaths = palloc0(Max(scanState->blobCount, 1) * sizeof(char *));
+
+	for (int blobIndex = 0; blobIndex < scanState->blobCount; blobIndex++)
+	{
+		scanState->blobPaths[blobIndex] = data;
+		data += strlen(data) + 1;
+	}
+
+	scanState->statsBlobETags = palloc0(Max(scanState->blobCount, 1) * sizeof(char *));
+
+	for (int blobIndex = 0; blobIndex < scanState->blobCount; blobIndex++)
+	{
+		bool etagKnown = *data++ == '=';
+
+		scanState->statsBlobETags[blobIndex] = etagKnown ? data : NULL;
+		data += strlen(data) + 1;
+	}
+
+	scanState->sharedState = sharedState;
+}
+
+
+/*
+ * BlobFdwAnalyzeForeignTable reports the size of the blobs in pages and
+ * returns the function that collects sample rows.
+ */
+static bool
+BlobFdwAnalyzeForeignTable(Relation relation,
+                           AcquireSampleRowsFunc *acquireSampleRowsFunc,
+                           BlockNumber *totalPages)
+{
+	BlobFdwOptions *options = GetBlobFdwOptions(RelationGetRelid(relation));
+	double blobCount = 1;
+	double storedBytes = 0;
+	double rowCount = 0;
+	bool estimated = false;
+
+	if (options->path != NULL)
+	{
+		estimated = EstimateBlobSize(options->accountString, options->containerName,
+		                             options->path, options->decoderString,
+		                             options->compressionString, &storedBytes,
+		                             &rowCount);
+	}
+	else
+	{
+		estimated = EstimatePrefixSize(options->accountString, options->containerName,
+		                               options->prefix, options->decoderString,
+		                               options->compressionString, &blobCount,
+		                               &storedBytes, &rowCount);
+	}
+
+	if (!estimated)
+	{
+		storedBytes = DEFAULT_BLOB_PAGES * BLCKSZ;
+	}
+
+	*totalPages = (BlockNumber) Max(ceil(storedBytes / BLCKSZ), 1);
+	*acquireSampleRowsFunc = BlobFdwAcquireSampleRows;
+
+	return true;
+}
+
+
+/*
+ * BlobFdwAcquireSampleRows reads the blobs of the foreign table and collects
+ * a random sample of rows using reservoir sampling.
+ *
+ * Blobs larger than azure.analyze_sample_blob_size that can be sampled are
+ * not read completely. Instead, rows are decoded from random ranges, and
+ * each stands for an equal share of the estimated rows in the blob.
+ */
+static int
+BlobFdwAcquireSampleRows(Relation relation, int logLevel, HeapTuple *rows,
+                         int targetRowCount, double *totalRowCount,
+                         double *totalDeadRowCount)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	BlobFdwOptions *options = GetBlobFdwOptions(RelationGetRelid(relation));
+	BlobFdwPartitioning *partitioning = BuildPartitioning(tupleDescriptor,
+	                                                      options->pathTemplate);
+	TupleDesc blobTupleDescriptor = tupleDescriptor;
+	char *connectionString = AccountStringToConnectionString(options->accountString);
+	List *blobPathList = ListBlobPaths(connectionString, options, NIL, NULL);
+	ListCell *blobPathCell = NULL;
+	int sampledBlobCount = 0;
+	int rangeCount = (targetRowCount + ANALYZE_ROWS_PER_RANGE - 1) /
+					 ANALYZE_ROWS_PER_RANGE;
+
+	BlobFdwSampleState sampleState;
+	memset(&sampleState, 0, sizeof(sampleState));
+	sampleState.tupleDescriptor = tupleDescriptor;
+	sampleState.rows = rows;
+	sampleState.targetRowCount = targetRowCount;
+	sampleState.rowsToSkip = -1;
+
+	reservoir_init_selection_state(&sampleState.reservoirState, targetRowCount);
+
+	MemoryContext blobContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                                  "azure_blob analyze",
+	                                                  ALLOCSET_DEFAULT_SIZES);
+	Datum *columnValues = palloc0(tupleDescriptor->natts * sizeof(Datum));
+	bool *columnNulls = palloc0(tupleDescriptor->natts * sizeof(bool));
+	Datum *partitionValues = NULL;
+	bool *partitionNulls = NULL;
+	Datum *blobValues = columnValues;
+	bool *blobNulls = columnNulls;
+
+	if (partitioning != NULL)
+	{
+		int blobColumnCount = Max(partitioning->blobTupleDescriptor->natts, 1);
+
+		blobTupleDescriptor = partitioning->blobTupleDescriptor;
+		partitionValues = palloc0(tupleDescriptor->natts * sizeof(Datum));
+		partitionNulls = palloc0(tupleDescriptor->natts * sizeof(bool));
+		blobValues = palloc0(blobColumnCount * sizeof(Datum));
+		blobNulls = palloc0(blobColumnCount * sizeof(bool));
+	}
+
+	TupleBatch *batch = CreateTupleBatch(blobTupleDescriptor, TUPLE_BATCH_SIZE);
+
+	foreach(blobPathCell, blobPathList)
+	{
+		char *path = (char *) lfirst(blobPathCell);
+		uint64 byteCount = 0;
+		uint64 blobSize = 0;
+		GzipIndex *gzipIndex = NULL;
+		ZstdSeekTable *zstdSeekTable = NULL;
+
+		MemoryContext oldContext = MemoryContextSwitchTo(blobContext);
+
+		if (partitioning != NULL &&
+		    !ParsePartitionValues(partitioning, tupleDescriptor, path, partitionValues,
+		                          partitionNulls))
+		{
+			MemoryContextSwitchTo(oldContext);
+			continue;
+		}
+
+		if (ShouldSampleBlob(connectionString, options, path, rangeCount, &blobSize,
+		                     &gzipIndex, &zstdSeekTable))
+		{
+			char *decoderString = options->decoderString;
+			double estimatedRowCount = 0;
+			BlobFdwSampledRows sampledRows = { blobTupleDescriptor, NIL };
+
+			if (strcmp(decoderString, "auto") == 0)
+			{
+				decoderString = CodecStringFromFileName(path);
+			}
+
+			SampleBlobRanges(connectionString, options->containerName, path, blobSize,
+			                 gzipIndex, zstdSeekTable, decoderString,
+			                 blobTupleDescriptor, rangeCount,
+			                 ANALYZE_ROWS_PER_RANGE, CollectSampledRow,
+			                 &sampledRows, &estimatedRowCount);
+
+			MemoryContextSwitchTo(oldContext);
+
+			int sampledRowCount = list_length(sampledRows.tupleList);
+			ListCell *tupleCell = NULL;
+			int tupleIndex = 0;
+
+			/* spread the estimated rows evenly over the sampled rows */
+			foreach(tupleCell, sampledRows.tupleList)
+			{
+				HeapTuple tuple = (HeapTuple) lfirst(tupleCell);
+				double rowCount =
+					floor((tupleIndex + 1) * estimatedRowCount / sampledRowCount) -
+					floor(tupleIndex * estimatedRowCount / sampledRowCount);
+
+				heap_deform_tuple(tuple, blobTupleDescriptor, blobValues, blobNulls);
+
+				if (partitioning != NULL)
+				{
+					GetPartitionedRow(partitioning, blobValues, blobNulls,
+					                  partitionValues, partitionNulls, columnValues,
+					                  columnNulls);
+				}
+
+				AddSampleRow(&sampleState, columnValues, columnNulls, rowCount);
+				tupleIndex++;
+			}
+
+			sampledBlobCount++;
+
+			MemoryContextReset(blobContext);
+			vacuum_delay_point();
+			continue;
+		}
+
+		TupleDecoder *decoder = OpenBlobDecoder(connectionString, options, path,
+		                                        blobTupleDescriptor, NULL, NULL,
+		                                        &byteCount, NULL);
+		decoder->start(decoder->state);
+
+		while (true)
+		{
+			MemoryContextSwitchTo(blobContext);
+
+			if (!TupleDecoderNextBatch(decoder, batch))
+			{
+				break;
+			}
+
+			MemoryContextSwitchTo(oldContext);
+
+			for (int rowIndex = 0; rowIndex < batch->rowCount; rowIndex++)
+			{
+				TupleBatchGetRow(batch, rowIndex, blobValues, blobNulls);
+
+				if (partitioning != NULL)
+				{
+					GetPartitionedRow(partitioning, blobValues, blobNulls,
+					                  partitionValues, partitionNulls, columnValues,
+					                  columnNulls);
+				}
+
+				AddSampleRow(&sampleState, columnValues, columnNulls, 1);
+			}
+
+			vacuum_delay_point();
+		}
+
+		decoder->finish(decoder->state);
+
+		MemoryContextSwitchTo(oldContext);
+		MemoryContextReset(blobContext);
+	}
+
+	MemoryContextDelete(blobContext);
+
+	*totalRowCount = sampleState.totalRowCount;
+	*totalDeadRowCount = 0;
+
+	ereport(logLevel, (errmsg("\"%s\": scanned %d blobs, of which %d were sampled, "
+	                          "containing %.0f rows; %d rows in sample",
+	                          RelationGetRelationName(relation),
+	                          list_length(blobPathList), sampledBlobCount,
+	                          *totalRowCount, sampleState.sampleRowCount)));
+
+	return sampleState.sampleRowCount;
+}
+
+
+/*
+ * ShouldSampleBlob returns whether ANALYZE should sample ranges of a blob
+ * rather than read it completely, and sets blobSize if so. This is the case
+ * for uncompressed csv and tsv blobs that are larger than both
+ * azure.analyze_sample_blob_size and the ranges that would be read, and for
+ * such gzip blobs that have a gzip index, which is returned in gzipIndex, and
+ * zstd blobs that have a seek table, which is returned in zstdSeekTable.
+ */
+static bool
+ShouldSampleBlob(char *connectionString, BlobFdwOptions *options, char *path,
+                 int rangeCount, uint64 *blobSize, GzipIndex **gzipIndex,
+                 ZstdSeekTable **zstdSeekTable)
+{
+	char *decoderString = options->decoderString;
+	char *compressionString = options->compressionString;
+
+	if (AnalyzeSampleBlobSize < 0)
+	{
+		return false;
+	}
+
+	if (strcmp(decoderString, "auto") == 0)
+	{
+		decoderString = CodecStringFromFileName(path);
+	}
+
+	if (strcmp(compressionString, "auto") == 0)
+	{
+		compressionString = CompressionStringForBlob(connectionString,
+		                                             options->containerName, path);
+	}
+
+	if (!CanSampleBlob(decoderString, compressionString))
+	{
+		return false;
+	}
+
+	*blobSize = GetBlobSize(connectionString, options->containerName, path);
+
+	if (*blobSize <= (uint64) AnalyzeSampleBlobSize * 1024)
+	{
+		return false;
+	}
+
+	uint64 sampledSize = *blobSize;
+
+	if (strcmp(compressionString, "zstd") == 0)
+	{
+		*zstdSeekTable = ReadZstdSeekTable(connectionString, options->containerName,
+		                                   path, *blobSize);
+
+		if (*zstdSeekTable == NULL)
+		{
+			return false;
+		}
+
+		sampledSize = (*zstdSeekTable)->uncompressedSize;
+	}
+	else if (strcmp(compressionString, "none") != 0)
+	{
+		*gzipIndex = ReadGzipIndex(connectionString, options->containerName, path,
+		                           *blobSize);
+
+		if (*gzipIndex == NULL)
+		{
+			return false;
+		}
+
+		sampledSize = (*gzipIndex)->uncompressedSize;
+	}
+
+	return sampledSize > (uint64) rangeCount * BLOB_SAMPLE_RANGE_SIZE;
+}
+
+
+/*
+ * CollectSampledRow adds a row sampled by SampleBlobRanges as a heap tuple to
+ * the BlobFdwSampledRows in context.
+ */
+static void
+CollectSampledRow(void *context, Datum *columnValues, bool *columnNulls)
+{
+	BlobFdwSampledRows *sampledRows = (BlobFdwSampledRows *) context;
+	HeapTuple tuple = heap_form_tuple(sampledRows->tupleDescriptor, columnValues,
+	                                  columnNulls);
+
+	sampledRows->tupleList = lappend(sampledRows->tupleList, tuple);
+}
+
+
+/*
+ * AddSampleRow adds a row that stands for rowCount rows of the table to the
+ * sample. While the sample is not full, the row is added. Afterwards, it
+ * replaces a random row in the sample with decreasing probability, once for
+ * every row it stands for that reservoir sampling selects.
+ */
+static void
+AddSampleRow(BlobFdwSampleState *sampleState, Datum *columnValues, bool *columnNulls,
+             double rowCount)
+{
+	int targetRowCount = sampleState->targetRowCount;
+	bool replaced = false;
+
+	if (rowCount > 0 && sampleState->sampleRowCount < targetRowCount)
+	{
+		sampleState->rows[sampleState->sampleRowCount++] =
+			heap_form_tuple(sampleState->tupleDescriptor, columnValues, columnNulls);
+		sampleState->totalRowCount += 1;
+		rowCount -= 1;
+		replaced = true;
+	}
+
+	while (rowCount > 0)
+	{
+		if (sampleState->rowsToSkip < 0)
+		{
+			sampleState->rowsToSkip = reservoir_get_next_S(&sampleState->reservoirState,
+			                                               sampleState->totalRowCount,
+			                                               targetRowCount);
+		}
+
+		if (sampleState->rowsToSkip >= rowCount)
+		{
+			sampleState->rowsToSkip -= rowCount;
+			sampleState->totalRowCount += rowCount;
+			break;
+		}
+
+		/* skip ahead to the row that replaces a random row in the sample */
+		sampleState->totalRowCount += sampleState->rowsToSkip + 1;
+		rowCount -= sampleState->rowsToSkip + 1;
+		sampleState->rowsToSkip = -1;
+
+		if (replaced)
+		{
+			/* the row is already in the sample, do not add it twice */
+			continue;
+		}
+
+#if PG_VERSION_NUM >= 150000
+		int rowToReplace =
+			(int) (targetRowCount *
+			       sampler_random_fract(&sampleState->reservoirState.randstate));
+#else
+		int rowToReplace =
+			(int) (targetRowCount *
+			       sampler_random_fract(sampleState->reservoirState.randstate));
+#endif
+
+		Assert(rowToReplace >= 0 && rowToReplace < targetRowCount);
+
+		heap_freetuple(sampleState->rows[rowToReplace]);
+		sampleState->rows[rowToReplace] =
+			heap_form_tuple(sampleState->tupleDescriptor, columnValues, columnNulls);
+		replaced = true;
+	}
+}
+
+
+/*
+ * BuildPartitioning resolves the columns of a path template against the
+ * columns of a foreign table. Returns NULL if there is no path template.
+ */
+static BlobFdwPartitioning *
+BuildPartitioning(TupleDesc tupleDescriptor, char *pathTemplateString)
+{
+	if (pathTemplateString == NULL)
+	{
+		return NULL;
+	}
+
+	PathTemplate *pathTemplate = ParsePathTemplate(pathTemplateString);
+	bool *isPartitionColumn = palloc0(tupleDescriptor->natts * sizeof(bool));
+
+	BlobFdwPartitioning *partitioning = palloc0(sizeof(BlobFdwPartitioning));
+	partitioning->pathTemplate = pathTemplate;
+	partitioning->partitionColumns = palloc0(pathTemplate->placeholderCount *
+	                                         sizeof(AttrNumber));
+
+	for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+	     placeholderIndex++)
+	{
+		char *columnName = pathTemplate->columnNames[placeholderIndex];
+		AttrNumber attributeNumber = InvalidAttrNumber;
+
+		for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+		{
+			Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+
+			if (!attribute->attisdropped &&
+			    strcmp(NameStr(attribute->attname), columnName) == 0)
+			{
+				attributeNumber = columnIndex + 1;
+				break;
+			}
+		}
+
+		if (attributeNumber == InvalidAttrNumber)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FDW_COLUMN_NAME_NOT_FOUND),
+			                errmsg("column \"%s\" of path_template does not exist",
+			                       columnName)));
+		}
+
+		partitioning->partitionColumns[placeholderIndex] = attributeNumber;
+		isPartitionColumn[attributeNumber - 1] = true;
+	}
+
+	int blobColumnCount = tupleDescriptor->natts - pathTemplate->placeholderCount;
+	int blobColumnIndex = 0;
+
+	partitioning->blobTupleDescriptor = CreateTemplateTupleDesc(blobColumnCount);
+	partitioning->blobColumns = palloc0(Max(blobColumnCount, 1) * sizeof(AttrNumber));
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		if (isPartitionColumn[columnIndex])
+		{
+			continue;
+		}
+
+		TupleDescCopyEntry(partitioning->blobTupleDescriptor, blobColumnIndex + 1,
+		                   tupleDescriptor, columnIndex + 1);
+		partitioning->blobColumns[blobColumnIndex] = columnIndex + 1;
+		blobColumnIndex++;
+	}
+
+	return partitioning;
+}
+
+
+/*
+ * ParsePartitionValues sets the values of the partition columns in values
+ * and nulls based on the path of a blob. Returns false if the path does not
+ * match the path template.
+ */
+static bool
+ParsePartitionValues(BlobFdwPartitioning *partitioning, TupleDesc tupleDescriptor,
+                     char *path, Datum *values, bool *nulls)
+{
+	PathTemplate *pathTemplate = partitioning->pathTemplate;
+	char **pathValues = palloc0(pathTemplate->placeholderCount * sizeof(char *));
+
+	if (!MatchPathTemplate(pathTemplate, path, pathValues))
+	{
+		return false;
+	}
+
+	for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+	     placeholderIndex++)
+	{
+		AttrNumber attributeNumber = partitioning->partitionColumns[placeholderIndex];
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor,
+		                                            attributeNumber - 1);
+		char *pathValue = pathValues[placeholderIndex];
+		Oid inputFunctionId = InvalidOid;
+		Oid typeIOParam = InvalidOid;
+
+		getTypeInputInfo(attribute->atttypid, &inputFunctionId, &typeIOParam);
+
+		values[attributeNumber - 1] = OidInputFunctionCall(inputFunctionId, pathValue,
+		                                                   typeIOParam,
+		                                                   attribute->atttypmod);
+		nulls[attributeNumber - 1] = (pathValue == NULL);
+	}
+
+	return true;
+}
+
+
+/*
+ * GetPartitionedRow combines the decoded values of a row with the values of
+ * the partition columns of its blob into values and nulls.
+ */
+static void
+GetPartitionedRow(BlobFdwPartitioning *partitioning, Datum *blobValues,
+                  bool *blobNulls, Datum *partitionValues, bool *partitionNulls,
+                  Datum *values, bool *nulls)
+{
+	PathTemplate *pathTemplate = partitioning->pathTemplate;
+	int blobColumnCount = partitioning->blobTupleDescriptor->natts;
+
+	for (int blobColumnIndex = 0; blobColumnIndex < blobColumnCount; blobColumnIndex++)
+	{
+		AttrNumber attributeNumber = partitioning->blobColumns[blobColumnIndex];
+
+		values[attributeNumber - 1] = blobValues[blobColumnIndex];
+		nulls[attributeNumber - 1] = blobNulls[blobColumnIndex];
+	}
+
+	for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+	     placeholderIndex++)
+	{
+		AttrNumber attributeNumber = partitioning->partitionColumns[placeholderIndex];
+
+		values[attributeNumber - 1] = partitionValues[attributeNumber - 1];
+		nulls[attributeNumber - 1] = partitionNulls[attributeNumber - 1];
+	}
+}
+
+
+/*
+ * PruneBlobPaths removes the paths that do not match the path template, or
+ * whose partition columns do not pass the partition filters of the scan,
+ * from a list of blob paths. The ETags in statsBlobETags, which are in the
+ * same order as the paths, are removed along with them.
+ */
+static List *
+PruneBlobPaths(ForeignScanState *node, List *blobPathList, char **statsBlobETags)
+{
+	BlobFdwScanState *scanState = (BlobFdwScanState *) node->fdw_state;
+	ForeignScan *foreignScan = (ForeignScan *) node->ss.ps.plan;
+	TupleDesc tupleDescriptor = scanState->tupleDescriptor;
+	ExprContext *exprContext = node->ss.ps.ps_ExprContext;
+	ExprState *filterState = ExecInitQual(foreignScan->fdw_exprs, (PlanState *) node);
+	TupleTableSlot *partitionSlot = MakeSingleTupleTableSlot(tupleDescriptor,
+	                                                         &TTSOpsVirtual);
+	TupleTableSlot *savedScanTuple = exprContext->ecxt_scantuple;
+	List *remainingPathList = NIL;
+	ListCell *blobPathCell = NULL;
+	int blobIndex = 0;
+
+	foreach(blobPathCell, blobPathList)
+	{
+		char *path = (char *) lfirst(blobPathCell);
+		char *statsBlobETag = statsBlobETags[blobIndex++];
+
+		ResetExprContext(exprContext);
+		ExecClearTuple(partitionSlot);
+		memset(partitionSlot->tts_isnull, true, tupleDescriptor->natts * sizeof(bool));
+
+		MemoryContext oldContext =
+			MemoryContextSwitchTo(exprContext->ecxt_per_tuple_memory);
+
+		bool pathMatches = ParsePartitionValues(scanState->partitioning,
+		                                        tupleDescriptor, path,
+		                                        partitionSlot->tts_values,
+		                                        partitionSlot->tts_isnull);
+
+		MemoryContextSwitchTo(oldContext);
+
+		if (pathMatches)
+		{
+			ExecStoreVirtualTuple(partitionSlot);
+			exprContext->ecxt_scantuple = partitionSlot;
+
+			if (ExecQual(filterState, exprContext))
+			{
+				statsBlobETags[list_length(remainingPathList)] = statsBlobETag;
+				remainingPathList = lappend(remainingPathList, path);
+				continue;
+			}
+		}
+
+		scanState->blobsPruned++;
+	}
+
+	exprContext->ecxt_scantuple = savedScanTuple;
+	ResetExprContext(exprContext);
+	ExecDropSingleTupleTableSlot(partitionSlot);
+
+	return remainingPathList;
+}
+
+
+/*
+ * ListBlobPaths returns the paths of the blobs to read for a foreign table,
+ * listing the blobs under each prefix in prefixList, or under the prefix of
+ * the table if prefixList is NIL. Empty blobs and statistics sidecars are
+ * skipped.
+ *
+ * If statsBlobETags is not NULL, it is set to an array with the ETag of
+ * each returned blob that has a statistics sidecar, and an empty string for
+ * the others. For a table with a path option, the blob is not listed and its
+ * entry is NULL.
+ */
+List *
+ListBlobPaths(char *connectionString, BlobFdwOptions *options, List *prefixList,
+              char ***statsBlobETags)
+{
+	if (options->path != NULL)
+	{
+		if (statsBlobETags != NULL)
+		{
+			*statsBlobETags = palloc0(sizeof(char *));
+		}
+
+		return list_make1(options->path);
+	}
+
+	if (prefixList == NIL)
+	{
+		prefixList = list_make1(makeString(options->prefix));
+	}
+
+	ListBlobPathsContext context;
+	context.blobPathList = NIL;
+	context.memoryContext = CurrentMemoryContext;
+	context.maxBlobCount = 64;
+	context.blobETags = palloc0(context.maxBlobCount * sizeof(char *));
+	context.statsPathList = NIL;
+
+	ListCell *prefixCell = NULL;
+
+	foreach(prefixCell, prefixList)
+	{
+		char *prefix = strVal(lfirst(prefixCell));
+
+		ListBlobs(connectionString, options->containerName, prefix, AddBlobPath,
+		          &context);
+	}
+
+	if (statsBlobETags == NULL)
+	{
+		return context.blobPathList;
+	}
+
+	int statsPathCount = list_length(context.statsPathList);
+	char **statsPaths = palloc0(Max(statsPathCount, 1) * sizeof(char *));
+	ListCell *pathCell = NULL;
+	int pathIndex = 0;
+
+	foreach(pathCell, context.statsPathList)
+	{
+		statsPaths[pathIndex++] = (char *) lfirst(pathCell);
+	}
+
+	qsort(statsPaths, statsPathCount, sizeof(char *), pg_qsort_strcmp);
+
+	*statsBlobETags = context.blobETags;
+	pathIndex = 0;
+
+	foreach(pathCell, context.blobPathList)
+	{
+		char *path = (char *) lfirst(pathCell);
+
+		if (bsearch(&path, statsPaths, statsPathCount, sizeof(char *),
+		            pg_qsort_strcmp) == NULL)
+		{
+			(*statsBlobETags)[pathIndex] = "";
+		}
+
+		pathIndex++;
+	}
+
+	return context.blobPathList;
+}
+
+
+/*
+ * AddBlobPath adds the path of a listed blob to the list in context, or to
+ * the list of blobs that have statistics if it is a sidecar.
+ */
+static void
+AddBlobPath(void *context, CloudBlob *blob)
+{
+	ListBlobPathsContext *listContext = (ListBlobPathsContext *) context;
+
+	if (blob->size == 0)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(listContext->memoryContext);
+
+	if (IsBlobStatsPath(blob->name))
+	{
+		char *path = pnstrdup(blob->name, strlen(blob->name) - strlen(BLOB_STATS_SUFFIX));
+
+		listContext->statsPathList = lappend(listContext->statsPathList, path);
+	}
+	else if (IsGzipIndexPath(blob->name) || IsZstdDictionaryPath(blob->name))
+	{
+		/* gzip indexes and zstd dictionaries are looked up when a blob is read */
+	}
+	else
+	{
+		int blobIndex = list_length(listContext->blobPathList);
+
+		if (blobIndex == listContext->maxBlobCount)
+		{
+			listContext->maxBlobCount *= 2;
+			listContext->blobETags = repalloc(listContext->blobETags,
+			                                  listContext->maxBlobCount * sizeof(char *));
+		}
+
+		listContext->blobETags[blobIndex] = pstrdup(blob->etag);
+		listContext->blobPathList = lappend(listContext->blobPathList,
+		                                    pstrdup(blob->name));
+	}
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * FreeBlobPrefetcherCallback frees a prefetcher when the memory context of
+ * its blob is reset or deleted.
+ */
+static void
+FreeBlobPrefetcherCallback(void *arg)
+{
+	FreeBlobPrefetcher((BlobPrefetcher *) arg);
+	ActiveAsyncBlobDownloads--;
+}
+
+
+/*
+ * OpenBlobDecoder opens a blob and builds a decoder for it, resolving "auto"
+ * decoder and compression options based on the path of the blob. The number
+ * of bytes read from blob storage is added to byteCount.
+ *
+ * If byteRanges is not NULL, only those byte ranges of the blob are read.
+ * Otherwise, if prefetcher is not NULL, the blob is downloaded in the
+ * background and the prefetcher is returned in it. It is freed when the
+ * current memory context is reset.
+ */
+TupleDecoder *
+OpenBlobDecoder(char *connectionString, BlobFdwOptions *options, char *path,
+                TupleDesc tupleDescriptor, bool *projectedColumns, char *byteRanges,
+                uint64 *byteCount, BlobPrefetcher **prefetcher)
+{
+	char *decoderString = options->decoderString;
+	char *compressionString = options->compressionString;
+
+	if (strcmp(decoderString, "auto") == 0)
+	{
+		decoderString = CodecStringFromFileName(path);
+	}
+
+	if (strcmp(compressionString, "auto") == 0)
+	{
+		compressionString = CompressionStringForBlob(connectionString,
+		                                             options->containerName, path);
+	}
+
+	ByteSource *byteSource = palloc0(sizeof(ByteSource));
+
+	if (byteRanges != NULL)
+	{
+		ReadBlockBlobRanges(connectionString, options->containerName, path, byteRanges,
+		                    byteSource);
+	}
+	else if (prefetcher != NULL)
+	{
+		MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+
+		*prefetcher = ReadBlockBlobPrefetched(connectionString, options->containerName,
+		                                      path, byteSource);
+		ActiveAsyncBlobDownloads++;
+
+		/* stop the download when the blob is closed or the query fails */
+		callback->func = FreeBlobPrefetcherCallback;
+		callback->arg = *prefetcher;
+		MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+	}
+	else
+	{
+		ReadBlockBlob(connectionString, options->containerName, path, byteSource);
+	}
+
+	byteSource = CreateCountingByteSource(byteSource, byteCount);
+
+	if (byteRanges != NULL)
+	{
+		byteSource = BuildDecompressor(compressionString, byteSource);
+	}
+	else
+	{
+		byteSource = BuildBlobDecompressor(compressionString, byteSource,
+		                                   connectionString, options->containerName,
+		                                   path);
+	}
+
+	return BuildTupleDecoder(decoderString, tupleDescriptor, byteSource,
+	                         projectedColumns, NULL);
+}
@@ -0,0 +1,653 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_fdw_aggregate.c
+ *     Aggregates over azure_blob foreign tables answered from statistics.
+ *
+ * A query such as SELECT count(*), min(ts), max(ts) FROM table, without
+ * filters or GROUP BY, is planned as a foreign scan that returns the
+ * aggregates directly. The scan lists the blobs of the table and combines
+ * the row counts, non-NULL counts and min/max values in their statistics
+ * sidecars (see blob_stats.c). Only blobs that have no sidecar, or whose
+ * sidecar lacks one of the columns, are downloaded and decoded.
+ *
+ * count, min and max also return their final value as the partial result,
+ * so the same scan serves as the partial aggregate of partitionwise and
+ * parallel aggregation.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_namespace.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "foreign/fdwapi.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/planmain.h"
+#include "pgazure/blob_estimates.h"
+#include "pgazure/blob_fdw.h"
+#include "pgazure/blob_stats.h"
+#include "pgazure/storage_account.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
+
+
+/*
+ * BlobAggregateType is an aggregate that can be answered from statistics.
+ */
+typedef enum BlobAggregateType
+{
+	BLOB_AGGREGATE_COUNT_ROWS,
+	BLOB_AGGREGATE_COUNT,
+	BLOB_AGGREGATE_MIN,
+	BLOB_AGGREGATE_MAX
+} BlobAggregateType;
+
+/*
+ * BlobAggregateScanState is the execution state of an aggregate scan.
+ */
+typedef struct BlobAggregateScanState
+{
+	BlobFdwOptions *options;
+	char *connectionString;
+
+	/* descriptor of the foreign table */
+	TupleDesc tupleDescriptor;
+
+	/* type and column of each aggregate in the scan tuple */
+	int aggregateCount;
+	BlobAggregateType *aggregateTypes;
+	AttrNumber *aggregateColumns;
+
+	/* comparison function of each column, used for min and max */
+	FmgrInfo **compareFunctions;
+
+	/* columns that are decoded from blobs that have no usable statistics */
+	bool *projectedColumns;
+
+	/* memory for the aggregate values, and for the current blob */
+	MemoryContext resultContext;
+	MemoryContext blobContext;
+
+	/* whether the row with the aggregates was returned */
+	bool finished;
+
+	/* statistics for EXPLAIN ANALYZE */
+	uint64 blobsFromStats;
+	uint64 blobsScanned;
+	uint64 bytesRead;
+} BlobAggregateScanState;
+
+
+static bool GetBlobAggregateType(Aggref *aggref, Index relationId, Oid foreignTableId,
+                                 BlobAggregateType *aggregateType,
+                                 AttrNumber *attributeNumber);
+static void ComputeBlobAggregates(BlobAggregateScanState *scanState,
+                                  TupleTableSlot *slot);
+static bool StatsCoverAggregates(BlobAggregateScanState *scanState, BlobStats *stats);
+static void AddBlobAggregates(BlobAggregateScanState *scanState, BlobStats *stats,
+                              TupleTableSlot *slot);
+
+
+/*
+ * AddBlobAggregatePath adds a path that computes the aggregates of the output
+ * relation from blob statistics, if the query only uses count, min and max
+ * of columns of a foreign table without filters and grouping.
+ */
+void
+AddBlobAggregatePath(PlannerInfo *root, UpperRelationKind stage, RelOptInfo *inputRel,
+                     RelOptInfo *outputRel, double blobCount)
+{
+	Query *query = root->parse;
+	PathTarget *groupingTarget = outputRel->reltarget;
+	Oid foreignTableId = planner_rt_fetch(inputRel->relid, root)->relid;
+	List *aggregateList = NIL;
+	List *aggregateTypeList = NIL;
+	List *aggregateColumnList = NIL;
+	ListCell *expressionCell = NULL;
+
+	if (!EnableBlobStats || query->groupClause != NIL || query->groupingSets != NIL ||
+	    inputRel->baserestrictinfo != NIL ||
+	    (stage == UPPERREL_GROUP_AGG && query->havingQual != NULL))
+	{
+		return;
+	}
+
+	foreach(expressionCell, groupingTarget->exprs)
+	{
+		Node *expression = (Node *) lfirst(expressionCell);
+		List *nodeList = pull_var_clause(expression, PVC_INCLUDE_AGGREGATES);
+		ListCell *nodeCell = NULL;
+
+		foreach(nodeCell, nodeList)
+		{
+			Node *node = (Node *) lfirst(nodeCell);
+			BlobAggregateType aggregateType = BLOB_AGGREGATE_COUNT_ROWS;
+			AttrNumber attributeNumber = InvalidAttrNumber;
+
+			if (!IsA(node, Aggref) ||
+			    !GetBlobAggregateType((Aggref *) node, inputRel->relid, foreignTableId,
+			                          &aggregateType, &attributeNumber))
+			{
+				return;
+			}
+
+			if (list_member(aggregateList, node))
+			{
+				continue;
+			}
+
+			aggregateList = lappend(aggregateList, node);
+			aggregateTypeList = lappend_int(aggregateTypeList, aggregateType);
+			aggregateColumnList = lappend_int(aggregateColumnList, attributeNumber);
+		}
+	}
+
+	if (aggregateList == NIL)
+	{
+		return;
+	}
+
+	/* a sidecar request per blob, in the best case */
+	Cost totalCost = blobCount * BlobRequestCost + cpu_tuple_cost;
+
+	List *fdwPrivate = list_make4(aggregateList, list_make1_oid(foreignTableId),
+	                              aggregateTypeList, aggregateColumnList);
+
+#if PG_VERSION_NUM >= 170000
+	ForeignPath *path = create_foreign_upper_path(root, outputRel, groupingTarget, 1,
+	                                              totalCost, totalCost, NIL, NULL, NIL,
+	                                              fdwPrivate);
+#else
+	ForeignPath *path = create_foreign_upper_path(root, outputRel, groupingTarget, 1,
+	                                              totalCost, totalCost, NIL, NULL,
+	                                              fdwPrivate);
+#endif
+
+	add_path(outputRel, (Path *) path);
+}
+
+
+/*
+ * GetBlobAggregateType determines which aggregate an Aggref is, and on which
+ * column. Returns false if it cannot be answered from statistics.
+ *
+ * min and max qualify when they order by the default btree operator class
+ * and the collation of the column, since statistics are collected that way.
+ */
+static bool
+GetBlobAggregateType(Aggref *aggref, Index relationId, Oid foreignTableId,
+                     BlobAggregateType *aggregateType, AttrNumber *attributeNumber)
+{
+	if (aggref->agglevelsup != 0 || aggref->aggorder != NIL ||
+	    aggref->aggdistinct != NIL || aggref->aggfilter != NULL ||
+	    aggref->aggkind != AGGKIND_NORMAL || DO_AGGSPLIT_COMBINE(aggref->aggsplit) ||
+	    get_func_namespace(aggref->aggfnoid) != PG_CATALOG_NAMESPACE)
+	{
+		return false;
+	}
+
+	char *functionName = get_func_name(aggref->aggfnoid);
+
+	if (strcmp(functionName, "count") == 0 && aggref->aggstar)
+	{
+		*aggregateType = BLOB_AGGREGATE_COUNT_ROWS;
+		return true;
+	}
+
+	if (list_length(aggref->args) != 1)
+	{
+		return false;
+	}
+
+	Node *argument = (Node *) ((TargetEntry *) linitial(aggref->args))->expr;
+
+	if (IsA(argument, RelabelType))
+	{
+		argument = (Node *) ((RelabelType *) argument)->arg;
+	}
+
+	if (!IsA(argument, Var))
+	{
+		return false;
+	}
+
+	Var *column = (Var *) argument;
+
+	if (column->varno != relationId || column->varlevelsup != 0 ||
+	    column->varattno <= 0)
+	{
+		return false;
+	}
+
+	*attributeNumber = column->varattno;
+
+	if (strcmp(functionName, "count") == 0)
+	{
+		*aggregateType = BLOB_AGGREGATE_COUNT;
+		return true;
+	}
+
+	bool isMin = strcmp(functionName, "min") == 0;
+	bool isMax = strcmp(functionName, "max") == 0;
+
+	if (!isMin && !isMax)
+	{
+		return false;
+	}
+
+	Oid columnTypeId = InvalidOid;
+	int32 columnTypeMod = -1;
+	Oid columnCollation = InvalidOid;
+
+	get_atttypetypmodcoll(foreignTableId, column->varattno, &columnTypeId,
+	                      &columnTypeMod, &columnCollation);
+
+	if (aggref->inputcollid != columnCollation)
+	{
+		return false;
+	}
+
+	HeapTuple aggregateTuple = SearchSysCache1(AGGFNOID,
+	                                           ObjectIdGetDatum(aggref->aggfnoid));
+	if (!HeapTupleIsValid(aggregateTuple))
+	{
+		return false;
+	}
+
+	Oid sortOperatorId = ((Form_pg_aggregate) GETSTRUCT(aggregateTuple))->aggsortop;
+
+	ReleaseSysCache(aggregateTuple);
+
+	TypeCacheEntry *typeEntry = lookup_type_cache(columnTypeId,
+	                                              TYPECACHE_LT_OPR | TYPECACHE_GT_OPR |
+	                                              TYPECACHE_CMP_PROC);
+
+	if (!OidIsValid(typeEntry->cmp_proc) ||
+	    sortOperatorId != (isMin ? typeEntry->lt_opr : typeEntry->gt_opr))
+	{
+		return false;
+	}
+
+	*aggregateType = isMin ? BLOB_AGGREGATE_MIN : BLOB_AGGREGATE_MAX;
+
+	return true;
+}
+
+
+/*
+ * BlobFdwGetAggregatePlan creates the plan of an aggregate path. The scan
+ * tuple contains the aggregates, which the target list refers to.
+ */
+ForeignScan *
+BlobFdwGetAggregatePlan(PlannerInfo *root, RelOptInfo *upperRel, ForeignPath *bestPath,
+                        List *targetList, Plan *outerPlan)
+{
+	List *aggregateList = (List *) linitial(bestPath->fdw_private);
+	List *fdwScanTargetList = NIL;
+	ListCell *aggregateCell = NULL;
+
+	foreach(aggregateCell, aggregateList)
+	{
+		Expr *aggregate = (Expr *) lfirst(aggregateCell);
+
+		fdwScanTargetList = lappend(fdwScanTargetList,
+		                            makeTargetEntry(aggregate,
+		                                            list_length(fdwScanTargetList) + 1,
+		                                            NULL, false));
+	}
+
+	List *fdwPrivate = list_copy_tail(bestPath->fdw_private, 1);
+
+	return make_foreignscan(targetList, NIL, 0, NIL, fdwPrivate, fdwScanTargetList, NIL,
+	                        outerPlan);
+}
+
+
+/*
+ * BlobFdwBeginAggregateScan sets up the state of an aggregate scan.
+ */
+void
+BlobFdwBeginAggregateScan(ForeignScanState *node, int eflags)
+{
+	ForeignScan *foreignScan = (ForeignScan *) node->ss.ps.plan;
+	Oid foreignTableId = linitial_oid((List *) linitial(foreignScan->fdw_private));
+	List *aggregateTypeList = (List *) lsecond(foreignScan->fdw_private);
+	List *aggregateColumnList = (List *) lthird(foreignScan->fdw_private);
+	int aggregateCount = list_length(aggregateTypeList);
+
+	Relation relation = table_open(foreignTableId, AccessShareLock);
+	TupleDesc tupleDescriptor = CreateTupleDescCopy(RelationGetDescr(relation));
+
+	table_close(relation, AccessShareLock);
+
+	BlobAggregateScanState *scanState = palloc0(sizeof(BlobAggregateScanState));
+	scanState->options = GetBlobFdwOptions(foreignTableId);
+	scanState->tupleDescriptor = tupleDescriptor;
+	scanState->aggregateCount = aggregateCount;
+	scanState->aggregateTypes = palloc0(aggregateCount * sizeof(BlobAggregateType));
+	scanState->aggregateColumns = palloc0(aggregateCount * sizeof(AttrNumber));
+	scanState->compareFunctions = palloc0(aggregateCount * sizeof(FmgrInfo *));
+	scanState->projectedColumns = palloc0(Max(tupleDescriptor->natts, 1) * sizeof(bool));
+
+	for (int aggregateIndex = 0; aggregateIndex < aggregateCount; aggregateIndex++)
+	{
+		BlobAggregateType aggregateType =
+			(BlobAggregateType) list_nth_int(aggregateTypeList, aggregateIndex);
+		AttrNumber attributeNumber =
+			(AttrNumber) list_nth_int(aggregateColumnList, aggregateIndex);
+
+		scanState->aggregateTypes[aggregateIndex] = aggregateType;
+		scanState->aggregateColumns[aggregateIndex] = attributeNumber;
+
+		if (aggregateType == BLOB_AGGREGATE_COUNT_ROWS)
+		{
+			continue;
+		}
+
+		scanState->projectedColumns[attributeNumber - 1] = true;
+
+		if (aggregateType == BLOB_AGGREGATE_MIN || aggregateType == BLOB_AGGREGATE_MAX)
+		{
+			Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, attributeNumber - 1);
+			TypeCacheEntry *typeEntry = lookup_type_cache(attr->atttypid,
+			                                              TYPECACHE_CMP_PROC_FINFO);
+
+			scanState->compareFunctions[aggregateIndex] = &typeEntry->cmp_proc_finfo;
+		}
+	}
+
+	node->fdw_state = scanState;
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+	{
+		return;
+	}
+
+	scanState->connectionString =
+		AccountStringToConnectionString(scanState->options->accountString);
+	scanState->resultContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                                 "azure_blob aggregates",
+	                                                 ALLOCSET_DEFAULT_SIZES);
+	scanState->blobContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                               "azure_blob aggregate blob",
+	                                               ALLOCSET_DEFAULT_SIZES);
+}
+
+
+/*
+ * BlobFdwIterateAggregateScan returns the row with the aggregates on the
+ * first call, and an empty slot afterwards.
+ */
+TupleTableSlot *
+BlobFdwIterateAggregateScan(ForeignScanState *node)
+{
+	BlobAggregateScanState *scanState = (BlobAggregateScanState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+	ExecClearTuple(slot);
+
+	if (scanState->finished)
+	{
+		return slot;
+	}
+
+	ComputeBlobAggregates(scanState, slot);
+	scanState->finished = true;
+
+	return ExecStoreVirtualTuple(slot);
+}
+
+
+/*
+ * ComputeBlobAggregates combines the statistics of all blobs of the table
+ * into the values of the aggregates in the slot.
+ */
+static void
+ComputeBlobAggregates(BlobAggregateScanState *scanState, TupleTableSlot *slot)
+{
+	BlobFdwOptions *options = scanState->options;
+	TupleDesc tupleDescriptor = scanState->tupleDescriptor;
+	char **statsBlobETags = NULL;
+	ListCell *blobPathCell = NULL;
+	int blobIndex = 0;
+
+	MemoryContextReset(scanState->resultContext);
+
+	for (int aggregateIndex = 0; aggregateIndex < scanState->aggregateCount;
+	     aggregateIndex++)
+	{
+		BlobAggregateType aggregateType = scanState->aggregateTypes[aggregateIndex];
+		bool isCount = aggregateType == BLOB_AGGREGATE_COUNT_ROWS ||
+					   aggregateType == BLOB_AGGREGATE_COUNT;
+
+		/* counts start at 0, min and max at NULL */
+		slot->tts_values[aggregateIndex] = isCount ? Int64GetDatum(0) : (Datum) 0;
+		slot->tts_isnull[aggregateIndex] = !isCount;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(scanState->resultContext);
+
+	List *blobPathList = ListBlobPaths(scanState->connectionString, options, NIL,
+	                                   &statsBlobETags);
+
+	MemoryContextSwitchTo(oldContext);
+
+	foreach(blobPathCell, blobPathList)
+	{
+		char *path = (char *) lfirst(blobPathCell);
+		char *statsBlobETag = statsBlobETags[blobIndex++];
+		BlobStats *stats = NULL;
+
+		oldContext = MemoryContextSwitchTo(scanState->blobContext);
+
+		if (statsBlobETag == NULL || *statsBlobETag != '\0')
+		{
+			stats = ReadBlobStats(scanState->connectionString, options->containerName,
+			                      path, statsBlobETag, tupleDescriptor);
+		}
+
+		if (stats != NULL && StatsCoverAggregates(scanState, stats))
+		{
+			scanState->blobsFromStats++;
+		}
+		else
+		{
+			uint64 byteCount = 0;
+			TupleDecoder *decoder = OpenBlobDecoder(scanState->connectionString, options,
+			                                        path, tupleDescriptor,
+			                                        scanState->projectedColumns, NULL,
+			                                        &byteCount, NULL);
+
+			stats = CollectBlobStats(decoder, tupleDescriptor);
+
+			scanState->blobsScanned++;
+			scanState->bytesRead += byteCount;
+		}
+
+		MemoryContextSwitchTo(scanState->resultContext);
+
+		AddBlobAggregates(scanState, stats, slot);
+
+		MemoryContextSwitchTo(oldContext);
+		MemoryContextReset(scanState->blobContext);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+
+/*
+ * StatsCoverAggregates returns whether the statistics of a blob have all the
+ * values needed for the aggregates.
+ */
+static bool
+StatsCoverAggregates(BlobAggregateScanState *scanState, BlobStats *stats)
+{
+	for (int aggregateIndex = 0; aggregateIndex < scanState->aggregateCount;
+	     aggregateIndex++)
+	{
+		BlobAggregateType aggregateType = scanState->aggregateTypes[aggregateIndex];
+		AttrNumber attributeNumber = scanState->aggregateColumns[aggregateIndex];
+
+		if (aggregateType == BLOB_AGGREGATE_COUNT_ROWS)
+		{
+			continue;
+		}
+
+		BlobColumnStats *columnStats = BlobStatsColumn(stats, attributeNumber - 1);
+
+		if (columnStats == NULL)
+		{
+			return false;
+		}
+
+		/* min/max are left out of sidecars for long values */
+		if (aggregateType != BLOB_AGGREGATE_COUNT && columnStats->valueCount > 0 &&
+		    !columnStats->hasRange)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * AddBlobAggregates adds the statistics of a blob to the aggregate values in
+ * the slot. New min/max values are copied into the current memory context.
+ */
+static void
+AddBlobAggregates(BlobAggregateScanState *scanState, BlobStats *stats,
+                  TupleTableSlot *slot)
+{
+	for (int aggregateIndex = 0; aggregateIndex < scanState->aggregateCount;
+	     aggregateIndex++)
+	{
+		BlobAggregateType aggregateType = scanState->aggregateTypes[aggregateIndex];
+		AttrNumber attributeNumber = scanState->aggregateColumns[aggregateIndex];
+		Datum *value = &slot->tts_values[aggregateIndex];
+		bool *isNull = &slot->tts_isnull[aggregateIndex];
+
+		if (aggregateType == BLOB_AGGREGATE_COUNT_ROWS)
+		{
+			*value = Int64GetDatum(DatumGetInt64(*value) + BlobStatsRowCount(stats));
+			continue;
+		}
+
+		BlobColumnStats *columnStats = BlobStatsColumn(stats, attributeNumber - 1);
+
+		if (aggregateType == BLOB_AGGREGATE_COUNT)
+		{
+			*value = Int64GetDatum(DatumGetInt64(*value) + columnStats->valueCount);
+			continue;
+		}
+
+		if (columnStats->valueCount == 0)
+		{
+			continue;
+		}
+
+		Form_pg_attribute attr = TupleDescAttr(scanState->tupleDescriptor,
+		                                       attributeNumber - 1);
+		bool isMin = aggregateType == BLOB_AGGREGATE_MIN;
+		Datum blobValue = isMin ? columnStats->minValue : columnStats->maxValue;
+
+		if (!*isNull)
+		{
+			int comparison =
+				DatumGetInt32(FunctionCall2Coll(scanState->compareFunctions[aggregateIndex],
+				                                attr->attcollation, blobValue, *value));
+
+			if ((isMin && comparison >= 0) || (!isMin && comparison <= 0))
+			{
+				continue;
+			}
+		}
+
+		*value = datumCopy(blobValue, attr->attbyval, attr->attlen);
+		*isNull = false;
+	}
+}
+
+
+/*
+ * BlobFdwReScanAggregateScan makes the scan compute the aggregates again on
+ * the next fetch.
+ */
+void
+BlobFdwReScanAggregateScan(ForeignScanState *node)
+{
+	BlobAggregateScanState *scanState = (BlobAggregateScanState *) node->fdw_state;
+
+	scanState->finished = false;
+}
+
+
+/*
+ * BlobFdwEndAggregateScan frees the memory of the scan.
+ */
+void
+BlobFdwEndAggregateScan(ForeignScanState *node)
+{
+	BlobAggregateScanState *scanState = (BlobAggregateScanState *) node->fdw_state;
+
+	if (scanState == NULL || scanState->blobContext == NULL)
+	{
+		return;
+	}
+
+	MemoryContextDelete(scanState->blobContext);
+	MemoryContextDelete(scanState->resultContext);
+	scanState->blobContext = NULL;
+	scanState->resultContext = NULL;
+}
+
+
+/*
+ * BlobFdwExplainAggregateScan shows the blobs that the aggregates are
+ * computed from and, for EXPLAIN ANALYZE, how many of them were answered
+ * from statistics.
+ */
+void
+BlobFdwExplainAggregateScan(ForeignScanState *node, ExplainState *es)
+{
+	BlobAggregateScanState *scanState = (BlobAggregateScanState *) node->fdw_state;
+	BlobFdwOptions *options = scanState->options;
+
+	ExplainPropertyText("Blob Container", options->containerName, es);
+
+	if (options->path != NULL)
+	{
+		ExplainPropertyText("Blob Path", options->path, es);
+	}
+	else
+	{
+		ExplainPropertyText("Blob Prefix", options->prefix, es);
+	}
+
+	if (es->analyze)
+	{
+		ExplainPropertyInteger("Blobs From Statistics", NULL, scanState->blobsFromStats,
+		                       es);
+		ExplainPropertyInteger("Blobs Scanned", NULL, scanState->blobsScanned, es);
+		ExplainPropertyInteger("Bytes Read", NULL, scanState->bytesRead, es);
+	}
+}
@@ -0,0 +1,481 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_fdw_modify.c
+ *     Inserts into azure_blob foreign tables.
+ *
+ * Rows inserted into a foreign table are passed from the slot straight into
+ * a TupleEncoder that writes to a compressor and a blob writer, without
+ * forming a record datum for every row as blob_storage_put_blob does.
+ *
+ * A foreign table with a path option writes to that blob, replacing it. For
+ * a foreign table with a prefix option, each insert statement writes new
+ * blobs named <prefix>part-<pid>-<start time>-<sequence number><suffix>,
+ * and continues in a new blob once max_blob_size bytes have been written.
+ * Blobs are committed when they are closed, independently of the
+ * transaction.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "executor/executor.h"
+#include "executor/tuptable.h"
+#include "nodes/execnodes.h"
+#include "pgazure/blob_fdw.h"
+#include "pgazure/blob_stats.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/codecs.h"
+#include "pgazure/compression.h"
+#include "pgazure/storage_account.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * BlobFdwModifyState is the state of an insert into a foreign table.
+ */
+typedef struct BlobFdwModifyState
+{
+	BlobFdwOptions *options;
+	char *connectionString;
+	TupleDesc tupleDescriptor;
+
+	/* resolved encoder and compression, and suffix of new blob names */
+	char *encoderString;
+	char *compressionString;
+	char *suffix;
+
+	/* start time of the insert and number of blobs started, for blob names */
+	TimestampTz startTime;
+	int blobCount;
+
+	/* memory context for the encoder and upload of the current blob */
+	MemoryContext blobContext;
+
+	/* encoder of the current blob, or NULL if no blob is open */
+	TupleEncoder *encoder;
+
+	/* number of bytes written to the current blob */
+	uint64 currentBlobBytes;
+
+	/* path and statistics of the current blob, if the write_stats option is set */
+	char *currentPath;
+	BlobStatsWriter *statsWriter;
+
+	/* rows collected for batch inserts */
+	TupleBatch *batch;
+} BlobFdwModifyState;
+
+
+static BlobFdwModifyState * CreateModifyState(ResultRelInfo *resultRelInfo);
+static char * DefaultSuffix(char *encoderString, char *compressionString);
+static void OpenOutputBlob(BlobFdwModifyState *modifyState);
+static void CloseOutputBlob(BlobFdwModifyState *modifyState);
+static void FlushInsertBatch(BlobFdwModifyState *modifyState);
+
+
+/*
+ * BlobFdwIsForeignRelUpdatable reports that foreign tables only support
+ * inserts, except for tables with a path template, whose partition columns
+ * are not stored in the blobs.
+ */
+int
+BlobFdwIsForeignRelUpdatable(Relation relation)
+{
+	BlobFdwOptions *options = GetBlobFdwOptions(RelationGetRelid(relation));
+
+	if (options->pathTemplate != NULL)
+	{
+		return 0;
+	}
+
+	return (1 << CMD_INSERT);
+}
+
+
+/*
+ * BlobFdwBeginForeignModify prepares an INSERT into a foreign table. The
+ * first blob is opened when the first row arrives.
+ */
+void
+BlobFdwBeginForeignModify(ModifyTableState *modifyTableState,
+                          ResultRelInfo *resultRelInfo, List *fdwPrivate,
+                          int subplanIndex, int eflags)
+{
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+	{
+		return;
+	}
+
+	resultRelInfo->ri_FdwState = CreateModifyState(resultRelInfo);
+}
+
+
+/*
+ * BlobFdwBeginForeignInsert prepares COPY FROM or an insert that is routed
+ * to a foreign table partition.
+ */
+void
+BlobFdwBeginForeignInsert(ModifyTableState *modifyTableState,
+                          ResultRelInfo *resultRelInfo)
+{
+	resultRelInfo->ri_FdwState = CreateModifyState(resultRelInfo);
+}
+
+
+/*
+ * CreateModifyState reads the options of the foreign table and resolves the
+ * encoder, compression and blob name suffix.
+ */
+static BlobFdwModifyState *
+CreateModifyState(ResultRelInfo *resultRelInfo)
+{
+	Relation relation = resultRelInfo->ri_RelationDesc;
+	BlobFdwOptions *options = GetBlobFdwOptions(RelationGetRelid(relation));
+
+	BlobFdwModifyState *modifyState = palloc0(sizeof(BlobFdwModifyState));
+	modifyState->options = options;
+	modifyState->connectionString =
+		AccountStringToConnectionString(options->accountString);
+	modifyState->tupleDescriptor = RelationGetDescr(relation);
+	modifyState->startTime = GetCurrentTimestamp();
+
+	/* blob names determine "auto" for paths, the suffix does for prefixes */
+	char *nameForAuto = options->path != NULL ? options->path : options->suffix;
+
+	modifyState->encoderString = options->decoderString;
+	if (strcmp(modifyState->encoderString, "auto") == 0)
+	{
+		modifyState->encoderString =
+			nameForAuto != NULL ? CodecStringFromFileName(nameForAuto) : "csv";
+	}
+
+	modifyState->compressionString = options->compressionString;
+	if (strcmp(modifyState->compressionString, "auto") == 0)
+	{
+		modifyState->compressionString =
+			nameForAuto != NULL ? CompressionStringFromFileName(nameForAuto) : "none";
+	}
+
+	modifyState->suffix = options->suffix;
+	if (modifyState->suffix == NULL)
+	{
+		modifyState->suffix = DefaultSuffix(modifyState->encoderString,
+		                                    modifyState->compressionString);
+	}
+
+	modifyState->blobContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                                 "azure_blob insert",
+	                                                 ALLOCSET_DEFAULT_SIZES);
+	modifyState->batch = CreateTupleBatch(modifyState->tupleDescriptor,
+	                                      options->batchSize);
+
+	return modifyState;
+}
+
+
+/*
+ * DefaultSuffix returns the blob name suffix for the given encoder and
+ * compression.
+ */
+static char *
+DefaultSuffix(char *encoderString, char *compressionString)
+{
+	char *extension = encoderString;
+
+	if (strcmp(encoderString, "binary") == 0)
+	{
+		extension = "bin";
+	}
+	else if (strcmp(encoderString, "text") == 0)
+	{
+		extension = "txt";
+	}
+
+	if (strcmp(compressionString, "gzip") == 0)
+	{
+		return psprintf(".%s.gz", extension);
+	}
+	else if (strcmp(compressionString, "zstd") == 0)
+	{
+		return psprintf(".%s.zst", extension);
+	}
+	else if (strcmp(compressionString, "lz4") == 0)
+	{
+		return psprintf(".%s.lz4", extension);
+	}
+
+	return psprintf(".%s", extension);
+}
+
+
+/*
+ * BlobFdwExecForeignInsert encodes a single row.
+ */
+TupleTableSlot *
+BlobFdwExecForeignInsert(EState *executorState, ResultRelInfo *resultRelInfo,
+                         TupleTableSlot *slot, TupleTableSlot *planSlot)
+{
+	BlobFdwModifyState *modifyState = (BlobFdwModifyState *) resultRelInfo->ri_FdwState;
+
+	slot_getallattrs(slot);
+
+	if (modifyState->encoder == NULL)
+	{
+		OpenOutputBlob(modifyState);
+	}
+
+	TupleEncoder *encoder = modifyState->encoder;
+
+	MemoryContext oldContext = MemoryContextSwitchTo(modifyState->blobContext);
+
+	encoder->push(encoder->state, slot->tts_values, slot->tts_isnull);
+
+	if (modifyState->statsWriter != NULL)
+	{
+		BlobStatsAddRow(modifyState->statsWriter, slot->tts_values, slot->tts_isnull);
+		BlobStatsRowsEncoded(modifyState->statsWriter, encoder);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (modifyState->options->path == NULL &&
+	    modifyState->currentBlobBytes >= modifyState->options->maxBlobSize)
+	{
+		CloseOutputBlob(modifyState);
+	}
+
+	return slot;
+}
+
+
+#if PG_VERSION_NUM >= 140000
+
+/*
+ * BlobFdwExecForeignBatchInsert encodes a set of rows using the batch
+ * function of the encoder. The values in the slots are only valid during
+ * the call, so the batch is always pushed before returning.
+ */
+TupleTableSlot **
+BlobFdwExecForeignBatchInsert(EState *executorState, ResultRelInfo *resultRelInfo,
+                              TupleTableSlot **slots, TupleTableSlot **planSlots,
+                              int *slotCount)
+{
+	BlobFdwModifyState *modifyState = (BlobFdwModifyState *) resultRelInfo->ri_FdwState;
+	TupleBatch *batch = modifyState->batch;
+
+	for (int slotIndex = 0; slotIndex < *slotCount; slotIndex++)
+	{
+		TupleTableSlot *slot = slots[slotIndex];
+
+		slot_getallattrs(slot);
+
+		TupleBatchAppendRow(batch, slot->tts_values, slot->tts_isnull);
+
+		if (batch->rowCount == batch->maxRows)
+		{
+			FlushInsertBatch(modifyState);
+		}
+	}
+
+	if (batch->rowCount > 0)
+	{
+		FlushInsertBatch(modifyState);
+	}
+
+	return slots;
+}
+
+
+/*
+ * BlobFdwGetForeignModifyBatchSize returns the batch_size option, unless
+ * the insert needs to see rows one at a time.
+ */
+int
+BlobFdwGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
+{
+	BlobFdwModifyState *modifyState = (BlobFdwModifyState *) resultRelInfo->ri_FdwState;
+
+	if (modifyState == NULL ||
+	    resultRelInfo->ri_projectReturning != NULL ||
+	    resultRelInfo->ri_WithCheckOptions != NIL ||
+	    (resultRelInfo->ri_TrigDesc != NULL &&
+	     (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
+	      resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
+	{
+		return 1;
+	}
+
+	return modifyState->options->batchSize;
+}
+
+#endif
+
+
+/*
+ * FlushInsertBatch encodes the rows in the batch into the current blob and
+ * continues in a new blob if the current one reached the maximum size.
+ */
+static void
+FlushInsertBatch(BlobFdwModifyState *modifyState)
+{
+	TupleBatch *batch = modifyState->batch;
+
+	if (modifyState->encoder == NULL)
+	{
+		OpenOutputBlob(modifyState);
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(modifyState->blobContext);
+
+	TupleEncoderPushBatch(modifyState->encoder, batch);
+
+	if (modifyState->statsWriter != NULL)
+	{
+		BlobStatsAddBatch(modifyState->statsWriter, batch);
+		BlobStatsRowsEncoded(modifyState->statsWriter, modifyState->encoder);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	batch->rowCount = 0;
+
+	if (modifyState->options->path == NULL &&
+	    modifyState->currentBlobBytes >= modifyState->options->maxBlobSize)
+	{
+		CloseOutputBlob(modifyState);
+	}
+}
+
+
+/*
+ * OpenOutputBlob starts writing a new blob.
+ */
+static void
+OpenOutputBlob(BlobFdwModifyState *modifyState)
+{
+	BlobFdwOptions *options = modifyState->options;
+	char *path = options->path;
+
+	if (path == NULL)
+	{
+		path = psprintf("%spart-%d-" INT64_FORMAT "-%05d%s", options->prefix, MyProcPid,
+		                (int64) modifyState->startTime, modifyState->blobCount,
+		                modifyState->suffix);
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(modifyState->blobContext);
+
+	ByteSink *blobSink = palloc0(sizeof(ByteSink));
+	WriteBlockBlob(modifyState->connectionString, options->containerName, path,
+	               blobSink);
+
+	ByteSink *byteSink = blobSink;
+
+	modifyState->currentBlobBytes = 0;
+	modifyState->currentPath = path;
+	byteSink = CreateCountingByteSink(byteSink, &modifyState->currentBlobBytes);
+
+	if (options->writeStats)
+	{
+		modifyState->statsWriter = CreateBlobStatsWriter(modifyState->tupleDescriptor,
+		                                                 options->bloomColumns);
+		byteSink = BlobStatsCountStoredBytes(modifyState->statsWriter, byteSink);
+	}
+
+	byteSink = BuildBlobCompressor(modifyState->compressionString, byteSink, blobSink,
+	                               modifyState->connectionString, options->containerName);
+
+	if (modifyState->statsWriter != NULL)
+	{
+		byteSink = BlobStatsCountEncodedBytes(modifyState->statsWriter, byteSink,
+		                                      CanReadBlobRanges(modifyState->encoderString,
+		                                                        modifyState->compressionString));
+	}
+
+	TupleEncoder *encoder = BuildTupleEncoder(modifyState->encoderString,
+	                                          modifyState->tupleDescriptor, byteSink);
+	encoder->start(encoder->state);
+
+	MemoryContextSwitchTo(oldContext);
+
+	modifyState->encoder = encoder;
+	modifyState->blobCount++;
+}
+
+
+/*
+ * CloseOutputBlob finishes the encoder of the current blob, which flushes
+ * the compressor and commits the blob.
+ */
+static void
+CloseOutputBlob(BlobFdwModifyState *modifyState)
+{
+	TupleEncoder *encoder = modifyState->encoder;
+
+	if (encoder == NULL)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(modifyState->blobContext);
+
+	encoder->finish(encoder->state);
+
+	if (modifyState->statsWriter != NULL)
+	{
+		WriteBlobStatsSidecar(modifyState->statsWriter, modifyState->connectionString,
+		                      modifyState->options->containerName,
+		                      modifyState->currentPath);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	modifyState->encoder = NULL;
+	modifyState->statsWriter = NULL;
+	MemoryContextReset(modifyState->blobContext);
+}
+
+
+/*
+ * BlobFdwEndForeignModify writes the remaining rows and closes the current
+ * blob.
+ */
+void
+BlobFdwEndForeignModify(EState *executorState, ResultRelInfo *resultRelInfo)
+{
+	BlobFdwModifyState *modifyState = (BlobFdwModifyState *) resultRelInfo->ri_FdwState;
+
+	if (modifyState == NULL)
+	{
+		return;
+	}
+
+	if (modifyState->batch->rowCount > 0)
+	{
+		FlushInsertBatch(modifyState);
+	}
+
+	CloseOutputBlob(modifyState);
+
+	MemoryContextDelete(modifyState->blobContext);
+	resultRelInfo->ri_FdwState = NULL;
+}
+
+
+/*
+ * BlobFdwEndForeignInsert finishes COPY FROM or a routed insert.
+ */
+void
+BlobFdwEndForeignInsert(EState *executorState, ResultRelInfo *resultRelInfo)
+{
+	BlobFdwEndForeignModify(executorState, resultRelInfo);
+}
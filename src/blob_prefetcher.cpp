@@ -0,0 +1,408 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_prefetcher.cpp
+ *     Reads a block blob in a background thread.
+ *
+ * A BlobPrefetcher downloads a blob into a bounded queue of chunks from
+ * a thread of its own, such that downloads of several blobs can proceed
+ * while the backend decodes one of them. The backend consumes the chunks
+ * through a regular ByteSource.
+ *
+ * The queue is mirrored by a pipe: the thread writes a byte for every chunk
+ * it adds and a byte when it is done, and the reader takes out a byte for
+ * every chunk it removes. The read end of the pipe is therefore readable
+ * exactly when there is data to consume or the download finished, which
+ * lets the executor wait for the blob in a WaitEventSet.
+ *
+ * The thread never calls into postgres. Errors are stored and raised by the
+ * reader.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <was/storage_account.h>
+#include <was/blob.h>
+#include <cpprest/interopstream.h>
+
+#include "pgazure/cpp_utils.h"
+#include "pgazure/blob_prefetcher.h"
+
+
+/* size of the chunks in which the blob is downloaded */
+#define PREFETCH_CHUNK_SIZE (1024 * 1024)
+
+/* maximum number of chunks that are downloaded ahead of the reader */
+#define PREFETCH_MAX_CHUNKS 8
+
+/* interval at which a waiting reader checks for cancellation */
+#define PREFETCH_WAIT_INTERVAL_MS 100
+
+
+class BlobPrefetcherImpl {
+		azure::storage::cloud_block_blob block_blob;
+
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable changed;
+
+		std::deque<std::vector<char>> chunks;
+		size_t chunkOffset;
+		bool finished;
+		bool stopping;
+		std::string error;
+
+		int pipeFds[2];
+
+		void run();
+		void signal();
+
+	public:
+		BlobPrefetcherImpl(char *connectionString, char *containerName, char *path);
+		~BlobPrefetcherImpl();
+		int read(char *buf, int minRead, int maxRead);
+		bool hasData();
+		int eventFd();
+};
+
+
+static int ReadFromBlobPrefetcher(void *context, void *buf, int minRead, int maxRead);
+static void CloseBlobPrefetcher(void *context);
+
+
+BlobPrefetcherImpl::BlobPrefetcherImpl(char *connectionString, char *containerName,
+                                       char *path)
+	: chunkOffset(0), finished(false), stopping(false)
+{
+	azure::storage::cloud_storage_account storage_account = azure::storage::cloud_storage_account::parse(connectionString);
+	azure::storage::cloud_blob_client blob_client = storage_account.create_cloud_blob_client();
+	azure::storage::cloud_blob_container container = blob_client.get_container_reference(U(containerName));
+
+	block_blob = container.get_block_blob_reference(U(path));
+
+	if (pipe(pipeFds) != 0)
+	{
+		throw std::runtime_error("could not create pipe for blob prefetcher");
+	}
+
+	/* the reader never blocks on the pipe */
+	fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+
+	thread = std::thread(&BlobPrefetcherImpl::run, this);
+}
+
+
+BlobPrefetcherImpl::~BlobPrefetcherImpl()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	changed.notify_all();
+
+	/* waits for a download request that is in progress */
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+
+	close(pipeFds[0]);
+	close(pipeFds[1]);
+}
+
+
+/*
+ * run downloads the blob into the chunk queue until the end of the blob,
+ * an error, or until the prefetcher is stopped.
+ */
+void
+BlobPrefetcherImpl::run()
+{
+	try
+	{
+		concurrency::streams::istream blockStream = block_blob.open_read();
+		Concurrency::streams::async_istream<char> syncStream(blockStream);
+
+		while (true)
+		{
+			std::vector<char> chunk(PREFETCH_CHUNK_SIZE);
+
+			syncStream.read(chunk.data(), PREFETCH_CHUNK_SIZE);
+
+			size_t bytesRead = syncStream.gcount();
+			if (bytesRead == 0)
+			{
+				break;
+			}
+
+			chunk.resize(bytesRead);
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				changed.wait(lock, [this] {
+					return stopping || chunks.size() < PREFETCH_MAX_CHUNKS;
+				});
+
+				if (stopping)
+				{
+					return;
+				}
+
+				chunks.push_back(std::move(chunk));
+			}
+
+			signal();
+			changed.notify_all();
+
+			if (bytesRead < PREFETCH_CHUNK_SIZE)
+			{
+				break;
+			}
+		}
+	}
+	catch (const azure::storage::storage_exception& e)
+	{
+		azure::storage::request_result result = e.result();
+		azure::storage::storage_extended_error extended_error = result.extended_error();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		error = !extended_error.message().empty() ? extended_error.message() : e.what();
+	}
+	catch (const std::exception& e)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		error = e.what();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+	}
+
+	signal();
+	changed.notify_all();
+}
+
+
+/*
+ * signal writes a byte into the pipe to wake up a waiting executor.
+ */
+void
+BlobPrefetcherImpl::signal()
+{
+	char byte = 0;
+
+	while (write(pipeFds[1], &byte, 1) < 0 && errno == EINTR)
+	{
+		/* retry */
+	}
+}
+
+
+/*
+ * read copies downloaded bytes into buf, waiting until at least minRead bytes
+ * were copied or the download finished.
+ */
+int
+BlobPrefetcherImpl::read(char *buf, int minRead, int maxRead)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	int bytesRead = 0;
+
+	while (bytesRead < maxRead)
+	{
+		if (chunks.empty())
+		{
+			if (finished)
+			{
+				if (!error.empty())
+				{
+					throw std::runtime_error(error);
+				}
+
+				break;
+			}
+
+			if (bytesRead >= minRead && bytesRead > 0)
+			{
+				break;
+			}
+
+			changed.wait_for(lock, std::chrono::milliseconds(PREFETCH_WAIT_INTERVAL_MS));
+
+			if (IsQueryCancelPending())
+			{
+				throw std::runtime_error("canceling statement due to user request");
+			}
+
+			continue;
+		}
+
+		std::vector<char> &chunk = chunks.front();
+		size_t bytesToCopy = std::min(chunk.size() - chunkOffset,
+		                              (size_t) (maxRead - bytesRead));
+
+		memcpy(buf + bytesRead, chunk.data() + chunkOffset, bytesToCopy);
+		bytesRead += bytesToCopy;
+		chunkOffset += bytesToCopy;
+
+		if (chunkOffset == chunk.size())
+		{
+			char byte;
+
+			chunks.pop_front();
+			chunkOffset = 0;
+
+			/* take out the byte that was written for this chunk */
+			if (::read(pipeFds[0], &byte, 1) < 0 && errno != EAGAIN)
+			{
+				throw std::runtime_error("could not read from blob prefetcher pipe");
+			}
+
+			changed.notify_all();
+		}
+	}
+
+	return bytesRead;
+}
+
+
+/*
+ * hasData returns whether read can return without waiting.
+ */
+bool
+BlobPrefetcherImpl::hasData()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return !chunks.empty() || finished;
+}
+
+
+/*
+ * eventFd returns a file descriptor that is readable when hasData is true.
+ */
+int
+BlobPrefetcherImpl::eventFd()
+{
+	return pipeFds[0];
+}
+
+
+/*
+ * ReadFromBlobPrefetcher is a C-style wrapper for BlobPrefetcherImpl::read.
+ */
+static int
+ReadFromBlobPrefetcher(void *context, void *buf, int minRead, int maxRead)
+{
+	try
+	{
+		BlobPrefetcherImpl *prefetcher = (BlobPrefetcherImpl *) context;
+
+		return prefetcher->read((char *) buf, minRead, maxRead);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return 0;
+}
+
+
+/*
+ * CloseBlobPrefetcher is the close function of the byte source. The
+ * prefetcher itself is freed separately by FreeBlobPrefetcher, such that
+ * it can also be freed when the byte source is never closed.
+ */
+static void
+CloseBlobPrefetcher(void *context)
+{
+	/* nothing to do */
+}
+
+
+/*
+ * ReadBlockBlobPrefetched starts downloading a block blob in the background
+ * and opens it for reading from the byte source. The returned prefetcher
+ * can be used to wait for data and must be freed using FreeBlobPrefetcher
+ * after the byte source is closed.
+ */
+BlobPrefetcher *
+ReadBlockBlobPrefetched(char *connectionString, char *containerName, char *path,
+                        ByteSource *byteSource)
+{
+	try
+	{
+		BlobPrefetcherImpl *prefetcher = new BlobPrefetcherImpl(connectionString,
+		                                                        containerName, path);
+
+		byteSource->context = (void *) prefetcher;
+		byteSource->read = ReadFromBlobPrefetcher;
+		byteSource->close = CloseBlobPrefetcher;
+
+		return (BlobPrefetcher *) prefetcher;
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return NULL;
+}
+
+
+/*
+ * BlobPrefetcherHasData returns whether the byte source of the prefetcher can
+ * be read without waiting.
+ */
+bool
+BlobPrefetcherHasData(BlobPrefetcher *prefetcher)
+{
+	return ((BlobPrefetcherImpl *) prefetcher)->hasData();
+}
+
+
+/*
+ * BlobPrefetcherEventFd returns a file descriptor that becomes readable when
+ * BlobPrefetcherHasData returns true.
+ */
+int
+BlobPrefetcherEventFd(BlobPrefetcher *prefetcher)
+{
+	return ((BlobPrefetcherImpl *) prefetcher)->eventFd();
+}
+
+
+/*
+ * FreeBlobPrefetcher stops the download thread and frees the prefetcher.
+ * It does not raise errors, since it is also used for cleanup on abort.
+ */
+void
+FreeBlobPrefetcher(BlobPrefetcher *prefetcher)
+{
+	try
+	{
+		delete (BlobPrefetcherImpl *) prefetcher;
+	}
+	catch (...)
+	{
+		/* ignore errors during cleanup */
+	}
+}
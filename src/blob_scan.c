@@ -0,0 +1,970 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_scan.c
+ *     Custom scan that replaces function scans on blob_storage_get_blob.
+ *
+ * A function scan materializes all rows returned by blob_storage_get_blob
+ * into a tuple store, and the decoder converts every column of every row.
+ * The custom scan instead streams rows out of the decoder as they are read,
+ * and tells the decoder which columns the query uses, such that it can skip
+ * the conversion of the other columns, which are returned as NULL.
+ *
+ * Simple filters on the columns (comparisons with constants, IN lists and
+ * IS [NOT] NULL) are pushed into the decoder, which evaluates them right
+ * after converting only the filter columns and skips the conversion of the
+ * remaining columns for rows that do not match. The same filters are checked
+ * against the statistics sidecar of the blob, if it has one, to skip the
+ * blob or the blocks of rows that cannot match.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/sysattr.h"
+#include "access/tupdesc.h"
+#include "catalog/namespace.h"
+#include "catalog/objectaccess.h"
+#include "catalog/pg_proc.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "nodes/extensible.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/restrictinfo.h"
+#include "pgazure/blob_estimates.h"
+#include "pgazure/blob_scan.h"
+#include "pgazure/blob_stats.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/codecs.h"
+#include "pgazure/get_blob.h"
+#include "pgazure/storage_account.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/ruleutils.h"
+
+
+/* schema in which the extension creates its functions */
+#define PGAZURE_SCHEMA_NAME "azure"
+
+/* number of arguments passed from blob_storage_get_blob to the scan */
+#define BLOB_SCAN_ARGUMENT_COUNT 5
+
+
+/*
+ * BlobScanState is the execution state of a blob scan.
+ */
+typedef struct BlobScanState
+{
+	CustomScanState customScanState;
+
+	/* connection string, container, path, decoder and compression arguments */
+	List *argumentStates;
+
+	/* for each column, whether the query uses it */
+	bool *projectedColumns;
+
+	/* filters evaluated by the decoder, or NULL if there are none */
+	ExprState *decoderQual;
+	ExprContext *decoderQualContext;
+	TupleTableSlot *decoderQualSlot;
+	TupleDecoderFilter *decoderFilter;
+	List *decoderQualList;
+
+	/* how the statistics sidecar was used, for EXPLAIN ANALYZE, or NULL */
+	char *statsUsage;
+
+	/* memory context for the decoder, reset when rescanning */
+	MemoryContext scanContext;
+
+	/* decoder and the current batch of rows, opened on the first fetch */
+	TupleDecoder *decoder;
+	TupleBatch *batch;
+	int batchRowIndex;
+	bool decoderFinished;
+} BlobScanState;
+
+
+static void BlobScanSetRelPathlist(PlannerInfo *root, RelOptInfo *rel, Index rti,
+                                   RangeTblEntry *rte);
+static List * BlobScanArgumentList(Expr *functionExpression);
+static TupleDesc BlobScanTupleDesc(RangeTblEntry *rte, RangeTblFunction *rtfunc);
+static bool IsDecoderQual(Expr *clause);
+static bool IsSimpleOperand(Node *operand, bool *isColumn);
+static Plan * BlobScanPlanCustomPath(PlannerInfo *root, RelOptInfo *rel,
+                                     CustomPath *bestPath, List *tlist,
+                                     List *clauses, List *customPlans);
+static List * BlobScanTargetList(Index relationId, TupleDesc tupleDescriptor);
+static Node * BlobScanCreateCustomScanState(CustomScan *customScan);
+static void BlobScanBeginCustomScan(CustomScanState *node, EState *estate, int eflags);
+static TupleDecoderFilter * CreateDecoderFilter(BlobScanState *scanState,
+                                                List *decoderQualList);
+static bool DecoderFilterMatches(void *context, Datum *columnValues, bool *columnNulls);
+static TupleTableSlot * BlobScanExecCustomScan(CustomScanState *node);
+static TupleTableSlot * BlobScanNext(ScanState *node);
+static bool BlobScanRecheck(ScanState *node, TupleTableSlot *slot);
+static void BlobScanOpenDecoder(BlobScanState *scanState);
+static void BlobScanCloseDecoder(BlobScanState *scanState);
+static void BlobScanEndCustomScan(CustomScanState *node);
+static void BlobScanReScanCustomScan(CustomScanState *node);
+static void BlobScanExplainCustomScan(CustomScanState *node, List *ancestors,
+                                      ExplainState *es);
+
+
+/* whether to replace function scans on blob_storage_get_blob */
+bool EnableBlobScan = true;
+
+static set_rel_pathlist_hook_type PreviousSetRelPathlistHook = NULL;
+
+static CustomPathMethods BlobScanPathMethods = {
+	.CustomName = "BlobScan",
+	.PlanCustomPath = BlobScanPlanCustomPath,
+};
+
+static CustomScanMethods BlobScanScanMethods = {
+	.CustomName = "BlobScan",
+	.CreateCustomScanState = BlobScanCreateCustomScanState,
+};
+
+static CustomExecMethods BlobScanExecMethods = {
+	.CustomName = "BlobScan",
+	.BeginCustomScan = BlobScanBeginCustomScan,
+	.ExecCustomScan = BlobScanExecCustomScan,
+	.EndCustomScan = BlobScanEndCustomScan,
+	.ReScanCustomScan = BlobScanReScanCustomScan,
+	.ExplainCustomScan = BlobScanExplainCustomScan,
+};
+
+/* names of the arguments, for error messages */
+static const char *BlobScanArgumentNames[BLOB_SCAN_ARGUMENT_COUNT] = {
+	"connection_string", "container_name", "path", "decoder", "compression"
+};
+
+
+/*
+ * InitializeBlobScan installs the planner hook that adds blob scan paths.
+ */
+void
+InitializeBlobScan(void)
+{
+	RegisterCustomScanMethods(&BlobScanScanMethods);
+
+	PreviousSetRelPathlistHook = set_rel_pathlist_hook;
+	set_rel_pathlist_hook = BlobScanSetRelPathlist;
+}
+
+
+/*
+ * BlobScanSetRelPathlist adds a blob scan path for function scans on
+ * blob_storage_get_blob.
+ */
+static void
+BlobScanSetRelPathlist(PlannerInfo *root, RelOptInfo *rel, Index rti,
+                       RangeTblEntry *rte)
+{
+	if (PreviousSetRelPathlistHook != NULL)
+	{
+		PreviousSetRelPathlistHook(root, rel, rti, rte);
+	}
+
+	if (!EnableBlobScan)
+	{
+		return;
+	}
+
+	/* arguments that refer to other relations are not supported */
+	if (rte->rtekind != RTE_FUNCTION || rte->funcordinality ||
+		list_length(rte->functions) != 1 || !bms_is_empty(rel->lateral_relids) ||
+		rel->pathlist == NIL)
+	{
+		return;
+	}
+
+	RangeTblFunction *rtfunc = (RangeTblFunction *) linitial(rte->functions);
+	if (BlobScanArgumentList((Expr *) rtfunc->funcexpr) == NIL)
+	{
+		return;
+	}
+
+	TupleDesc tupleDescriptor = BlobScanTupleDesc(rte, rtfunc);
+	if (tupleDescriptor == NULL)
+	{
+		return;
+	}
+
+	Path *functionScanPath = (Path *) linitial(rel->pathlist);
+
+	CustomPath *customPath = makeNode(CustomPath);
+	customPath->path.pathtype = T_CustomScan;
+	customPath->path.parent = rel;
+	customPath->path.pathtarget = rel->reltarget;
+	customPath->path.param_info = NULL;
+	customPath->path.parallel_aware = false;
+	customPath->path.parallel_safe = false;
+	customPath->path.parallel_workers = 0;
+	customPath->path.rows = rel->rows;
+
+	/*
+	 * The function scan reads the whole blob before returning the first row,
+	 * whereas we return rows as they are decoded, after the request that
+	 * opens the blob. The total work is the same or less, so we keep the
+	 * total cost of the function scan.
+	 */
+	customPath->path.startup_cost = Min(BlobRequestCost, functionScanPath->total_cost);
+	customPath->path.total_cost = functionScanPath->total_cost;
+	customPath->path.pathkeys = NIL;
+
+	customPath->flags = 0;
+	customPath->custom_paths = NIL;
+	customPath->custom_private = list_make1(ProjectedColumnList(rel,
+	                                                            tupleDescriptor->natts));
+	customPath->methods = &BlobScanPathMethods;
+
+	add_path(rel, (Path *) customPath);
+}
+
+
+/*
+ * BlobScanArgumentList returns the connection string, container name, path,
+ * decoder and compression arguments if the expression is a call to
+ * blob_storage_get_blob, or NIL otherwise.
+ */
+static List *
+BlobScanArgumentList(Expr *functionExpression)
+{
+	if (!IsA(functionExpression, FuncExpr))
+	{
+		return NIL;
+	}
+
+	FuncExpr *funcExpr = (FuncExpr *) functionExpression;
+	Oid functionId = funcExpr->funcid;
+	char *functionName = get_func_name(functionId);
+
+	if (functionName == NULL || strcmp(functionName, "blob_storage_get_blob") != 0 ||
+		get_func_namespace(functionId) != get_namespace_oid(PGAZURE_SCHEMA_NAME, true))
+	{
+		return NIL;
+	}
+
+	/* default arguments have been filled in by the planner at this point */
+	List *argumentList = funcExpr->args;
+
+	if (list_length(argumentList) == BLOB_SCAN_ARGUMENT_COUNT)
+	{
+		/* blob_storage_get_blob(text,text,text,text,text) */
+		return argumentList;
+	}
+	else if (list_length(argumentList) == BLOB_SCAN_ARGUMENT_COUNT + 1)
+	{
+		/* blob_storage_get_blob(text,text,text,anyelement,text,text) */
+		return list_make5(list_nth(argumentList, 0), list_nth(argumentList, 1),
+		                  list_nth(argumentList, 2), list_nth(argumentList, 4),
+		                  list_nth(argumentList, 5));
+	}
+
+	return NIL;
+}
+
+
+/*
+ * BlobScanTupleDesc returns the tuple descriptor of the rows returned by the
+ * function, or NULL if the blob scan does not support the result type.
+ */
+static TupleDesc
+BlobScanTupleDesc(RangeTblEntry *rte, RangeTblFunction *rtfunc)
+{
+	Node *functionExpression = rtfunc->funcexpr;
+	TupleDesc tupleDescriptor = NULL;
+	Oid resultTypeId = InvalidOid;
+
+	TypeFuncClass functionClass = get_expr_result_type(functionExpression,
+	                                                   &resultTypeId,
+	                                                   &tupleDescriptor);
+
+	if (functionClass == TYPEFUNC_COMPOSITE)
+	{
+		/* blob_storage_get_blob(text,text,text,anyelement,text,text) */
+		for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+			/* the scan tuple cannot contain dropped columns */
+			if (attr->attisdropped)
+			{
+				return NULL;
+			}
+		}
+
+		return tupleDescriptor;
+	}
+	else if (functionClass == TYPEFUNC_SCALAR)
+	{
+		/* blob_storage_get_blob with a scalar anyelement, e.g. jsonb */
+		char *columnName = strVal(linitial(rte->eref->colnames));
+
+		tupleDescriptor = CreateTemplateTupleDesc(1);
+		TupleDescInitEntry(tupleDescriptor, (AttrNumber) 1, columnName,
+		                   resultTypeId, -1, 0);
+
+		return tupleDescriptor;
+	}
+	else if (functionClass == TYPEFUNC_RECORD && rtfunc->funccolnames != NIL)
+	{
+		/* blob_storage_get_blob(text,text,text,text,text) with a column list */
+		return BuildDescFromLists(rtfunc->funccolnames, rtfunc->funccoltypes,
+		                          rtfunc->funccoltypmods, rtfunc->funccolcollations);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * ProjectedColumnList returns the attribute numbers of the columns that are
+ * used in the target list or the filters of the relation.
+ */
+List *
+ProjectedColumnList(RelOptInfo *rel, int columnCount)
+{
+	Bitmapset *attributesUsed = NULL;
+	List *projectedColumnList = NIL;
+	ListCell *restrictInfoCell = NULL;
+
+	pull_varattnos((Node *) rel->reltarget->exprs, rel->relid, &attributesUsed);
+
+	foreach(restrictInfoCell, rel->baserestrictinfo)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+
+		pull_varattnos((Node *) restrictInfo->clause, rel->relid, &attributesUsed);
+	}
+
+	/* a whole-row reference uses all columns */
+	bool wholeRowUsed = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber,
+	                                  attributesUsed);
+
+	for (AttrNumber attributeNumber = 1; attributeNumber <= columnCount;
+	     attributeNumber++)
+	{
+		if (wholeRowUsed ||
+			bms_is_member(attributeNumber - FirstLowInvalidHeapAttributeNumber,
+			              attributesUsed))
+		{
+			projectedColumnList = lappend_int(projectedColumnList, attributeNumber);
+		}
+	}
+
+	return projectedColumnList;
+}
+
+
+/*
+ * BlobScanPlanCustomPath creates the plan for a blob scan path.
+ *
+ * Since the function RTE is not a relation, the scan uses scanrelid 0 and
+ * describes its scan tuple in custom_scan_tlist. custom_exprs contains the
+ * arguments of the function, which are evaluated at run time, followed by
+ * the filters that are evaluated by the decoder.
+ */
+static Plan *
+BlobScanPlanCustomPath(PlannerInfo *root, RelOptInfo *rel, CustomPath *bestPath,
+                       List *tlist, List *clauses, List *customPlans)
+{
+	RangeTblEntry *rte = planner_rt_fetch(rel->relid, root);
+	RangeTblFunction *rtfunc = (RangeTblFunction *) linitial(rte->functions);
+	TupleDesc tupleDescriptor = BlobScanTupleDesc(rte, rtfunc);
+	List *argumentList = BlobScanArgumentList((Expr *) rtfunc->funcexpr);
+	List *decoderQualList = NIL;
+	List *scanQualList = NIL;
+	ListCell *clauseCell = NULL;
+
+	foreach(clauseCell, clauses)
+	{
+		RestrictInfo *restrictInfo = lfirst_node(RestrictInfo, clauseCell);
+
+		/* pseudoconstant quals are handled by a gating Result node */
+		if (restrictInfo->pseudoconstant)
+		{
+			continue;
+		}
+
+		if (IsDecoderQual(restrictInfo->clause))
+		{
+			decoderQualList = lappend(decoderQualList, restrictInfo->clause);
+		}
+		else
+		{
+			scanQualList = lappend(scanQualList, restrictInfo->clause);
+		}
+	}
+
+	CustomScan *customScan = makeNode(CustomScan);
+	customScan->scan.plan.targetlist = tlist;
+	customScan->scan.plan.qual = scanQualList;
+	customScan->scan.scanrelid = 0;
+	customScan->flags = bestPath->flags;
+	customScan->custom_scan_tlist = BlobScanTargetList(rel->relid, tupleDescriptor);
+	customScan->custom_exprs = list_concat(list_copy(argumentList), decoderQualList);
+	/* projected columns and the function, whose privileges are checked at run time */
+	Oid functionId = ((FuncExpr *) rtfunc->funcexpr)->funcid;
+	customScan->custom_private = lappend(list_copy(bestPath->custom_private),
+	                                     list_make1_oid(functionId));
+	customScan->methods = &BlobScanScanMethods;
+
+	return (Plan *) customScan;
+}
+
+
+/*
+ * IsDecoderQual returns whether a clause can be evaluated by the decoder,
+ * which applies to comparisons between a column and a constant, IN lists
+ * and IS [NOT] NULL. The decoder evaluates these using only the columns
+ * they reference, before converting the rest of the row.
+ */
+static bool
+IsDecoderQual(Expr *clause)
+{
+	bool isColumn = false;
+
+	if (contain_volatile_functions((Node *) clause))
+	{
+		return false;
+	}
+
+	if (IsA(clause, OpExpr))
+	{
+		OpExpr *opExpr = (OpExpr *) clause;
+		bool leftIsColumn = false;
+		bool rightIsColumn = false;
+
+		return list_length(opExpr->args) == 2 &&
+			   IsSimpleOperand(linitial(opExpr->args), &leftIsColumn) &&
+			   IsSimpleOperand(lsecond(opExpr->args), &rightIsColumn) &&
+			   (leftIsColumn || rightIsColumn);
+	}
+	else if (IsA(clause, ScalarArrayOpExpr))
+	{
+		ScalarArrayOpExpr *arrayOpExpr = (ScalarArrayOpExpr *) clause;
+		bool arrayIsColumn = false;
+
+		return IsSimpleOperand(linitial(arrayOpExpr->args), &isColumn) && isColumn &&
+			   IsSimpleOperand(lsecond(arrayOpExpr->args), &arrayIsColumn) &&
+			   !arrayIsColumn;
+	}
+	else if (IsA(clause, NullTest))
+	{
+		NullTest *nullTest = (NullTest *) clause;
+
+		return !nullTest->argisrow &&
+			   IsSimpleOperand((Node *) nullTest->arg, &isColumn) && isColumn;
+	}
+
+	return false;
+}
+
+
+/*
+ * IsSimpleOperand returns whether an operand is a column, a constant or a
+ * parameter, possibly with a binary-compatible cast, and sets isColumn when
+ * it is a column.
+ */
+static bool
+IsSimpleOperand(Node *operand, bool *isColumn)
+{
+	if (IsA(operand, RelabelType))
+	{
+		operand = (Node *) ((RelabelType *) operand)->arg;
+	}
+
+	*isColumn = IsA(operand, Var) && ((Var *) operand)->varlevelsup == 0 &&
+				((Var *) operand)->varattno > 0;
+
+	return *isColumn || IsA(operand, Const) || IsA(operand, Param);
+}
+
+
+/*
+ * BlobScanTargetList returns a target list with a Var for every column of
+ * the function result, which describes the scan tuple of the blob scan.
+ */
+static List *
+BlobScanTargetList(Index relationId, TupleDesc tupleDescriptor)
+{
+	List *targetList = NIL;
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+		AttrNumber attributeNumber = columnIndex + 1;
+
+		Var *column = makeVar(relationId, attributeNumber, attr->atttypid,
+		                      attr->atttypmod, attr->attcollation, 0);
+		TargetEntry *targetEntry = makeTargetEntry((Expr *) column, attributeNumber,
+		                                           pstrdup(NameStr(attr->attname)),
+		                                           false);
+
+		targetList = lappend(targetList, targetEntry);
+	}
+
+	return targetList;
+}
+
+
+/*
+ * BlobScanCreateCustomScanState creates the execution state of a blob scan.
+ */
+static Node *
+BlobScanCreateCustomScanState(CustomScan *customScan)
+{
+	BlobScanState *scanState = palloc0(sizeof(BlobScanState));
+
+	NodeSetTag(scanState, T_CustomScanState);
+	scanState->customScanState.methods = &BlobScanExecMethods;
+	scanState->customScanState.slotOps = &TTSOpsVirtual;
+
+	return (Node *) scanState;
+}
+
+
+/*
+ * BlobScanBeginCustomScan prepares the arguments and the projection of the
+ * scan. The blob is only opened on the first fetch.
+ */
+static void
+BlobScanBeginCustomScan(CustomScanState *node, EState *estate, int eflags)
+{
+	BlobScanState *scanState = (BlobScanState *) node;
+	CustomScan *customScan = (CustomScan *) node->ss.ps.plan;
+	TupleDesc tupleDescriptor = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	List *projectedColumnList = (List *) linitial(customScan->custom_private);
+	Oid functionId = linitial_oid((List *) lsecond(customScan->custom_private));
+	ListCell *projectedColumnCell = NULL;
+
+	/* same checks as the function scan we replace does in init_fcache */
+#if PG_VERSION_NUM >= 160000
+	AclResult aclResult = object_aclcheck(ProcedureRelationId, functionId, GetUserId(),
+	                                      ACL_EXECUTE);
+#else
+	AclResult aclResult = pg_proc_aclcheck(functionId, GetUserId(), ACL_EXECUTE);
+#endif
+	if (aclResult != ACLCHECK_OK)
+	{
+		aclcheck_error(aclResult, OBJECT_FUNCTION, get_func_name(functionId));
+	}
+
+	InvokeFunctionExecuteHook(functionId);
+
+	List *argumentList = list_truncate(list_copy(customScan->custom_exprs),
+	                                   BLOB_SCAN_ARGUMENT_COUNT);
+	List *decoderQualList = list_copy_tail(customScan->custom_exprs,
+	                                       BLOB_SCAN_ARGUMENT_COUNT);
+
+	scanState->argumentStates = ExecInitExprList(argumentList, (PlanState *) node);
+
+	scanState->projectedColumns = palloc0(tupleDescriptor->natts * sizeof(bool));
+
+	foreach(projectedColumnCell, projectedColumnList)
+	{
+		AttrNumber attributeNumber = (AttrNumber) lfirst_int(projectedColumnCell);
+
+		scanState->projectedColumns[attributeNumber - 1] = true;
+	}
+
+	if (decoderQualList != NIL)
+	{
+		scanState->decoderFilter = CreateDecoderFilter(scanState, decoderQualList);
+		scanState->decoderQualList = decoderQualList;
+	}
+
+	scanState->scanContext = AllocSetContextCreate(estate->es_query_cxt,
+	                                               "Blob Scan Context",
+	                                               ALLOCSET_DEFAULT_SIZES);
+}
+
+
+/*
+ * CreateDecoderFilter prepares the filters that are evaluated by the decoder.
+ * They are evaluated against a separate slot, since the decoder calls the
+ * filter while the scan tuple slot may still hold a previous row.
+ */
+static TupleDecoderFilter *
+CreateDecoderFilter(BlobScanState *scanState, List *decoderQualList)
+{
+	PlanState *planState = (PlanState *) scanState;
+	EState *executorState = planState->state;
+	TupleDesc tupleDescriptor =
+		scanState->customScanState.ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	Bitmapset *filterAttributes = NULL;
+
+	scanState->decoderQual = ExecInitQual(decoderQualList, planState);
+	scanState->decoderQualContext = CreateExprContext(executorState);
+	scanState->decoderQualSlot = ExecInitExtraTupleSlot(executorState, tupleDescriptor,
+	                                                    &TTSOpsVirtual);
+
+	/* after setrefs, the filters refer to the scan tuple as INDEX_VAR */
+	pull_varattnos((Node *) decoderQualList, INDEX_VAR, &filterAttributes);
+
+	TupleDecoderFilter *filter = palloc0(sizeof(TupleDecoderFilter));
+	filter->filterColumns = palloc0(tupleDescriptor->natts * sizeof(bool));
+	filter->matches = DecoderFilterMatches;
+	filter->context = scanState;
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		AttrNumber attributeNumber = columnIndex + 1;
+
+		filter->filterColumns[columnIndex] =
+			bms_is_member(attributeNumber - FirstLowInvalidHeapAttributeNumber,
+			              filterAttributes);
+	}
+
+	return filter;
+}
+
+
+/*
+ * DecoderFilterMatches is called by the decoder with the filter columns of a
+ * row and returns whether the row passes the decoder filters.
+ */
+static bool
+DecoderFilterMatches(void *context, Datum *columnValues, bool *columnNulls)
+{
+	BlobScanState *scanState = (BlobScanState *) context;
+	ExprContext *expressionContext = scanState->decoderQualContext;
+	TupleTableSlot *slot = scanState->decoderQualSlot;
+	int columnCount = slot->tts_tupleDescriptor->natts;
+
+	ResetExprContext(expressionContext);
+
+	ExecClearTuple(slot);
+	memcpy(slot->tts_values, columnValues, columnCount * sizeof(Datum));
+	memcpy(slot->tts_isnull, columnNulls, columnCount * sizeof(bool));
+	ExecStoreVirtualTuple(slot);
+
+	expressionContext->ecxt_scantuple = slot;
+
+	return ExecQual(scanState->decoderQual, expressionContext);
+}
+
+
+/*
+ * BlobScanExecCustomScan returns the next tuple that passes the filters.
+ */
+static TupleTableSlot *
+BlobScanExecCustomScan(CustomScanState *node)
+{
+	return ExecScan(&node->ss, BlobScanNext, BlobScanRecheck);
+}
+
+
+/*
+ * BlobScanNext returns the next row from the decoder in the scan tuple slot,
+ * or an empty slot when there are no more rows.
+ */
+static TupleTableSlot *
+BlobScanNext(ScanState *node)
+{
+	BlobScanState *scanState = (BlobScanState *) node;
+	TupleTableSlot *slot = node->ss_ScanTupleSlot;
+
+	if (scanState->batch == NULL)
+	{
+		BlobScanOpenDecoder(scanState);
+	}
+
+	ExecClearTuple(slot);
+
+	TupleBatch *batch = scanState->batch;
+
+	/* batches can be empty when the decoder filters out all rows */
+	while (scanState->batchRowIndex >= batch->rowCount)
+	{
+		if (scanState->decoderFinished)
+		{
+			return slot;
+		}
+
+		MemoryContext oldContext = MemoryContextSwitchTo(scanState->scanContext);
+
+		bool batchFound = TupleDecoderNextBatch(scanState->decoder, batch);
+
+		MemoryContextSwitchTo(oldContext);
+
+		if (!batchFound)
+		{
+			BlobScanCloseDecoder(scanState);
+			return slot;
+		}
+
+		scanState->batchRowIndex = 0;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	TupleBatchGetRow(batch, scanState->batchRowIndex, slot->tts_values,
+	                 slot->tts_isnull);
+	scanState->batchRowIndex++;
+
+	return ExecStoreVirtualTuple(slot);
+}
+
+
+/*
+ * BlobScanRecheck is only called for EvalPlanQual, which does not apply to
+ * blob scans.
+ */
+static bool
+BlobScanRecheck(ScanState *node, TupleTableSlot *slot)
+{
+	return true;
+}
+
+
+/*
+ * BlobScanOpenDecoder evaluates the function arguments, opens the blob and
+ * starts the decoder. If the statistics sidecar of the blob shows that no
+ * row passes the decoder filters, the blob is not opened and the scan is
+ * finished right away.
+ */
+static void
+BlobScanOpenDecoder(BlobScanState *scanState)
+{
+	ExprContext *expressionContext = scanState->customScanState.ss.ps.ps_ExprContext;
+	TupleTableSlot *slot = scanState->customScanState.ss.ss_ScanTupleSlot;
+	TupleDesc tupleDescriptor = slot->tts_tupleDescriptor;
+	char *arguments[BLOB_SCAN_ARGUMENT_COUNT];
+	int argumentIndex = 0;
+	ListCell *argumentCell = NULL;
+
+	MemoryContext oldContext = MemoryContextSwitchTo(scanState->scanContext);
+
+	foreach(argumentCell, scanState->argumentStates)
+	{
+		ExprState *argumentState = (ExprState *) lfirst(argumentCell);
+		bool isNull = false;
+
+		Datum argumentValue = ExecEvalExpr(argumentState, expressionContext, &isNull);
+		if (isNull)
+		{
+			ereport(ERROR, (errmsg("%s argument is required",
+			                       BlobScanArgumentNames[argumentIndex])));
+		}
+
+		arguments[argumentIndex] = TextDatumGetCString(argumentValue);
+		argumentIndex++;
+	}
+
+	char *connectionString = AccountStringToConnectionString(arguments[0]);
+	char *containerName = arguments[1];
+	char *path = arguments[2];
+	char *decoderString = arguments[3];
+	char *compressionString = arguments[4];
+	char *byteRanges = NULL;
+
+	scanState->batch = CreateTupleBatch(tupleDescriptor, TUPLE_BATCH_SIZE);
+	scanState->batchRowIndex = 0;
+	scanState->decoderFinished = false;
+
+	if (EnableBlobStats && scanState->decoderQualList != NIL)
+	{
+		List *predicateList = BuildBlobStatsPredicates(scanState->decoderQualList,
+		                                               INDEX_VAR, tupleDescriptor,
+		                                               expressionContext);
+		BlobStats *stats = NULL;
+
+		if (predicateList != NIL)
+		{
+			stats = ReadBlobStats(connectionString, containerName, path, NULL,
+			                      tupleDescriptor);
+		}
+
+		if (stats != NULL &&
+		    !BlobStatsSelectRanges(stats, predicateList, &byteRanges))
+		{
+			scanState->statsUsage = "blob skipped";
+			scanState->decoderFinished = true;
+
+			MemoryContextSwitchTo(oldContext);
+			return;
+		}
+
+		scanState->statsUsage = stats == NULL ? NULL :
+								byteRanges != NULL ? "blocks skipped" : "no rows skipped";
+	}
+
+	if (strcmp(compressionString, "auto") == 0)
+	{
+		compressionString = CompressionStringForBlob(connectionString, containerName,
+		                                             path);
+	}
+
+	if (strcmp(decoderString, "auto") == 0)
+	{
+		decoderString = CodecStringFromFileName(path);
+	}
+
+	TupleDecoder *decoder = NULL;
+
+	if (byteRanges != NULL && CanReadBlobRanges(decoderString, compressionString))
+	{
+		ByteSource *byteSource = palloc0(sizeof(ByteSource));
+
+		ReadBlockBlobRanges(connectionString, containerName, path, byteRanges,
+		                    byteSource);
+
+		decoder = BuildTupleDecoder(decoderString, tupleDescriptor, byteSource,
+		                            scanState->projectedColumns,
+		                            scanState->decoderFilter);
+	}
+	else
+	{
+		if (byteRanges != NULL)
+		{
+			/* the arguments do not match how the blob was written */
+			scanState->statsUsage = "no rows skipped";
+		}
+
+		decoder = BuildBlobTupleDecoder(connectionString, containerName, path,
+		                                decoderString, compressionString,
+		                                tupleDescriptor, scanState->projectedColumns,
+		                                scanState->decoderFilter);
+	}
+
+	decoder->start(decoder->state);
+
+	scanState->decoder = decoder;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * BlobScanCloseDecoder finishes the decoder, which closes the blob.
+ */
+static void
+BlobScanCloseDecoder(BlobScanState *scanState)
+{
+	TupleDecoder *decoder = scanState->decoder;
+
+	if (decoder == NULL || scanState->decoderFinished)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(scanState->scanContext);
+
+	decoder->finish(decoder->state);
+
+	MemoryContextSwitchTo(oldContext);
+
+	scanState->decoderFinished = true;
+}
+
+
+/*
+ * BlobScanEndCustomScan closes the blob if the scan stopped early.
+ */
+static void
+BlobScanEndCustomScan(CustomScanState *node)
+{
+	BlobScanState *scanState = (BlobScanState *) node;
+
+	BlobScanCloseDecoder(scanState);
+
+	MemoryContextDelete(scanState->scanContext);
+}
+
+
+/*
+ * BlobScanReScanCustomScan closes the blob, such that it is read again from
+ * the start on the next fetch.
+ */
+static void
+BlobScanReScanCustomScan(CustomScanState *node)
+{
+	BlobScanState *scanState = (BlobScanState *) node;
+
+	BlobScanCloseDecoder(scanState);
+
+	MemoryContextReset(scanState->scanContext);
+	scanState->decoder = NULL;
+	scanState->batch = NULL;
+	scanState->statsUsage = NULL;
+
+	ExecScanReScan(&node->ss);
+}
+
+
+/*
+ * BlobScanExplainCustomScan shows which columns are decoded and the filters
+ * that are evaluated by the decoder.
+ */
+static void
+BlobScanExplainCustomScan(CustomScanState *node, List *ancestors, ExplainState *es)
+{
+	BlobScanState *scanState = (BlobScanState *) node;
+	TupleDesc tupleDescriptor = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	StringInfo decodedColumns = makeStringInfo();
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (!scanState->projectedColumns[columnIndex])
+		{
+			continue;
+		}
+
+		if (decodedColumns->len > 0)
+		{
+			appendStringInfoString(decodedColumns, ", ");
+		}
+
+		appendStringInfoString(decodedColumns, quote_identifier(NameStr(attr->attname)));
+	}
+
+	ExplainPropertyText("Decoded Columns",
+	                    decodedColumns->len > 0 ? decodedColumns->data : "none", es);
+
+	CustomScan *customScan = (CustomScan *) node->ss.ps.plan;
+	List *decoderQualList = list_copy_tail(customScan->custom_exprs,
+	                                       BLOB_SCAN_ARGUMENT_COUNT);
+
+	if (decoderQualList != NIL)
+	{
+		bool useVariablePrefix = list_length(es->rtable) > 1 || es->verbose;
+
+#if PG_VERSION_NUM >= 130000
+		List *deparseContext = set_deparse_context_plan(es->deparse_cxt,
+		                                                (Plan *) customScan,
+		                                                ancestors);
+#else
+		List *deparseContext = set_deparse_context_planstate(es->deparse_cxt,
+		                                                     (Node *) node,
+		                                                     ancestors);
+#endif
+
+		char *decoderFilterString =
+			deparse_expression((Node *) make_ands_explicit(decoderQualList),
+			                   deparseContext, useVariablePrefix, false);
+
+		ExplainPropertyText("Decoder Filter", decoderFilterString, es);
+	}
+
+	if (es->analyze && scanState->statsUsage != NULL)
+	{
+		ExplainPropertyText("Blob Statistics", scanState->statsUsage, es);
+	}
+}
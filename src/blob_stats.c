@@ -0,0 +1,2196 @@
+/*-------------------------------------------------------------------------
+ *
+ * blob_stats.c
+ *     Column statistics sidecars that are used to skip blobs.
+ *
+ * When a blob is written with statistics, the minimum and maximum value and
+ * the number of NULLs of each column are collected while the rows are
+ * encoded, along with bloom filters of the values of chosen columns. They
+ * are stored in a small text blob named <path>.pgazure_stats next to the
+ * blob, which also records the ETag of the blob after it was uploaded, such
+ * that a sidecar that belongs to another version of the blob is ignored,
+ * even if the new version has the same size.
+ *
+ * Scans turn simple filters on columns into predicates and check them
+ * against the sidecar before downloading a blob, and skip the blob when no
+ * row can match. For uncompressed csv and tsv blobs, the sidecar also has
+ * statistics for each block of BLOB_STATS_BLOCK_ROWS rows along with the
+ * byte range of the block, and only the byte ranges of blocks that may
+ * match are downloaded.
+ *
+ * The sidecar consists of tab-separated lines:
+ *
+ *   pgazure_stats 3
+ *   blob <stored bytes> <encoded bytes> <rows> <has blocks> <etag>
+ *   column <name> <type> <collation> <nulls> <non-nulls> <hex min> <hex max>
+ *   bloom <name> <hash count> <bit count> <hex bits>
+ *   block <start offset> <end offset> <rows>
+ *   column ...
+ *
+ * where column lines after a block line describe the block. Fields are
+ * escaped like COPY text format and \N marks a missing value. The min and
+ * max values are in the binary format of the type's send function, such that
+ * they do not depend on settings like DateStyle or extra_float_digits.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+#include <errno.h>
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/nbtree.h"
+#include "access/stratnum.h"
+#include "executor/executor.h"
+#include "lib/stringinfo.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
+#include "optimizer/optimizer.h"
+#include "pgazure/blob_stats.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "port/pg_bitutils.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/typcache.h"
+#include "utils/varlena.h"
+
+
+/*
+ * version of the sidecar format, 2 stores min/max in binary format and 3
+ * the ETag of the blob
+ */
+#define BLOB_STATS_VERSION 3
+
+/* values with a longer binary representation are not stored as min/max */
+#define BLOB_STATS_MAX_VALUE_LENGTH 256
+
+/* size of bloom filters while collecting, and smallest size after folding */
+#define BLOOM_FILTER_MAX_BITS (1 << 20)
+#define BLOOM_FILTER_MIN_BITS (1 << 10)
+
+/* number of bits set in a bloom filter for each value */
+#define BLOOM_FILTER_HASH_COUNT 7
+
+/* number of bytes downloaded at once when reading byte ranges */
+#define BLOB_RANGE_READ_SIZE (4 * 1024 * 1024)
+
+
+/*
+ * BloomFilter is a bloom filter of the values of a column. Bit i of value v
+ * is (h1(v) + i * h2(v)) modulo bitCount, which is a power of 2, such that
+ * a filter can be folded in half by OR-ing its halves.
+ */
+typedef struct BloomFilter
+{
+	int hashCount;
+	int bitCount;
+	uint8 *bits;
+} BloomFilter;
+
+/*
+ * BlobStatsBlock contains the statistics of a block of rows in a blob.
+ */
+typedef struct BlobStatsBlock
+{
+	/* byte range [startOffset, endOffset) of the rows in the blob */
+	uint64 startOffset;
+	uint64 endOffset;
+	uint64 rowCount;
+
+	BlobColumnStats *columns;
+} BlobStatsBlock;
+
+/*
+ * BlobStatsWriter collects the statistics of a blob while it is written.
+ */
+struct BlobStatsWriter
+{
+	TupleDesc tupleDescriptor;
+
+	/* memory for the min/max values of the blob */
+	MemoryContext memoryContext;
+
+	/* memory for the min/max values of the current block */
+	MemoryContext blockContext;
+
+	/* comparison function of each column, or NULL if its type has no ordering */
+	FmgrInfo **compareFunctions;
+
+	/* send function of each column, or NULL if its type has none */
+	FmgrInfo **sendFunctions;
+
+	/* hash function and bloom filter of each bloom filter column, or NULL */
+	FmgrInfo **hashFunctions;
+	BloomFilter **bloomFilters;
+
+	/* bytes written to the blob and bytes produced by the encoder */
+	uint64 storedBytes;
+	uint64 encodedBytes;
+
+	/* whether to collect statistics per block */
+	bool recordBlocks;
+
+	uint64 rowCount;
+	BlobColumnStats *columns;
+
+	/* statistics of the current block */
+	uint64 blockStartOffset;
+	uint64 blockRowCount;
+	BlobColumnStats *blockColumns;
+
+	/* serialized statistics of the completed blocks */
+	StringInfo blockLines;
+};
+
+/*
+ * BlobStats contains the statistics of a blob read from its sidecar, for
+ * the columns of a tuple descriptor.
+ */
+struct BlobStats
+{
+	TupleDesc tupleDescriptor;
+
+	uint64 storedBytes;
+	uint64 rowCount;
+
+	/* ETag of the blob when the statistics were written */
+	char *etag;
+
+	/* collation of each column when the statistics were collected, or NULL */
+	char **collationNames;
+
+	BlobColumnStats *columns;
+	BloomFilter **bloomFilters;
+
+	/* whether the blocks can be read by themselves */
+	bool hasBlocks;
+
+	int blockCount;
+	BlobStatsBlock *blocks;
+};
+
+/*
+ * BlobStatsPredicateType is the kind of condition in a BlobStatsPredicate.
+ */
+typedef enum BlobStatsPredicateType
+{
+	/* column <strategy> any of values */
+	PREDICATE_VALUES,
+	PREDICATE_IS_NULL,
+	PREDICATE_IS_NOT_NULL
+} BlobStatsPredicateType;
+
+/*
+ * BlobStatsPredicate is a condition on a column that every row returned by
+ * a scan satisfies, in a form that can be checked against statistics.
+ */
+typedef struct BlobStatsPredicate
+{
+	BlobStatsPredicateType type;
+
+	char *columnName;
+	Oid columnTypeId;
+
+	/* btree strategy of the comparison */
+	StrategyNumber strategy;
+
+	/* name of the collation of the comparison, or NULL */
+	char *collationName;
+	Oid collation;
+
+	FmgrInfo compareFunction;
+
+	/* hash function of the column type, used for bloom filters */
+	bool hasHashFunction;
+	FmgrInfo hashFunction;
+
+	int valueCount;
+	Datum *values;
+} BlobStatsPredicate;
+
+/*
+ * BlobRangeReaderState is the state of a ByteSource that reads a list of byte
+ * ranges of a blob.
+ */
+typedef struct BlobRangeReaderState
+{
+	char *connectionString;
+	char *containerName;
+	char *path;
+
+	int rangeCount;
+	uint64 *startOffsets;
+	uint64 *endOffsets;
+
+	/* current range and the offset in the blob from which to read next */
+	int rangeIndex;
+	uint64 offset;
+
+	char *buffer;
+	int bufferLength;
+	int bufferOffset;
+} BlobRangeReaderState;
+
+
+static void UpdateColumnStats(BlobStatsWriter *writer, BlobColumnStats *columnStats,
+                              int columnIndex, Datum value, bool isNull,
+                              MemoryContext memoryContext);
+static void EndBlobStatsBlock(BlobStatsWriter *writer);
+static void AppendColumnStatsLine(BlobStatsWriter *writer, StringInfo buffer,
+                                  int columnIndex, BlobColumnStats *columnStats);
+static void AppendBloomFilterLine(BlobStatsWriter *writer, StringInfo buffer,
+                                  int columnIndex);
+static char * HexEncodeBytes(const char *bytes, int length);
+static void AppendEscapedField(StringInfo buffer, const char *value);
+static BloomFilter * CreateBloomFilter(int bitCount, int hashCount);
+static void BloomFilterAdd(BloomFilter *bloomFilter, uint32 hash);
+static bool BloomFilterMayContain(BloomFilter *bloomFilter, uint32 hash);
+static void FoldBloomFilter(BloomFilter *bloomFilter);
+static inline uint32 BloomFilterSecondHash(uint32 hash);
+static BlobStatsPredicate * BuildPredicate(Expr *clause, Index relationId,
+                                           TupleDesc tupleDescriptor,
+                                           ExprContext *exprContext);
+static Var * ColumnOperand(Node *operand, Index relationId);
+static bool IsEvaluableOperand(Node *operand);
+static bool EvaluateOperand(Expr *operand, ExprContext *exprContext, Datum *value);
+static BlobStats * ParseBlobStats(char *data, TupleDesc tupleDescriptor);
+static bool ParseColumnStatsLine(BlobStats *stats, List *fieldList,
+                                 BlobColumnStats *columnStatsArray);
+static bool ReceiveHexValue(Oid receiveFunctionId, Oid typeIOParam, char *hexString,
+                            Datum *value);
+static Oid TypeIOFunctionId(Oid typeId, IOFuncSelector which, Oid *typeIOParam);
+static bool ParseBloomFilterLine(BlobStats *stats, List *fieldList);
+static bool ParseCount(char *field, uint64 *count);
+static int ColumnIndexByName(TupleDesc tupleDescriptor, char *columnName);
+static List * SplitFields(char *line);
+static char * UnescapeField(char *field);
+static bool PredicatesMayMatch(BlobStats *stats, BlobColumnStats *columnStatsArray,
+                               List *predicateList, bool useBloomFilters);
+static bool ColumnStatsMayMatch(BlobColumnStats *columnStats,
+                                BlobStatsPredicate *predicate,
+                                BloomFilter *bloomFilter);
+static int BlobRangesRead(void *context, void *buffer, int minRead, int maxRead);
+static bool FillBlobRangeBuffer(BlobRangeReaderState *state);
+static void BlobRangesClose(void *context);
+
+
+/* whether scans use statistics sidecars to skip blobs */
+bool EnableBlobStats = true;
+
+/* whether blob_storage_put_blob writes statistics sidecars */
+bool WriteBlobStats = false;
+
+/* columns for which blob_storage_put_blob builds bloom filters */
+char *BlobStatsBloomColumns = "";
+
+
+/*
+ * CreateBlobStatsWriter creates a collector of statistics of rows with the
+ * given tuple descriptor, with bloom filters on the columns in the comma-
+ * separated bloomColumns list.
+ */
+BlobStatsWriter *
+CreateBlobStatsWriter(TupleDesc tupleDescriptor, char *bloomColumns)
+{
+	int columnCount = tupleDescriptor->natts;
+	List *bloomColumnNameList = NIL;
+	ListCell *columnNameCell = NULL;
+
+	BlobStatsWriter *writer = palloc0(sizeof(BlobStatsWriter));
+	writer->tupleDescriptor = tupleDescriptor;
+	writer->memoryContext = CurrentMemoryContext;
+	writer->blockContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                             "Blob Statistics Block Context",
+	                                             ALLOCSET_DEFAULT_SIZES);
+	writer->compareFunctions = palloc0(columnCount * sizeof(FmgrInfo *));
+	writer->sendFunctions = palloc0(columnCount * sizeof(FmgrInfo *));
+	writer->hashFunctions = palloc0(columnCount * sizeof(FmgrInfo *));
+	writer->bloomFilters = palloc0(columnCount * sizeof(BloomFilter *));
+	writer->columns = palloc0(columnCount * sizeof(BlobColumnStats));
+	writer->blockColumns = palloc0(columnCount * sizeof(BlobColumnStats));
+	writer->blockLines = makeStringInfo();
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid sendFunctionId = InvalidOid;
+
+		if (attr->attisdropped)
+		{
+			continue;
+		}
+
+		TypeCacheEntry *typeEntry = lookup_type_cache(attr->atttypid,
+		                                              TYPECACHE_CMP_PROC_FINFO);
+
+		if (OidIsValid(typeEntry->cmp_proc))
+		{
+			writer->compareFunctions[columnIndex] = &typeEntry->cmp_proc_finfo;
+		}
+
+		sendFunctionId = TypeIOFunctionId(attr->atttypid, IOFunc_send, NULL);
+		if (OidIsValid(sendFunctionId))
+		{
+			writer->sendFunctions[columnIndex] = palloc0(sizeof(FmgrInfo));
+			fmgr_info(sendFunctionId, writer->sendFunctions[columnIndex]);
+		}
+	}
+
+	if (bloomColumns == NULL || bloomColumns[0] == '\0')
+	{
+		return writer;
+	}
+
+	if (!SplitIdentifierString(pstrdup(bloomColumns), ',', &bloomColumnNameList))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+		                errmsg("invalid list of bloom filter columns: \"%s\"",
+		                       bloomColumns)));
+	}
+
+	foreach(columnNameCell, bloomColumnNameList)
+	{
+		char *columnName = (char *) lfirst(columnNameCell);
+		int columnIndex = ColumnIndexByName(tupleDescriptor, columnName);
+
+		if (columnIndex < 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+			                errmsg("bloom filter column \"%s\" does not exist",
+			                       columnName)));
+		}
+
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+		TypeCacheEntry *typeEntry = lookup_type_cache(attr->atttypid,
+		                                              TYPECACHE_HASH_PROC_FINFO);
+
+		if (!OidIsValid(typeEntry->hash_proc))
+		{
+			ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
+			                errmsg("could not identify a hash function for type %s "
+			                       "of bloom filter column \"%s\"",
+			                       format_type_be(attr->atttypid), columnName)));
+		}
+
+		writer->hashFunctions[columnIndex] = &typeEntry->hash_proc_finfo;
+		writer->bloomFilters[columnIndex] = CreateBloomFilter(BLOOM_FILTER_MAX_BITS,
+		                                                      BLOOM_FILTER_HASH_COUNT);
+	}
+
+	return writer;
+}
+
+
+/*
+ * BlobStatsCountStoredBytes returns a ByteSink that counts the bytes written
+ * to the blob, which should be the sink to which the compressor writes.
+ */
+ByteSink *
+BlobStatsCountStoredBytes(BlobStatsWriter *writer, ByteSink *byteSink)
+{
+	return CreateCountingByteSink(byteSink, &writer->storedBytes);
+}
+
+
+/*
+ * BlobStatsCountEncodedBytes returns a ByteSink that counts the bytes written
+ * by the encoder, which should be the sink that the encoder writes to. If
+ * recordBlocks is true, the offsets of blocks of rows are recorded, which is
+ * only useful if the blocks can be read without the rest of the blob.
+ */
+ByteSink *
+BlobStatsCountEncodedBytes(BlobStatsWriter *writer, ByteSink *byteSink,
+                           bool recordBlocks)
+{
+	writer->recordBlocks = recordBlocks;
+
+	return CreateCountingByteSink(byteSink, &writer->encodedBytes);
+}
+
+
+/*
+ * BlobStatsAddRow adds a row to the statistics.
+ */
+void
+BlobStatsAddRow(BlobStatsWriter *writer, Datum *columnValues, bool *columnNulls)
+{
+	TupleDesc tupleDescriptor = writer->tupleDescriptor;
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Datum value = columnValues[columnIndex];
+		bool isNull = columnNulls[columnIndex];
+
+		if (TupleDescAttr(tupleDescriptor, columnIndex)->attisdropped)
+		{
+			continue;
+		}
+
+		UpdateColumnStats(writer, &writer->columns[columnIndex], columnIndex, value,
+		                  isNull, writer->memoryContext);
+
+		if (writer->recordBlocks)
+		{
+			UpdateColumnStats(writer, &writer->blockColumns[columnIndex], columnIndex,
+			                  value, isNull, writer->blockContext);
+		}
+
+		if (writer->bloomFilters[columnIndex] != NULL && !isNull)
+		{
+			Oid collation = TupleDescAttr(tupleDescriptor, columnIndex)->attcollation;
+			Datum hash = FunctionCall1Coll(writer->hashFunctions[columnIndex],
+			                               collation, value);
+
+			BloomFilterAdd(writer->bloomFilters[columnIndex], DatumGetUInt32(hash));
+		}
+	}
+
+	writer->rowCount++;
+	writer->blockRowCount++;
+}
+
+
+/*
+ * BlobStatsAddBatch adds all rows in a batch to the statistics.
+ */
+void
+BlobStatsAddBatch(BlobStatsWriter *writer, TupleBatch *batch)
+{
+	for (int rowIndex = 0; rowIndex < batch->rowCount; rowIndex++)
+	{
+		TupleBatchGetRow(batch, rowIndex, batch->rowValues, batch->rowNulls);
+		BlobStatsAddRow(writer, batch->rowValues, batch->rowNulls);
+	}
+}
+
+
+/*
+ * UpdateColumnStats adds a value to the statistics of a column, copying new
+ * min/max values into memoryContext.
+ */
+static void
+UpdateColumnStats(BlobStatsWriter *writer, BlobColumnStats *columnStats,
+                  int columnIndex, Datum value, bool isNull,
+                  MemoryContext memoryContext)
+{
+	FmgrInfo *compareFunction = writer->compareFunctions[columnIndex];
+	Form_pg_attribute attr = TupleDescAttr(writer->tupleDescriptor, columnIndex);
+	bool replaceMin = false;
+	bool replaceMax = false;
+
+	if (isNull)
+	{
+		columnStats->nullCount++;
+		return;
+	}
+
+	columnStats->valueCount++;
+
+	if (compareFunction == NULL)
+	{
+		return;
+	}
+
+	if (!columnStats->hasRange)
+	{
+		replaceMin = true;
+		replaceMax = true;
+	}
+	else if (DatumGetInt32(FunctionCall2Coll(compareFunction, attr->attcollation,
+	                                         value, columnStats->minValue)) < 0)
+	{
+		replaceMin = true;
+	}
+	else if (DatumGetInt32(FunctionCall2Coll(compareFunction, attr->attcollation,
+	                                         value, columnStats->maxValue)) > 0)
+	{
+		replaceMax = true;
+	}
+
+	if (!replaceMin && !replaceMax)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(memoryContext);
+
+	/* values may point into toasted storage that is gone by the time we write */
+	Datum copiedValue = value;
+
+	if (attr->attlen == -1)
+	{
+		copiedValue = PointerGetDatum(PG_DETOAST_DATUM_COPY(value));
+	}
+	else
+	{
+		copiedValue = datumCopy(value, attr->attbyval, attr->attlen);
+	}
+
+	if (replaceMin)
+	{
+		if (columnStats->hasRange && !attr->attbyval)
+		{
+			pfree(DatumGetPointer(columnStats->minValue));
+		}
+
+		columnStats->minValue = copiedValue;
+	}
+
+	if (replaceMax)
+	{
+		if (columnStats->hasRange && !attr->attbyval)
+		{
+			pfree(DatumGetPointer(columnStats->maxValue));
+		}
+
+		/* the first value is both the min and the max */
+		columnStats->maxValue = replaceMin && !attr->attbyval ?
+								datumCopy(copiedValue, false, attr->attlen) : copiedValue;
+	}
+
+	columnStats->hasRange = true;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * BlobStatsRowsEncoded is called after rows were pushed into the encoder, and
+ * ends the current block if it has enough rows. The encoder is flushed such
+ * that the encoded bytes mark the end of the last row of the block.
+ */
+void
+BlobStatsRowsEncoded(BlobStatsWriter *writer, TupleEncoder *encoder)
+{
+	if (!writer->recordBlocks || writer->blockRowCount < BLOB_STATS_BLOCK_ROWS)
+	{
+		return;
+	}
+
+	if (encoder->flush == NULL)
+	{
+		/* the row boundaries in the blob are not known */
+		writer->recordBlocks = false;
+		resetStringInfo(writer->blockLines);
+		return;
+	}
+
+	encoder->flush(encoder->state);
+
+	EndBlobStatsBlock(writer);
+}
+
+
+/*
+ * EndBlobStatsBlock serializes the statistics of the current block and starts
+ * a new block at the current offset.
+ */
+static void
+EndBlobStatsBlock(BlobStatsWriter *writer)
+{
+	StringInfo blockLines = writer->blockLines;
+	TupleDesc tupleDescriptor = writer->tupleDescriptor;
+
+	appendStringInfo(blockLines, "block\t" UINT64_FORMAT "\t" UINT64_FORMAT "\t"
+	                 UINT64_FORMAT "\n", writer->blockStartOffset,
+	                 writer->encodedBytes, writer->blockRowCount);
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		if (TupleDescAttr(tupleDescriptor, columnIndex)->attisdropped)
+		{
+			continue;
+		}
+
+		AppendColumnStatsLine(writer, blockLines, columnIndex,
+		                      &writer->blockColumns[columnIndex]);
+	}
+
+	memset(writer->blockColumns, 0, tupleDescriptor->natts * sizeof(BlobColumnStats));
+	MemoryContextReset(writer->blockContext);
+
+	writer->blockStartOffset = writer->encodedBytes;
+	writer->blockRowCount = 0;
+}
+
+
+/*
+ * WriteBlobStatsSidecar writes the statistics of a blob to its sidecar. It is
+ * called after the encoder finished, such that all bytes were counted and
+ * the blob is uploaded.
+ */
+void
+WriteBlobStatsSidecar(BlobStatsWriter *writer, char *connectionString,
+                      char *containerName, char *path)
+{
+	TupleDesc tupleDescriptor = writer->tupleDescriptor;
+	StringInfo buffer = makeStringInfo();
+	char blobETag[BLOB_ETAG_BUFFER_LENGTH];
+
+	GetBlobETag(connectionString, containerName, path, blobETag,
+	            BLOB_ETAG_BUFFER_LENGTH);
+
+	if (writer->recordBlocks && writer->blockRowCount > 0)
+	{
+		EndBlobStatsBlock(writer);
+	}
+
+	appendStringInfo(buffer, "pgazure_stats\t%d\n", BLOB_STATS_VERSION);
+	appendStringInfo(buffer, "blob\t" UINT64_FORMAT "\t" UINT64_FORMAT "\t"
+	                 UINT64_FORMAT "\t%d\t", writer->storedBytes, writer->encodedBytes,
+	                 writer->rowCount, writer->recordBlocks ? 1 : 0);
+	AppendEscapedField(buffer, blobETag);
+	appendStringInfoChar(buffer, '\n');
+
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		if (TupleDescAttr(tupleDescriptor, columnIndex)->attisdropped)
+		{
+			continue;
+		}
+
+		AppendColumnStatsLine(writer, buffer, columnIndex, &writer->columns[columnIndex]);
+
+		if (writer->bloomFilters[columnIndex] != NULL)
+		{
+			AppendBloomFilterLine(writer, buffer, columnIndex);
+		}
+	}
+
+	if (writer->recordBlocks)
+	{
+		appendBinaryStringInfo(buffer, writer->blockLines->data, writer->blockLines->len);
+	}
+
+	char *statsPath = psprintf("%s%s", path, BLOB_STATS_SUFFIX);
+	ByteSink *byteSink = palloc0(sizeof(ByteSink));
+
+	WriteBlockBlob(connectionString, containerName, statsPath, byteSink);
+	byteSink->write(byteSink->context, buffer->data, buffer->len);
+	byteSink->close(byteSink->context);
+}
+
+
+/*
+ * AppendColumnStatsLine appends a line with the statistics of a column to
+ * buffer.
+ */
+static void
+AppendColumnStatsLine(BlobStatsWriter *writer, StringInfo buffer, int columnIndex,
+                      BlobColumnStats *columnStats)
+{
+	Form_pg_attribute attr = TupleDescAttr(writer->tupleDescriptor, columnIndex);
+	FmgrInfo *sendFunction = writer->sendFunctions[columnIndex];
+	char *minString = NULL;
+	char *maxString = NULL;
+
+	if (columnStats->hasRange && sendFunction != NULL)
+	{
+		bytea *minBytes = SendFunctionCall(sendFunction, columnStats->minValue);
+		bytea *maxBytes = SendFunctionCall(sendFunction, columnStats->maxValue);
+
+		/* long values would bloat the sidecar */
+		if (VARSIZE(minBytes) - VARHDRSZ <= BLOB_STATS_MAX_VALUE_LENGTH &&
+		    VARSIZE(maxBytes) - VARHDRSZ <= BLOB_STATS_MAX_VALUE_LENGTH)
+		{
+			minString = HexEncodeBytes(VARDATA(minBytes), VARSIZE(minBytes) - VARHDRSZ);
+			maxString = HexEncodeBytes(VARDATA(maxBytes), VARSIZE(maxBytes) - VARHDRSZ);
+		}
+	}
+
+	appendStringInfoString(buffer, "column\t");
+	AppendEscapedField(buffer, NameStr(attr->attname));
+	appendStringInfoChar(buffer, '\t');
+	AppendEscapedField(buffer, format_type_be(attr->atttypid));
+	appendStringInfoChar(buffer, '\t');
+	AppendEscapedField(buffer, OidIsValid(attr->attcollation) ?
+	                   get_collation_name(attr->attcollation) : NULL);
+	appendStringInfo(buffer, "\t" UINT64_FORMAT "\t" UINT64_FORMAT "\t",
+	                 columnStats->nullCount, columnStats->valueCount);
+	AppendEscapedField(buffer, minString);
+	appendStringInfoChar(buffer, '\t');
+	AppendEscapedField(buffer, maxString);
+	appendStringInfoChar(buffer, '\n');
+}
+
+
+/*
+ * AppendBloomFilterLine appends a line with the bloom filter of a column to
+ * buffer, after folding the filter to a size that fits the number of values.
+ */
+static void
+AppendBloomFilterLine(BlobStatsWriter *writer, StringInfo buffer, int columnIndex)
+{
+	Form_pg_attribute attr = TupleDescAttr(writer->tupleDescriptor, columnIndex);
+	BloomFilter *bloomFilter = writer->bloomFilters[columnIndex];
+
+	FoldBloomFilter(bloomFilter);
+
+	appendStringInfoString(buffer, "bloom\t");
+	AppendEscapedField(buffer, NameStr(attr->attname));
+	appendStringInfo(buffer, "\t%d\t%d\t", bloomFilter->hashCount,
+	                 bloomFilter->bitCount);
+	appendStringInfoString(buffer, HexEncodeBytes((char *) bloomFilter->bits,
+	                                              bloomFilter->bitCount / 8));
+	appendStringInfoChar(buffer, '\n');
+}
+
+
+/*
+ * HexEncodeBytes returns the given bytes as a string of hex digits.
+ */
+static char *
+HexEncodeBytes(const char *bytes, int length)
+{
+	static const char hexDigits[] = "0123456789abcdef";
+	char *hexString = palloc(length * 2 + 1);
+
+	for (int byteIndex = 0; byteIndex < length; byteIndex++)
+	{
+		uint8 byte = (uint8) bytes[byteIndex];
+
+		hexString[byteIndex * 2] = hexDigits[byte >> 4];
+		hexString[byteIndex * 2 + 1] = hexDigits[byte & 0xF];
+	}
+
+	hexString[length * 2] = '\0';
+
+	return hexString;
+}
+
+
+/*
+ * AppendEscapedField appends a value to buffer, escaping characters that
+ * separate fields and lines, or \N if the value is NULL.
+ */
+static void
+AppendEscapedField(StringInfo buffer, const char *value)
+{
+	if (value == NULL)
+	{
+		appendStringInfoString(buffer, "\\N");
+		return;
+	}
+
+	for (const char *current = value; *current != '\0'; current++)
+	{
+		switch (*current)
+		{
+			case '\\':
+			{
+				appendStringInfoString(buffer, "\\\\");
+				break;
+			}
+
+			case '\t':
+			{
+				appendStringInfoString(buffer, "\\t");
+				break;
+			}
+
+			case '\n':
+			{
+				appendStringInfoString(buffer, "\\n");
+				break;
+			}
+
+			case '\r':
+			{
+				appendStringInfoString(buffer, "\\r");
+				break;
+			}
+
+			default:
+			{
+				appendStringInfoChar(buffer, *current);
+				break;
+			}
+		}
+	}
+}
+
+
+/*
+ * CreateBloomFilter creates an empty bloom filter.
+ */
+static BloomFilter *
+CreateBloomFilter(int bitCount, int hashCount)
+{
+	BloomFilter *bloomFilter = palloc0(sizeof(BloomFilter));
+	bloomFilter->hashCount = hashCount;
+	bloomFilter->bitCount = bitCount;
+	bloomFilter->bits = palloc0(bitCount / 8);
+
+	return bloomFilter;
+}
+
+
+/*
+ * BloomFilterAdd adds the hash of a value to a bloom filter.
+ */
+static void
+BloomFilterAdd(BloomFilter *bloomFilter, uint32 hash)
+{
+	uint32 secondHash = BloomFilterSecondHash(hash);
+	uint32 bitMask = bloomFilter->bitCount - 1;
+
+	for (int hashIndex = 0; hashIndex < bloomFilter->hashCount; hashIndex++)
+	{
+		uint32 bitIndex = (hash + hashIndex * secondHash) & bitMask;
+
+		bloomFilter->bits[bitIndex / 8] |= (uint8) (1 << (bitIndex % 8));
+	}
+}
+
+
+/*
+ * BloomFilterMayContain returns false if a value with the given hash was
+ * definitely not added to the bloom filter.
+ */
+static bool
+BloomFilterMayContain(BloomFilter *bloomFilter, uint32 hash)
+{
+	uint32 secondHash = BloomFilterSecondHash(hash);
+	uint32 bitMask = bloomFilter->bitCount - 1;
+
+	for (int hashIndex = 0; hashIndex < bloomFilter->hashCount; hashIndex++)
+	{
+		uint32 bitIndex = (hash + hashIndex * secondHash) & bitMask;
+
+		if ((bloomFilter->bits[bitIndex / 8] & (1 << (bitIndex % 8))) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * FoldBloomFilter halves the size of a bloom filter for as long as less than
+ * a quarter of its bits are set, such that the folded filter stays below
+ * half full. Folding maps bit i to bit i modulo the new size, which is the
+ * bit that the same hashes select in a filter of that size.
+ */
+static void
+FoldBloomFilter(BloomFilter *bloomFilter)
+{
+	int byteCount = bloomFilter->bitCount / 8;
+	uint64 setBitCount = pg_popcount((const char *) bloomFilter->bits, byteCount);
+
+	while (bloomFilter->bitCount > BLOOM_FILTER_MIN_BITS &&
+	       setBitCount * 4 < (uint64) bloomFilter->bitCount)
+	{
+		int halfByteCount = byteCount / 2;
+
+		for (int byteIndex = 0; byteIndex < halfByteCount; byteIndex++)
+		{
+			bloomFilter->bits[byteIndex] |= bloomFilter->bits[byteIndex + halfByteCount];
+		}
+
+		bloomFilter->bitCount /= 2;
+		byteCount = halfByteCount;
+		setBitCount = pg_popcount((const char *) bloomFilter->bits, byteCount);
+	}
+}
+
+
+/*
+ * BloomFilterSecondHash derives the step between the bits of a value from
+ * its hash. The step is odd, such that the bits differ for any filter size.
+ */
+static inline uint32
+BloomFilterSecondHash(uint32 hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash | 1;
+}
+
+
+/*
+ * IsBlobStatsPath returns whether a blob is a statistics sidecar.
+ */
+bool
+IsBlobStatsPath(const char *path)
+{
+	int pathLength = strlen(path);
+	int suffixLength = strlen(BLOB_STATS_SUFFIX);
+
+	return pathLength > suffixLength &&
+		   strcmp(path + pathLength - suffixLength, BLOB_STATS_SUFFIX) == 0;
+}
+
+
+/*
+ * CanReadBlobRanges returns whether blocks of rows of a blob with the given
+ * decoder and compression can be read without the rest of the blob, which
+ * applies to uncompressed formats with one row per line and no header.
+ */
+bool
+CanReadBlobRanges(char *decoderString, char *compressionString)
+{
+	return (strcmp(decoderString, "csv") == 0 || strcmp(decoderString, "tsv") == 0) &&
+		   strcmp(compressionString, "none") == 0;
+}
+
+
+/*
+ * BuildBlobStatsPredicates returns the predicates that can be checked against
+ * statistics for a list of implicitly AND-ed clauses on a relation with the
+ * given tuple descriptor. These are comparisons of a column with an
+ * expression that does not depend on the row, IN lists, and IS [NOT] NULL.
+ * The expressions are evaluated in exprContext.
+ */
+List *
+BuildBlobStatsPredicates(List *clauseList, Index relationId, TupleDesc tupleDescriptor,
+                         ExprContext *exprContext)
+{
+	List *predicateList = NIL;
+	ListCell *clauseCell = NULL;
+
+	foreach(clauseCell, clauseList)
+	{
+		Expr *clause = (Expr *) lfirst(clauseCell);
+
+		BlobStatsPredicate *predicate = BuildPredicate(clause, relationId,
+		                                               tupleDescriptor, exprContext);
+
+		if (predicate != NULL)
+		{
+			predicateList = lappend(predicateList, predicate);
+		}
+	}
+
+	return predicateList;
+}
+
+
+/*
+ * BuildPredicate returns the predicate for a clause, or NULL if the clause
+ * cannot be checked against statistics.
+ */
+static BlobStatsPredicate *
+BuildPredicate(Expr *clause, Index relationId, TupleDesc tupleDescriptor,
+               ExprContext *exprContext)
+{
+	Var *column = NULL;
+	Expr *valueExpression = NULL;
+	Oid operatorId = InvalidOid;
+	Oid collation = InvalidOid;
+	bool columnOnRight = false;
+	bool isArray = false;
+
+	if (IsA(clause, NullTest))
+	{
+		NullTest *nullTest = (NullTest *) clause;
+
+		column = ColumnOperand((Node *) nullTest->arg, relationId);
+		if (column == NULL || nullTest->argisrow)
+		{
+			return NULL;
+		}
+
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, column->varattno - 1);
+
+		BlobStatsPredicate *predicate = palloc0(sizeof(BlobStatsPredicate));
+		predicate->type = nullTest->nulltesttype == IS_NULL ?
+						  PREDICATE_IS_NULL : PREDICATE_IS_NOT_NULL;
+		predicate->columnName = pstrdup(NameStr(attr->attname));
+		predicate->columnTypeId = attr->atttypid;
+
+		return predicate;
+	}
+	else if (IsA(clause, OpExpr))
+	{
+		OpExpr *opExpr = (OpExpr *) clause;
+
+		if (list_length(opExpr->args) != 2)
+		{
+			return NULL;
+		}
+
+		Node *leftOperand = (Node *) linitial(opExpr->args);
+		Node *rightOperand = (Node *) lsecond(opExpr->args);
+
+		column = ColumnOperand(leftOperand, relationId);
+		valueExpression = (Expr *) rightOperand;
+
+		if (column == NULL)
+		{
+			column = ColumnOperand(rightOperand, relationId);
+			valueExpression = (Expr *) leftOperand;
+			columnOnRight = true;
+		}
+
+		operatorId = opExpr->opno;
+		collation = opExpr->inputcollid;
+	}
+	else if (IsA(clause, ScalarArrayOpExpr))
+	{
+		ScalarArrayOpExpr *arrayOpExpr = (ScalarArrayOpExpr *) clause;
+
+		if (!arrayOpExpr->useOr)
+		{
+			return NULL;
+		}
+
+		column = ColumnOperand((Node *) linitial(arrayOpExpr->args), relationId);
+		valueExpression = (Expr *) lsecond(arrayOpExpr->args);
+		operatorId = arrayOpExpr->opno;
+		collation = arrayOpExpr->inputcollid;
+		isArray = true;
+	}
+
+	if (column == NULL || !IsEvaluableOperand((Node *) valueExpression))
+	{
+		return NULL;
+	}
+
+	Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, column->varattno - 1);
+	TypeCacheEntry *typeEntry = lookup_type_cache(attr->atttypid,
+	                                              TYPECACHE_BTREE_OPFAMILY |
+	                                              TYPECACHE_HASH_PROC);
+	Oid operatorFamily = typeEntry->btree_opf;
+	Oid leftTypeId = InvalidOid;
+	Oid rightTypeId = InvalidOid;
+
+	if (!OidIsValid(operatorFamily))
+	{
+		return NULL;
+	}
+
+	/* statistics are collected with the ordering of the default operator family */
+	op_input_types(operatorId, &leftTypeId, &rightTypeId);
+
+	int strategy = get_op_opfamily_strategy(operatorId, operatorFamily);
+
+	if (strategy == 0 || leftTypeId != rightTypeId ||
+	    (isArray && strategy != BTEqualStrategyNumber))
+	{
+		return NULL;
+	}
+
+	Oid compareFunctionId = get_opfamily_proc(operatorFamily, leftTypeId, rightTypeId,
+	                                          BTORDER_PROC);
+	if (!OidIsValid(compareFunctionId))
+	{
+		return NULL;
+	}
+
+	if (columnOnRight)
+	{
+		strategy = BTCommuteStrategyNumber(strategy);
+	}
+
+	BlobStatsPredicate *predicate = palloc0(sizeof(BlobStatsPredicate));
+	predicate->type = PREDICATE_VALUES;
+	predicate->columnName = pstrdup(NameStr(attr->attname));
+	predicate->columnTypeId = attr->atttypid;
+	predicate->strategy = strategy;
+	predicate->collation = collation;
+	predicate->collationName = OidIsValid(collation) ? get_collation_name(collation) :
+							   NULL;
+
+	fmgr_info(compareFunctionId, &predicate->compareFunction);
+
+	if (OidIsValid(typeEntry->hash_proc))
+	{
+		predicate->hasHashFunction = true;
+		fmgr_info(typeEntry->hash_proc, &predicate->hashFunction);
+	}
+
+	Datum value = 0;
+
+	if (!EvaluateOperand(valueExpression, exprContext, &value))
+	{
+		/* comparisons with NULL do not match any row */
+		predicate->valueCount = 0;
+		return predicate;
+	}
+
+	if (!isArray)
+	{
+		predicate->valueCount = 1;
+		predicate->values = palloc0(sizeof(Datum));
+		predicate->values[0] = value;
+
+		return predicate;
+	}
+
+	ArrayType *array = DatumGetArrayTypeP(value);
+	Oid elementTypeId = ARR_ELEMTYPE(array);
+	int16 elementLength = 0;
+	bool elementByValue = false;
+	char elementAlignment = 0;
+	Datum *elementValues = NULL;
+	bool *elementNulls = NULL;
+	int elementCount = 0;
+
+	get_typlenbyvalalign(elementTypeId, &elementLength, &elementByValue,
+	                     &elementAlignment);
+	deconstruct_array(array, elementTypeId, elementLength, elementByValue,
+	                  elementAlignment, &elementValues, &elementNulls, &elementCount);
+
+	predicate->values = palloc0(Max(elementCount, 1) * sizeof(Datum));
+
+	for (int elementIndex = 0; elementIndex < elementCount; elementIndex++)
+	{
+		/* NULL elements do not match any row */
+		if (!elementNulls[elementIndex])
+		{
+			predicate->values[predicate->valueCount++] = elementValues[elementIndex];
+		}
+	}
+
+	return predicate;
+}
+
+
+/*
+ * ColumnOperand returns the column that an operand refers to, possibly with
+ * a binary-compatible cast, or NULL if it is not a column of the relation.
+ */
+static Var *
+ColumnOperand(Node *operand, Index relationId)
+{
+	if (IsA(operand, RelabelType))
+	{
+		operand = (Node *) ((RelabelType *) operand)->arg;
+	}
+
+	if (!IsA(operand, Var))
+	{
+		return NULL;
+	}
+
+	Var *column = (Var *) operand;
+
+	if (column->varno != relationId || column->varlevelsup != 0 ||
+	    column->varattno <= 0)
+	{
+		return NULL;
+	}
+
+	return column;
+}
+
+
+/*
+ * IsEvaluableOperand returns whether an operand has the same value for all
+ * rows of a scan.
+ */
+static bool
+IsEvaluableOperand(Node *operand)
+{
+	return !contain_var_clause(operand) &&
+		   !contain_volatile_functions(operand) &&
+		   !contain_subplans(operand);
+}
+
+
+/*
+ * EvaluateOperand evaluates an operand that does not depend on the row and
+ * copies the result into the current memory context. Returns false if the
+ * result is NULL.
+ */
+static bool
+EvaluateOperand(Expr *operand, ExprContext *exprContext, Datum *value)
+{
+	Oid typeId = exprType((Node *) operand);
+	int16 typeLength = 0;
+	bool typeByValue = false;
+	bool isNull = false;
+
+	ExprState *exprState = ExecInitExpr(operand, NULL);
+	Datum result = ExecEvalExprSwitchContext(exprState, exprContext, &isNull);
+
+	if (isNull)
+	{
+		return false;
+	}
+
+	get_typlenbyval(typeId, &typeLength, &typeByValue);
+	*value = datumCopy(result, typeByValue, typeLength);
+
+	return true;
+}
+
+
+/*
+ * ReadBlobStats reads the statistics sidecar of a blob for the columns in the
+ * given tuple descriptor. blobETag is the ETag of the blob from a listing if
+ * it is known that the sidecar exists, or NULL to check whether it exists and
+ * look up the ETag. Returns NULL if there is no sidecar, or if it belongs to
+ * a different version of the blob.
+ */
+BlobStats *
+ReadBlobStats(char *connectionString, char *containerName, char *path,
+              const char *blobETag, TupleDesc tupleDescriptor)
+{
+	char *statsPath = psprintf("%s%s", path, BLOB_STATS_SUFFIX);
+
+	if (blobETag == NULL)
+	{
+		size_t statsSize = 0;
+		char *currentETag = palloc(BLOB_ETAG_BUFFER_LENGTH);
+
+		if (!GetBlobSizeIfExists(connectionString, containerName, statsPath, &statsSize))
+		{
+			return NULL;
+		}
+
+		GetBlobETag(connectionString, containerName, path, currentETag,
+		            BLOB_ETAG_BUFFER_LENGTH);
+		blobETag = currentETag;
+	}
+
+	StringInfo data = ReadBlobContents(connectionString, containerName, statsPath);
+	BlobStats *stats = ParseBlobStats(data->data, tupleDescriptor);
+
+	if (stats == NULL || strcmp(stats->etag, blobETag) != 0)
+	{
+		ereport(DEBUG1, (errmsg("ignoring statistics of blob \"%s\"", path),
+		                 errdetail("The sidecar is malformed or outdated.")));
+		return NULL;
+	}
+
+	return stats;
+}
+
+
+/*
+ * ParseBlobStats parses the contents of a sidecar, keeping the statistics of
+ * the columns in the tuple descriptor that have the same name and type.
+ * Returns NULL if the sidecar is malformed or has an unknown version.
+ */
+static BlobStats *
+ParseBlobStats(char *data, TupleDesc tupleDescriptor)
+{
+	int columnCount = tupleDescriptor->natts;
+	int maxBlockCount = 16;
+	bool headerFound = false;
+	char *lineStart = data;
+
+	BlobStats *stats = palloc0(sizeof(BlobStats));
+	stats->tupleDescriptor = tupleDescriptor;
+	stats->collationNames = palloc0(Max(columnCount, 1) * sizeof(char *));
+	stats->columns = palloc0(Max(columnCount, 1) * sizeof(BlobColumnStats));
+	stats->bloomFilters = palloc0(Max(columnCount, 1) * sizeof(BloomFilter *));
+	stats->blocks = palloc0(maxBlockCount * sizeof(BlobStatsBlock));
+
+	while (*lineStart != '\0')
+	{
+		char *lineEnd = strchr(lineStart, '\n');
+
+		if (lineEnd != NULL)
+		{
+			*lineEnd = '\0';
+		}
+
+		List *fieldList = SplitFields(lineStart);
+		char *lineType = (char *) linitial(fieldList);
+
+		lineStart = lineEnd != NULL ? lineEnd + 1 : lineStart + strlen(lineStart);
+
+		if (!headerFound)
+		{
+			if (lineType == NULL || strcmp(lineType, "pgazure_stats") != 0 ||
+			    list_length(fieldList) < 2 || lsecond(fieldList) == NULL ||
+			    atoi((char *) lsecond(fieldList)) != BLOB_STATS_VERSION)
+			{
+				return NULL;
+			}
+
+			headerFound = true;
+		}
+		else if (lineType == NULL)
+		{
+			return NULL;
+		}
+		else if (strcmp(lineType, "blob") == 0 && list_length(fieldList) == 6)
+		{
+			char *hasBlocksString = (char *) list_nth(fieldList, 4);
+
+			if (!ParseCount((char *) list_nth(fieldList, 1), &stats->storedBytes) ||
+			    !ParseCount((char *) list_nth(fieldList, 3), &stats->rowCount) ||
+			    hasBlocksString == NULL || list_nth(fieldList, 5) == NULL)
+			{
+				return NULL;
+			}
+
+			stats->etag = (char *) list_nth(fieldList, 5);
+
+			stats->hasBlocks = strcmp(hasBlocksString, "1") == 0;
+		}
+		else if (strcmp(lineType, "column") == 0)
+		{
+			BlobColumnStats *columnStatsArray = stats->columns;
+
+			if (stats->blockCount > 0)
+			{
+				columnStatsArray = stats->blocks[stats->blockCount - 1].columns;
+			}
+
+			if (!ParseColumnStatsLine(stats, fieldList, columnStatsArray))
+			{
+				return NULL;
+			}
+		}
+		else if (strcmp(lineType, "bloom") == 0)
+		{
+			if (!ParseBloomFilterLine(stats, fieldList))
+			{
+				return NULL;
+			}
+		}
+		else if (strcmp(lineType, "block") == 0 && list_length(fieldList) == 4)
+		{
+			if (stats->blockCount == maxBlockCount)
+			{
+				maxBlockCount *= 2;
+				stats->blocks = repalloc(stats->blocks,
+				                         maxBlockCount * sizeof(BlobStatsBlock));
+			}
+
+			BlobStatsBlock *block = &stats->blocks[stats->blockCount++];
+			block->columns = palloc0(Max(columnCount, 1) * sizeof(BlobColumnStats));
+
+			if (!ParseCount((char *) list_nth(fieldList, 1), &block->startOffset) ||
+			    !ParseCount((char *) list_nth(fieldList, 2), &block->endOffset) ||
+			    !ParseCount((char *) list_nth(fieldList, 3), &block->rowCount) ||
+			    block->endOffset < block->startOffset)
+			{
+				return NULL;
+			}
+		}
+		else
+		{
+			return NULL;
+		}
+	}
+
+	if (!headerFound || stats->etag == NULL)
+	{
+		/* without a blob line, the sidecar cannot be matched to the blob */
+		return NULL;
+	}
+
+	return stats;
+}
+
+
+/*
+ * ParseColumnStatsLine parses a column line into the statistics of the
+ * matching column in columnStatsArray. Lines of columns that are not in the
+ * tuple descriptor, or have a different type, are ignored.
+ */
+static bool
+ParseColumnStatsLine(BlobStats *stats, List *fieldList, BlobColumnStats *columnStatsArray)
+{
+	TupleDesc tupleDescriptor = stats->tupleDescriptor;
+
+	if (list_length(fieldList) != 8)
+	{
+		return false;
+	}
+
+	char *columnName = (char *) list_nth(fieldList, 1);
+	char *typeName = (char *) list_nth(fieldList, 2);
+	char *collationName = (char *) list_nth(fieldList, 3);
+	char *minString = (char *) list_nth(fieldList, 6);
+	char *maxString = (char *) list_nth(fieldList, 7);
+
+	if (columnName == NULL || typeName == NULL)
+	{
+		return false;
+	}
+
+	int columnIndex = ColumnIndexByName(tupleDescriptor, columnName);
+	if (columnIndex < 0)
+	{
+		return true;
+	}
+
+	Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+	if (strcmp(format_type_be(attr->atttypid), typeName) != 0)
+	{
+		return true;
+	}
+
+	BlobColumnStats *columnStats = &columnStatsArray[columnIndex];
+
+	if (!ParseCount((char *) list_nth(fieldList, 4), &columnStats->nullCount) ||
+	    !ParseCount((char *) list_nth(fieldList, 5), &columnStats->valueCount))
+	{
+		return false;
+	}
+
+	columnStats->known = true;
+
+	if (columnStatsArray == stats->columns)
+	{
+		stats->collationNames[columnIndex] = collationName;
+	}
+
+	if (minString != NULL && maxString != NULL)
+	{
+		Oid typeIOParam = InvalidOid;
+		Oid receiveFunctionId = TypeIOFunctionId(attr->atttypid, IOFunc_receive,
+		                                         &typeIOParam);
+
+		if (!OidIsValid(receiveFunctionId) ||
+		    !ReceiveHexValue(receiveFunctionId, typeIOParam, minString,
+		                     &columnStats->minValue) ||
+		    !ReceiveHexValue(receiveFunctionId, typeIOParam, maxString,
+		                     &columnStats->maxValue))
+		{
+			return false;
+		}
+
+		columnStats->hasRange = true;
+	}
+
+	return true;
+}
+
+
+/*
+ * ReceiveHexValue converts a value in the hex-encoded binary format of its
+ * type using the receive function. Returns false if the hex string is
+ * malformed or the receive function does not consume all bytes.
+ */
+static bool
+ReceiveHexValue(Oid receiveFunctionId, Oid typeIOParam, char *hexString,
+                Datum *value)
+{
+	int hexLength = strlen(hexString);
+	StringInfoData valueBuffer;
+
+	if (hexLength % 2 != 0)
+	{
+		return false;
+	}
+
+	initStringInfo(&valueBuffer);
+
+	for (int hexIndex = 0; hexIndex < hexLength; hexIndex += 2)
+	{
+		char byteString[3] = { hexString[hexIndex], hexString[hexIndex + 1], '\0' };
+		char *end = NULL;
+
+		if (!isxdigit((unsigned char) byteString[0]))
+		{
+			return false;
+		}
+
+		appendStringInfoChar(&valueBuffer, (char) strtoul(byteString, &end, 16));
+
+		if (*end != '\0')
+		{
+			return false;
+		}
+	}
+
+	*value = OidReceiveFunctionCall(receiveFunctionId, &valueBuffer, typeIOParam, -1);
+
+	return valueBuffer.cursor == valueBuffer.len;
+}
+
+
+/*
+ * TypeIOFunctionId returns the send or receive function of a type, or
+ * InvalidOid if the type does not have one. The I/O parameter of the type
+ * is stored in typeIOParam if it is not NULL.
+ */
+static Oid
+TypeIOFunctionId(Oid typeId, IOFuncSelector which, Oid *typeIOParam)
+{
+	int16 typeLength = 0;
+	bool typeByValue = false;
+	char typeAlign = 0;
+	char typeDelimiter = 0;
+	Oid ioParam = InvalidOid;
+	Oid functionId = InvalidOid;
+
+	get_type_io_data(typeId, which, &typeLength, &typeByValue, &typeAlign,
+	                 &typeDelimiter, &ioParam, &functionId);
+
+	if (typeIOParam != NULL)
+	{
+		*typeIOParam = ioParam;
+	}
+
+	return functionId;
+}
+
+
+/*
+ * ParseBloomFilterLine parses a bloom filter line.
+ */
+static bool
+ParseBloomFilterLine(BlobStats *stats, List *fieldList)
+{
+	if (list_length(fieldList) != 5 || list_nth(fieldList, 1) == NULL ||
+	    list_nth(fieldList, 4) == NULL)
+	{
+		return false;
+	}
+
+	char *columnName = (char *) list_nth(fieldList, 1);
+	int hashCount = atoi((char *) list_nth(fieldList, 2));
+	int bitCount = atoi((char *) list_nth(fieldList, 3));
+	char *hexBits = (char *) list_nth(fieldList, 4);
+
+	if (hashCount <= 0 || bitCount < 8 || (bitCount & (bitCount - 1)) != 0 ||
+	    strlen(hexBits) != (size_t) bitCount / 4)
+	{
+		return false;
+	}
+
+	int columnIndex = ColumnIndexByName(stats->tupleDescriptor, columnName);
+	if (columnIndex < 0)
+	{
+		return true;
+	}
+
+	BloomFilter *bloomFilter = CreateBloomFilter(bitCount, hashCount);
+
+	for (int byteIndex = 0; byteIndex < bitCount / 8; byteIndex++)
+	{
+		char byteString[3] = { hexBits[byteIndex * 2], hexBits[byteIndex * 2 + 1], '\0' };
+		char *end = NULL;
+
+		bloomFilter->bits[byteIndex] = (uint8) strtoul(byteString, &end, 16);
+
+		if (*end != '\0')
+		{
+			return false;
+		}
+	}
+
+	stats->bloomFilters[columnIndex] = bloomFilter;
+
+	return true;
+}
+
+
+/*
+ * ParseCount parses a non-negative number, and returns false if the field is
+ * not one.
+ */
+static bool
+ParseCount(char *field, uint64 *count)
+{
+	char *end = NULL;
+
+	if (field == NULL || !isdigit((unsigned char) field[0]))
+	{
+		return false;
+	}
+
+	errno = 0;
+	*count = (uint64) strtoull(field, &end, 10);
+
+	return errno == 0 && *end == '\0';
+}
+
+
+/*
+ * ColumnIndexByName returns the index of the column with the given name in
+ * a tuple descriptor, or -1 if there is none.
+ */
+static int
+ColumnIndexByName(TupleDesc tupleDescriptor, char *columnName)
+{
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (!attr->attisdropped && strcmp(NameStr(attr->attname), columnName) == 0)
+		{
+			return columnIndex;
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * SplitFields splits a line into unescaped tab-separated fields, in which
+ * \N becomes NULL.
+ */
+static List *
+SplitFields(char *line)
+{
+	List *fieldList = NIL;
+	char *fieldStart = line;
+
+	while (true)
+	{
+		char *fieldEnd = strchr(fieldStart, '\t');
+
+		if (fieldEnd != NULL)
+		{
+			*fieldEnd = '\0';
+		}
+
+		fieldList = lappend(fieldList, UnescapeField(fieldStart));
+
+		if (fieldEnd == NULL)
+		{
+			break;
+		}
+
+		fieldStart = fieldEnd + 1;
+	}
+
+	return fieldList;
+}
+
+
+/*
+ * UnescapeField reverses AppendEscapedField.
+ */
+static char *
+UnescapeField(char *field)
+{
+	if (strcmp(field, "\\N") == 0)
+	{
+		return NULL;
+	}
+
+	StringInfo value = makeStringInfo();
+
+	for (char *current = field; *current != '\0'; current++)
+	{
+		if (*current != '\\' || current[1] == '\0')
+		{
+			appendStringInfoChar(value, *current);
+			continue;
+		}
+
+		current++;
+
+		switch (*current)
+		{
+			case 't':
+			{
+				appendStringInfoChar(value, '\t');
+				break;
+			}
+
+			case 'n':
+			{
+				appendStringInfoChar(value, '\n');
+				break;
+			}
+
+			case 'r':
+			{
+				appendStringInfoChar(value, '\r');
+				break;
+			}
+
+			default:
+			{
+				appendStringInfoChar(value, *current);
+				break;
+			}
+		}
+	}
+
+	return value->data;
+}
+
+
+/*
+ * BlobStatsSelectRanges returns whether any row of a blob may satisfy all
+ * predicates. If only some blocks of the blob may match and the blocks can
+ * be read by themselves, byteRanges is set to the list of byte ranges to
+ * read, and otherwise to NULL.
+ */
+bool
+BlobStatsSelectRanges(BlobStats *stats, List *predicateList, char **byteRanges)
+{
+	*byteRanges = NULL;
+
+	if (predicateList == NIL)
+	{
+		return true;
+	}
+
+	if (!PredicatesMayMatch(stats, stats->columns, predicateList, true))
+	{
+		return false;
+	}
+
+	if (!stats->hasBlocks || stats->blockCount == 0)
+	{
+		return true;
+	}
+
+	StringInfo rangeString = makeStringInfo();
+	int matchingBlockCount = 0;
+	uint64 rangeStart = 0;
+	uint64 rangeEnd = 0;
+
+	for (int blockIndex = 0; blockIndex < stats->blockCount; blockIndex++)
+	{
+		BlobStatsBlock *block = &stats->blocks[blockIndex];
+
+		if (!PredicatesMayMatch(stats, block->columns, predicateList, false))
+		{
+			continue;
+		}
+
+		matchingBlockCount++;
+
+		if (matchingBlockCount > 1 && block->startOffset == rangeEnd)
+		{
+			/* adjacent blocks are read in a single range */
+			rangeEnd = block->endOffset;
+			continue;
+		}
+
+		if (matchingBlockCount > 1)
+		{
+			appendStringInfo(rangeString, "%s" UINT64_FORMAT "-" UINT64_FORMAT,
+			                 rangeString->len > 0 ? "," : "", rangeStart, rangeEnd);
+		}
+
+		rangeStart = block->startOffset;
+		rangeEnd = block->endOffset;
+	}
+
+	if (matchingBlockCount == 0)
+	{
+		return false;
+	}
+
+	if (matchingBlockCount == stats->blockCount)
+	{
+		return true;
+	}
+
+	appendStringInfo(rangeString, "%s" UINT64_FORMAT "-" UINT64_FORMAT,
+	                 rangeString->len > 0 ? "," : "", rangeStart, rangeEnd);
+
+	*byteRanges = rangeString->data;
+
+	return true;
+}
+
+
+/*
+ * PredicatesMayMatch returns whether the column statistics of a blob or a
+ * block allow a row that satisfies all predicates.
+ */
+static bool
+PredicatesMayMatch(BlobStats *stats, BlobColumnStats *columnStatsArray,
+                   List *predicateList, bool useBloomFilters)
+{
+	TupleDesc tupleDescriptor = stats->tupleDescriptor;
+	ListCell *predicateCell = NULL;
+
+	foreach(predicateCell, predicateList)
+	{
+		BlobStatsPredicate *predicate = (BlobStatsPredicate *) lfirst(predicateCell);
+		int columnIndex = ColumnIndexByName(tupleDescriptor, predicate->columnName);
+
+		if (columnIndex < 0 ||
+		    TupleDescAttr(tupleDescriptor, columnIndex)->atttypid !=
+		    predicate->columnTypeId ||
+		    !columnStatsArray[columnIndex].known)
+		{
+			continue;
+		}
+
+		if (predicate->type == PREDICATE_VALUES)
+		{
+			char *collationName = stats->collationNames[columnIndex];
+
+			/* the ordering and hashes depend on the collation */
+			if ((collationName == NULL) != (predicate->collationName == NULL) ||
+			    (collationName != NULL &&
+			     strcmp(collationName, predicate->collationName) != 0))
+			{
+				continue;
+			}
+		}
+
+		BloomFilter *bloomFilter = useBloomFilters ? stats->bloomFilters[columnIndex] :
+								   NULL;
+
+		if (!ColumnStatsMayMatch(&columnStatsArray[columnIndex], predicate, bloomFilter))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * ColumnStatsMayMatch returns whether the statistics of a column allow a
+ * value that satisfies the predicate.
+ */
+static bool
+ColumnStatsMayMatch(BlobColumnStats *columnStats, BlobStatsPredicate *predicate,
+                    BloomFilter *bloomFilter)
+{
+	if (predicate->type == PREDICATE_IS_NULL)
+	{
+		return columnStats->nullCount > 0;
+	}
+	else if (predicate->type == PREDICATE_IS_NOT_NULL)
+	{
+		return columnStats->valueCount > 0;
+	}
+
+	if (columnStats->valueCount == 0)
+	{
+		/* comparisons with NULL never match */
+		return false;
+	}
+
+	for (int valueIndex = 0; valueIndex < predicate->valueCount; valueIndex++)
+	{
+		Datum value = predicate->values[valueIndex];
+		bool valueMayMatch = true;
+
+		if (columnStats->hasRange)
+		{
+			int minComparison =
+				DatumGetInt32(FunctionCall2Coll(&predicate->compareFunction,
+				                                predicate->collation,
+				                                columnStats->minValue, value));
+			int maxComparison =
+				DatumGetInt32(FunctionCall2Coll(&predicate->compareFunction,
+				                                predicate->collation,
+				                                columnStats->maxValue, value));
+
+			switch (predicate->strategy)
+			{
+				case BTLessStrategyNumber:
+				{
+					valueMayMatch = minComparison < 0;
+					break;
+				}
+
+				case BTLessEqualStrategyNumber:
+				{
+					valueMayMatch = minComparison <= 0;
+					break;
+				}
+
+				case BTEqualStrategyNumber:
+				{
+					valueMayMatch = minComparison <= 0 && maxComparison >= 0;
+					break;
+				}
+
+				case BTGreaterEqualStrategyNumber:
+				{
+					valueMayMatch = maxComparison >= 0;
+					break;
+				}
+
+				case BTGreaterStrategyNumber:
+				{
+					valueMayMatch = maxComparison > 0;
+					break;
+				}
+
+				default:
+				{
+					break;
+				}
+			}
+		}
+
+		if (valueMayMatch && bloomFilter != NULL &&
+		    predicate->strategy == BTEqualStrategyNumber &&
+		    predicate->hasHashFunction)
+		{
+			Datum hash = FunctionCall1Coll(&predicate->hashFunction,
+			                               predicate->collation, value);
+
+			valueMayMatch = BloomFilterMayContain(bloomFilter, DatumGetUInt32(hash));
+		}
+
+		if (valueMayMatch)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * BlobStatsRowCount returns the number of rows in a blob.
+ */
+uint64
+BlobStatsRowCount(BlobStats *stats)
+{
+	return stats->rowCount;
+}
+
+
+/*
+ * BlobStatsColumn returns the statistics of a column of a blob, or NULL if
+ * there are none or they were collected with a different collation than
+ * that of the column in the tuple descriptor.
+ */
+BlobColumnStats *
+BlobStatsColumn(BlobStats *stats, int columnIndex)
+{
+	BlobColumnStats *columnStats = &stats->columns[columnIndex];
+	Oid collation = TupleDescAttr(stats->tupleDescriptor, columnIndex)->attcollation;
+	char *collationName = OidIsValid(collation) ? get_collation_name(collation) : NULL;
+	char *statsCollationName = stats->collationNames[columnIndex];
+
+	if (!columnStats->known)
+	{
+		return NULL;
+	}
+
+	if ((collationName == NULL) != (statsCollationName == NULL) ||
+	    (collationName != NULL && strcmp(collationName, statsCollationName) != 0))
+	{
+		return NULL;
+	}
+
+	return columnStats;
+}
+
+
+/*
+ * CollectBlobStats decodes all rows of a blob and returns their statistics,
+ * for blobs that do not have a sidecar. The decoder is started and
+ * finished. Columns that the decoder does not project count as NULL.
+ */
+BlobStats *
+CollectBlobStats(TupleDecoder *decoder, TupleDesc tupleDescriptor)
+{
+	int columnCount = tupleDescriptor->natts;
+	BlobStatsWriter *writer = CreateBlobStatsWriter(tupleDescriptor, NULL);
+	TupleBatch *batch = CreateTupleBatch(tupleDescriptor, TUPLE_BATCH_SIZE);
+
+	decoder->start(decoder->state);
+
+	while (TupleDecoderNextBatch(decoder, batch))
+	{
+		BlobStatsAddBatch(writer, batch);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	decoder->finish(decoder->state);
+
+	BlobStats *stats = palloc0(sizeof(BlobStats));
+	stats->tupleDescriptor = tupleDescriptor;
+	stats->rowCount = writer->rowCount;
+	stats->columns = writer->columns;
+	stats->collationNames = palloc0(Max(columnCount, 1) * sizeof(char *));
+	stats->bloomFilters = palloc0(Max(columnCount, 1) * sizeof(BloomFilter *));
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (attr->attisdropped)
+		{
+			continue;
+		}
+
+		stats->columns[columnIndex].known = true;
+
+		if (OidIsValid(attr->attcollation))
+		{
+			stats->collationNames[columnIndex] = get_collation_name(attr->attcollation);
+		}
+	}
+
+	return stats;
+}
+
+
+/*
+ * ReadBlockBlobRanges opens a list of byte ranges of a block blob, formatted
+ * as start-end,start-end by BlobStatsSelectRanges, for reading from the
+ * byte source as if they were a single blob.
+ */
+void
+ReadBlockBlobRanges(char *connectionString, char *containerName, char *path,
+                    char *byteRanges, ByteSource *byteSource)
+{
+	int maxRangeCount = 1;
+
+	for (char *current = byteRanges; *current != '\0'; current++)
+	{
+		if (*current == ',')
+		{
+			maxRangeCount++;
+		}
+	}
+
+	BlobRangeReaderState *state = palloc0(sizeof(BlobRangeReaderState));
+	state->connectionString = connectionString;
+	state->containerName = containerName;
+	state->path = path;
+	state->startOffsets = palloc0(maxRangeCount * sizeof(uint64));
+	state->endOffsets = palloc0(maxRangeCount * sizeof(uint64));
+	state->buffer = palloc(BLOB_RANGE_READ_SIZE);
+
+	char *range = byteRanges;
+
+	while (*range != '\0')
+	{
+		char *end = NULL;
+		int rangeIndex = state->rangeCount;
+
+		state->startOffsets[rangeIndex] = (uint64) strtoull(range, &end, 10);
+
+		if (end == range || *end != '-')
+		{
+			ereport(ERROR, (errmsg("invalid byte ranges: \"%s\"", byteRanges)));
+		}
+
+		range = end + 1;
+		state->endOffsets[rangeIndex] = (uint64) strtoull(range, &end, 10);
+
+		if (end == range || (*end != ',' && *end != '\0') ||
+		    state->endOffsets[rangeIndex] < state->startOffsets[rangeIndex])
+		{
+			ereport(ERROR, (errmsg("invalid byte ranges: \"%s\"", byteRanges)));
+		}
+
+		state->rangeCount++;
+		range = *end == ',' ? end + 1 : end;
+	}
+
+	if (state->rangeCount > 0)
+	{
+		state->offset = state->startOffsets[0];
+	}
+
+	byteSource->context = state;
+	byteSource->read = BlobRangesRead;
+	byteSource->close = BlobRangesClose;
+}
+
+
+/*
+ * BlobRangesRead reads at least minRead bytes from the byte ranges, unless
+ * the last range ends first.
+ */
+static int
+BlobRangesRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	BlobRangeReaderState *state = (BlobRangeReaderState *) context;
+	char *outputBuffer = (char *) buffer;
+	int bytesRead = 0;
+
+	while (bytesRead < maxRead)
+	{
+		if (state->bufferOffset == state->bufferLength)
+		{
+			if (bytesRead > 0 && bytesRead >= minRead)
+			{
+				break;
+			}
+
+			if (!FillBlobRangeBuffer(state))
+			{
+				break;
+			}
+		}
+
+		int bytesToCopy = Min(state->bufferLength - state->bufferOffset,
+		                      maxRead - bytesRead);
+
+		memcpy(outputBuffer + bytesRead, state->buffer + state->bufferOffset, bytesToCopy);
+		state->bufferOffset += bytesToCopy;
+		bytesRead += bytesToCopy;
+	}
+
+	return bytesRead;
+}
+
+
+/*
+ * FillBlobRangeBuffer downloads the next part of the current range into the
+ * buffer, moving on to the next range when the current one is done. Returns
+ * false after the last range.
+ */
+static bool
+FillBlobRangeBuffer(BlobRangeReaderState *state)
+{
+	while (state->rangeIndex < state->rangeCount &&
+	       state->offset >= state->endOffsets[state->rangeIndex])
+	{
+		state->rangeIndex++;
+
+		if (state->rangeIndex < state->rangeCount)
+		{
+			state->offset = state->startOffsets[state->rangeIndex];
+		}
+	}
+
+	if (state->rangeIndex >= state->rangeCount)
+	{
+		return false;
+	}
+
+	CHECK_FOR_INTERRUPTS();
+
+	int length = (int) Min(state->endOffsets[state->rangeIndex] - state->offset,
+	                       BLOB_RANGE_READ_SIZE);
+	int bytesRead = ReadBlockBlobRange(state->connectionString, state->containerName,
+	                                   state->path, state->offset, state->buffer,
+	                                   length);
+
+	if (bytesRead < length)
+	{
+		ereport(ERROR, (errmsg("blob \"%s\" is shorter than its statistics indicate",
+		                       state->path)));
+	}
+
+	state->offset += bytesRead;
+	state->bufferLength = bytesRead;
+	state->bufferOffset = 0;
+
+	return true;
+}
+
+
+/*
+ * BlobRangesClose frees the buffer of the byte ranges.
+ */
+static void
+BlobRangesClose(void *context)
+{
+	BlobRangeReaderState *state = (BlobRangeReaderState *) context;
+
+	pfree(state->buffer);
+}
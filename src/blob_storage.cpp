@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+
 #include <was/storage_account.h>
 #include <was/blob.h>
 #include <cpprest/filestream.h>
@@ -8,9 +13,19 @@
 #include "pgazure/blob_storage.h"
 
 
+/* size of the ranges that ReadBlockBlobParallel downloads */
+#define PARALLEL_READ_RANGE_SIZE (4 * 1024 * 1024)
+
+/* interval at which a reader that waits for a range checks for cancellation */
+#define PARALLEL_READ_WAIT_INTERVAL_MS 10
+
+
 static void CheckForInterrupts(void);
 static int ReadFromStdInputStream(void *context, void *buf, int minRead, int maxRead);
 static void CloseStdInputStream(void *context);
+static int ReadFromParallelBlobReader(void *context, void *buf, int minRead,
+                                      int maxRead);
+static void CloseParallelBlobReader(void *context);
 static void WriteToBlockBlobWriter(void *context, void *buf, int bytesToWrite);
 static void CloseBlockBlobWriter(void *context);
 
@@ -127,6 +142,445 @@ ReadBlockBlob(char *connectionString, char *containerName, char *path,
 	}
 }
 
+/*
+ * GetBlobSize returns the size of a blob in bytes based on its properties.
+ */
+size_t
+GetBlobSize(char *connectionString, char *containerName, char *path)
+{
+	try
+	{
+		azure::storage::cloud_storage_account storage_account = azure::storage::cloud_storage_account::parse(connectionString);
+		azure::storage::cloud_blob_client blob_client = storage_account.create_cloud_blob_client();
+		azure::storage::cloud_blob_container container = blob_client.get_container_reference(U(containerName));
+
+		azure::storage::cloud_blob blob = container.get_blob_reference(U(path));
+		blob.download_attributes();
+
+		return blob.properties().size();
+	}
+	catch (const azure::storage::storage_exception& e)
+	{
+		azure::storage::request_result result = e.result();
+		azure::storage::storage_extended_error extended_error = result.extended_error();
+		if (!extended_error.message().empty())
+		{
+			ThrowPostgresError(extended_error.message().c_str());
+		}
+		else
+		{
+			ThrowPostgresError(e.what());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return 0;
+}
+
+
+/*
+ * GetBlobContentEncoding copies the content-encoding of a blob into
+ * contentEncoding, truncated to maxLength - 1 bytes, or an empty string if
+ * the blob has none.
+ */
+void
+GetBlobContentEncoding(char *connectionString, char *containerName, char *path,
+                       char *contentEncoding, int maxLength)
+{
+	try
+	{
+		azure::storage::cloud_storage_account storage_account = azure::storage::cloud_storage_account::parse(connectionString);
+		azure::storage::cloud_blob_client blob_client = storage_account.create_cloud_blob_client();
+		azure::storage::cloud_blob_container container = blob_client.get_container_reference(U(containerName));
+
+		azure::storage::cloud_blob blob = container.get_blob_reference(U(path));
+		blob.download_attributes();
+
+		const utility::string_t &encoding = blob.properties().content_encoding();
+		size_t length = std::min(encoding.size(), (size_t) maxLength - 1);
+
+		memcpy(contentEncoding, encoding.c_str(), length);
+		contentEncoding[length] = '\0';
+	}
+	catch (const azure::storage::storage_exception& e)
+	{
+		azure::storage::request_result result = e.result();
+		azure::storage::storage_extended_error extended_error = result.extended_error();
+		if (!extended_error.message().empty())
+		{
+			ThrowPostgresError(extended_error.message().c_str());
+		}
+		else
+		{
+			ThrowPostgresError(e.what());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * GetBlobETag copies the ETag of a blob into etag, truncated to maxLength - 1
+ * bytes. The ETag changes whenever the blob is overwritten.
+ */
+void
+GetBlobETag(char *connectionString, char *containerName, char *path, char *etag,
+            int maxLength)
+{
+	try
+	{
+		azure::storage::cloud_storage_account storage_account = azure::storage::cloud_storage_account::parse(connectionString);
+		azure::storage::cloud_blob_client blob_client = storage_account.create_cloud_blob_client();
+		azure::storage::cloud_blob_container container = blob_client.get_container_reference(U(containerName));
+
+		azure::storage::cloud_blob blob = container.get_blob_reference(U(path));
+		blob.download_attributes();
+
+		const utility::string_t &blobETag = blob.properties().etag();
+		size_t length = std::min(blobETag.size(), (size_t) maxLength - 1);
+
+		memcpy(etag, blobETag.c_str(), length);
+		etag[length] = '\0';
+	}
+	catch (const azure::storage::storage_exception& e)
+	{
+		azure::storage::request_result result = e.result();
+		azure::storage::storage_extended_error extended_error = result.extended_error();
+		if (!extended_error.message().empty())
+		{
+			ThrowPostgresError(extended_error.message().c_str());
+		}
+		else
+		{
+			ThrowPostgresError(e.what());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * GetBlobSizeIfExists sets size to the size of a blob in bytes and returns
+ * true, or returns false if the blob does not exist.
+ */
+bool
+GetBlobSizeIfExists(char *connectionString, char *containerName, char *path,
+                    size_t *size)
+{
+	try
+	{
+		azure::storage::cloud_storage_account storage_account = azure::storage::cloud_storage_account::parse(connectionString);
+		azure::storage::cloud_blob_client blob_client = storage_account.create_cloud_blob_client();
+		azure::storage::cloud_blob_container container = blob_client.get_container_reference(U(containerName));
+
+		azure::storage::cloud_blob blob = container.get_blob_reference(U(path));
+		blob.download_attributes();
+
+		*size = blob.properties().size();
+
+		return true;
+	}
+	catch (const azure::storage::storage_exception& e)
+	{
+		azure::storage::request_result result = e.result();
+
+		if (result.http_status_code() == web::http::status_codes::NotFound)
+		{
+			return false;
+		}
+
+		azure::storage::storage_extended_error extended_error = result.extended_error();
+		if (!extended_error.message().empty())
+		{
+			ThrowPostgresError(extended_error.message().c_str());
+		}
+		else
+		{
+			ThrowPostgresError(e.what());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return false;
+}
+
+
+/*
+ * ReadBlockBlobRange reads up to length bytes starting at offset from a block
+ * blob into buffer and returns the number of bytes read, which is smaller than
+ * length if the blob ends before offset + length.
+ */
+int
+ReadBlockBlobRange(char *connectionString, char *containerName, char *path,
+                   size_t offset, char *buffer, int length)
+{
+	try
+	{
+		azure::storage::cloud_storage_account storage_account = azure::storage::cloud_storage_account::parse(connectionString);
+		azure::storage::cloud_blob_client blob_client = storage_account.create_cloud_blob_client();
+		azure::storage::cloud_blob_container container = blob_client.get_container_reference(U(containerName));
+
+		azure::storage::cloud_block_blob block_blob = container.get_block_blob_reference(U(path));
+		concurrency::streams::container_buffer<std::vector<uint8_t>> rangeBuffer;
+
+		block_blob.download_range_to_stream(rangeBuffer.create_ostream(), offset, length);
+
+		std::vector<uint8_t>& rangeBytes = rangeBuffer.collection();
+		int bytesRead = std::min((int) rangeBytes.size(), length);
+
+		memcpy(buffer, rangeBytes.data(), bytesRead);
+
+		return bytesRead;
+	}
+	catch (const azure::storage::storage_exception& e)
+	{
+		azure::storage::request_result result = e.result();
+		azure::storage::storage_extended_error extended_error = result.extended_error();
+		if (!extended_error.message().empty())
+		{
+			ThrowPostgresError(extended_error.message().c_str());
+		}
+		else
+		{
+			ThrowPostgresError(e.what());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return 0;
+}
+
+/*
+ * ParallelBlobReader reads a block blob as a stream while downloading up to
+ * parallelism ranges of it concurrently. Ranges are returned in order, so
+ * readers see the same bytes as from ReadBlockBlob.
+ */
+class ParallelBlobReader {
+		struct PendingRange {
+			pplx::task<void> download;
+			concurrency::streams::container_buffer<std::vector<uint8_t>> buffer;
+		};
+
+		azure::storage::cloud_block_blob block_blob;
+		size_t blobSize;
+		size_t nextRangeOffset;
+		size_t parallelism;
+
+		std::deque<PendingRange> pendingRanges;
+		std::vector<uint8_t> currentRange;
+		size_t currentRangeOffset;
+
+		void requestRanges();
+
+	public:
+		ParallelBlobReader(char *connectionString, char *containerName, char *path,
+		                   size_t blobSize, int parallelism);
+		~ParallelBlobReader();
+		int read(char *buf, int minRead, int maxRead);
+};
+
+
+ParallelBlobReader::ParallelBlobReader(char *connectionString, char *containerName,
+                                       char *path, size_t blobSize, int parallelism)
+	: blobSize(blobSize), nextRangeOffset(0), parallelism(std::max(parallelism, 1)),
+	  currentRangeOffset(0)
+{
+	azure::storage::cloud_storage_account storage_account = azure::storage::cloud_storage_account::parse(connectionString);
+	azure::storage::cloud_blob_client blob_client = storage_account.create_cloud_blob_client();
+	azure::storage::cloud_blob_container container = blob_client.get_container_reference(U(containerName));
+
+	block_blob = container.get_block_blob_reference(U(path));
+
+	requestRanges();
+}
+
+
+ParallelBlobReader::~ParallelBlobReader()
+{
+	/* the downloads write into buffers we own */
+	for (PendingRange& range : pendingRanges)
+	{
+		try
+		{
+			range.download.wait();
+		}
+		catch (...)
+		{
+			/* the range is not needed anymore */
+		}
+	}
+}
+
+
+/*
+ * requestRanges starts downloads of the next ranges of the blob until
+ * parallelism ranges are pending.
+ */
+void
+ParallelBlobReader::requestRanges()
+{
+	while (pendingRanges.size() < parallelism && nextRangeOffset < blobSize)
+	{
+		size_t length = std::min((size_t) PARALLEL_READ_RANGE_SIZE,
+		                         blobSize - nextRangeOffset);
+		PendingRange range;
+
+		range.download = block_blob.download_range_to_stream_async(range.buffer.create_ostream(),
+		                                                           nextRangeOffset, length);
+		pendingRanges.push_back(range);
+
+		nextRangeOffset += length;
+	}
+}
+
+
+/*
+ * read copies between minRead and maxRead bytes into buf, unless the blob
+ * ends, waiting for the oldest pending range when the current one is used
+ * up.
+ */
+int
+ParallelBlobReader::read(char *buf, int minRead, int maxRead)
+{
+	int bytesRead = 0;
+
+	do
+	{
+		if (currentRangeOffset == currentRange.size())
+		{
+			if (pendingRanges.empty())
+			{
+				break;
+			}
+
+			PendingRange& range = pendingRanges.front();
+
+			while (!range.download.is_done())
+			{
+				CheckForInterrupts();
+				std::this_thread::sleep_for(std::chrono::milliseconds(PARALLEL_READ_WAIT_INTERVAL_MS));
+			}
+
+			/* throws the error of a failed download */
+			range.download.get();
+
+			currentRange = std::move(range.buffer.collection());
+			currentRangeOffset = 0;
+
+			pendingRanges.pop_front();
+			requestRanges();
+		}
+
+		size_t length = std::min((size_t) (maxRead - bytesRead),
+		                         currentRange.size() - currentRangeOffset);
+
+		memcpy(buf + bytesRead, currentRange.data() + currentRangeOffset, length);
+
+		currentRangeOffset += length;
+		bytesRead += length;
+	}
+	while (bytesRead < minRead);
+
+	return bytesRead;
+}
+
+
+/*
+ * ReadFromParallelBlobReader reads up to maxRead bytes from the
+ * ParallelBlobReader pointed to by context into outBuf.
+ */
+static int
+ReadFromParallelBlobReader(void *context, void *outBuf, int minRead, int maxRead)
+{
+	try
+	{
+		ParallelBlobReader *reader = (ParallelBlobReader *) context;
+
+		return reader->read((char *) outBuf, minRead, maxRead);
+	}
+	catch (const azure::storage::storage_exception& e)
+	{
+		azure::storage::request_result result = e.result();
+		azure::storage::storage_extended_error extended_error = result.extended_error();
+		if (!extended_error.message().empty())
+		{
+			ThrowPostgresError(extended_error.message().c_str());
+		}
+		else
+		{
+			ThrowPostgresError(e.what());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return 0;
+}
+
+
+/*
+ * CloseParallelBlobReader disposes of the ParallelBlobReader pointed to by
+ * context.
+ */
+static void
+CloseParallelBlobReader(void *context)
+{
+	try
+	{
+		ParallelBlobReader *reader = (ParallelBlobReader *) context;
+		delete reader;
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * ReadBlockBlobParallel opens a block blob of blobSize bytes for reading from
+ * the byte source, downloading up to parallelism ranges of it at a time.
+ */
+void
+ReadBlockBlobParallel(char *connectionString, char *containerName, char *path,
+                      size_t blobSize, int parallelism, ByteSource *byteSource)
+{
+	try
+	{
+		ParallelBlobReader *reader = new ParallelBlobReader(connectionString, containerName,
+		                                                    path, blobSize, parallelism);
+
+		byteSource->context = (void *) reader;
+		byteSource->read = ReadFromParallelBlobReader;
+		byteSource->close = CloseParallelBlobReader;
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
 class BlockBlobWriter {
 		azure::storage::cloud_storage_account storage_account;
 		azure::storage::cloud_blob_client blob_client;
@@ -138,6 +592,8 @@ class BlockBlobWriter {
 	public:
 		BlockBlobWriter(char *connectionString, char *containerName, char *path);
 		void write(const char *buf, int bytesToWrite);
+		void setContentEncoding(const char *contentEncoding);
+		void setMetadata(const char *key, const char *value);
 		void close();
 
 };
@@ -159,6 +615,24 @@ void BlockBlobWriter::write(const char *buf, int bytesToWrite)
 	blockStream.write(sbuf, bytesToWrite).wait();
 }
 
+/*
+ * setContentEncoding sets the content-encoding property of the blob, which
+ * is committed together with the block list when the writer is closed.
+ */
+void BlockBlobWriter::setContentEncoding(const char *contentEncoding)
+{
+	block_blob.properties().set_content_encoding(U(contentEncoding));
+}
+
+/*
+ * setMetadata sets a metadata value of the blob, which is committed together
+ * with the block list when the writer is closed.
+ */
+void BlockBlobWriter::setMetadata(const char *key, const char *value)
+{
+	block_blob.metadata()[U(key)] = U(value);
+}
+
 void BlockBlobWriter::close()
 {
 	blockStream.flush().wait();
@@ -204,6 +678,44 @@ CloseBlockBlobWriter(void *context)
 }
 
 
+/*
+ * SetBlockBlobContentEncoding sets the content-encoding of a blob that is
+ * being written through a byte sink created by WriteBlockBlob.
+ */
+void
+SetBlockBlobContentEncoding(ByteSink *blobSink, const char *contentEncoding)
+{
+	try
+	{
+		BlockBlobWriter *writer = (BlockBlobWriter *) blobSink->context;
+		writer->setContentEncoding(contentEncoding);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * SetBlockBlobMetadata sets a metadata value of a blob that is being written
+ * through a byte sink created by WriteBlockBlob.
+ */
+void
+SetBlockBlobMetadata(ByteSink *blobSink, const char *key, const char *value)
+{
+	try
+	{
+		BlockBlobWriter *writer = (BlockBlobWriter *) blobSink->context;
+		writer->setMetadata(key, value);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
 /*
  * WriteBlockBlob opens a block blob for writing into the byte sink.
  */
@@ -1,8 +1,36 @@
 #include "postgres.h"
 
+#include "pgazure/blob_storage.h"
 #include "pgazure/blob_storage_utils.h"
 
 
+/*
+ * MemoryByteSourceState is the state of a ByteSource that reads from
+ * a buffer in memory.
+ */
+typedef struct MemoryByteSourceState
+{
+	char *data;
+	int length;
+	int offset;
+} MemoryByteSourceState;
+
+
+/* maximum length of a content-encoding that is looked up */
+#define MAX_CONTENT_ENCODING_LENGTH 64
+
+
+/* whether blobs without a compression suffix are checked for a content-encoding */
+bool DetectContentEncoding = false;
+
+/* suffixes of compressed files, and none for uncompressed files */
+static const char *CompressionSuffixes[] = { "", ".gz", ".zst", ".lz4" };
+
+
+static int MemoryByteSourceRead(void *context, void *buffer, int minRead, int maxRead);
+static void MemoryByteSourceClose(void *context);
+
+
 /*
  * CodecStringFromFileName tries to guess the encoder/decoder string
  * from the suffix of a file name.
@@ -10,19 +38,19 @@
 char *
 CodecStringFromFileName(char *path)
 {
-	if (HasSuffix(path, ".csv") || HasSuffix(path, ".csv.gz"))
+	if (HasCodecSuffix(path, ".csv"))
 	{
 		return "csv";
 	}
-	else if (HasSuffix(path, ".tsv") || HasSuffix(path, ".tsv.gz"))
+	else if (HasCodecSuffix(path, ".tsv"))
 	{
 		return "tsv";
 	}
-	else if (HasSuffix(path, ".json") || HasSuffix(path, ".json.gz"))
+	else if (HasCodecSuffix(path, ".json"))
 	{
 		return  "json";
 	}
-	else if (HasSuffix(path, ".xml") || HasSuffix(path, ".xml.gz"))
+	else if (HasCodecSuffix(path, ".xml"))
 	{
 		return  "xml";
 	}
@@ -33,6 +61,109 @@ CodecStringFromFileName(char *path)
 }
 
 
+/*
+ * CompressionStringFromFileName tries to guess the compression string
+ * from the suffix of a file name.
+ */
+char *
+CompressionStringFromFileName(char *path)
+{
+	if (HasSuffix(path, ".gz"))
+	{
+		return "gzip";
+	}
+	else if (HasSuffix(path, ".zst"))
+	{
+		return "zstd";
+	}
+	else if (HasSuffix(path, ".lz4"))
+	{
+		return "lz4";
+	}
+	else
+	{
+		return "none";
+	}
+}
+
+
+/*
+ * CompressionStringFromContentEncoding returns the compression string of a
+ * content-encoding, or "none" if it is not a compression format.
+ */
+char *
+CompressionStringFromContentEncoding(const char *contentEncoding)
+{
+	if (pg_strcasecmp(contentEncoding, "gzip") == 0 ||
+		pg_strcasecmp(contentEncoding, "x-gzip") == 0)
+	{
+		return "gzip";
+	}
+	else if (pg_strcasecmp(contentEncoding, "zstd") == 0)
+	{
+		return "zstd";
+	}
+	else if (pg_strcasecmp(contentEncoding, "lz4") == 0)
+	{
+		return "lz4";
+	}
+	else
+	{
+		return "none";
+	}
+}
+
+
+/*
+ * CompressionStringForBlob determines the compression string of a blob from
+ * the suffix of its name, or else, if azure.detect_content_encoding is on,
+ * from its content-encoding, as set by blob_storage_put_blob with
+ * compression => 'adaptive'. Looking up the content-encoding takes a request
+ * per blob, so it is off by default.
+ */
+char *
+CompressionStringForBlob(char *connectionString, char *containerName, char *path)
+{
+	char *compressionString = CompressionStringFromFileName(path);
+
+	if (DetectContentEncoding && strcmp(compressionString, "none") == 0)
+	{
+		char contentEncoding[MAX_CONTENT_ENCODING_LENGTH];
+
+		GetBlobContentEncoding(connectionString, containerName, path, contentEncoding,
+		                       MAX_CONTENT_ENCODING_LENGTH);
+
+		compressionString = CompressionStringFromContentEncoding(contentEncoding);
+	}
+
+	return compressionString;
+}
+
+
+/*
+ * HasCodecSuffix determines whether a file name ends in the given extension,
+ * optionally followed by the suffix of a compression format.
+ */
+bool
+HasCodecSuffix(const char *path, const char *extension)
+{
+	for (int suffixIndex = 0; suffixIndex < lengthof(CompressionSuffixes); suffixIndex++)
+	{
+		char *suffix = psprintf("%s%s", extension, CompressionSuffixes[suffixIndex]);
+		bool hasSuffix = HasSuffix(path, suffix);
+
+		pfree(suffix);
+
+		if (hasSuffix)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 /*
  * HasSuffix determines whether a filename ends in the given suffix.
  */
@@ -51,3 +182,81 @@ HasSuffix(const char *filename, const char *suffix)
 }
 
 
+/*
+ * CreateMemoryByteSource creates a ByteSource that reads from a buffer
+ * in memory.
+ */
+ByteSource *
+CreateMemoryByteSource(char *data, int length)
+{
+	MemoryByteSourceState *state = palloc0(sizeof(MemoryByteSourceState));
+	state->data = data;
+	state->length = length;
+	state->offset = 0;
+
+	ByteSource *byteSource = palloc0(sizeof(ByteSource));
+	byteSource->context = state;
+	byteSource->read = MemoryByteSourceRead;
+	byteSource->close = MemoryByteSourceClose;
+
+	return byteSource;
+}
+
+
+/*
+ * MemoryByteSourceRead copies up to maxRead bytes from the buffer.
+ */
+static int
+MemoryByteSourceRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	MemoryByteSourceState *state = (MemoryByteSourceState *) context;
+	int bytesRead = Min(maxRead, state->length - state->offset);
+
+	memcpy(buffer, state->data + state->offset, bytesRead);
+	state->offset += bytesRead;
+
+	return bytesRead;
+}
+
+
+/*
+ * MemoryByteSourceClose frees the state of the memory byte source, but
+ * not the buffer.
+ */
+static void
+MemoryByteSourceClose(void *context)
+{
+	pfree(context);
+}
+
+
+/*
+ * ReadBlobContents reads an entire blob into a string.
+ */
+StringInfo
+ReadBlobContents(char *connectionString, char *containerName, char *path)
+{
+	StringInfo data = makeStringInfo();
+	ByteSource *byteSource = palloc0(sizeof(ByteSource));
+
+	ReadBlockBlob(connectionString, containerName, path, byteSource);
+
+	while (true)
+	{
+		enlargeStringInfo(data, BLCKSZ);
+
+		int bytesRead = byteSource->read(byteSource->context, data->data + data->len, 1,
+		                                 data->maxlen - data->len - 1);
+		if (bytesRead == 0)
+		{
+			break;
+		}
+
+		data->len += bytesRead;
+		data->data[data->len] = '\0';
+	}
+
+	byteSource->close(byteSource->context);
+
+	return data;
+}
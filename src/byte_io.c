@@ -0,0 +1,139 @@
+/*-------------------------------------------------------------------------
+ *
+ * byte_io.c
+ *	  ByteSource and ByteSink wrappers that are used across the extension.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgazure/byte_io.h"
+
+
+/*
+ * CountingByteSourceState is the state of a ByteSource that counts the bytes
+ * read from another ByteSource.
+ */
+typedef struct CountingByteSourceState
+{
+	ByteSource *byteSource;
+	uint64 *byteCount;
+} CountingByteSourceState;
+
+/*
+ * CountingByteSinkState is the state of a ByteSink that counts the bytes
+ * written to another ByteSink.
+ */
+typedef struct CountingByteSinkState
+{
+	ByteSink *byteSink;
+	uint64 *byteCount;
+} CountingByteSinkState;
+
+
+static int CountingByteSourceRead(void *context, void *buffer, int minRead,
+                                  int maxRead);
+static void CountingByteSourceClose(void *context);
+static void CountingByteSinkWrite(void *context, void *buffer, int byteCount);
+static void CountingByteSinkClose(void *context);
+
+
+/*
+ * CreateCountingByteSource creates a ByteSource that adds the number of bytes
+ * read from another ByteSource to byteCount.
+ */
+ByteSource *
+CreateCountingByteSource(ByteSource *byteSource, uint64 *byteCount)
+{
+	CountingByteSourceState *state = palloc0(sizeof(CountingByteSourceState));
+	state->byteSource = byteSource;
+	state->byteCount = byteCount;
+
+	ByteSource *countingSource = palloc0(sizeof(ByteSource));
+	countingSource->context = state;
+	countingSource->read = CountingByteSourceRead;
+	countingSource->close = CountingByteSourceClose;
+
+	return countingSource;
+}
+
+
+/*
+ * CountingByteSourceRead reads from the underlying ByteSource and counts
+ * the bytes.
+ */
+static int
+CountingByteSourceRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	CountingByteSourceState *state = (CountingByteSourceState *) context;
+	ByteSource *byteSource = state->byteSource;
+
+	int bytesRead = byteSource->read(byteSource->context, buffer, minRead, maxRead);
+
+	*state->byteCount += bytesRead;
+
+	return bytesRead;
+}
+
+
+/*
+ * CountingByteSourceClose closes the underlying ByteSource.
+ */
+static void
+CountingByteSourceClose(void *context)
+{
+	CountingByteSourceState *state = (CountingByteSourceState *) context;
+	ByteSource *byteSource = state->byteSource;
+
+	byteSource->close(byteSource->context);
+}
+
+
+/*
+ * CreateCountingByteSink creates a ByteSink that adds the number of bytes
+ * written to another ByteSink to byteCount.
+ */
+ByteSink *
+CreateCountingByteSink(ByteSink *byteSink, uint64 *byteCount)
+{
+	CountingByteSinkState *state = palloc0(sizeof(CountingByteSinkState));
+	state->byteSink = byteSink;
+	state->byteCount = byteCount;
+
+	ByteSink *countingSink = palloc0(sizeof(ByteSink));
+	countingSink->context = state;
+	countingSink->write = CountingByteSinkWrite;
+	countingSink->close = CountingByteSinkClose;
+
+	return countingSink;
+}
+
+
+/*
+ * CountingByteSinkWrite writes to the underlying ByteSink and counts the
+ * bytes.
+ */
+static void
+CountingByteSinkWrite(void *context, void *buffer, int byteCount)
+{
+	CountingByteSinkState *state = (CountingByteSinkState *) context;
+	ByteSink *byteSink = state->byteSink;
+
+	byteSink->write(byteSink->context, buffer, byteCount);
+
+	*state->byteCount += byteCount;
+}
+
+
+/*
+ * CountingByteSinkClose closes the underlying ByteSink.
+ */
+static void
+CountingByteSinkClose(void *context)
+{
+	CountingByteSinkState *state = (CountingByteSinkState *) context;
+	ByteSink *byteSink = state->byteSink;
+
+	byteSink->close(byteSink->context);
+}
@@ -10,6 +10,7 @@
 #include "postgres.h"
 
 #include "access/tupdesc.h"
+#include "pgazure/binary_codec.h"
 #include "pgazure/byte_io.h"
 #include "pgazure/codecs.h"
 #include "pgazure/copy_format_decoder.h"
@@ -50,6 +51,123 @@ CreateTupleDecoder(TupleDesc tupleDescriptor)
 	return decoder;
 }
 
+
+/*
+ * CreateTupleBatch creates an empty batch that can hold up to maxRows tuples
+ * of the given tuple descriptor.
+ */
+TupleBatch *
+CreateTupleBatch(TupleDesc tupleDescriptor, int maxRows)
+{
+	int columnCount = tupleDescriptor->natts;
+
+	TupleBatch *batch = palloc0(sizeof(TupleBatch));
+	batch->columnCount = columnCount;
+	batch->maxRows = maxRows;
+	batch->rowCount = 0;
+	batch->columnValues = palloc0(columnCount * sizeof(Datum *));
+	batch->columnNulls = palloc0(columnCount * sizeof(bool *));
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		batch->columnValues[columnIndex] = palloc0(maxRows * sizeof(Datum));
+		batch->columnNulls[columnIndex] = palloc0(maxRows * sizeof(bool));
+	}
+
+	batch->rowValues = palloc0(columnCount * sizeof(Datum));
+	batch->rowNulls = palloc0(columnCount * sizeof(bool));
+
+	return batch;
+}
+
+
+/*
+ * TupleBatchAppendRow adds a row to the end of a batch that is not full.
+ */
+void
+TupleBatchAppendRow(TupleBatch *batch, Datum *columnValues, bool *columnNulls)
+{
+	int rowIndex = batch->rowCount;
+
+	Assert(rowIndex < batch->maxRows);
+
+	for (int columnIndex = 0; columnIndex < batch->columnCount; columnIndex++)
+	{
+		batch->columnValues[columnIndex][rowIndex] = columnValues[columnIndex];
+		batch->columnNulls[columnIndex][rowIndex] = columnNulls[columnIndex];
+	}
+
+	batch->rowCount++;
+}
+
+
+/*
+ * TupleBatchGetRow copies the values of a row in the batch into the
+ * columnValues and columnNulls arrays.
+ */
+void
+TupleBatchGetRow(TupleBatch *batch, int rowIndex, Datum *columnValues,
+				 bool *columnNulls)
+{
+	Assert(rowIndex < batch->rowCount);
+
+	for (int columnIndex = 0; columnIndex < batch->columnCount; columnIndex++)
+	{
+		columnValues[columnIndex] = batch->columnValues[columnIndex][rowIndex];
+		columnNulls[columnIndex] = batch->columnNulls[columnIndex][rowIndex];
+	}
+}
+
+
+/*
+ * TupleEncoderPushBatch encodes all rows in the batch, using the pushBatch
+ * function of the encoder if it has one and pushing rows one by one
+ * otherwise.
+ */
+void
+TupleEncoderPushBatch(TupleEncoder *encoder, TupleBatch *batch)
+{
+	if (encoder->pushBatch != NULL)
+	{
+		encoder->pushBatch(encoder->state, batch);
+		return;
+	}
+
+	for (int rowIndex = 0; rowIndex < batch->rowCount; rowIndex++)
+	{
+		TupleBatchGetRow(batch, rowIndex, batch->rowValues, batch->rowNulls);
+
+		encoder->push(encoder->state, batch->rowValues, batch->rowNulls);
+	}
+}
+
+
+/*
+ * TupleDecoderNextBatch decodes the next batch of rows, using the nextBatch
+ * function of the decoder if it has one. Otherwise, the batch holds a single
+ * row, since decoders may reuse the memory of the previous row in next.
+ * Returns false when there are no more rows.
+ */
+bool
+TupleDecoderNextBatch(TupleDecoder *decoder, TupleBatch *batch)
+{
+	if (decoder->nextBatch != NULL)
+	{
+		return decoder->nextBatch(decoder->state, batch);
+	}
+
+	batch->rowCount = 0;
+
+	if (!decoder->next(decoder->state, batch->rowValues, batch->rowNulls))
+	{
+		return false;
+	}
+
+	TupleBatchAppendRow(batch, batch->rowValues, batch->rowNulls);
+
+	return true;
+}
+
 /*
  * BuildTupleEncoder builds a tuple encoder from a string.
  */
@@ -62,6 +180,11 @@ BuildTupleEncoder(char *encoderString, TupleDesc tupleDescriptor, ByteSink *byte
 	switch (codecType)
 	{
 		case TUPLE_CODEC_BINARY:
+		{
+			encoder = CreateBinaryEncoder(byteSink, tupleDescriptor);
+			break;
+		}
+
 		case TUPLE_CODEC_CSV:
 		case TUPLE_CODEC_TSV:
 		{
@@ -70,6 +193,13 @@ BuildTupleEncoder(char *encoderString, TupleDesc tupleDescriptor, ByteSink *byte
 				makeDefElem("format", (Node *) makeString(copyFormat), -1);
 			List *copyOptions = list_make1(formatResultOption);
 
+			if (CodecStringHasHeader(encoderString))
+			{
+				copyOptions = lappend(copyOptions,
+				                      makeDefElem("header", (Node *) makeString("true"),
+				                                  -1));
+			}
+
 			encoder = CreateCopyFormatEncoder(byteSink, tupleDescriptor, copyOptions);
 			break;
 		}
@@ -86,10 +216,18 @@ BuildTupleEncoder(char *encoderString, TupleDesc tupleDescriptor, ByteSink *byte
 
 
 /*
- * BuildTupleEncoder builds a tuple decoder from a string.
+ * BuildTupleDecoder builds a tuple decoder from a string.
+ *
+ * If projectedColumns is not NULL, it indicates for each column whether the
+ * column is used by the query. Decoders may skip the conversion of other
+ * columns and return them as NULL.
+ *
+ * If filter is not NULL, decoders only return rows that match the filter.
+ * The filter columns need to be projected.
  */
 TupleDecoder *
-BuildTupleDecoder(char *decoderString, TupleDesc tupleDescriptor, ByteSource *byteSource)
+BuildTupleDecoder(char *decoderString, TupleDesc tupleDescriptor, ByteSource *byteSource,
+				  bool *projectedColumns, TupleDecoderFilter *filter)
 {
 	TupleDecoder *decoder = NULL;
 	TupleCodecType codecType = TupleCodecTypeFromString(decoderString);
@@ -97,6 +235,12 @@ BuildTupleDecoder(char *decoderString, TupleDesc tupleDescriptor, ByteSource *by
 	switch (codecType)
 	{
 		case TUPLE_CODEC_BINARY:
+		{
+			decoder = CreateBinaryDecoder(byteSource, tupleDescriptor, projectedColumns,
+			                              filter);
+			break;
+		}
+
 		case TUPLE_CODEC_CSV:
 		case TUPLE_CODEC_TSV:
 		{
@@ -105,13 +249,22 @@ BuildTupleDecoder(char *decoderString, TupleDesc tupleDescriptor, ByteSource *by
 				makeDefElem("format", (Node *) makeString(copyFormat), -1);
 			List *copyOptions = list_make1(formatResultOption);
 
-			decoder = CreateCopyFormatDecoder(byteSource, tupleDescriptor, copyOptions);
+			if (CodecStringHasHeader(decoderString))
+			{
+				copyOptions = lappend(copyOptions,
+				                      makeDefElem("header", (Node *) makeString("true"),
+				                                  -1));
+			}
+
+			decoder = CreateCopyFormatDecoder(byteSource, tupleDescriptor, copyOptions,
+			                                  projectedColumns, filter);
 			break;
 		}
 
 		case TUPLE_CODEC_FULL_TEXT:
 		{
-			decoder = CreateTextDecoder(byteSource, tupleDescriptor);
+			decoder = CreateTextDecoder(byteSource, tupleDescriptor, projectedColumns,
+			                            filter);
 			break;
 		}
 	}
@@ -120,6 +273,19 @@ BuildTupleDecoder(char *decoderString, TupleDesc tupleDescriptor, ByteSource *by
 }
 
 
+/*
+ * CodecStringHasHeader returns whether an encoder/decoder string is csv_header
+ * or tsv_header, which are csv and tsv with a header row that is skipped
+ * when decoding.
+ */
+bool
+CodecStringHasHeader(char *codecString)
+{
+	return strcmp(codecString, "csv_header") == 0 ||
+		   strcmp(codecString, "tsv_header") == 0;
+}
+
+
 /*
  * TupleCodecTypeFromString determines the codec type in an encoder/decoder
  * string.
@@ -127,11 +293,11 @@ BuildTupleDecoder(char *decoderString, TupleDesc tupleDescriptor, ByteSource *by
 static TupleCodecType
 TupleCodecTypeFromString(char *codecString)
 {
-	if (strcmp(codecString, "csv") == 0)
+	if (strcmp(codecString, "csv") == 0 || strcmp(codecString, "csv_header") == 0)
 	{
 		return TUPLE_CODEC_CSV;
 	}
-	else if (strcmp(codecString, "tsv") == 0)
+	else if (strcmp(codecString, "tsv") == 0 || strcmp(codecString, "tsv_header") == 0)
 	{
 		return TUPLE_CODEC_TSV;
 	}
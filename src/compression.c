@@ -9,11 +9,22 @@
  */
 #include "postgres.h"
 
+#include "pgazure/blob_storage.h"
 #include "pgazure/byte_io.h"
 #include "pgazure/compression.h"
+#include "pgazure/gzip_index.h"
+#include "pgazure/isal_compression.h"
+#include "pgazure/lz4_compression.h"
 #include "pgazure/zlib_compression.h"
+#include "pgazure/zstd_compression.h"
+#include "pgazure/zstd_dictionary.h"
 
 
+static ByteSource * BuildIndexedDecompressor(char *decompressorString,
+                                             ByteSource *byteSource,
+                                             GzipIndex *gzipIndex,
+                                             char *connectionString,
+                                             char *containerName);
 static CompressionType CompressionTypeFromString(char *string);
 
 
@@ -22,6 +33,49 @@ static CompressionType CompressionTypeFromString(char *string);
  */
 ByteSink *
 BuildCompressor(char *compressorString, ByteSink *byteSink)
+{
+	return BuildCompressorWithLevel(compressorString, COMPRESSION_DEFAULT_LEVEL,
+	                                byteSink);
+}
+
+
+/*
+ * BuildBlobCompressor builds a compressor from a string for a blob that is
+ * written through blobSink in the given container. When
+ * azure.zstd_dictionary_id is set, zstd compresses with that dictionary and
+ * its ID is recorded in the metadata of the blob.
+ */
+ByteSink *
+BuildBlobCompressor(char *compressorString, ByteSink *byteSink, ByteSink *blobSink,
+                    char *connectionString, char *containerName)
+{
+#ifdef USE_ZSTD
+	if (ZstdDictionaryId != 0 &&
+		CompressionTypeFromString(compressorString) == COMPRESSION_ZSTD)
+	{
+		ZSTD_CDict *dictionary = GetZstdCompressionDictionary(connectionString,
+		                                                      containerName,
+		                                                      ZstdDictionaryId,
+		                                                      ZstdCompressionLevel);
+
+		SetBlockBlobMetadata(blobSink, ZSTD_DICTIONARY_METADATA_KEY,
+		                     psprintf("%u", (uint32) ZstdDictionaryId));
+
+		return CreateZstdCompressor(byteSink, COMPRESSION_DEFAULT_LEVEL, dictionary);
+	}
+#endif
+
+	return BuildCompressor(compressorString, byteSink);
+}
+
+
+/*
+ * BuildCompressorWithLevel builds a compressor from a string that compresses
+ * at the given level, or at the configured level of the format if level is
+ * COMPRESSION_DEFAULT_LEVEL. Formats without levels ignore it.
+ */
+ByteSink *
+BuildCompressorWithLevel(char *compressorString, int level, ByteSink *byteSink)
 {
 	ByteSink *compressor = NULL;
 	CompressionType compressionType = CompressionTypeFromString(compressorString);
@@ -31,7 +85,38 @@ BuildCompressor(char *compressorString, ByteSink *byteSink)
 #ifdef HAVE_LIBZ
 		case COMPRESSION_GZIP:
 		{
-			compressor = CreateZLibCompressor(byteSink);
+			if (GzipWorkers > 0)
+			{
+				compressor = CreateParallelZLibCompressor(byteSink, GzipWorkers, level);
+			}
+#ifdef USE_ISAL
+			else if (ActiveGzipEngine() == GZIP_ENGINE_ISAL &&
+			         level == COMPRESSION_DEFAULT_LEVEL)
+			{
+				/* ISA-L compresses at a fixed level */
+				compressor = CreateIsalCompressor(byteSink);
+			}
+#endif
+			else
+			{
+				compressor = CreateZLibCompressor(byteSink, level);
+			}
+			break;
+		}
+#endif
+
+#ifdef USE_ZSTD
+		case COMPRESSION_ZSTD:
+		{
+			compressor = CreateZstdCompressor(byteSink, level, NULL);
+			break;
+		}
+#endif
+
+#ifdef USE_LZ4
+		case COMPRESSION_LZ4:
+		{
+			compressor = CreateLZ4Compressor(byteSink);
 			break;
 		}
 #endif
@@ -53,6 +138,45 @@ BuildCompressor(char *compressorString, ByteSink *byteSink)
  */
 ByteSource *
 BuildDecompressor(char *decompressorString, ByteSource *byteSource)
+{
+	return BuildIndexedDecompressor(decompressorString, byteSource, NULL, NULL, NULL);
+}
+
+
+/*
+ * BuildBlobDecompressor builds a decompressor from a string for the contents
+ * of the given blob. Parallel gzip decompression uses the gzip index of the
+ * blob if it has one, unless path is NULL because only part of the blob is
+ * decompressed. zstd dictionaries are loaded from the container.
+ */
+ByteSource *
+BuildBlobDecompressor(char *decompressorString, ByteSource *byteSource,
+                      char *connectionString, char *containerName, char *path)
+{
+	GzipIndex *gzipIndex = NULL;
+
+#ifdef HAVE_LIBZ
+	if (GzipDecompressionWorkers > 0 && path != NULL &&
+	    CompressionTypeFromString(decompressorString) == COMPRESSION_GZIP)
+	{
+		gzipIndex = ReadGzipIndex(connectionString, containerName, path, -1);
+	}
+#endif
+
+	return BuildIndexedDecompressor(decompressorString, byteSource, gzipIndex,
+	                                connectionString, containerName);
+}
+
+
+/*
+ * BuildIndexedDecompressor builds a decompressor from a string, which splits
+ * gzip input at the checkpoints of gzipIndex if it is not NULL, and loads
+ * zstd dictionaries from the given container if connectionString is not NULL.
+ */
+static ByteSource *
+BuildIndexedDecompressor(char *decompressorString, ByteSource *byteSource,
+                         GzipIndex *gzipIndex, char *connectionString,
+                         char *containerName)
 {
 	ByteSource *decompressor = NULL;
 	CompressionType compressionType = CompressionTypeFromString(decompressorString);
@@ -62,7 +186,39 @@ BuildDecompressor(char *decompressorString, ByteSource *byteSource)
 #ifdef HAVE_LIBZ
 		case COMPRESSION_GZIP:
 		{
-			decompressor = CreateZLibDecompressor(byteSource);
+			if (GzipDecompressionWorkers > 0)
+			{
+				decompressor = CreateParallelZLibDecompressor(byteSource,
+				                                              GzipDecompressionWorkers,
+				                                              gzipIndex);
+			}
+#ifdef USE_ISAL
+			else if (ActiveGzipEngine() == GZIP_ENGINE_ISAL)
+			{
+				decompressor = CreateIsalDecompressor(byteSource);
+			}
+#endif
+			else
+			{
+				decompressor = CreateZLibDecompressor(byteSource);
+			}
+			break;
+		}
+#endif
+
+#ifdef USE_ZSTD
+		case COMPRESSION_ZSTD:
+		{
+			decompressor = CreateZstdDecompressor(byteSource, connectionString,
+			                                      containerName);
+			break;
+		}
+#endif
+
+#ifdef USE_LZ4
+		case COMPRESSION_LZ4:
+		{
+			decompressor = CreateLZ4Decompressor(byteSource);
 			break;
 		}
 #endif
@@ -93,6 +249,24 @@ CompressionTypeFromString(char *compressionString)
 #else
 		ereport(ERROR, (errmsg("gzip compression requires postgres to be "
 							   "built with zlib")));
+#endif
+	}
+	else if (strcmp(compressionString, "zstd") == 0)
+	{
+#ifdef USE_ZSTD
+		return COMPRESSION_ZSTD;
+#else
+		ereport(ERROR, (errmsg("zstd compression requires postgres to be "
+							   "built with zstd")));
+#endif
+	}
+	else if (strcmp(compressionString, "lz4") == 0)
+	{
+#ifdef USE_LZ4
+		return COMPRESSION_LZ4;
+#else
+		ereport(ERROR, (errmsg("lz4 compression requires postgres to be "
+							   "built with lz4")));
 #endif
 	}
 	else if (strcmp(compressionString, "none") == 0)
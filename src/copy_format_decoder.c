@@ -13,27 +13,27 @@
 #include "utils/memutils.h"
 
 #include "commands/copy.h"
+#include "commands/defrem.h"
 #include "executor/executor.h"
+#include "mb/pg_wchar.h"
 #include "nodes/execnodes.h"
 #include "pgazure/byte_io.h"
 #include "pgazure/codecs.h"
 #include "pgazure/copy_format_decoder.h"
+#include "pgazure/utf8_validation.h"
 #include "utils/builtins.h"
+#include "utils/lsyscache.h"
 #include "utils/rel.h"
 
 
-#if PG_VERSION_NUM >= 120000
-#define NextCopyFromCompat NextCopyFrom
-#else
-#define NextCopyFromCompat(cstate, econtext, values, nulls) \
-	NextCopyFrom(cstate, econtext, values, nulls, NULL)
-#endif
-
-
 /*
  * BeginCopyFrom takes a callback function to read bytes from, but it does not
  * allow you to specify an extra argument. Therefore we set this global variable
  * and use it the callback (ReadFromCurrentByteSource).
+ *
+ * Several decoders can be open at the same time, for instance when joining
+ * two blob scans, so each decoder sets it to its own byte source around every
+ * call into copy.c that may read, and restores the previous value afterwards.
  */
 static ByteSource *CurrentByteSource;
 
@@ -42,21 +42,117 @@ static int ReadFromCurrentByteSource(void *outBuf, int minRead, int maxRead);
 static Relation StubRelation(TupleDesc tupleDescriptor);
 static List * TupleDescColumnNameList(TupleDesc tupleDescriptor);
 static List * ColumnNameListToCopyStmtAttributeList(List *columnNameList);
+static bool ConvertFields(CopyFormatDecoderState *decoder, char **fieldStrings,
+                          Datum *columnValues, bool *columnNulls);
+static inline void ConvertFieldList(CopyFormatDecoderState *decoder, int *fieldIndexes,
+                                    int fieldCount, char **fieldStrings,
+                                    Datum *columnValues, bool *columnNulls);
 
 
 /*
  * CreateCopyFormatDecoder creates a tuple decoder that uses PostgreSQL's
  * COPY logic to parse the incoming bytes.
+ *
+ * COPY only splits lines into fields, we convert the fields ourselves such
+ * that we can skip columns that are not in projectedColumns and only convert
+ * the remaining columns of a row when the filter columns match.
+ *
+ * The header option is handled here rather than by COPY, which only accepts
+ * it for the text format from PostgreSQL 15 onwards: the first line is split
+ * into fields and discarded.
  */
 TupleDecoder *
 CreateCopyFormatDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor,
-						List *copyOptions)
+						List *copyOptions, bool *projectedColumns,
+						TupleDecoderFilter *filter)
 {
+#if PG_VERSION_NUM >= 140000
+
+	/*
+	 * When the input and server encodings are both UTF-8, COPY validates
+	 * every line before parsing it. We validate whole buffers using a much
+	 * faster validator instead, and tell COPY that the input is SQL_ASCII,
+	 * in which case it only checks for NUL bytes.
+	 */
+	if (GetDatabaseEncoding() == PG_UTF8 && pg_get_client_encoding() == PG_UTF8)
+	{
+		DefElem *encodingOption =
+			makeDefElem("encoding", (Node *) makeString("SQL_ASCII"), -1);
+
+		byteSource = CreateUtf8ValidatingSource(byteSource);
+		copyOptions = lappend(list_copy(copyOptions), encodingOption);
+	}
+#endif
+
 	CopyFormatDecoderState *state = palloc0(sizeof(CopyFormatDecoderState));
+	List *copyStmtOptions = NIL;
+	ListCell *optionCell = NULL;
+
+	foreach(optionCell, copyOptions)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strcmp(option->defname, "header") == 0)
+		{
+			state->skipHeader = defGetBoolean(option);
+		}
+		else
+		{
+			copyStmtOptions = lappend(copyStmtOptions, option);
+		}
+	}
+
 	state->byteSource = byteSource;
-	state->copyOptions = copyOptions;
+	state->copyOptions = copyStmtOptions;
 	state->executorState = CreateExecutorState();
 	state->tupleDescriptor = tupleDescriptor;
+	state->filter = filter;
+
+	int columnCount = tupleDescriptor->natts;
+
+	state->columnIndexes = palloc0(columnCount * sizeof(int));
+	state->filterFieldIndexes = palloc0(columnCount * sizeof(int));
+	state->remainingFieldIndexes = palloc0(columnCount * sizeof(int));
+	state->inputFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+	state->typeIOParams = palloc0(columnCount * sizeof(Oid));
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		/* same columns as in TupleDescColumnNameList */
+		if (attr->attisdropped
+#if PG_VERSION_NUM >= 120000
+			|| attr->attgenerated == ATTRIBUTE_GENERATED_STORED
+#endif
+			)
+		{
+			continue;
+		}
+
+		int fieldIndex = state->fieldCount++;
+		state->columnIndexes[fieldIndex] = columnIndex;
+
+		if (projectedColumns != NULL && !projectedColumns[columnIndex])
+		{
+			continue;
+		}
+
+		if (filter != NULL && filter->filterColumns[columnIndex])
+		{
+			state->filterFieldIndexes[state->filterFieldCount++] = fieldIndex;
+		}
+		else
+		{
+			state->remainingFieldIndexes[state->remainingFieldCount++] = fieldIndex;
+		}
+
+		Oid inputFunctionId = InvalidOid;
+
+		getTypeInputInfo(attr->atttypid, &inputFunctionId,
+		                 &state->typeIOParams[columnIndex]);
+		fmgr_info(inputFunctionId, &state->inputFunctions[columnIndex]);
+	}
 
 	TupleDecoder *decoder = CreateTupleDecoder(tupleDescriptor);
 	decoder->state = state;
@@ -76,25 +172,28 @@ CopyFormatDecoderStart(void *state)
 {
 	CopyFormatDecoderState *decoder = (CopyFormatDecoderState *) state;
 
-	/* set the global byte source to read in ReadFromCurrentByteSource */
-	CurrentByteSource = decoder->byteSource;
-
 	Relation stubRelation = StubRelation(decoder->tupleDescriptor);
 	List *columnNameList = TupleDescColumnNameList(decoder->tupleDescriptor);
 	List *attributeList = ColumnNameListToCopyStmtAttributeList(columnNameList);
 
+	/* set the global byte source to read in ReadFromCurrentByteSource */
+	ByteSource *previousByteSource = CurrentByteSource;
+	CurrentByteSource = decoder->byteSource;
+
 	CopyState copyState = BeginCopyFrom(NULL, stubRelation, NULL, false,
 	                                    ReadFromCurrentByteSource,
 	                                    attributeList, decoder->copyOptions);
 
+	CurrentByteSource = previousByteSource;
+
 	decoder->copyState = copyState;
 }
 
 
 /*
- * CopyFormatDecoderNext reads a tuple in COPY format from the ByteSource and writes
- * the values to columnValues and columnNulls. If returns false when there are no
- * more tuples to read.
+ * CopyFormatDecoderNext reads the next tuple in COPY format that matches the
+ * filter from the ByteSource and writes the values to columnValues and
+ * columnNulls. It returns false when there are no more tuples to read.
  */
 bool
 CopyFormatDecoderNext(void *state, Datum *columnValues, bool *columnNulls)
@@ -102,32 +201,146 @@ CopyFormatDecoderNext(void *state, Datum *columnValues, bool *columnNulls)
 	CopyFormatDecoderState *decoder = (CopyFormatDecoderState *) state;
 	EState *executorState = decoder->executorState;
 	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
-	ExprContext *executorExpressionContext = GetPerTupleExprContext(executorState);
-	
-	ResetPerTupleExprContext(executorState);
-	MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
-
 	CopyState copyState = decoder->copyState;
+	bool rowMatches = false;
+	bool nextRowFound = false;
 
-    /* set up callback to identify error line number */
+	/* set up callback to identify error line number */
 	ErrorContextCallback errorCallback;
-    errorCallback.callback = CopyFromErrorCallback;
-    errorCallback.arg = (void *) copyState;
-    errorCallback.previous = error_context_stack;
-    error_context_stack = &errorCallback;
+	errorCallback.callback = CopyFromErrorCallback;
+	errorCallback.arg = (void *) copyState;
+	errorCallback.previous = error_context_stack;
+	error_context_stack = &errorCallback;
+
+	/*
+	 * Read from our own byte source. On error, the next decoder to read sets
+	 * its own, so we do not need to restore the previous one.
+	 */
+	ByteSource *previousByteSource = CurrentByteSource;
+	CurrentByteSource = decoder->byteSource;
 
-	bool nextRowFound = NextCopyFromCompat(copyState, executorExpressionContext,
-									       columnValues, columnNulls);
+	if (decoder->skipHeader)
+	{
+		char **headerFields = NULL;
+		int headerFieldCount = 0;
+
+		MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+		NextCopyFromRawFields(copyState, &headerFields, &headerFieldCount);
+		decoder->skipHeader = false;
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	do
+	{
+		char **fieldStrings = NULL;
+		int fieldCount = 0;
+
+		ResetPerTupleExprContext(executorState);
+		MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+		nextRowFound = NextCopyFromRawFields(copyState, &fieldStrings, &fieldCount);
+		if (nextRowFound)
+		{
+			/* same checks as NextCopyFrom */
+			if (fieldCount > decoder->fieldCount)
+			{
+				ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+				                errmsg("extra data after last expected column")));
+			}
+			else if (fieldCount < decoder->fieldCount)
+			{
+				int columnIndex = decoder->columnIndexes[fieldCount];
+				Form_pg_attribute attr = TupleDescAttr(decoder->tupleDescriptor,
+				                                       columnIndex);
+
+				ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+				                errmsg("missing data for column \"%s\"",
+				                       NameStr(attr->attname))));
+			}
+
+			rowMatches = ConvertFields(decoder, fieldStrings, columnValues,
+			                           columnNulls);
+		}
+
+		MemoryContextSwitchTo(oldContext);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+	while (nextRowFound && !rowMatches);
+
+	CurrentByteSource = previousByteSource;
+
+	error_context_stack = errorCallback.previous;
 
-   	error_context_stack = errorCallback.previous;
-	MemoryContextSwitchTo(oldContext);
 	return nextRowFound;
 }
 
 
+/*
+ * ConvertFields converts the projected fields of a line by calling the input
+ * functions of the columns. If there is a filter, the filter fields are
+ * converted first, and the remaining fields are only converted if the row
+ * matches. Returns whether the row matches.
+ */
+static bool
+ConvertFields(CopyFormatDecoderState *decoder, char **fieldStrings,
+              Datum *columnValues, bool *columnNulls)
+{
+	TupleDecoderFilter *filter = decoder->filter;
+	bool rowMatches = true;
+
+	/* dropped, generated and skipped columns are NULL */
+	memset(columnNulls, true, decoder->tupleDescriptor->natts * sizeof(bool));
+
+	if (filter != NULL)
+	{
+		ConvertFieldList(decoder, decoder->filterFieldIndexes, decoder->filterFieldCount,
+		                 fieldStrings, columnValues, columnNulls);
+
+		rowMatches = filter->matches(filter->context, columnValues, columnNulls);
+	}
+
+	if (rowMatches)
+	{
+		ConvertFieldList(decoder, decoder->remainingFieldIndexes,
+		                 decoder->remainingFieldCount, fieldStrings, columnValues,
+		                 columnNulls);
+	}
+
+	return rowMatches;
+}
+
+
+/*
+ * ConvertFieldList converts the given fields of a line.
+ */
+static inline void
+ConvertFieldList(CopyFormatDecoderState *decoder, int *fieldIndexes, int fieldCount,
+                 char **fieldStrings, Datum *columnValues, bool *columnNulls)
+{
+	TupleDesc tupleDescriptor = decoder->tupleDescriptor;
+
+	for (int index = 0; index < fieldCount; index++)
+	{
+		int fieldIndex = fieldIndexes[index];
+		int columnIndex = decoder->columnIndexes[fieldIndex];
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+		char *fieldString = fieldStrings[fieldIndex];
+
+		/* input functions are called for NULL too, to check domain constraints */
+		columnValues[columnIndex] =
+			InputFunctionCall(&decoder->inputFunctions[columnIndex], fieldString,
+			                  decoder->typeIOParams[columnIndex], attr->atttypmod);
+		columnNulls[columnIndex] = (fieldString == NULL);
+	}
+}
+
+
 /*
  * ReadFromCurrentByteSource is a callback function passed to BeginCopyFrom to
- * read from CurrentByteSource.
+ * read from CurrentByteSource, which is set by the decoder that is reading.
  */
 static int
 ReadFromCurrentByteSource(void *outBuf, int minRead, int maxRead)
@@ -147,11 +360,11 @@ CopyFormatDecoderFinish(void *state)
 {
 	CopyFormatDecoderState *decoder = (CopyFormatDecoderState *) state;
 
-	EndCopyFrom(decoder->copyState);
+	ByteSource *byteSource = decoder->byteSource;
 
-	CurrentByteSource->close(CurrentByteSource->context);
+	EndCopyFrom(decoder->copyState);
 
-	CurrentByteSource = NULL;
+	byteSource->close(byteSource->context);
 }
 
 
@@ -20,6 +20,7 @@
 #include "executor/executor.h"
 #include "mb/pg_wchar.h"
 #include "nodes/execnodes.h"
+#include "pgazure/binary_codec.h"
 #include "pgazure/byte_io.h"
 #include "pgazure/codecs.h"
 #include "pgazure/copy_format_encoder.h"
@@ -30,8 +31,14 @@
 #include "utils/rel.h"
 
 
-/* constant used in binary protocol */
-static const char BinarySignature[11] = "PGCOPY\n\377\r\n\0";
+/*
+ * Encoded rows are accumulated in fe_msgbuf and written to the byte sink
+ * once the buffer reaches COPY_ENCODER_BATCH_SIZE. If a single large row
+ * caused the buffer to grow beyond COPY_ENCODER_MAX_BUFFER_SIZE, the buffer
+ * is shrunk again after flushing to keep memory usage bounded.
+ */
+#define COPY_ENCODER_BATCH_SIZE 65536
+#define COPY_ENCODER_MAX_BUFFER_SIZE (4 * COPY_ENCODER_BATCH_SIZE)
 
 
 static void CopyOutStateInitialize(CopyOutState cstate, TupleDesc tupDesc,
@@ -58,6 +65,8 @@ static void CopyAttributeOutCSV(CopyOutState cstate, char *string,
                                 bool use_quote, bool single_attr);
 static void CopyFlushOutput(CopyOutState cstate, char *start, char *pointer);
 static void ProcessCopyOutOptions(CopyOutState cstate, List *options);
+static void CopyFormatEncoderFlush(CopyFormatEncoderState *encoder);
+static void CopyFormatEncoderFlushRows(void *state);
 
 
 /*
@@ -80,6 +89,7 @@ CreateCopyFormatEncoder(ByteSink *byteSink, TupleDesc tupleDescriptor,
 	encoder->state = state;
 	encoder->start = CopyFormatEncoderStart;
 	encoder->push = CopyFormatEncoderPush;
+	encoder->flush = CopyFormatEncoderFlushRows;
 	encoder->finish = CopyFormatEncoderFinish;
 
 	return encoder;
@@ -90,7 +100,6 @@ void
 CopyFormatEncoderStart(void *state)
 {
 	CopyFormatEncoderState *encoder = (CopyFormatEncoderState *) state;
-	ByteSink *byteSink = encoder->byteSink;
 	CopyOutState copyOutState = (CopyOutState) palloc0(sizeof(CopyOutStateData));
 
 	CopyOutStateInitialize(copyOutState, encoder->tupleDescriptor, encoder->copyOptions);
@@ -99,13 +108,10 @@ CopyFormatEncoderStart(void *state)
 	encoder->columnOutputFunctions = ColumnOutputFunctions(encoder->tupleDescriptor,
 	                                                       false);
 
-	StringInfo copyData = copyOutState->fe_msgbuf;
-
 	if (copyOutState->binary)
 	{
-		/* send headers when using binary encoding */
+		/* headers are written along with the first batch of rows */
 		AppendCopyBinaryHeaders(copyOutState);
-		byteSink->write(byteSink->context, copyData->data, copyData->len);
 	}
 	else
 	{
@@ -123,7 +129,6 @@ CopyFormatEncoderStart(void *state)
 		if (copyOutState->header_line)
 		{
 			CopyHeaderCSV(copyOutState, encoder->tupleDescriptor);
-			byteSink->write(byteSink->context, copyData->data, copyData->len);
 		}
 	}
 }
@@ -131,24 +136,40 @@ CopyFormatEncoderStart(void *state)
 
 /*
  * CopyFormatEncoderPush encodes a single tuple according to the COPY format
- * and writes it to the byte sink immediately.
+ * and appends it to the current batch, which is written to the byte sink
+ * once it is full.
  */
 void
 CopyFormatEncoderPush(void *state, Datum *columnValues, bool *columnNulls)
 {
 	CopyFormatEncoderState *encoder = (CopyFormatEncoderState *) state;
-	ByteSink *byteSink = encoder->byteSink;
 	TupleDesc tupleDescriptor = encoder->tupleDescriptor;
 	CopyOutState copyOutState = encoder->copyOutState;
 	FmgrInfo *columnOutputFunctions = encoder->columnOutputFunctions;
 	StringInfo copyData = copyOutState->fe_msgbuf;
 
-    /* construct row in COPY format */
-    resetStringInfo(copyData);
-    AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-                      copyOutState, columnOutputFunctions, NULL);
+	/* free memory used by output functions for the previous row */
+	MemoryContextReset(copyOutState->rowcontext);
+
+	/* construct row in COPY format */
+	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
+	                  copyOutState, columnOutputFunctions, NULL);
+
+	if (copyData->len >= COPY_ENCODER_BATCH_SIZE)
+	{
+		CopyFormatEncoderFlush(encoder);
+	}
+}
+
 
-	byteSink->write(byteSink->context, copyData->data, copyData->len);
+/*
+ * CopyFormatEncoderFlushRows writes the rows that were pushed so far to the
+ * byte sink.
+ */
+static void
+CopyFormatEncoderFlushRows(void *state)
+{
+	CopyFormatEncoderFlush((CopyFormatEncoderState *) state);
 }
 
 
@@ -164,16 +185,44 @@ CopyFormatEncoderFinish(void *state)
 
 	if (copyOutState->binary)
 	{
-		StringInfo copyData = copyOutState->fe_msgbuf;
-
 		/* send footers when using binary encoding */
-		resetStringInfo(copyData);
 		AppendCopyBinaryFooters(copyOutState);
-
-		byteSink->write(byteSink, copyData->data, copyData->len);
 	}
 
+	CopyFormatEncoderFlush(encoder);
+
 	byteSink->close(byteSink->context);
+
+	MemoryContextDelete(copyOutState->rowcontext);
+}
+
+
+/*
+ * CopyFormatEncoderFlush writes the current batch of encoded rows to the
+ * byte sink and empties the buffer.
+ */
+static void
+CopyFormatEncoderFlush(CopyFormatEncoderState *encoder)
+{
+	ByteSink *byteSink = encoder->byteSink;
+	StringInfo copyData = encoder->copyOutState->fe_msgbuf;
+
+	if (copyData->len > 0)
+	{
+		byteSink->write(byteSink->context, copyData->data, copyData->len);
+	}
+
+	if (copyData->maxlen > COPY_ENCODER_MAX_BUFFER_SIZE)
+	{
+		/* a large row enlarged the buffer, give the memory back */
+		MemoryContext bufferContext = GetMemoryChunkContext(copyData->data);
+
+		pfree(copyData->data);
+		copyData->data = MemoryContextAlloc(bufferContext, COPY_ENCODER_BATCH_SIZE);
+		copyData->maxlen = COPY_ENCODER_BATCH_SIZE;
+	}
+
+	resetStringInfo(copyData);
 }
 
 
@@ -189,6 +238,7 @@ CopyOutStateInitialize(CopyOutState cstate, TupleDesc tupDesc, List *copyOptions
 	ProcessCopyOutOptions(cstate, copyOptions);
 
 	cstate->fe_msgbuf = makeStringInfo();
+	enlargeStringInfo(cstate->fe_msgbuf, COPY_ENCODER_BATCH_SIZE);
 	cstate->rowcontext =
 			AllocSetContextCreate(CurrentMemoryContext, "COPY TO", ALLOCSET_DEFAULT_SIZES);
 
@@ -305,13 +355,12 @@ CopyOutStateInitialize(CopyOutState cstate, TupleDesc tupDesc, List *copyOptions
 		cstate->file_encoding = pg_get_client_encoding();
 
 	/*
-	 * Set up encoding conversion info.  Even if the file and server encodings
-	 * are the same, we must apply pg_any_to_server() to validate data in
-	 * multibyte encodings.
+	 * Set up encoding conversion info.  Unlike COPY FROM, we only write data
+	 * that is already stored in the database and therefore valid in the
+	 * server encoding, so we can skip pg_server_to_any() when the file and
+	 * server encodings are the same.
 	 */
-	cstate->need_transcoding =
-		(cstate->file_encoding != GetDatabaseEncoding() ||
-		 pg_database_encoding_max_length() > 1);
+	cstate->need_transcoding = (cstate->file_encoding != GetDatabaseEncoding());
 	/* See Multibyte encoding comment above */
 	cstate->encoding_embeds_ascii = PG_ENCODING_IS_CLIENT_ONLY(cstate->file_encoding);
 
@@ -363,6 +412,9 @@ CopyHeaderCSV(CopyOutState cstate, TupleDesc tupDesc)
  * commands/copy.c, but only implements a subset of that functionality.
  * Note that the caller of this function should reset row memory context
  * to not bloat memory usage.
+ *
+ * The row is appended to the data that is already in the message buffer,
+ * such that multiple rows can be written to the byte sink at once.
  */
 static void
 AppendCopyRowData(Datum *valueArray, bool *isNullArray, TupleDesc rowDescriptor,
@@ -548,7 +600,7 @@ AppendCopyBinaryHeaders(CopyOutState headerOutputState)
 	MemoryContext oldContext = MemoryContextSwitchTo(headerOutputState->rowcontext);
 
 	/* Signature */
-	CopySendData(headerOutputState, BinarySignature, 11);
+	CopySendData(headerOutputState, BinaryCopySignature, BINARY_SIGNATURE_LENGTH);
 
 	/* Flags field (no OIDs) */
 	CopySendInt32(headerOutputState, zero);
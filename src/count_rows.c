@@ -0,0 +1,211 @@
+/*-------------------------------------------------------------------------
+ *
+ * count_rows.c
+ *     Implementation the blob_storage_count_rows UDF
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/compression.h"
+#include "pgazure/row_counter.h"
+#include "pgazure/set_returning_functions.h"
+#include "pgazure/storage_account.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+
+
+/* number of bytes that are counted at a time */
+#define COUNT_ROWS_BUFFER_SIZE (1024 * 1024)
+
+#define COUNT_RESULT_RANGE_START_INDEX 0
+#define COUNT_RESULT_RANGE_END_INDEX 1
+#define COUNT_RESULT_ROW_COUNT_INDEX 2
+#define COUNT_RESULT_MIN_ROW_LENGTH_INDEX 3
+#define COUNT_RESULT_MAX_ROW_LENGTH_INDEX 4
+#define COUNT_RESULT_AVG_ROW_LENGTH_INDEX 5
+#define COUNT_RESULT_COLUMN_COUNT 6
+
+
+static RowCounterMode RowCounterModeFromDecoder(char *decoderString);
+
+
+PG_FUNCTION_INFO_V1(blob_storage_count_rows);
+
+
+/*
+ * blob_storage_count_rows counts the rows in a blob without decoding them,
+ * and returns the number of rows and their lengths per range of at least
+ * range_size decompressed bytes, or for the whole blob if range_size is NULL.
+ *
+ * Ranges start and end at row boundaries, so for uncompressed blobs they
+ * can be read separately. If parallelism is larger than 1, that many ranges
+ * of the blob are downloaded concurrently.
+ */
+Datum
+blob_storage_count_rows(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errmsg("connection_string argument is required")));
+	}
+	if (PG_ARGISNULL(1))
+	{
+		ereport(ERROR, (errmsg("container_name argument is required")));
+	}
+	if (PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errmsg("path argument is required")));
+	}
+	if (PG_ARGISNULL(3))
+	{
+		ereport(ERROR, (errmsg("decoder argument is required")));
+	}
+	if (PG_ARGISNULL(4))
+	{
+		ereport(ERROR, (errmsg("compression argument is required")));
+	}
+
+	char *accountString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *containerName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *path = text_to_cstring(PG_GETARG_TEXT_P(2));
+	char *decoderString = text_to_cstring(PG_GETARG_TEXT_P(3));
+	char *compressionString = text_to_cstring(PG_GETARG_TEXT_P(4));
+	int64 rangeSize = PG_ARGISNULL(5) ? 0 : PG_GETARG_INT64(5);
+	int parallelism = PG_ARGISNULL(6) ? 1 : PG_GETARG_INT32(6);
+
+	if (!PG_ARGISNULL(5) && rangeSize <= 0)
+	{
+		ereport(ERROR, (errmsg("range_size must be positive")));
+	}
+
+	if (parallelism < 1)
+	{
+		ereport(ERROR, (errmsg("parallelism must be at least 1")));
+	}
+
+	if (strcmp(decoderString, "auto") == 0)
+	{
+		/* csv and tsv blobs are recognized by their suffix, like in get_blob */
+		decoderString = CodecStringFromFileName(path);
+	}
+
+	char *connectionString = AccountStringToConnectionString(accountString);
+
+	if (strcmp(compressionString, "auto") == 0)
+	{
+		compressionString = CompressionStringForBlob(connectionString, containerName,
+		                                             path);
+	}
+
+	RowCounterMode counterMode = RowCounterModeFromDecoder(decoderString);
+
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	ByteSource *byteSource = palloc0(sizeof(ByteSource));
+
+	if (parallelism > 1)
+	{
+		size_t blobSize = GetBlobSize(connectionString, containerName, path);
+
+		ReadBlockBlobParallel(connectionString, containerName, path, blobSize,
+		                      parallelism, byteSource);
+	}
+	else
+	{
+		ReadBlockBlob(connectionString, containerName, path, byteSource);
+	}
+
+	byteSource = BuildBlobDecompressor(compressionString, byteSource, connectionString,
+	                                   containerName, path);
+
+	RowCounter *counter = CreateRowCounter(counterMode, rangeSize);
+	char *buffer = palloc(COUNT_ROWS_BUFFER_SIZE);
+	int bytesRead = 0;
+
+	while ((bytesRead = byteSource->read(byteSource->context, buffer, 1,
+	                                     COUNT_ROWS_BUFFER_SIZE)) > 0)
+	{
+		RowCounterAddBytes(counter, buffer, bytesRead);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	byteSource->close(byteSource->context);
+
+	List *rangeList = RowCounterFinish(counter);
+	ListCell *rangeCell = NULL;
+
+	foreach(rangeCell, rangeList)
+	{
+		RowCountRange *range = (RowCountRange *) lfirst(rangeCell);
+		Datum columnValues[COUNT_RESULT_COLUMN_COUNT];
+		bool columnNulls[COUNT_RESULT_COLUMN_COUNT];
+
+		memset(columnNulls, false, sizeof(columnNulls));
+
+		columnValues[COUNT_RESULT_RANGE_START_INDEX] = Int64GetDatum(range->startOffset);
+		columnValues[COUNT_RESULT_RANGE_END_INDEX] = Int64GetDatum(range->endOffset);
+		columnValues[COUNT_RESULT_ROW_COUNT_INDEX] = Int64GetDatum(range->rowCount);
+		columnValues[COUNT_RESULT_MIN_ROW_LENGTH_INDEX] =
+			Int64GetDatum(range->minRowLength);
+		columnValues[COUNT_RESULT_MAX_ROW_LENGTH_INDEX] =
+			Int64GetDatum(range->maxRowLength);
+
+		if (range->rowCount > 0)
+		{
+			double averageRowLength =
+				(double) (range->endOffset - range->startOffset) / range->rowCount;
+
+			columnValues[COUNT_RESULT_AVG_ROW_LENGTH_INDEX] =
+				Float8GetDatum(averageRowLength);
+		}
+		else
+		{
+			columnNulls[COUNT_RESULT_MIN_ROW_LENGTH_INDEX] = true;
+			columnNulls[COUNT_RESULT_MAX_ROW_LENGTH_INDEX] = true;
+			columnNulls[COUNT_RESULT_AVG_ROW_LENGTH_INDEX] = true;
+		}
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, columnValues, columnNulls);
+	}
+
+	PG_RETURN_DATUM(0);
+}
+
+
+/*
+ * RowCounterModeFromDecoder returns how rows are delimited in the format of
+ * the given decoder.
+ */
+static RowCounterMode
+RowCounterModeFromDecoder(char *decoderString)
+{
+	if (strcmp(decoderString, "csv") == 0)
+	{
+		return ROW_COUNTER_CSV;
+	}
+	else if (strcmp(decoderString, "tsv") == 0)
+	{
+		return ROW_COUNTER_LINES;
+	}
+	else if (strcmp(decoderString, "json") == 0 ||
+	         strcmp(decoderString, "xml") == 0 ||
+	         strcmp(decoderString, "text") == 0)
+	{
+		return ROW_COUNTER_WHOLE;
+	}
+	else
+	{
+		ereport(ERROR, (errmsg("cannot count rows for decoder: %s", decoderString)));
+	}
+}
@@ -23,5 +23,6 @@ IsQueryCancelPending(void)
 void
 ThrowPostgresError(const char *message)
 {
-	ereport(ERROR, (errmsg("%s", message)));
+	ereport(ERROR, (errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
+	                errmsg("%s", message)));
 }
@@ -17,6 +17,7 @@
 #include "pgazure/codecs.h"
 #include "pgazure/compression.h"
 #include "pgazure/copy_format_decoder.h"
+#include "pgazure/get_blob.h"
 #include "pgazure/set_returning_functions.h"
 #include "pgazure/storage_account.h"
 #include "pgazure/zlib_compression.h"
@@ -143,6 +144,27 @@ static void
 ReadBlockBlobIntoTuplestore(char *connectionString, char *containerName, char *path,
                             char *decoderString, char *compressionString,
                             Tuplestorestate *tupleStore, TupleDesc tupleDescriptor)
+{
+	TupleDecoder *decoder = BuildBlobTupleDecoder(connectionString, containerName, path,
+	                                              decoderString, compressionString,
+	                                              tupleDescriptor, NULL, NULL);
+
+	DecodeTuplesIntoTupleStore(decoder, tupleStore);
+}
+
+
+/*
+ * BuildBlobTupleDecoder opens a block blob in blob storage and builds a tuple
+ * decoder that reads from it, after resolving "auto" decoder and compression
+ * strings based on the path.
+ *
+ * projectedColumns and filter are passed to BuildTupleDecoder.
+ */
+TupleDecoder *
+BuildBlobTupleDecoder(char *connectionString, char *containerName, char *path,
+                      char *decoderString, char *compressionString,
+                      TupleDesc tupleDescriptor, bool *projectedColumns,
+                      TupleDecoderFilter *filter)
 {
 	ByteSource *byteSource = palloc0(sizeof(ByteSource));
 
@@ -150,18 +172,12 @@ ReadBlockBlobIntoTuplestore(char *connectionString, char *containerName, char *p
 
 	if (strcmp(compressionString, "auto") == 0)
 	{
-		/* TODO: look at the content-type / content-encoding */
-		if (HasSuffix(path, ".gz"))
-		{
-			compressionString = "gzip";
-		}
-		else
-		{
-			compressionString = "none";
-		}
+		compressionString = CompressionStringForBlob(connectionString, containerName,
+		                                             path);
 	}
 
-	byteSource = BuildDecompressor(compressionString, byteSource);
+	byteSource = BuildBlobDecompressor(compressionString, byteSource, connectionString,
+	                                   containerName, path);
 
 	if (strcmp(decoderString, "auto") == 0)
 	{
@@ -169,12 +185,8 @@ ReadBlockBlobIntoTuplestore(char *connectionString, char *containerName, char *p
 		decoderString = CodecStringFromFileName(path);
 	}
 
-	TupleDecoder *decoder = BuildTupleDecoder(decoderString, tupleDescriptor,
-											  byteSource);
-
-	DecodeTuplesIntoTupleStore(decoder, tupleStore);
-
-	pfree(byteSource);
+	return BuildTupleDecoder(decoderString, tupleDescriptor, byteSource,
+	                         projectedColumns, filter);
 }
 
 
@@ -186,15 +198,19 @@ static void
 DecodeTuplesIntoTupleStore(TupleDecoder *decoder, Tuplestorestate *tupleStore)
 {
 	TupleDesc tupleDescriptor = decoder->tupleDescriptor;
-	int columnCount = tupleDescriptor->natts;
-	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
-	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	TupleBatch *batch = CreateTupleBatch(tupleDescriptor, TUPLE_BATCH_SIZE);
+	Datum *columnValues = batch->rowValues;
+	bool *columnNulls = batch->rowNulls;
 
 	decoder->start(decoder->state);
 
-	while (decoder->next(decoder->state, columnValues, columnNulls))
+	while (TupleDecoderNextBatch(decoder, batch))
 	{
-		tuplestore_putvalues(tupleStore, tupleDescriptor, columnValues, columnNulls);
+		for (int rowIndex = 0; rowIndex < batch->rowCount; rowIndex++)
+		{
+			TupleBatchGetRow(batch, rowIndex, columnValues, columnNulls);
+			tuplestore_putvalues(tupleStore, tupleDescriptor, columnValues, columnNulls);
+		}
 
 		CHECK_FOR_INTERRUPTS();
 	}
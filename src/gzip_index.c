@@ -0,0 +1,617 @@
+/*-------------------------------------------------------------------------
+ *
+ * gzip_index.c
+ *     Checkpoint index sidecars for random access into gzip blobs.
+ *
+ * A gzip blob can normally only be decompressed from the start. The index
+ * is built by decompressing the blob once and recording checkpoints at the
+ * start of a deflate block roughly every span_size decompressed bytes, in
+ * the style of zlib's zran example. A checkpoint consists of the bit offset
+ * of the block in the blob, the number of decompressed bytes before it, and
+ * the last 32kB of decompressed data, which deflate can refer back to.
+ * Decompression can start at any checkpoint by priming a raw inflate stream
+ * with the bits of the partial first byte and setting the window as its
+ * dictionary.
+ *
+ * The index is stored in a blob named <path>.pgazure_gzindex next to the
+ * blob, which also records the size of the blob such that an index that
+ * belongs to an older version of the blob is ignored. It is used to sample
+ * gzip blobs through ranged reads, and to decompress them on several
+ * threads when azure.gzip_decompression_workers is set.
+ *
+ * The sidecar consists of integers in network byte order:
+ *
+ *   "PGAZGZI1" <compressed size:8> <uncompressed size:8> <point count:4>
+ *   <compressed offset:8> <uncompressed offset:8> <bits:1> <window length:4>
+ *   <window>
+ *   ...
+ *
+ * where the window is compressed with zlib.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/gzip_index.h"
+#include "pgazure/storage_account.h"
+#include "utils/builtins.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+
+/* magic bytes at the start of the sidecar */
+#define GZIP_INDEX_MAGIC "PGAZGZI1"
+#define GZIP_INDEX_MAGIC_LENGTH 8
+
+/* size of the sidecar header and of a checkpoint without its window */
+#define GZIP_INDEX_HEADER_SIZE (GZIP_INDEX_MAGIC_LENGTH + 8 + 8 + 4)
+#define GZIP_INDEX_POINT_SIZE (8 + 8 + 1 + 4)
+
+/* smallest number of decompressed bytes between checkpoints */
+#define GZIP_INDEX_MIN_SPAN_SIZE (64 * 1024)
+
+/* number of compressed bytes that are read at a time */
+#define GZIP_INDEX_READ_SIZE (1024 * 1024)
+
+/* makes inflate detect the gzip header */
+#define GZIP_DECODING 32
+
+/* size of the trailer with the CRC and length at the end of a gzip member */
+#define GZIP_TRAILER_SIZE 8
+
+
+PG_FUNCTION_INFO_V1(blob_storage_build_gzip_index);
+
+
+#ifdef HAVE_LIBZ
+static GzipIndex * BuildGzipIndex(ByteSource *byteSource, uint64 spanSize);
+static void AddGzipIndexPoint(GzipIndex *index, int *maxPointCount, int bits,
+                              uint64 compressedOffset, uint64 uncompressedOffset,
+                              unsigned char *window, int windowEnd);
+static void WriteGzipIndex(GzipIndex *index, char *connectionString,
+                           char *containerName, char *path);
+static GzipIndex * ParseGzipIndex(StringInfo data);
+static int FindGzipIndexPoint(GzipIndex *index, uint64 offset);
+#endif
+
+
+/*
+ * blob_storage_build_gzip_index decompresses a gzip blob once, and writes an
+ * index sidecar with a checkpoint every span_size decompressed bytes. It
+ * returns the number of checkpoints.
+ */
+Datum
+blob_storage_build_gzip_index(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errmsg("connection_string argument is required")));
+	}
+	if (PG_ARGISNULL(1))
+	{
+		ereport(ERROR, (errmsg("container_name argument is required")));
+	}
+	if (PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errmsg("path argument is required")));
+	}
+	if (PG_ARGISNULL(3))
+	{
+		ereport(ERROR, (errmsg("span_size argument is required")));
+	}
+
+#ifdef HAVE_LIBZ
+	char *accountString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *containerName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *path = text_to_cstring(PG_GETARG_TEXT_P(2));
+	int64 spanSize = PG_GETARG_INT64(3);
+
+	if (spanSize < GZIP_INDEX_MIN_SPAN_SIZE)
+	{
+		ereport(ERROR, (errmsg("span_size must be at least %d",
+		                       GZIP_INDEX_MIN_SPAN_SIZE)));
+	}
+
+	char *connectionString = AccountStringToConnectionString(accountString);
+	ByteSource *byteSource = palloc0(sizeof(ByteSource));
+
+	ReadBlockBlob(connectionString, containerName, path, byteSource);
+
+	GzipIndex *index = BuildGzipIndex(byteSource, (uint64) spanSize);
+
+	byteSource->close(byteSource->context);
+
+	WriteGzipIndex(index, connectionString, containerName, path);
+
+	PG_RETURN_INT64(index->pointCount);
+#else
+	ereport(ERROR, (errmsg("gzip compression requires postgres to be built with zlib")));
+#endif
+}
+
+
+/*
+ * IsGzipIndexPath returns whether a blob is a gzip index sidecar.
+ */
+bool
+IsGzipIndexPath(const char *path)
+{
+	return HasSuffix(path, GZIP_INDEX_SUFFIX);
+}
+
+
+#ifdef HAVE_LIBZ
+
+/*
+ * BuildGzipIndex decompresses the gzip stream from byteSource and returns an
+ * index with a checkpoint at the start of the first deflate block, and at
+ * the first block that starts at least spanSize bytes after the previous
+ * checkpoint. Streams with several members get checkpoints in all of them.
+ */
+static GzipIndex *
+BuildGzipIndex(ByteSource *byteSource, uint64 spanSize)
+{
+	GzipIndex *index = palloc0(sizeof(GzipIndex));
+	int maxPointCount = 16;
+	unsigned char *input = palloc(GZIP_INDEX_READ_SIZE);
+	unsigned char *window = palloc(GZIP_INDEX_WINDOW_SIZE);
+	uint64 compressedOffset = 0;
+	uint64 uncompressedOffset = 0;
+	uint64 lastPointOffset = 0;
+	bool memberOpen = false;
+	z_stream stream;
+
+	index->points = palloc0(maxPointCount * sizeof(GzipIndexPoint));
+
+	memset(&stream, 0, sizeof(stream));
+
+	if (inflateInit2(&stream, MAX_WBITS | GZIP_DECODING) != Z_OK)
+	{
+		ereport(ERROR, (errmsg("could not initialize compression library: %s",
+		                       stream.msg)));
+	}
+
+	/* the window is used as a circular output buffer */
+	stream.avail_out = 0;
+
+	while (true)
+	{
+		if (stream.avail_in == 0)
+		{
+			int bytesRead = byteSource->read(byteSource->context, input, 1,
+			                                 GZIP_INDEX_READ_SIZE);
+			if (bytesRead == 0)
+			{
+				break;
+			}
+
+			stream.next_in = input;
+			stream.avail_in = bytesRead;
+		}
+
+		if (stream.avail_out == 0)
+		{
+			stream.next_out = window;
+			stream.avail_out = GZIP_INDEX_WINDOW_SIZE;
+		}
+
+		/* stop at the end of every deflate block */
+		compressedOffset += stream.avail_in;
+		uncompressedOffset += stream.avail_out;
+
+		int resultCode = inflate(&stream, Z_BLOCK);
+
+		compressedOffset -= stream.avail_in;
+		uncompressedOffset -= stream.avail_out;
+
+		if (resultCode == Z_STREAM_END)
+		{
+			/* the stream may continue with another member */
+			memberOpen = false;
+			inflateReset(&stream);
+			continue;
+		}
+		else if (resultCode != Z_OK)
+		{
+			ereport(ERROR, (errmsg("could not uncompress data: %s", stream.msg)));
+		}
+
+		memberOpen = true;
+
+		/* bit 128 marks the start of a block, and bit 64 the last block */
+		if ((stream.data_type & 128) && !(stream.data_type & 64) &&
+		    (index->pointCount == 0 || uncompressedOffset - lastPointOffset >= spanSize))
+		{
+			AddGzipIndexPoint(index, &maxPointCount, stream.data_type & 7,
+			                  compressedOffset, uncompressedOffset, window,
+			                  GZIP_INDEX_WINDOW_SIZE - stream.avail_out);
+			lastPointOffset = uncompressedOffset;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	inflateEnd(&stream);
+
+	if (memberOpen)
+	{
+		ereport(ERROR, (errmsg("could not uncompress data: unexpected end of gzip data")));
+	}
+
+	index->compressedSize = compressedOffset;
+	index->uncompressedSize = uncompressedOffset;
+
+	pfree(input);
+	pfree(window);
+
+	return index;
+}
+
+
+/*
+ * AddGzipIndexPoint adds a checkpoint to the index, with the decompressed
+ * bytes before it in the circular window buffer, which ends at windowEnd.
+ */
+static void
+AddGzipIndexPoint(GzipIndex *index, int *maxPointCount, int bits,
+                  uint64 compressedOffset, uint64 uncompressedOffset,
+                  unsigned char *window, int windowEnd)
+{
+	unsigned char linearWindow[GZIP_INDEX_WINDOW_SIZE];
+	int windowLength = (int) Min(uncompressedOffset, GZIP_INDEX_WINDOW_SIZE);
+
+	if (index->pointCount == *maxPointCount)
+	{
+		*maxPointCount *= 2;
+		index->points = repalloc(index->points, *maxPointCount * sizeof(GzipIndexPoint));
+	}
+
+	/* put the window in order, oldest byte first */
+	memcpy(linearWindow, window + windowEnd, GZIP_INDEX_WINDOW_SIZE - windowEnd);
+	memcpy(linearWindow + GZIP_INDEX_WINDOW_SIZE - windowEnd, window, windowEnd);
+
+	GzipIndexPoint *point = &index->points[index->pointCount];
+	point->compressedOffset = compressedOffset;
+	point->bits = bits;
+	point->uncompressedOffset = uncompressedOffset;
+
+	uLongf compressedLength = compressBound(windowLength);
+	point->window = palloc(compressedLength);
+
+	if (compress((Bytef *) point->window, &compressedLength,
+	             linearWindow + GZIP_INDEX_WINDOW_SIZE - windowLength,
+	             windowLength) != Z_OK)
+	{
+		ereport(ERROR, (errmsg("could not compress gzip index window")));
+	}
+
+	point->windowLength = (int) compressedLength;
+
+	index->pointCount++;
+}
+
+
+/*
+ * WriteGzipIndex writes an index to the sidecar of a blob.
+ */
+static void
+WriteGzipIndex(GzipIndex *index, char *connectionString, char *containerName,
+               char *path)
+{
+	StringInfoData buffer;
+
+	initStringInfo(&buffer);
+	appendBinaryStringInfo(&buffer, GZIP_INDEX_MAGIC, GZIP_INDEX_MAGIC_LENGTH);
+	pq_sendint64(&buffer, index->compressedSize);
+	pq_sendint64(&buffer, index->uncompressedSize);
+	pq_sendint32(&buffer, index->pointCount);
+
+	for (int pointIndex = 0; pointIndex < index->pointCount; pointIndex++)
+	{
+		GzipIndexPoint *point = &index->points[pointIndex];
+
+		pq_sendint64(&buffer, point->compressedOffset);
+		pq_sendint64(&buffer, point->uncompressedOffset);
+		pq_sendbyte(&buffer, point->bits);
+		pq_sendint32(&buffer, point->windowLength);
+		pq_sendbytes(&buffer, point->window, point->windowLength);
+	}
+
+	char *indexPath = psprintf("%s%s", path, GZIP_INDEX_SUFFIX);
+	ByteSink *byteSink = palloc0(sizeof(ByteSink));
+
+	WriteBlockBlob(connectionString, containerName, indexPath, byteSink);
+	byteSink->write(byteSink->context, buffer.data, buffer.len);
+	byteSink->close(byteSink->context);
+}
+
+#endif
+
+
+/*
+ * ReadGzipIndex reads the index sidecar of a gzip blob. blobSize is the size
+ * of the blob if it is known, or -1. Returns NULL if there is no sidecar, or
+ * if it belongs to a different version of the blob.
+ */
+GzipIndex *
+ReadGzipIndex(char *connectionString, char *containerName, char *path, int64 blobSize)
+{
+#ifdef HAVE_LIBZ
+	char *indexPath = psprintf("%s%s", path, GZIP_INDEX_SUFFIX);
+	size_t indexSize = 0;
+
+	if (!GetBlobSizeIfExists(connectionString, containerName, indexPath, &indexSize))
+	{
+		return NULL;
+	}
+
+	if (blobSize < 0)
+	{
+		blobSize = (int64) GetBlobSize(connectionString, containerName, path);
+	}
+
+	StringInfo data = ReadBlobContents(connectionString, containerName, indexPath);
+	GzipIndex *index = ParseGzipIndex(data);
+
+	if (index == NULL || index->compressedSize != (uint64) blobSize)
+	{
+		ereport(DEBUG1, (errmsg("ignoring gzip index of blob \"%s\"", path),
+		                 errdetail("The sidecar is malformed or outdated.")));
+		return NULL;
+	}
+
+	return index;
+#else
+	return NULL;
+#endif
+}
+
+
+#ifdef HAVE_LIBZ
+
+/*
+ * ParseGzipIndex parses the contents of a sidecar, or returns NULL if it is
+ * malformed.
+ */
+static GzipIndex *
+ParseGzipIndex(StringInfo data)
+{
+	if (data->len < GZIP_INDEX_HEADER_SIZE ||
+	    memcmp(data->data, GZIP_INDEX_MAGIC, GZIP_INDEX_MAGIC_LENGTH) != 0)
+	{
+		return NULL;
+	}
+
+	GzipIndex *index = palloc0(sizeof(GzipIndex));
+
+	data->cursor = GZIP_INDEX_MAGIC_LENGTH;
+	index->compressedSize = (uint64) pq_getmsgint64(data);
+	index->uncompressedSize = (uint64) pq_getmsgint64(data);
+	index->pointCount = pq_getmsgint(data, 4);
+
+	if (index->pointCount <= 0 ||
+	    index->pointCount > (data->len - data->cursor) / GZIP_INDEX_POINT_SIZE)
+	{
+		return NULL;
+	}
+
+	index->points = palloc0(index->pointCount * sizeof(GzipIndexPoint));
+
+	for (int pointIndex = 0; pointIndex < index->pointCount; pointIndex++)
+	{
+		GzipIndexPoint *point = &index->points[pointIndex];
+
+		if (data->len - data->cursor < GZIP_INDEX_POINT_SIZE)
+		{
+			return NULL;
+		}
+
+		point->compressedOffset = (uint64) pq_getmsgint64(data);
+		point->uncompressedOffset = (uint64) pq_getmsgint64(data);
+		point->bits = pq_getmsgbyte(data);
+		point->windowLength = pq_getmsgint(data, 4);
+
+		if (point->bits > 7 || point->windowLength < 0 ||
+		    point->windowLength > data->len - data->cursor ||
+		    point->compressedOffset > index->compressedSize ||
+		    (point->bits > 0 && point->compressedOffset == 0) ||
+		    (pointIndex > 0 &&
+		     point->uncompressedOffset <= index->points[pointIndex - 1].uncompressedOffset))
+		{
+			return NULL;
+		}
+
+		point->window = (char *) pq_getmsgbytes(data, point->windowLength);
+	}
+
+	return index;
+}
+
+
+/*
+ * FindGzipIndexPoint returns the last checkpoint at or before a decompressed
+ * offset.
+ */
+static int
+FindGzipIndexPoint(GzipIndex *index, uint64 offset)
+{
+	int low = 0;
+	int high = index->pointCount - 1;
+
+	while (low < high)
+	{
+		int middle = low + (high - low + 1) / 2;
+
+		if (index->points[middle].uncompressedOffset <= offset)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return low;
+}
+
+#endif
+
+
+/*
+ * ReadGzipIndexedRange reads up to length decompressed bytes at a decompressed
+ * offset of a gzip blob into buffer, by reading the blob from the last
+ * checkpoint before the offset. It returns the number of bytes read, which
+ * is less than length only at the end of the blob.
+ */
+int
+ReadGzipIndexedRange(char *connectionString, char *containerName, char *path,
+                     GzipIndex *index, uint64 offset, char *buffer, int length)
+{
+#ifdef HAVE_LIBZ
+	GzipIndexPoint *point = &index->points[FindGzipIndexPoint(index, offset)];
+	uint64 readOffset = point->compressedOffset - (point->bits > 0 ? 1 : 0);
+	uint64 bytesToSkip = offset - point->uncompressedOffset;
+	char *input = palloc(GZIP_INDEX_READ_SIZE);
+	char *window = palloc(GZIP_INDEX_WINDOW_SIZE);
+	uLongf windowLength = GZIP_INDEX_WINDOW_SIZE;
+	bool rawDeflate = true;
+	int trailerBytesToSkip = 0;
+	int bytesRead = 0;
+	z_stream stream;
+
+	if (uncompress((Bytef *) window, &windowLength, (Bytef *) point->window,
+	               point->windowLength) != Z_OK)
+	{
+		ereport(ERROR, (errmsg("could not uncompress gzip index window of blob \"%s\"",
+		                       path)));
+	}
+
+	memset(&stream, 0, sizeof(stream));
+
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+	{
+		ereport(ERROR, (errmsg("could not initialize compression library: %s",
+		                       stream.msg)));
+	}
+
+	while (bytesRead < length)
+	{
+		if (stream.avail_in == 0)
+		{
+			if (readOffset >= index->compressedSize)
+			{
+				break;
+			}
+
+			int readLength = (int) Min(index->compressedSize - readOffset,
+			                           GZIP_INDEX_READ_SIZE);
+
+			readLength = ReadBlockBlobRange(connectionString, containerName, path,
+			                                readOffset, input, readLength);
+			if (readLength == 0)
+			{
+				break;
+			}
+
+			stream.next_in = (Bytef *) input;
+			stream.avail_in = readLength;
+
+			if (readOffset < point->compressedOffset)
+			{
+				/* the block starts with the last bits of the first byte */
+				int firstByte = (unsigned char) input[0];
+
+				inflatePrime(&stream, point->bits, firstByte >> (8 - point->bits));
+				stream.next_in++;
+				stream.avail_in--;
+			}
+
+			if (readOffset <= point->compressedOffset && windowLength > 0)
+			{
+				inflateSetDictionary(&stream, (Bytef *) window, windowLength);
+			}
+
+			readOffset += readLength;
+
+			CHECK_FOR_INTERRUPTS();
+			continue;
+		}
+
+		if (trailerBytesToSkip > 0)
+		{
+			int skippedBytes = Min(trailerBytesToSkip, (int) stream.avail_in);
+
+			stream.next_in += skippedBytes;
+			stream.avail_in -= skippedBytes;
+			trailerBytesToSkip -= skippedBytes;
+			continue;
+		}
+
+		if (bytesToSkip > 0)
+		{
+			/* decompress the bytes before the offset into the window buffer */
+			stream.next_out = (Bytef *) window;
+			stream.avail_out = (uInt) Min(bytesToSkip, GZIP_INDEX_WINDOW_SIZE);
+		}
+		else
+		{
+			stream.next_out = (Bytef *) buffer + bytesRead;
+			stream.avail_out = length - bytesRead;
+		}
+
+		uInt outputSize = stream.avail_out;
+		int resultCode = inflate(&stream, Z_NO_FLUSH);
+		uInt bytesProduced = outputSize - stream.avail_out;
+
+		if (bytesToSkip > 0)
+		{
+			bytesToSkip -= bytesProduced;
+		}
+		else
+		{
+			bytesRead += bytesProduced;
+		}
+
+		if (resultCode == Z_STREAM_END)
+		{
+			if (rawDeflate)
+			{
+				/* skip the trailer of the member, and continue with gzip headers */
+				trailerBytesToSkip = GZIP_TRAILER_SIZE;
+				rawDeflate = false;
+				inflateReset2(&stream, MAX_WBITS | GZIP_DECODING);
+			}
+			else
+			{
+				inflateReset(&stream);
+			}
+		}
+		else if (resultCode != Z_OK)
+		{
+			ereport(ERROR, (errmsg("could not uncompress data: %s", stream.msg)));
+		}
+	}
+
+	inflateEnd(&stream);
+
+	pfree(input);
+	pfree(window);
+
+	return bytesRead;
+#else
+	ereport(ERROR, (errmsg("gzip compression requires postgres to be built with zlib")));
+#endif
+}
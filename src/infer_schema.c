@@ -0,0 +1,1094 @@
+/*-------------------------------------------------------------------------
+ *
+ * infer_schema.c
+ *     Implementation the blob_storage_infer_schema UDF
+ *
+ * The schema of a csv or tsv blob is inferred from the first few MB, which
+ * are fetched with a single range read and decompressed in memory. Fields
+ * are split without converting them, and each column gets the narrowest
+ * type that all of its non-NULL values in the sample can be read as.
+ *
+ * Values are classified with cheap syntax checks rather than by calling the
+ * type input functions, such that a value that does not fit does not need
+ * a subtransaction. The checks are a bit stricter than the input functions,
+ * which means we sometimes infer a wider type than needed, but never one
+ * that fails on a value in the sample.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+#include <limits.h>
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "catalog/namespace.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/codecs.h"
+#include "pgazure/compression.h"
+#include "pgazure/set_returning_functions.h"
+#include "pgazure/storage_account.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+#include "utils/varlena.h"
+
+
+/* maximum number of decompressed bytes we look at */
+#define MAX_INFER_SAMPLE_SIZE (64 * 1024 * 1024)
+
+/* number of lines that are used to pick the delimiter */
+#define SNIFF_LINE_COUNT 64
+
+#define INFER_RESULT_COLUMN_NUMBER_INDEX 0
+#define INFER_RESULT_COLUMN_NAME_INDEX 1
+#define INFER_RESULT_DATA_TYPE_INDEX 2
+#define INFER_RESULT_COLUMN_COUNT 3
+
+
+/*
+ * InferredType is a type that can be inferred for a column, ordered from
+ * narrowest to widest.
+ */
+typedef enum InferredType
+{
+	INFERRED_BOOLEAN,
+	INFERRED_INTEGER,
+	INFERRED_BIGINT,
+	INFERRED_NUMERIC,
+	INFERRED_DATE,
+	INFERRED_TIMESTAMP,
+	INFERRED_TIMESTAMPTZ,
+	INFERRED_UUID,
+	INFERRED_TEXT
+} InferredType;
+
+#define INFERRED_TYPE_BIT(type) (1U << (type))
+#define ALL_INFERRED_TYPES (INFERRED_TYPE_BIT(INFERRED_TEXT + 1) - 1)
+
+static const char *InferredTypeNames[] = {
+	"boolean",
+	"integer",
+	"bigint",
+	"numeric",
+	"date",
+	"timestamp without time zone",
+	"timestamp with time zone",
+	"uuid",
+	"text"
+};
+
+/*
+ * SampleParser splits the rows in a sample of a csv or tsv blob into fields.
+ */
+typedef struct SampleParser
+{
+	char *data;
+	int length;
+	int position;
+	char delimiter;
+	bool isCsv;
+
+	/* whether the sample contains the end of the blob */
+	bool isComplete;
+} SampleParser;
+
+/*
+ * InferredColumn contains the state of inferring the type of a column.
+ */
+typedef struct InferredColumn
+{
+	char *name;
+
+	/* bitmask of the types that all values seen so far fit in */
+	uint32 candidateTypes;
+	int64 valueCount;
+} InferredColumn;
+
+
+static char * ReadBlobHead(char *connectionString, char *containerName, char *path,
+                           char *compressionString, int sampleSize, int *length,
+                           bool *isComplete);
+static char * SniffDecoder(char *data, int length);
+static List * ParseSampleRows(SampleParser *parser);
+static bool ParseRow(SampleParser *parser, List **fieldList);
+static uint32 ValueTypes(char *value);
+static bool IsInteger(char *value, bool *fitsInt32, bool *fitsInt64);
+static bool IsNumeric(char *value);
+static int ParseDate(char *value);
+static int ParseTime(char *value);
+static bool IsTimeZone(char *value);
+static bool IsUuid(char *value);
+static int ParseDigits(char *value, int count, int *number);
+static InferredType ColumnType(InferredColumn *column);
+static bool HasHeaderRow(List *rowList, InferredColumn *columns, int columnCount);
+static void SetColumnNames(InferredColumn *columns, int columnCount, List *headerRow);
+static void CreateCompositeType(char *typeName, InferredColumn *columns,
+                                int columnCount);
+
+
+PG_FUNCTION_INFO_V1(blob_storage_infer_schema);
+
+
+/*
+ * blob_storage_infer_schema infers a column definition list for a csv or
+ * tsv blob from the first sample_size bytes and returns it as a row per
+ * column. If header is NULL, we guess whether the first row is a header
+ * from whether its values fit the types of the other rows. If type_name is
+ * not NULL, a composite type with the inferred columns is created as well.
+ */
+Datum
+blob_storage_infer_schema(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errmsg("connection_string argument is required")));
+	}
+	if (PG_ARGISNULL(1))
+	{
+		ereport(ERROR, (errmsg("container_name argument is required")));
+	}
+	if (PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errmsg("path argument is required")));
+	}
+	if (PG_ARGISNULL(3))
+	{
+		ereport(ERROR, (errmsg("decoder argument is required")));
+	}
+	if (PG_ARGISNULL(4))
+	{
+		ereport(ERROR, (errmsg("compression argument is required")));
+	}
+	if (PG_ARGISNULL(7))
+	{
+		ereport(ERROR, (errmsg("sample_size argument is required")));
+	}
+
+	char *accountString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *containerName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *path = text_to_cstring(PG_GETARG_TEXT_P(2));
+	char *decoderString = text_to_cstring(PG_GETARG_TEXT_P(3));
+	char *compressionString = text_to_cstring(PG_GETARG_TEXT_P(4));
+	char *typeName = PG_ARGISNULL(6) ? NULL : text_to_cstring(PG_GETARG_TEXT_P(6));
+	int sampleSize = PG_GETARG_INT32(7);
+	bool sniffDecoder = false;
+
+	if (sampleSize < 1)
+	{
+		ereport(ERROR, (errmsg("sample_size must be positive")));
+	}
+
+	if (strcmp(decoderString, "auto") == 0)
+	{
+		decoderString = CodecStringFromFileName(path);
+
+		/* CodecStringFromFileName falls back to csv for unknown suffixes */
+		sniffDecoder = strcmp(decoderString, "csv") == 0 && !HasCodecSuffix(path, ".csv");
+	}
+
+	char *connectionString = AccountStringToConnectionString(accountString);
+
+	if (strcmp(compressionString, "auto") == 0)
+	{
+		compressionString = CompressionStringForBlob(connectionString, containerName,
+		                                             path);
+	}
+
+	/* csv_header and tsv_header default to treating the first row as a header */
+	bool decoderHasHeader = CodecStringHasHeader(decoderString);
+
+	if (decoderHasHeader)
+	{
+		decoderString = strcmp(decoderString, "csv_header") == 0 ? "csv" : "tsv";
+	}
+
+	if (strcmp(decoderString, "csv") != 0 && strcmp(decoderString, "tsv") != 0)
+	{
+		ereport(ERROR, (errmsg("can only infer the schema of csv and tsv blobs")));
+	}
+
+	int length = 0;
+	bool isComplete = false;
+	char *data = ReadBlobHead(connectionString, containerName, path, compressionString,
+	                          sampleSize, &length, &isComplete);
+
+	if (sniffDecoder)
+	{
+		decoderString = SniffDecoder(data, length);
+	}
+
+	SampleParser parser = {
+		.data = data,
+		.length = length,
+		.delimiter = strcmp(decoderString, "csv") == 0 ? ',' : '\t',
+		.isCsv = strcmp(decoderString, "csv") == 0,
+		.isComplete = isComplete
+	};
+	List *rowList = ParseSampleRows(&parser);
+	ListCell *rowCell = NULL;
+	int columnCount = 0;
+
+	if (rowList == NIL)
+	{
+		ereport(ERROR, (errmsg("could not find a complete row in the first %d bytes "
+		                       "of %s", sampleSize, path),
+		                errhint("Increase sample_size.")));
+	}
+
+	foreach(rowCell, rowList)
+	{
+		columnCount = Max(columnCount, list_length((List *) lfirst(rowCell)));
+	}
+
+	if (columnCount > MaxTupleAttributeNumber)
+	{
+		ereport(ERROR, (errmsg("rows in %s have more than %d fields", path,
+		                       MaxTupleAttributeNumber)));
+	}
+
+	InferredColumn *columns = palloc0(columnCount * sizeof(InferredColumn));
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		columns[columnIndex].candidateTypes = ALL_INFERRED_TYPES;
+	}
+
+	/* infer types from all rows but the first, which might be a header */
+	foreach(rowCell, rowList)
+	{
+		List *fieldList = (List *) lfirst(rowCell);
+		ListCell *fieldCell = NULL;
+		int columnIndex = 0;
+
+		if (fieldList == linitial(rowList))
+		{
+			continue;
+		}
+
+		foreach(fieldCell, fieldList)
+		{
+			char *value = (char *) lfirst(fieldCell);
+
+			if (value != NULL)
+			{
+				columns[columnIndex].candidateTypes &= ValueTypes(value);
+				columns[columnIndex].valueCount++;
+			}
+
+			columnIndex++;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	List *headerRow = (List *) linitial(rowList);
+	bool hasHeader = !PG_ARGISNULL(5) ? PG_GETARG_BOOL(5) :
+					 decoderHasHeader ? true :
+					 HasHeaderRow(rowList, columns, columnCount);
+
+	/*
+	 * Tell the caller which decoder reads the blob the way we parsed it, since
+	 * get_blob and the FDW neither sniff the delimiter nor detect a header.
+	 */
+	if (sniffDecoder || hasHeader != decoderHasHeader)
+	{
+		char *resultDecoder = hasHeader ? psprintf("%s_header", decoderString) :
+							  decoderString;
+
+		ereport(NOTICE, (errmsg("using decoder %s for %s", resultDecoder, path),
+		                 errhint("Pass decoder => '%s' when reading the blob.",
+		                         resultDecoder)));
+	}
+
+	if (hasHeader)
+	{
+		SetColumnNames(columns, columnCount, headerRow);
+	}
+	else
+	{
+		ListCell *fieldCell = NULL;
+		int columnIndex = 0;
+
+		foreach(fieldCell, headerRow)
+		{
+			char *value = (char *) lfirst(fieldCell);
+
+			if (value != NULL)
+			{
+				columns[columnIndex].candidateTypes &= ValueTypes(value);
+				columns[columnIndex].valueCount++;
+			}
+
+			columnIndex++;
+		}
+
+		SetColumnNames(columns, columnCount, NIL);
+	}
+
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		InferredColumn *column = &columns[columnIndex];
+		Datum columnValues[INFER_RESULT_COLUMN_COUNT];
+		bool columnNulls[INFER_RESULT_COLUMN_COUNT];
+
+		memset(columnNulls, false, sizeof(columnNulls));
+
+		columnValues[INFER_RESULT_COLUMN_NUMBER_INDEX] = Int32GetDatum(columnIndex + 1);
+		columnValues[INFER_RESULT_COLUMN_NAME_INDEX] = CStringGetTextDatum(column->name);
+		columnValues[INFER_RESULT_DATA_TYPE_INDEX] =
+			CStringGetTextDatum(InferredTypeNames[ColumnType(column)]);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, columnValues, columnNulls);
+	}
+
+	if (typeName != NULL)
+	{
+		CreateCompositeType(typeName, columns, columnCount);
+	}
+
+	PG_RETURN_DATUM(0);
+}
+
+
+/*
+ * ReadBlobHead reads up to sampleSize bytes from the start of a blob using
+ * a single range read and returns them decompressed. isComplete is set to
+ * whether the returned bytes are the whole (decompressed) blob.
+ */
+static char *
+ReadBlobHead(char *connectionString, char *containerName, char *path,
+             char *compressionString, int sampleSize, int *length, bool *isComplete)
+{
+	size_t blobSize = GetBlobSize(connectionString, containerName, path);
+	int sampleLength = (int) Min(blobSize, (size_t) sampleSize);
+	char *sample = palloc(Max(sampleLength, 1));
+
+	if (sampleLength > 0)
+	{
+		sampleLength = ReadBlockBlobRange(connectionString, containerName, path, 0,
+		                                  sample, sampleLength);
+	}
+
+	ByteSource *byteSource = CreateMemoryByteSource(sample, sampleLength);
+	byteSource = BuildBlobDecompressor(compressionString, byteSource, connectionString,
+	                                   containerName, NULL);
+
+	int maxLength = strcmp(compressionString, "none") == 0 ?
+					sampleLength :
+					(int) Min((int64) sampleLength * 16, MAX_INFER_SAMPLE_SIZE);
+	char *data = palloc(maxLength + 1);
+	int dataLength = 0;
+	bool endOfInput = false;
+
+	while (dataLength < maxLength)
+	{
+		int bytesRead = byteSource->read(byteSource->context, data + dataLength, 0,
+		                                 maxLength - dataLength);
+		if (bytesRead == 0)
+		{
+			endOfInput = true;
+			break;
+		}
+
+		dataLength += bytesRead;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (!endOfInput)
+	{
+		char extraByte;
+
+		endOfInput = byteSource->read(byteSource->context, &extraByte, 0, 1) == 0;
+	}
+
+	byteSource->close(byteSource->context);
+
+	data[dataLength] = '\0';
+
+	*length = dataLength;
+	*isComplete = endOfInput && (size_t) sampleLength >= blobSize;
+
+	return data;
+}
+
+
+/*
+ * SniffDecoder picks csv or tsv for a sample depending on whether commas or
+ * tabs appear the same number of times on its first lines.
+ */
+static char *
+SniffDecoder(char *data, int length)
+{
+	int commaCounts[SNIFF_LINE_COUNT];
+	int tabCounts[SNIFF_LINE_COUNT];
+	int lineCount = 0;
+	char *current = data;
+	char *end = data + length;
+
+	while (current < end && lineCount < SNIFF_LINE_COUNT)
+	{
+		char *newline = memchr(current, '\n', end - current);
+		char *lineEnd = newline != NULL ? newline : end;
+
+		commaCounts[lineCount] = 0;
+		tabCounts[lineCount] = 0;
+
+		for (char *byte = current; byte < lineEnd; byte++)
+		{
+			commaCounts[lineCount] += *byte == ',';
+			tabCounts[lineCount] += *byte == '\t';
+		}
+
+		lineCount++;
+
+		if (newline == NULL)
+		{
+			break;
+		}
+
+		current = newline + 1;
+	}
+
+	bool commasConsistent = lineCount > 0 && commaCounts[0] > 0;
+	bool tabsConsistent = lineCount > 0 && tabCounts[0] > 0;
+
+	for (int lineIndex = 1; lineIndex < lineCount; lineIndex++)
+	{
+		commasConsistent &= commaCounts[lineIndex] == commaCounts[0];
+		tabsConsistent &= tabCounts[lineIndex] == tabCounts[0];
+	}
+
+	if (tabsConsistent && (!commasConsistent || tabCounts[0] >= commaCounts[0]))
+	{
+		return "tsv";
+	}
+
+	return "csv";
+}
+
+
+/*
+ * ParseSampleRows splits the sample into rows and returns them as a list of
+ * lists of field values, which are NULL for NULL fields. A final row that
+ * is cut off by the end of the sample is left out.
+ */
+static List *
+ParseSampleRows(SampleParser *parser)
+{
+	List *rowList = NIL;
+	List *fieldList = NIL;
+
+	while (ParseRow(parser, &fieldList))
+	{
+		rowList = lappend(rowList, fieldList);
+	}
+
+	return rowList;
+}
+
+
+/*
+ * ParseRow parses the next row of the sample into fieldList and returns
+ * whether a complete row was found. Fields follow the csv and text formats
+ * of COPY: in csv, unquoted empty fields are NULL and quotes are escaped by
+ * doubling them; in tsv, \N is NULL and backslashes escape characters.
+ */
+static bool
+ParseRow(SampleParser *parser, List **fieldList)
+{
+	char *data = parser->data;
+	int length = parser->length;
+	int position = parser->position;
+	StringInfoData field;
+
+	*fieldList = NIL;
+
+	/* skip empty lines */
+	while (position < length && (data[position] == '\n' || data[position] == '\r'))
+	{
+		position++;
+	}
+
+	if (position >= length)
+	{
+		return false;
+	}
+
+	initStringInfo(&field);
+
+	while (true)
+	{
+		bool isQuoted = false;
+		bool inQuotes = false;
+		bool isEscaped = false;
+
+		resetStringInfo(&field);
+
+		while (position < length)
+		{
+			char byte = data[position];
+
+			if (inQuotes)
+			{
+				if (byte == '"' && position + 1 < length && data[position + 1] == '"')
+				{
+					appendStringInfoChar(&field, '"');
+					position += 2;
+					continue;
+				}
+				else if (byte == '"')
+				{
+					inQuotes = false;
+				}
+				else
+				{
+					appendStringInfoChar(&field, byte);
+				}
+			}
+			else if (byte == parser->delimiter || byte == '\n')
+			{
+				break;
+			}
+			else if (parser->isCsv && byte == '"')
+			{
+				isQuoted = true;
+				inQuotes = true;
+			}
+			else if (!parser->isCsv && byte == '\\' && position + 1 < length)
+			{
+				char escaped = data[++position];
+
+				isEscaped |= escaped == 'N' && field.len == 0;
+
+				switch (escaped)
+				{
+					case 'b': appendStringInfoChar(&field, '\b'); break;
+					case 'f': appendStringInfoChar(&field, '\f'); break;
+					case 'n': appendStringInfoChar(&field, '\n'); break;
+					case 'r': appendStringInfoChar(&field, '\r'); break;
+					case 't': appendStringInfoChar(&field, '\t'); break;
+					case 'v': appendStringInfoChar(&field, '\v'); break;
+					default: appendStringInfoChar(&field, escaped); break;
+				}
+			}
+			else if (byte != '\r' || (position + 1 < length && data[position + 1] != '\n'))
+			{
+				appendStringInfoChar(&field, byte);
+			}
+
+			position++;
+		}
+
+		if (position >= length && (inQuotes || !parser->isComplete))
+		{
+			/* row continues after the sample */
+			return false;
+		}
+
+		bool isNull = parser->isCsv ?
+					  (field.len == 0 && !isQuoted) :
+					  (isEscaped && strcmp(field.data, "N") == 0);
+
+		*fieldList = lappend(*fieldList, isNull ? NULL : pstrdup(field.data));
+
+		if (position >= length || data[position] == '\n')
+		{
+			parser->position = position + 1;
+			return true;
+		}
+
+		/* skip the delimiter */
+		position++;
+	}
+}
+
+
+/*
+ * ValueTypes returns the bitmask of inferred types that a value can be read
+ * as. Text is always included.
+ */
+static uint32
+ValueTypes(char *value)
+{
+	uint32 types = INFERRED_TYPE_BIT(INFERRED_TEXT);
+	bool fitsInt32 = false;
+	bool fitsInt64 = false;
+
+	if (pg_strcasecmp(value, "true") == 0 || pg_strcasecmp(value, "false") == 0 ||
+	    pg_strcasecmp(value, "t") == 0 || pg_strcasecmp(value, "f") == 0)
+	{
+		types |= INFERRED_TYPE_BIT(INFERRED_BOOLEAN);
+	}
+	else if (IsInteger(value, &fitsInt32, &fitsInt64))
+	{
+		types |= INFERRED_TYPE_BIT(INFERRED_NUMERIC);
+
+		if (fitsInt64)
+		{
+			types |= INFERRED_TYPE_BIT(INFERRED_BIGINT);
+		}
+
+		if (fitsInt32)
+		{
+			types |= INFERRED_TYPE_BIT(INFERRED_INTEGER);
+		}
+	}
+	else if (IsNumeric(value))
+	{
+		types |= INFERRED_TYPE_BIT(INFERRED_NUMERIC);
+	}
+	else if (IsUuid(value))
+	{
+		types |= INFERRED_TYPE_BIT(INFERRED_UUID);
+	}
+	else
+	{
+		int dateLength = ParseDate(value);
+
+		if (dateLength > 0 && value[dateLength] == '\0')
+		{
+			types |= INFERRED_TYPE_BIT(INFERRED_DATE) |
+					 INFERRED_TYPE_BIT(INFERRED_TIMESTAMP) |
+					 INFERRED_TYPE_BIT(INFERRED_TIMESTAMPTZ);
+		}
+		else if (dateLength > 0 &&
+		         (value[dateLength] == ' ' || value[dateLength] == 'T'))
+		{
+			char *time = value + dateLength + 1;
+			int timeLength = ParseTime(time);
+
+			if (timeLength > 0 && time[timeLength] == '\0')
+			{
+				types |= INFERRED_TYPE_BIT(INFERRED_TIMESTAMP) |
+						 INFERRED_TYPE_BIT(INFERRED_TIMESTAMPTZ);
+			}
+			else if (timeLength > 0 && IsTimeZone(time + timeLength))
+			{
+				types |= INFERRED_TYPE_BIT(INFERRED_TIMESTAMPTZ);
+			}
+		}
+	}
+
+	return types;
+}
+
+
+/*
+ * IsInteger returns whether a value is an optionally signed integer and
+ * whether it fits in 32 and 64 bits. Values with leading zeros are not
+ * considered integers, since those are usually codes in which the zeros
+ * matter.
+ */
+static bool
+IsInteger(char *value, bool *fitsInt32, bool *fitsInt64)
+{
+	char *digits = value;
+
+	if (*digits == '-' || *digits == '+')
+	{
+		digits++;
+	}
+
+	int digitCount = strspn(digits, "0123456789");
+
+	if (digitCount == 0 || digits[digitCount] != '\0' ||
+	    (digits[0] == '0' && digitCount > 1))
+	{
+		return false;
+	}
+
+	/* 19 digits may or may not fit in 64 bits, let strtoi64 decide */
+	if (digitCount <= 19)
+	{
+		errno = 0;
+
+		int64 number = strtoi64(value, NULL, 10);
+
+		*fitsInt64 = errno == 0;
+		*fitsInt32 = *fitsInt64 && number >= PG_INT32_MIN && number <= PG_INT32_MAX;
+	}
+
+	return true;
+}
+
+
+/*
+ * IsNumeric returns whether a value is a decimal number with an optional
+ * sign, fraction, and exponent.
+ */
+static bool
+IsNumeric(char *value)
+{
+	char *current = value;
+
+	if (*current == '-' || *current == '+')
+	{
+		current++;
+	}
+
+	int integerDigits = strspn(current, "0123456789");
+	current += integerDigits;
+
+	int fractionDigits = 0;
+
+	if (*current == '.')
+	{
+		current++;
+		fractionDigits = strspn(current, "0123456789");
+		current += fractionDigits;
+	}
+
+	if (integerDigits + fractionDigits == 0)
+	{
+		return false;
+	}
+
+	if (*current == 'e' || *current == 'E')
+	{
+		current++;
+
+		if (*current == '-' || *current == '+')
+		{
+			current++;
+		}
+
+		int exponentDigits = strspn(current, "0123456789");
+		if (exponentDigits == 0)
+		{
+			return false;
+		}
+
+		current += exponentDigits;
+	}
+
+	return *current == '\0';
+}
+
+
+/*
+ * ParseDate parses an ISO 8601 date (YYYY-MM-DD) at the start of value and
+ * returns its length, or 0 if there is no valid date.
+ */
+static int
+ParseDate(char *value)
+{
+	int year = 0;
+	int month = 0;
+	int day = 0;
+
+	if (ParseDigits(value, 4, &year) == 0 || value[4] != '-' ||
+	    ParseDigits(value + 5, 2, &month) == 0 || value[7] != '-' ||
+	    ParseDigits(value + 8, 2, &day) == 0)
+	{
+		return 0;
+	}
+
+	if (month < 1 || month > 12 || day < 1 || day > 31)
+	{
+		return 0;
+	}
+
+	return 10;
+}
+
+
+/*
+ * ParseTime parses a time (HH:MM[:SS[.fraction]]) at the start of value and
+ * returns its length, or 0 if there is no valid time.
+ */
+static int
+ParseTime(char *value)
+{
+	int hour = 0;
+	int minute = 0;
+	int second = 0;
+	int length = 5;
+
+	if (ParseDigits(value, 2, &hour) == 0 || value[2] != ':' ||
+	    ParseDigits(value + 3, 2, &minute) == 0)
+	{
+		return 0;
+	}
+
+	if (value[5] == ':')
+	{
+		if (ParseDigits(value + 6, 2, &second) == 0)
+		{
+			return 0;
+		}
+
+		length = 8;
+
+		if (value[8] == '.')
+		{
+			int fractionDigits = strspn(value + 9, "0123456789");
+			if (fractionDigits == 0)
+			{
+				return 0;
+			}
+
+			length = 9 + fractionDigits;
+		}
+	}
+
+	if (hour > 23 || minute > 59 || second > 59)
+	{
+		return 0;
+	}
+
+	return length;
+}
+
+
+/*
+ * IsTimeZone returns whether value is a UTC offset (Z, +HH, +HHMM, +HH:MM,
+ * optionally preceded by a space).
+ */
+static bool
+IsTimeZone(char *value)
+{
+	int hours = 0;
+	int minutes = 0;
+
+	if (*value == ' ')
+	{
+		value++;
+	}
+
+	if (strcmp(value, "Z") == 0)
+	{
+		return true;
+	}
+
+	if ((*value != '+' && *value != '-') || ParseDigits(value + 1, 2, &hours) == 0)
+	{
+		return false;
+	}
+
+	value += 3;
+
+	if (*value == ':')
+	{
+		value++;
+	}
+
+	if (*value != '\0' && (ParseDigits(value, 2, &minutes) == 0 || value[2] != '\0'))
+	{
+		return false;
+	}
+
+	return hours <= 15 && minutes <= 59;
+}
+
+
+/*
+ * IsUuid returns whether value is a UUID in the standard 8-4-4-4-12 form.
+ */
+static bool
+IsUuid(char *value)
+{
+	static const int groupLengths[] = { 8, 4, 4, 4, 12 };
+
+	for (int groupIndex = 0; groupIndex < 5; groupIndex++)
+	{
+		int groupLength = groupLengths[groupIndex];
+
+		if ((int) strspn(value, "0123456789abcdefABCDEF") != groupLength)
+		{
+			return false;
+		}
+
+		value += groupLength;
+
+		if (groupIndex < 4 && *value++ != '-')
+		{
+			return false;
+		}
+	}
+
+	return *value == '\0';
+}
+
+
+/*
+ * ParseDigits parses exactly count digits at the start of value into number
+ * and returns count, or 0 if there are not that many digits.
+ */
+static int
+ParseDigits(char *value, int count, int *number)
+{
+	*number = 0;
+
+	for (int digitIndex = 0; digitIndex < count; digitIndex++)
+	{
+		if (!isdigit((unsigned char) value[digitIndex]))
+		{
+			return 0;
+		}
+
+		*number = *number * 10 + (value[digitIndex] - '0');
+	}
+
+	return count;
+}
+
+
+/*
+ * ColumnType returns the narrowest type that all values of a column fit in,
+ * or text if the column has no values.
+ */
+static InferredType
+ColumnType(InferredColumn *column)
+{
+	if (column->valueCount == 0)
+	{
+		return INFERRED_TEXT;
+	}
+
+	for (int type = INFERRED_BOOLEAN; type < INFERRED_TEXT; type++)
+	{
+		if (column->candidateTypes & INFERRED_TYPE_BIT(type))
+		{
+			return (InferredType) type;
+		}
+	}
+
+	return INFERRED_TEXT;
+}
+
+
+/*
+ * HasHeaderRow guesses whether the first row is a header, given the types
+ * inferred from the other rows. That is the case when all fields of the
+ * first row have distinct non-empty values and none of them fit the type of
+ * their column, for at least one column that is not text.
+ */
+static bool
+HasHeaderRow(List *rowList, InferredColumn *columns, int columnCount)
+{
+	List *headerRow = (List *) linitial(rowList);
+	ListCell *fieldCell = NULL;
+	List *seenNames = NIL;
+	int typedColumnCount = 0;
+	int columnIndex = 0;
+
+	if (list_length(rowList) < 2)
+	{
+		return false;
+	}
+
+	foreach(fieldCell, headerRow)
+	{
+		char *value = (char *) lfirst(fieldCell);
+		InferredType columnType = ColumnType(&columns[columnIndex]);
+
+		if (value == NULL || value[0] == '\0')
+		{
+			return false;
+		}
+
+		ListCell *seenCell = NULL;
+
+		foreach(seenCell, seenNames)
+		{
+			if (strcmp((char *) lfirst(seenCell), value) == 0)
+			{
+				return false;
+			}
+		}
+
+		seenNames = lappend(seenNames, value);
+
+		if (columnType != INFERRED_TEXT)
+		{
+			if (ValueTypes(value) & INFERRED_TYPE_BIT(columnType))
+			{
+				return false;
+			}
+
+			typedColumnCount++;
+		}
+
+		columnIndex++;
+	}
+
+	return typedColumnCount > 0;
+}
+
+
+/*
+ * SetColumnNames names the columns after the fields in the header row, or
+ * column_<n> for columns without a (unique) name in the header.
+ */
+static void
+SetColumnNames(InferredColumn *columns, int columnCount, List *headerRow)
+{
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		char *name = NULL;
+
+		if (columnIndex < list_length(headerRow))
+		{
+			name = (char *) list_nth(headerRow, columnIndex);
+		}
+
+		for (int otherIndex = 0; name != NULL && otherIndex < columnIndex; otherIndex++)
+		{
+			if (strcmp(columns[otherIndex].name, name) == 0)
+			{
+				name = NULL;
+			}
+		}
+
+		if (name == NULL || name[0] == '\0' || strlen(name) >= NAMEDATALEN)
+		{
+			name = psprintf("column_%d", columnIndex + 1);
+		}
+
+		columns[columnIndex].name = name;
+	}
+}
+
+
+/*
+ * CreateCompositeType creates a composite type with the inferred columns,
+ * which can be passed to blob_storage_get_blob as NULL::<type_name>.
+ */
+static void
+CreateCompositeType(char *typeName, InferredColumn *columns, int columnCount)
+{
+	List *nameList = textToQualifiedNameList(cstring_to_text(typeName));
+	StringInfo command = makeStringInfo();
+
+	appendStringInfo(command, "CREATE TYPE %s AS (", NameListToQuotedString(nameList));
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		InferredColumn *column = &columns[columnIndex];
+
+		appendStringInfo(command, "%s%s %s", columnIndex > 0 ? ", " : "",
+		                 quote_identifier(column->name),
+		                 InferredTypeNames[ColumnType(column)]);
+	}
+
+	appendStringInfoChar(command, ')');
+
+	SPI_connect();
+
+	int spiStatus PG_USED_FOR_ASSERTS_ONLY = SPI_execute(command->data, false, 0);
+	Assert(spiStatus == SPI_OK_UTILITY);
+
+	SPI_finish();
+}
@@ -0,0 +1,169 @@
+/*-------------------------------------------------------------------------
+ *
+ * isal_decompressor.c
+ *     Decompressor that uses Intel's ISA-L to decompress a gzip stream.
+ *
+ * Like the zlib decompressor, it decompresses all members of a multi-member
+ * gzip stream.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "pgazure/byte_io.h"
+#include "pgazure/isal_compression.h"
+
+#ifdef USE_ISAL
+#include <isa-l/igzip_lib.h>
+
+#define ISAL_IN_SIZE 65536
+
+
+/*
+ * IsalDecompressorState contains the internal state that is passed to the
+ * read and close functions of the ByteSource.
+ */
+typedef struct IsalDecompressorState
+{
+	struct inflate_state stream;
+
+	ByteSource *byteSource;
+
+	char *inputBuffer;
+	bool endOfInputReached;
+
+	/* whether input of the current member was passed to isal_inflate */
+	bool memberStarted;
+} IsalDecompressorState;
+
+
+static int IsalDecompressorRead(void *context, void *buffer, int minRead, int maxRead);
+static void IsalDecompressorClose(void *context);
+static void FillIsalInputBuffer(IsalDecompressorState *state);
+
+
+/*
+ * CreateIsalDecompressor creates a ByteSource that decompresses the bytes
+ * coming in from another ByteSource.
+ */
+ByteSource *
+CreateIsalDecompressor(ByteSource *byteSource)
+{
+	IsalDecompressorState *state = palloc0(sizeof(IsalDecompressorState));
+	state->byteSource = byteSource;
+	state->inputBuffer = palloc(ISAL_IN_SIZE);
+
+	isal_inflate_init(&state->stream);
+	state->stream.crc_flag = ISAL_GZIP;
+
+	ByteSource *decompressor = palloc0(sizeof(ByteSource));
+	decompressor->context = state;
+	decompressor->read = IsalDecompressorRead;
+	decompressor->close = IsalDecompressorClose;
+
+	return decompressor;
+}
+
+
+/*
+ * IsalDecompressorRead decompresses bytes directly into the caller's buffer
+ * until it is full or the input ends.
+ */
+static int
+IsalDecompressorRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	IsalDecompressorState *state = (IsalDecompressorState *) context;
+	struct inflate_state *stream = &state->stream;
+
+	stream->next_out = (uint8_t *) buffer;
+	stream->avail_out = maxRead;
+
+	while (stream->avail_out > 0)
+	{
+		if (stream->avail_in == 0 && !state->endOfInputReached)
+		{
+			FillIsalInputBuffer(state);
+		}
+
+		if (stream->block_state == ISAL_BLOCK_FINISH)
+		{
+			if (stream->avail_in == 0)
+			{
+				/* end of the last member */
+				break;
+			}
+
+			/* the stream continues with another member */
+			isal_inflate_reset(stream);
+			stream->crc_flag = ISAL_GZIP;
+			state->memberStarted = false;
+		}
+
+		if (stream->avail_in == 0)
+		{
+			if (state->memberStarted)
+			{
+				ereport(ERROR, (errmsg("could not uncompress data: unexpected end of "
+				                       "gzip data")));
+			}
+
+			/* empty input */
+			break;
+		}
+
+		state->memberStarted = true;
+
+		int resultCode = isal_inflate(stream);
+		if (resultCode < 0)
+		{
+			ereport(ERROR, (errmsg("could not uncompress data: ISA-L error %d",
+			                       resultCode)));
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return maxRead - stream->avail_out;
+}
+
+
+/*
+ * FillIsalInputBuffer reads the next compressed bytes from the ByteSource
+ * into the (consumed) input buffer.
+ */
+static void
+FillIsalInputBuffer(IsalDecompressorState *state)
+{
+	ByteSource *byteSource = state->byteSource;
+
+	int bytesRead = byteSource->read(byteSource->context, state->inputBuffer, 0,
+	                                 ISAL_IN_SIZE);
+	if (bytesRead == 0)
+	{
+		state->endOfInputReached = true;
+	}
+
+	state->stream.next_in = (uint8_t *) state->inputBuffer;
+	state->stream.avail_in = bytesRead;
+}
+
+
+/*
+ * IsalDecompressorClose closes the underlying ByteSource.
+ */
+static void
+IsalDecompressorClose(void *context)
+{
+	IsalDecompressorState *state = (IsalDecompressorState *) context;
+	ByteSource *byteSource = state->byteSource;
+
+	byteSource->close(byteSource->context);
+
+	pfree(state->inputBuffer);
+	pfree(state);
+}
+
+#endif
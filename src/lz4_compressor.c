@@ -0,0 +1,187 @@
+/*-------------------------------------------------------------------------
+ *
+ * lz4_compressor.c
+ *     Compressor that uses liblz4 to compress a stream of bytes in the LZ4
+ *     frame format.
+ *
+ * Blocks are compressed independently, such that a reader does not need
+ * to keep previous blocks around, and we favour speed over ratio.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgazure/byte_io.h"
+#include "pgazure/lz4_compression.h"
+
+#ifdef USE_LZ4
+#include <lz4frame.h>
+
+/* number of bytes passed to LZ4F_compressUpdate at a time */
+#define LZ4_IN_SIZE 65536
+
+
+/*
+ * LZ4CompressorState contains the internal state that is passed to the
+ * write and close functions of the ByteSink.
+ */
+typedef struct LZ4CompressorState
+{
+	ByteSink *byteSink;
+
+	LZ4F_cctx *compressionContext;
+	LZ4F_preferences_t preferences;
+
+	/* buffer that fits the output of compressing LZ4_IN_SIZE bytes */
+	char *outputBuffer;
+	size_t outputBufferSize;
+} LZ4CompressorState;
+
+
+static void LZ4Write(void *context, void *buffer, int bytesToWrite);
+static void LZ4Close(void *context);
+static void CheckLZ4Result(size_t result);
+static void FreeLZ4CompressorCallback(void *arg);
+
+
+/*
+ * CreateLZ4Compressor creates a ByteSink that compresses the bytes that
+ * are written to it and writes the compressed bytes to another ByteSink.
+ */
+ByteSink *
+CreateLZ4Compressor(ByteSink *byteSink)
+{
+	LZ4CompressorState *state = palloc0(sizeof(LZ4CompressorState));
+	state->byteSink = byteSink;
+
+	size_t result = LZ4F_createCompressionContext(&state->compressionContext,
+	                                              LZ4F_VERSION);
+	if (LZ4F_isError(result))
+	{
+		ereport(ERROR, (errmsg("could not create LZ4 compression context: %s",
+		                       LZ4F_getErrorName(result))));
+	}
+
+	/* free the context if the query fails before the sink is closed */
+	MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+	callback->func = FreeLZ4CompressorCallback;
+	callback->arg = state;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	memset(&state->preferences, 0, sizeof(LZ4F_preferences_t));
+	state->preferences.frameInfo.blockSizeID = LZ4F_max1MB;
+	state->preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+	state->preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+	/* large enough for the frame header, a compressUpdate, or the frame end */
+	state->outputBufferSize = Max(LZ4F_compressBound(LZ4_IN_SIZE, &state->preferences),
+	                              LZ4F_HEADER_SIZE_MAX);
+	state->outputBuffer = palloc(state->outputBufferSize);
+
+	result = LZ4F_compressBegin(state->compressionContext, state->outputBuffer,
+	                            state->outputBufferSize, &state->preferences);
+	CheckLZ4Result(result);
+
+	byteSink->write(byteSink->context, state->outputBuffer, result);
+
+	ByteSink *compressor = palloc0(sizeof(ByteSink));
+	compressor->context = state;
+	compressor->write = LZ4Write;
+	compressor->close = LZ4Close;
+
+	return compressor;
+}
+
+
+/*
+ * LZ4Write compresses the given buffer in chunks of at most LZ4_IN_SIZE
+ * bytes. LZ4 only returns output once it completes a block.
+ */
+static void
+LZ4Write(void *context, void *buffer, int bytesToWrite)
+{
+	LZ4CompressorState *state = (LZ4CompressorState *) context;
+	ByteSink *byteSink = state->byteSink;
+	char *input = (char *) buffer;
+	int inputOffset = 0;
+
+	while (inputOffset < bytesToWrite)
+	{
+		int chunkSize = Min(bytesToWrite - inputOffset, LZ4_IN_SIZE);
+
+		size_t result = LZ4F_compressUpdate(state->compressionContext,
+		                                    state->outputBuffer,
+		                                    state->outputBufferSize,
+		                                    input + inputOffset, chunkSize, NULL);
+		CheckLZ4Result(result);
+
+		if (result > 0)
+		{
+			byteSink->write(byteSink->context, state->outputBuffer, result);
+		}
+
+		inputOffset += chunkSize;
+	}
+}
+
+
+/*
+ * LZ4Close writes the last block and the end of the frame, and closes the
+ * underlying ByteSink.
+ */
+static void
+LZ4Close(void *context)
+{
+	LZ4CompressorState *state = (LZ4CompressorState *) context;
+	ByteSink *byteSink = state->byteSink;
+
+	size_t result = LZ4F_compressEnd(state->compressionContext, state->outputBuffer,
+	                                 state->outputBufferSize, NULL);
+	CheckLZ4Result(result);
+
+	byteSink->write(byteSink->context, state->outputBuffer, result);
+
+	LZ4F_freeCompressionContext(state->compressionContext);
+	state->compressionContext = NULL;
+
+	byteSink->close(byteSink->context);
+
+	/* the state itself is freed with the memory context, after the callback */
+	pfree(state->outputBuffer);
+}
+
+
+/*
+ * CheckLZ4Result throws an error if result is an LZ4 error code.
+ */
+static void
+CheckLZ4Result(size_t result)
+{
+	if (LZ4F_isError(result))
+	{
+		ereport(ERROR, (errmsg("could not compress data: %s",
+		                       LZ4F_getErrorName(result))));
+	}
+}
+
+
+/*
+ * FreeLZ4CompressorCallback frees the compression context of a compressor
+ * that was not closed when the memory context in which it was created is
+ * reset or deleted, such as after an error.
+ */
+static void
+FreeLZ4CompressorCallback(void *arg)
+{
+	LZ4CompressorState *state = (LZ4CompressorState *) arg;
+
+	if (state->compressionContext != NULL)
+	{
+		LZ4F_freeCompressionContext(state->compressionContext);
+		state->compressionContext = NULL;
+	}
+}
+
+#endif
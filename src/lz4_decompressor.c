@@ -0,0 +1,188 @@
+/*-------------------------------------------------------------------------
+ *
+ * lz4_decompressor.c
+ *     Decompressor that uses liblz4 to decompress a stream of bytes in the
+ *     LZ4 frame format.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "pgazure/byte_io.h"
+#include "pgazure/lz4_compression.h"
+
+#ifdef USE_LZ4
+#include <lz4frame.h>
+
+#define LZ4_IN_SIZE 65536
+
+
+/*
+ * LZ4DecompressorState contains the internal state that is passed to the
+ * read and close functions of the ByteSource.
+ */
+typedef struct LZ4DecompressorState
+{
+	LZ4F_dctx *decompressionContext;
+
+	ByteSource *byteSource;
+
+	/* compressed bytes read from the byteSource, of which inputOffset are used */
+	char *inputBuffer;
+	int inputLength;
+	int inputOffset;
+	bool endOfInputReached;
+} LZ4DecompressorState;
+
+
+static int LZ4DecompressorRead(void *context, void *buffer, int minRead, int maxRead);
+static void LZ4DecompressorClose(void *context);
+static void FillLZ4InputBuffer(LZ4DecompressorState *state);
+static void FreeLZ4DecompressorCallback(void *arg);
+
+
+/*
+ * CreateLZ4Decompressor creates a ByteSource that decompresses the bytes
+ * coming in from another ByteSource.
+ */
+ByteSource *
+CreateLZ4Decompressor(ByteSource *byteSource)
+{
+	LZ4DecompressorState *state = palloc0(sizeof(LZ4DecompressorState));
+	state->byteSource = byteSource;
+	state->inputBuffer = palloc(LZ4_IN_SIZE);
+
+	size_t result = LZ4F_createDecompressionContext(&state->decompressionContext,
+	                                                LZ4F_VERSION);
+	if (LZ4F_isError(result))
+	{
+		ereport(ERROR, (errmsg("could not create LZ4 decompression context: %s",
+		                       LZ4F_getErrorName(result))));
+	}
+
+	/* free the context if the query fails before the source is closed */
+	MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+	callback->func = FreeLZ4DecompressorCallback;
+	callback->arg = state;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	ByteSource *decompressor = palloc0(sizeof(ByteSource));
+	decompressor->context = state;
+	decompressor->read = LZ4DecompressorRead;
+	decompressor->close = LZ4DecompressorClose;
+
+	return decompressor;
+}
+
+
+/*
+ * LZ4DecompressorRead decompresses bytes into the caller's buffer until it
+ * is full or the input ends. LZ4 decodes blocks directly into the buffer
+ * when they fit, and only goes through its own buffer otherwise.
+ */
+static int
+LZ4DecompressorRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	LZ4DecompressorState *state = (LZ4DecompressorState *) context;
+	char *output = (char *) buffer;
+	int bytesRead = 0;
+
+	while (bytesRead < maxRead)
+	{
+		if (state->inputOffset == state->inputLength && !state->endOfInputReached)
+		{
+			FillLZ4InputBuffer(state);
+		}
+
+		size_t outputSize = maxRead - bytesRead;
+		size_t inputSize = state->inputLength - state->inputOffset;
+
+		size_t result = LZ4F_decompress(state->decompressionContext,
+		                                output + bytesRead, &outputSize,
+		                                state->inputBuffer + state->inputOffset,
+		                                &inputSize, NULL);
+		if (LZ4F_isError(result))
+		{
+			ereport(ERROR, (errmsg("could not uncompress data: %s",
+			                       LZ4F_getErrorName(result))));
+		}
+
+		state->inputOffset += inputSize;
+		bytesRead += outputSize;
+
+		if (state->endOfInputReached && state->inputOffset == state->inputLength &&
+		    outputSize == 0)
+		{
+			/* no more input, and nothing left to flush */
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return bytesRead;
+}
+
+
+/*
+ * FillLZ4InputBuffer reads the next compressed bytes from the ByteSource
+ * into the (consumed) input buffer.
+ */
+static void
+FillLZ4InputBuffer(LZ4DecompressorState *state)
+{
+	ByteSource *byteSource = state->byteSource;
+
+	int bytesRead = byteSource->read(byteSource->context, state->inputBuffer, 0,
+	                                 LZ4_IN_SIZE);
+	if (bytesRead == 0)
+	{
+		state->endOfInputReached = true;
+	}
+
+	state->inputLength = bytesRead;
+	state->inputOffset = 0;
+}
+
+
+/*
+ * LZ4DecompressorClose frees the decompression context and closes the
+ * underlying ByteSource.
+ */
+static void
+LZ4DecompressorClose(void *context)
+{
+	LZ4DecompressorState *state = (LZ4DecompressorState *) context;
+	ByteSource *byteSource = state->byteSource;
+
+	LZ4F_freeDecompressionContext(state->decompressionContext);
+	state->decompressionContext = NULL;
+
+	byteSource->close(byteSource->context);
+
+	/* the state itself is freed with the memory context, after the callback */
+	pfree(state->inputBuffer);
+}
+
+
+/*
+ * FreeLZ4DecompressorCallback frees the decompression context of a
+ * decompressor that was not closed when the memory context in which it was
+ * created is reset or deleted, such as after an error.
+ */
+static void
+FreeLZ4DecompressorCallback(void *arg)
+{
+	LZ4DecompressorState *state = (LZ4DecompressorState *) arg;
+
+	if (state->decompressionContext != NULL)
+	{
+		LZ4F_freeDecompressionContext(state->decompressionContext);
+		state->decompressionContext = NULL;
+	}
+}
+
+#endif
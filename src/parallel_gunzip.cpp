@@ -0,0 +1,1099 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_gunzip.cpp
+ *     gzip decompression of multi-member streams on a pool of threads.
+ *
+ * A gzip file can consist of several members, each of which starts with
+ * its own header and can be decompressed without the preceding ones. The
+ * compressed input is split into chunks at member boundaries, which are
+ * inflated by the worker threads and returned in order.
+ *
+ * BGZF files, as written by bgzip and most genomics tools, record the size
+ * of every member in an extra field of its header, which gives the exact
+ * boundaries. For other gzip files the input is scanned for bytes that
+ * look like a gzip header. Such a boundary may be wrong, in which case the
+ * preceding chunk ends in the middle of a member; the backend then discards
+ * what the worker produced and continues the open member into the chunk.
+ * The same happens when no boundary is found at all, as in a gzip file with
+ * a single member, which is therefore decompressed by the backend itself,
+ * unless the blob has a gzip index.
+ *
+ * The checkpoints of a gzip index (see gzip_index.c) mark the start of a
+ * deflate block along with the window of data before it. When they are
+ * given, the input is split at the checkpoints instead, and each chunk is
+ * inflated as raw deflate data from its checkpoint up to the next one. The
+ * CRC in the trailer of a member that starts before a checkpoint is not
+ * checked.
+ *
+ * With libdeflate, chunks that consist of complete members are decompressed
+ * by libdeflate, which is considerably faster than zlib but cannot stop in
+ * the middle of a member. Other chunks, and chunks on which it fails, are
+ * inflated with zlib.
+ *
+ * The threads never call into postgres. Errors are stored and raised by
+ * the backend when it takes the output of the chunk.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pg_config.h"
+#include "pgazure/cpp_utils.h"
+#include "pgazure/parallel_gunzip.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+
+/* number of compressed bytes after which a chunk ends at the next member */
+#define PARALLEL_GUNZIP_CHUNK_SIZE (1024 * 1024)
+
+/* number of compressed bytes after which a chunk ends inside a member */
+#define PARALLEL_GUNZIP_MAX_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* number of compressed bytes that are added to the input at a time */
+#define PARALLEL_GUNZIP_WRITE_SIZE 65536
+
+/* size of the fixed part of a gzip header, and of a BGZF header */
+#define GZIP_HEADER_SIZE 10
+#define BGZF_HEADER_SIZE 18
+
+/* header flag that indicates the presence of an extra field */
+#define GZIP_FLAG_EXTRA 0x04
+
+/* makes inflate detect and check the gzip header and trailer */
+#define GZIP_DECODING 32
+
+/* size of the trailer with the CRC and length at the end of a gzip member */
+#define GZIP_TRAILER_SIZE 8
+
+/* size of the deflate window */
+#define GZIP_WINDOW_SIZE 32768
+
+/* interval at which a waiting backend checks for cancellation */
+#define PARALLEL_GUNZIP_WAIT_INTERVAL_MS 100
+
+
+/*
+ * GunzipCheckpoint is a position at which inflating can start, at the start
+ * of a deflate block.
+ */
+struct GunzipCheckpoint {
+	/* offset of the first byte of the block that is not shared with the previous */
+	size_t compressedOffset;
+
+	/* number of bits of the block in the byte before compressedOffset */
+	int bits;
+
+	size_t uncompressedOffset;
+
+	/* the decompressed bytes before the block, compressed with zlib */
+	std::vector<char> window;
+};
+
+
+/*
+ * GunzipChunk is a chunk of compressed input that is inflated by a worker
+ * thread, or by the backend if it starts inside a member.
+ */
+struct GunzipChunk {
+	std::vector<char> input;
+	bool continuesPrevious;
+	bool endsInsideMember;
+	bool isLast;
+
+	/* checkpoint at which the input starts, and the number of bytes up to the next */
+	const GunzipCheckpoint *checkpoint;
+	size_t outputLimit;
+
+	/* set by the worker */
+	std::vector<char> output;
+	z_stream *openStream;
+	bool done;
+	std::string error;
+};
+
+
+class ParallelGunzipImpl {
+		GzipEngineType engine;
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable workAvailable;
+		std::condition_variable chunkDone;
+		bool stopping;
+
+		/* chunks that are not yet taken by a worker */
+		std::deque<GunzipChunk *> queue;
+
+		/* all chunks whose output is not yet taken, in order */
+		std::deque<GunzipChunk *> chunks;
+
+		/* compressed bytes that are not yet submitted */
+		std::vector<char> pending;
+
+		/* whether the input is BGZF, which is known after the first header */
+		bool formatKnown;
+		bool isBgzf;
+
+		/* offset in pending of the next BGZF header */
+		size_t nextMemberOffset;
+
+		/* offset in pending from which to look for gzip headers */
+		size_t scanOffset;
+
+		/* whether the last submitted chunk ended inside a member */
+		bool nextContinuesPrevious;
+
+		/* checkpoints of a gzip index, the next one to submit, and where pending starts */
+		std::vector<GunzipCheckpoint> checkpoints;
+		size_t nextCheckpoint;
+		size_t pendingOffset;
+
+		/* last chunk that was taken, and the member that continues after it */
+		GunzipChunk *takenChunk;
+		z_stream *openStream;
+
+		void split();
+		size_t findMemberBoundary();
+		int bgzfBlockSize(size_t offset);
+		void submit(size_t length, bool isLast, bool endsInsideMember);
+		void submitCheckpoint(bool isLast);
+		void enqueue(GunzipChunk *chunk);
+		static size_t checkpointStart(const GunzipCheckpoint& checkpoint);
+		void run();
+		static bool looksLikeGzipHeader(const unsigned char *header);
+		static z_stream *inflateChunk(GunzipChunk *chunk, z_stream *stream);
+#ifdef USE_LIBDEFLATE
+		static bool decompressMembers(GunzipChunk *chunk);
+#endif
+		static void freeStream(z_stream *stream);
+
+	public:
+		ParallelGunzipImpl(int workerCount, GzipEngineType engine);
+		~ParallelGunzipImpl();
+		void addCheckpoint(size_t compressedOffset, int bits, size_t uncompressedOffset,
+		                   const char *window, int windowLength);
+		void write(const char *data, int length);
+		void finish();
+		int pendingChunks();
+		bool takeOutput(bool wait, const char **data, int *length);
+};
+
+
+ParallelGunzipImpl::ParallelGunzipImpl(int workerCount, GzipEngineType engine)
+	: engine(engine), stopping(false), formatKnown(false), isBgzf(false), nextMemberOffset(0),
+	  scanOffset(0), nextContinuesPrevious(false), nextCheckpoint(0), pendingOffset(0),
+	  takenChunk(NULL), openStream(NULL)
+{
+	for (int workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		workers.push_back(std::thread(&ParallelGunzipImpl::run, this));
+	}
+}
+
+
+ParallelGunzipImpl::~ParallelGunzipImpl()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	workAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (GunzipChunk *chunk : chunks)
+	{
+		freeStream(chunk->openStream);
+		delete chunk;
+	}
+
+	delete takenChunk;
+	freeStream(openStream);
+}
+
+
+/*
+ * addCheckpoint adds a checkpoint of a gzip index, which must be added in
+ * order and before any input.
+ */
+void
+ParallelGunzipImpl::addCheckpoint(size_t compressedOffset, int bits,
+                                  size_t uncompressedOffset, const char *window,
+                                  int windowLength)
+{
+	GunzipCheckpoint checkpoint;
+
+	checkpoint.compressedOffset = compressedOffset;
+	checkpoint.bits = bits;
+	checkpoint.uncompressedOffset = uncompressedOffset;
+	checkpoint.window.assign(window, window + windowLength);
+
+	checkpoints.push_back(checkpoint);
+}
+
+
+/*
+ * write adds compressed bytes to the input, and submits chunks to the
+ * workers as member boundaries are found.
+ */
+void
+ParallelGunzipImpl::write(const char *data, int length)
+{
+	while (length > 0)
+	{
+		int bytesToCopy = std::min(length, PARALLEL_GUNZIP_WRITE_SIZE);
+
+		pending.insert(pending.end(), data, data + bytesToCopy);
+		data += bytesToCopy;
+		length -= bytesToCopy;
+
+		split();
+	}
+}
+
+
+/*
+ * finish submits the remaining bytes as the last chunk, which may be empty.
+ */
+void
+ParallelGunzipImpl::finish()
+{
+	if (!checkpoints.empty())
+	{
+		submitCheckpoint(true);
+	}
+	else
+	{
+		submit(pending.size(), true, false);
+	}
+}
+
+
+/*
+ * split submits chunks for as long as a member boundary is found, or the
+ * pending input grows too large without one.
+ */
+void
+ParallelGunzipImpl::split()
+{
+	if (!checkpoints.empty())
+	{
+		/* submit a chunk once the input reaches the checkpoint after it */
+		while (nextCheckpoint + 1 < checkpoints.size() &&
+		       checkpoints[nextCheckpoint + 1].compressedOffset <=
+		       pendingOffset + pending.size())
+		{
+			submitCheckpoint(false);
+		}
+
+		return;
+	}
+
+	while (true)
+	{
+		size_t boundary = findMemberBoundary();
+
+		if (boundary > 0)
+		{
+			submit(boundary, false, false);
+		}
+		else if (pending.size() >= PARALLEL_GUNZIP_MAX_CHUNK_SIZE)
+		{
+			submit(pending.size(), false, true);
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * findMemberBoundary returns the offset of the first member that starts at
+ * least a chunk size into the pending input, or 0 if none is found yet.
+ */
+size_t
+ParallelGunzipImpl::findMemberBoundary()
+{
+	if (!formatKnown)
+	{
+		int blockSize = bgzfBlockSize(0);
+
+		if (blockSize == 0)
+		{
+			/* not enough bytes for the first header */
+			return 0;
+		}
+
+		formatKnown = true;
+		isBgzf = blockSize > 0;
+	}
+
+	while (isBgzf)
+	{
+		if (nextMemberOffset > pending.size())
+		{
+			return 0;
+		}
+
+		if (nextMemberOffset >= PARALLEL_GUNZIP_CHUNK_SIZE)
+		{
+			return nextMemberOffset;
+		}
+
+		int blockSize = bgzfBlockSize(nextMemberOffset);
+
+		if (blockSize == 0)
+		{
+			return 0;
+		}
+		else if (blockSize < 0)
+		{
+			/* a member without a block size, look for headers from here */
+			isBgzf = false;
+			scanOffset = nextMemberOffset;
+		}
+		else
+		{
+			nextMemberOffset += blockSize;
+		}
+	}
+
+	const unsigned char *data = (const unsigned char *) pending.data();
+	size_t offset = std::max(scanOffset, (size_t) PARALLEL_GUNZIP_CHUNK_SIZE);
+
+	while (offset + GZIP_HEADER_SIZE <= pending.size())
+	{
+		const void *candidate = memchr(data + offset, 0x1f,
+		                               pending.size() - GZIP_HEADER_SIZE + 1 - offset);
+		if (candidate == NULL)
+		{
+			offset = pending.size() - GZIP_HEADER_SIZE + 1;
+			break;
+		}
+
+		offset = (const unsigned char *) candidate - data;
+
+		if (looksLikeGzipHeader(data + offset))
+		{
+			return offset;
+		}
+
+		offset++;
+	}
+
+	scanOffset = offset;
+
+	return 0;
+}
+
+
+/*
+ * bgzfBlockSize returns the size of the BGZF block whose header starts at
+ * offset in the pending input, 0 if the header is not complete yet, or -1
+ * if it is not a BGZF header.
+ */
+int
+ParallelGunzipImpl::bgzfBlockSize(size_t offset)
+{
+	const unsigned char *header = (const unsigned char *) pending.data() + offset;
+	size_t available = pending.size() - offset;
+
+	if (available < BGZF_HEADER_SIZE)
+	{
+		return 0;
+	}
+
+	if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 ||
+	    (header[3] & GZIP_FLAG_EXTRA) == 0)
+	{
+		return -1;
+	}
+
+	size_t extraLength = header[10] | (header[11] << 8);
+
+	if (available < GZIP_HEADER_SIZE + 2 + extraLength)
+	{
+		return 0;
+	}
+
+	/* the block size is in the BC subfield of the extra field */
+	const unsigned char *subfield = header + GZIP_HEADER_SIZE + 2;
+	const unsigned char *extraEnd = subfield + extraLength;
+
+	while (subfield + 4 <= extraEnd)
+	{
+		size_t subfieldLength = subfield[2] | (subfield[3] << 8);
+
+		if (subfield[0] == 'B' && subfield[1] == 'C' && subfieldLength == 2 &&
+		    subfield + 6 <= extraEnd)
+		{
+			return (subfield[4] | (subfield[5] << 8)) + 1;
+		}
+
+		subfield += 4 + subfieldLength;
+	}
+
+	return -1;
+}
+
+
+/*
+ * looksLikeGzipHeader returns whether the given bytes could be the fixed
+ * part of a gzip header, which has a magic number, deflate as its method,
+ * no reserved flags, and a known value for the extra flags and OS.
+ */
+bool
+ParallelGunzipImpl::looksLikeGzipHeader(const unsigned char *header)
+{
+	return header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 &&
+	       (header[3] & 0xe0) == 0 &&
+	       (header[8] == 0 || header[8] == 2 || header[8] == 4) &&
+	       (header[9] <= 13 || header[9] == 255);
+}
+
+
+/*
+ * submit hands the first length bytes of the pending input to the workers
+ * as a chunk. Chunks that start inside a member are left to the backend.
+ */
+void
+ParallelGunzipImpl::submit(size_t length, bool isLast, bool endsInsideMember)
+{
+	GunzipChunk *chunk = new GunzipChunk();
+
+	chunk->input.assign(pending.begin(), pending.begin() + length);
+	chunk->continuesPrevious = nextContinuesPrevious;
+	chunk->endsInsideMember = endsInsideMember;
+	chunk->isLast = isLast;
+	chunk->openStream = NULL;
+	chunk->done = chunk->continuesPrevious;
+
+	chunk->checkpoint = NULL;
+	chunk->outputLimit = 0;
+
+	pending.erase(pending.begin(), pending.begin() + length);
+	nextMemberOffset = nextMemberOffset > length ? nextMemberOffset - length : 0;
+	scanOffset = scanOffset > length ? scanOffset - length : 0;
+	nextContinuesPrevious = endsInsideMember;
+
+	enqueue(chunk);
+}
+
+
+/*
+ * submitCheckpoint hands the input from the next checkpoint up to the one
+ * after it to the workers, or up to the end of the input if isLast.
+ */
+void
+ParallelGunzipImpl::submitCheckpoint(bool isLast)
+{
+	const GunzipCheckpoint *checkpoint = &checkpoints[nextCheckpoint];
+	size_t start = checkpointStart(*checkpoint);
+	size_t end = pendingOffset + pending.size();
+
+	if (!isLast)
+	{
+		end = checkpoints[nextCheckpoint + 1].compressedOffset;
+	}
+
+	if (start < pendingOffset || end < start)
+	{
+		throw std::runtime_error("could not uncompress data: gzip index does not match "
+		                         "the blob");
+	}
+
+	GunzipChunk *chunk = new GunzipChunk();
+
+	chunk->input.assign(pending.begin() + (start - pendingOffset),
+	                    pending.begin() + (end - pendingOffset));
+	chunk->continuesPrevious = false;
+	chunk->endsInsideMember = !isLast;
+	chunk->isLast = isLast;
+	chunk->checkpoint = checkpoint;
+	chunk->outputLimit = 0;
+	chunk->openStream = NULL;
+	chunk->done = false;
+
+	if (!isLast)
+	{
+		const GunzipCheckpoint& next = checkpoints[nextCheckpoint + 1];
+
+		chunk->outputLimit = next.uncompressedOffset - checkpoint->uncompressedOffset;
+
+		/* the next chunk may start with the last byte of this one */
+		size_t nextStart = checkpointStart(next);
+
+		pending.erase(pending.begin(), pending.begin() + (nextStart - pendingOffset));
+		pendingOffset = nextStart;
+		nextCheckpoint++;
+	}
+
+	enqueue(chunk);
+}
+
+
+/*
+ * checkpointStart returns the offset of the first byte that holds bits of
+ * the block at a checkpoint.
+ */
+size_t
+ParallelGunzipImpl::checkpointStart(const GunzipCheckpoint& checkpoint)
+{
+	return checkpoint.compressedOffset - (checkpoint.bits > 0 ? 1 : 0);
+}
+
+
+/*
+ * enqueue adds a chunk to the list of chunks, and to the queue of the
+ * workers unless it starts inside a member.
+ */
+void
+ParallelGunzipImpl::enqueue(GunzipChunk *chunk)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (!chunk->continuesPrevious)
+		{
+			queue.push_back(chunk);
+		}
+
+		chunks.push_back(chunk);
+	}
+
+	workAvailable.notify_one();
+}
+
+
+/*
+ * run is the main function of a worker thread, which inflates chunks from
+ * the queue until the decompressor is freed.
+ */
+void
+ParallelGunzipImpl::run()
+{
+	while (true)
+	{
+		GunzipChunk *chunk = NULL;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+
+			if (stopping)
+			{
+				return;
+			}
+
+			chunk = queue.front();
+			queue.pop_front();
+		}
+
+		try
+		{
+#ifdef USE_LIBDEFLATE
+			if (engine == GZIP_ENGINE_LIBDEFLATE && chunk->checkpoint == NULL &&
+			    !chunk->endsInsideMember && decompressMembers(chunk))
+			{
+				chunk->openStream = NULL;
+			}
+			else
+#endif
+			{
+				chunk->openStream = inflateChunk(chunk, NULL);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			chunk->error = e.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			chunk->done = true;
+		}
+
+		chunkDone.notify_all();
+	}
+}
+
+
+#ifdef USE_LIBDEFLATE
+
+/*
+ * decompressMembers decompresses the members in the input of a chunk into
+ * its output with libdeflate. It returns false if the input does not consist
+ * of complete, valid members, in which case it is left to inflateChunk.
+ */
+bool
+ParallelGunzipImpl::decompressMembers(GunzipChunk *chunk)
+{
+	struct libdeflate_decompressor *decompressor = libdeflate_alloc_decompressor();
+
+	if (decompressor == NULL)
+	{
+		throw std::runtime_error("could not initialize compression library");
+	}
+
+	size_t inputOffset = 0;
+	size_t outputLength = 0;
+
+	chunk->output.resize(std::max(4 * chunk->input.size(), (size_t) 65536));
+
+	while (inputOffset < chunk->input.size())
+	{
+		size_t memberInputLength = 0;
+		size_t memberOutputLength = 0;
+
+		enum libdeflate_result result =
+			libdeflate_gzip_decompress_ex(decompressor,
+			                              chunk->input.data() + inputOffset,
+			                              chunk->input.size() - inputOffset,
+			                              chunk->output.data() + outputLength,
+			                              chunk->output.size() - outputLength,
+			                              &memberInputLength, &memberOutputLength);
+
+		if (result == LIBDEFLATE_INSUFFICIENT_SPACE)
+		{
+			/* libdeflate starts the member over */
+			chunk->output.resize(2 * chunk->output.size());
+			continue;
+		}
+		else if (result != LIBDEFLATE_SUCCESS)
+		{
+			libdeflate_free_decompressor(decompressor);
+			chunk->output.clear();
+			return false;
+		}
+
+		inputOffset += memberInputLength;
+		outputLength += memberOutputLength;
+	}
+
+	libdeflate_free_decompressor(decompressor);
+
+	chunk->output.resize(outputLength);
+
+	return true;
+}
+
+#endif
+
+
+/*
+ * inflateChunk decompresses the members in the input of a chunk into its
+ * output. If stream is not NULL, the chunk continues the member that is
+ * open in the stream. It returns the stream if the chunk ends inside a
+ * member, and NULL otherwise.
+ *
+ * A chunk that starts at a checkpoint is inflated as raw deflate data,
+ * until it has produced the bytes up to the next checkpoint.
+ */
+z_stream *
+ParallelGunzipImpl::inflateChunk(GunzipChunk *chunk, z_stream *stream)
+{
+	const GunzipCheckpoint *checkpoint = chunk->checkpoint;
+	bool memberOpen = stream != NULL;
+	bool rawDeflate = false;
+	size_t inputOffset = 0;
+
+	if (stream == NULL)
+	{
+		int windowBits = checkpoint != NULL ? -MAX_WBITS : MAX_WBITS | GZIP_DECODING;
+
+		stream = new z_stream();
+
+		if (inflateInit2(stream, windowBits) != Z_OK)
+		{
+			delete stream;
+			throw std::runtime_error("could not initialize compression library");
+		}
+	}
+
+	if (checkpoint != NULL)
+	{
+		std::vector<char> window(GZIP_WINDOW_SIZE);
+		uLongf windowLength = window.size();
+
+		if (uncompress((Bytef *) window.data(), &windowLength,
+		               (const Bytef *) checkpoint->window.data(),
+		               checkpoint->window.size()) != Z_OK ||
+		    (checkpoint->bits > 0 && chunk->input.empty()))
+		{
+			freeStream(stream);
+			throw std::runtime_error("could not uncompress data: invalid gzip index");
+		}
+
+		/* the block starts with the last bits of the first byte */
+		if (checkpoint->bits > 0)
+		{
+			int firstByte = (unsigned char) chunk->input[0];
+
+			inflatePrime(stream, checkpoint->bits, firstByte >> (8 - checkpoint->bits));
+			inputOffset = 1;
+		}
+
+		if (windowLength > 0)
+		{
+			inflateSetDictionary(stream, (const Bytef *) window.data(), windowLength);
+		}
+
+		rawDeflate = true;
+		memberOpen = true;
+	}
+
+	size_t outputLength = 0;
+
+	if (chunk->outputLimit > 0)
+	{
+		chunk->output.resize(chunk->outputLimit);
+	}
+	else
+	{
+		chunk->output.resize(std::max(4 * chunk->input.size(), (size_t) 65536));
+	}
+
+	stream->next_in = (Bytef *) chunk->input.data() + inputOffset;
+	stream->avail_in = chunk->input.size() - inputOffset;
+
+	while (true)
+	{
+		if (outputLength == chunk->output.size())
+		{
+			if (chunk->outputLimit > 0)
+			{
+				/* reached the next checkpoint */
+				break;
+			}
+
+			chunk->output.resize(2 * chunk->output.size());
+		}
+
+		stream->next_out = (Bytef *) chunk->output.data() + outputLength;
+		stream->avail_out = chunk->output.size() - outputLength;
+
+		int result = inflate(stream, Z_NO_FLUSH);
+
+		outputLength = chunk->output.size() - stream->avail_out;
+
+		if (result == Z_STREAM_END)
+		{
+			/* the next member starts with a new header */
+			memberOpen = false;
+
+			if (rawDeflate)
+			{
+				if (stream->avail_in < GZIP_TRAILER_SIZE)
+				{
+					freeStream(stream);
+					throw std::runtime_error("could not uncompress data: unexpected end "
+					                         "of gzip data");
+				}
+
+				/* skip the trailer of the member that started before the checkpoint */
+				stream->next_in += GZIP_TRAILER_SIZE;
+				stream->avail_in -= GZIP_TRAILER_SIZE;
+				inflateReset2(stream, MAX_WBITS | GZIP_DECODING);
+				rawDeflate = false;
+			}
+			else
+			{
+				inflateReset(stream);
+			}
+
+			if (stream->avail_in == 0)
+			{
+				break;
+			}
+		}
+		else if (result == Z_OK)
+		{
+			memberOpen = true;
+
+			if (stream->avail_in == 0 && stream->avail_out > 0)
+			{
+				break;
+			}
+		}
+		else if (result == Z_BUF_ERROR && stream->avail_in == 0)
+		{
+			/* no more input, and nothing left to flush */
+			break;
+		}
+		else
+		{
+			std::string message = stream->msg != NULL ? stream->msg : "invalid data";
+
+			freeStream(stream);
+			throw std::runtime_error("could not uncompress data: " + message);
+		}
+	}
+
+	chunk->output.resize(outputLength);
+
+	if (chunk->outputLimit > 0)
+	{
+		/* the next chunk starts at its own checkpoint */
+		freeStream(stream);
+
+		if (outputLength != chunk->outputLimit)
+		{
+			throw std::runtime_error("could not uncompress data: gzip index does not "
+			                         "match the blob");
+		}
+
+		return NULL;
+	}
+
+	if (!memberOpen)
+	{
+		freeStream(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+
+/*
+ * freeStream frees an inflate stream, if any.
+ */
+void
+ParallelGunzipImpl::freeStream(z_stream *stream)
+{
+	if (stream != NULL)
+	{
+		inflateEnd(stream);
+		delete stream;
+	}
+}
+
+
+/*
+ * pendingChunks returns the number of chunks whose output was not taken.
+ */
+int
+ParallelGunzipImpl::pendingChunks()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return chunks.size();
+}
+
+
+/*
+ * takeOutput returns the decompressed bytes of the oldest chunk, which remain
+ * valid until the next call. If wait is false, it returns false when the
+ * oldest chunk is not done yet. When the previous chunk ended inside a
+ * member, the chunk is inflated here by continuing that member.
+ */
+bool
+ParallelGunzipImpl::takeOutput(bool wait, const char **data, int *length)
+{
+	GunzipChunk *chunk = NULL;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (!chunks.empty() && !chunks.front()->done && wait)
+		{
+			chunkDone.wait_for(lock, std::chrono::milliseconds(PARALLEL_GUNZIP_WAIT_INTERVAL_MS));
+
+			if (IsQueryCancelPending())
+			{
+				throw std::runtime_error("canceling statement due to user request");
+			}
+		}
+
+		if (chunks.empty() || !chunks.front()->done)
+		{
+			return false;
+		}
+
+		chunk = chunks.front();
+		chunks.pop_front();
+	}
+
+	delete takenChunk;
+	takenChunk = chunk;
+
+	if (chunk->continuesPrevious || openStream != NULL)
+	{
+		/* the chunk does not start at a member, discard what a worker made of it */
+		freeStream(chunk->openStream);
+
+		z_stream *stream = openStream;
+		openStream = NULL;
+
+		chunk->openStream = inflateChunk(chunk, stream);
+	}
+	else if (!chunk->error.empty())
+	{
+		throw std::runtime_error(chunk->error);
+	}
+
+	openStream = chunk->openStream;
+	chunk->openStream = NULL;
+
+	if (chunk->isLast && openStream != NULL)
+	{
+		throw std::runtime_error("could not uncompress data: unexpected end of gzip data");
+	}
+
+	*data = chunk->output.data();
+	*length = chunk->output.size();
+
+	return true;
+}
+
+
+/*
+ * CreateParallelGunzip creates a gzip decompressor that decompresses on
+ * workerCount threads with the given engine.
+ */
+ParallelGunzip *
+CreateParallelGunzip(int workerCount, GzipEngineType engine)
+{
+	try
+	{
+		return (ParallelGunzip *) new ParallelGunzipImpl(workerCount, engine);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return NULL;
+}
+
+
+/*
+ * ParallelGunzipAddCheckpoint adds a checkpoint of a gzip index, at which the
+ * decompressor splits the input.
+ */
+void
+ParallelGunzipAddCheckpoint(ParallelGunzip *decompressor, size_t compressedOffset,
+                            int bits, size_t uncompressedOffset, const char *window,
+                            int windowLength)
+{
+	try
+	{
+		((ParallelGunzipImpl *) decompressor)->addCheckpoint(compressedOffset, bits,
+		                                                     uncompressedOffset, window,
+		                                                     windowLength);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * ParallelGunzipWrite adds compressed bytes to the input of the decompressor.
+ */
+void
+ParallelGunzipWrite(ParallelGunzip *decompressor, const char *data, int length)
+{
+	try
+	{
+		((ParallelGunzipImpl *) decompressor)->write(data, length);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * ParallelGunzipFinish marks the end of the input.
+ */
+void
+ParallelGunzipFinish(ParallelGunzip *decompressor)
+{
+	try
+	{
+		((ParallelGunzipImpl *) decompressor)->finish();
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * ParallelGunzipPendingChunks returns the number of chunks that are being
+ * decompressed or whose output was not yet taken.
+ */
+int
+ParallelGunzipPendingChunks(ParallelGunzip *decompressor)
+{
+	return ((ParallelGunzipImpl *) decompressor)->pendingChunks();
+}
+
+
+/*
+ * ParallelGunzipTakeOutput returns the next decompressed bytes in order, see
+ * ParallelGunzipImpl::takeOutput.
+ */
+bool
+ParallelGunzipTakeOutput(ParallelGunzip *decompressor, bool wait, const char **data,
+                         int *length)
+{
+	try
+	{
+		return ((ParallelGunzipImpl *) decompressor)->takeOutput(wait, data, length);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return false;
+}
+
+
+/*
+ * FreeParallelGunzip stops the worker threads and frees the decompressor. It
+ * does not raise errors, since it is also used for cleanup on abort.
+ */
+void
+FreeParallelGunzip(ParallelGunzip *decompressor)
+{
+	try
+	{
+		delete (ParallelGunzipImpl *) decompressor;
+	}
+	catch (...)
+	{
+		/* ignore errors during cleanup */
+	}
+}
+
+#endif
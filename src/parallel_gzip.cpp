@@ -0,0 +1,651 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel_gzip.cpp
+ *     gzip compression on a pool of threads, in the style of pigz.
+ *
+ * The input is split into chunks that are deflated independently by the
+ * worker threads. Every chunk but the last ends with a sync flush, which
+ * aligns it to a byte boundary, so the compressed chunks concatenate into
+ * a single deflate stream. Together with one gzip header, and a trailer
+ * with the combined CRC of the chunks, the output is a regular gzip file.
+ *
+ * When the dictionary is shared, each chunk is compressed with the last
+ * 32kB of the previous chunk as its dictionary, which gives almost the
+ * same ratio as compressing on a single thread.
+ *
+ * Chunks are deflated with zlib or ISA-L. libdeflate can only produce
+ * complete deflate streams, so with libdeflate every chunk becomes a gzip
+ * member of its own instead, without a dictionary. The output is then a
+ * multi-member gzip file, which gzip readers decompress as a whole.
+ *
+ * The threads never call into postgres. Errors are stored and raised by
+ * the backend when it takes the output of the chunk.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pg_config.h"
+#include "pgazure/cpp_utils.h"
+#include "pgazure/parallel_gzip.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef USE_ISAL
+#include <isa-l/igzip_lib.h>
+
+/* ISA-L levels go from 0 to 3, of which 1 is its default */
+#define ISAL_COMPRESSION_LEVEL 1
+#define ISAL_LEVEL_BUFFER_SIZE ISAL_DEF_LVL1_DEFAULT
+#endif
+
+
+/* number of uncompressed bytes in a chunk */
+#define PARALLEL_GZIP_CHUNK_SIZE (256 * 1024)
+
+/* size of the deflate window, which is the largest useful dictionary */
+#define PARALLEL_GZIP_DICTIONARY_SIZE 32768
+
+/* interval at which a waiting backend checks for cancellation */
+#define PARALLEL_GZIP_WAIT_INTERVAL_MS 100
+
+
+/* gzip header without a name or modification time, written by a Unix system */
+static const char GzipHeader[] = {
+	0x1f, (char) 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+};
+
+
+/*
+ * GzipChunk is a chunk of input that is compressed by a worker thread.
+ */
+struct GzipChunk {
+	std::vector<char> input;
+	std::vector<char> dictionary;
+	bool isFirst;
+	bool isLast;
+
+	/* set by the worker */
+	std::vector<char> output;
+	uLong crc;
+	bool done;
+	std::string error;
+};
+
+
+class ParallelGzipImpl {
+		int level;
+		bool shareDictionary;
+		GzipEngineType engine;
+
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable workAvailable;
+		std::condition_variable chunkDone;
+		bool stopping;
+
+		/* chunks that are not yet taken by a worker */
+		std::deque<GzipChunk *> queue;
+
+		/* all chunks whose output is not yet taken, in order */
+		std::deque<GzipChunk *> chunks;
+
+		/* chunk that is currently being filled by the backend */
+		std::vector<char> currentInput;
+		std::vector<char> previousTail;
+		bool submittedFirst;
+
+		/* output of the last chunk that was taken, and the trailer state */
+		GzipChunk *takenChunk;
+		uLong crc;
+		uLong totalLength;
+
+		void submit(bool isLast);
+		void run();
+		static void compress(GzipChunk *chunk, int level);
+#ifdef USE_LIBDEFLATE
+		static void compressMember(GzipChunk *chunk, int level);
+#endif
+#ifdef USE_ISAL
+		static void compressIsal(GzipChunk *chunk);
+#endif
+
+	public:
+		ParallelGzipImpl(int workerCount, int level, bool shareDictionary,
+		                 GzipEngineType engine);
+		~ParallelGzipImpl();
+		void write(const char *data, int length);
+		void finish();
+		int pendingChunks();
+		bool takeOutput(bool wait, const char **data, int *length);
+};
+
+
+ParallelGzipImpl::ParallelGzipImpl(int workerCount, int level, bool shareDictionary,
+                                   GzipEngineType engine)
+	: level(level), shareDictionary(shareDictionary && engine != GZIP_ENGINE_LIBDEFLATE),
+	  engine(engine), stopping(false),
+	  submittedFirst(false), takenChunk(NULL), crc(crc32(0L, Z_NULL, 0)),
+	  totalLength(0)
+{
+	currentInput.reserve(PARALLEL_GZIP_CHUNK_SIZE);
+
+	for (int workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		workers.push_back(std::thread(&ParallelGzipImpl::run, this));
+	}
+}
+
+
+ParallelGzipImpl::~ParallelGzipImpl()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	workAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (GzipChunk *chunk : chunks)
+	{
+		delete chunk;
+	}
+
+	delete takenChunk;
+}
+
+
+/*
+ * write adds bytes to the current chunk, and submits it to the workers
+ * whenever it is full.
+ */
+void
+ParallelGzipImpl::write(const char *data, int length)
+{
+	while (length > 0)
+	{
+		size_t bytesToCopy = std::min((size_t) length,
+		                              PARALLEL_GZIP_CHUNK_SIZE - currentInput.size());
+
+		currentInput.insert(currentInput.end(), data, data + bytesToCopy);
+		data += bytesToCopy;
+		length -= bytesToCopy;
+
+		if (currentInput.size() == PARALLEL_GZIP_CHUNK_SIZE)
+		{
+			submit(false);
+		}
+	}
+}
+
+
+/*
+ * finish submits the remaining bytes as the last chunk, which may be empty.
+ */
+void
+ParallelGzipImpl::finish()
+{
+	submit(true);
+}
+
+
+/*
+ * submit hands the current chunk to the workers and starts a new one.
+ */
+void
+ParallelGzipImpl::submit(bool isLast)
+{
+	GzipChunk *chunk = new GzipChunk();
+
+	chunk->input.swap(currentInput);
+	chunk->isFirst = !submittedFirst;
+	chunk->isLast = isLast;
+	chunk->crc = 0;
+	chunk->done = false;
+
+	if (shareDictionary)
+	{
+		chunk->dictionary.swap(previousTail);
+
+		size_t tailLength = std::min(chunk->input.size(),
+		                             (size_t) PARALLEL_GZIP_DICTIONARY_SIZE);
+
+		previousTail.assign(chunk->input.end() - tailLength, chunk->input.end());
+	}
+
+	submittedFirst = true;
+	currentInput.reserve(PARALLEL_GZIP_CHUNK_SIZE);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(chunk);
+		chunks.push_back(chunk);
+	}
+
+	workAvailable.notify_one();
+}
+
+
+/*
+ * run is the main function of a worker thread, which compresses chunks
+ * from the queue until the compressor is freed.
+ */
+void
+ParallelGzipImpl::run()
+{
+	while (true)
+	{
+		GzipChunk *chunk = NULL;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+
+			if (stopping)
+			{
+				return;
+			}
+
+			chunk = queue.front();
+			queue.pop_front();
+		}
+
+		try
+		{
+#ifdef USE_LIBDEFLATE
+			if (engine == GZIP_ENGINE_LIBDEFLATE)
+			{
+				compressMember(chunk, level);
+			}
+			else
+#endif
+#ifdef USE_ISAL
+			if (engine == GZIP_ENGINE_ISAL)
+			{
+				compressIsal(chunk);
+			}
+			else
+#endif
+			{
+				compress(chunk, level);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			chunk->error = e.what();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			chunk->done = true;
+		}
+
+		chunkDone.notify_all();
+	}
+}
+
+
+/*
+ * compress deflates a chunk into its output as raw deflate data that ends
+ * at a byte boundary, preceded by the gzip header for the first chunk.
+ */
+void
+ParallelGzipImpl::compress(GzipChunk *chunk, int level)
+{
+	z_stream stream;
+
+	memset(&stream, 0, sizeof(stream));
+
+	if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8,
+	                 Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		throw std::runtime_error("could not initialize compression library");
+	}
+
+	if (!chunk->dictionary.empty())
+	{
+		deflateSetDictionary(&stream, (const Bytef *) chunk->dictionary.data(),
+		                     chunk->dictionary.size());
+	}
+
+	size_t headerLength = chunk->isFirst ? sizeof(GzipHeader) : 0;
+
+	/* leave room for the empty stored block of the sync flush */
+	chunk->output.resize(headerLength + deflateBound(&stream, chunk->input.size()) + 16);
+	memcpy(chunk->output.data(), GzipHeader, headerLength);
+
+	stream.next_in = (Bytef *) chunk->input.data();
+	stream.avail_in = chunk->input.size();
+	stream.next_out = (Bytef *) chunk->output.data() + headerLength;
+	stream.avail_out = chunk->output.size() - headerLength;
+
+	int result = deflate(&stream, chunk->isLast ? Z_FINISH : Z_SYNC_FLUSH);
+
+	if ((chunk->isLast && result != Z_STREAM_END) ||
+	    (!chunk->isLast && (result != Z_OK || stream.avail_in != 0 ||
+	                        stream.avail_out == 0)))
+	{
+		deflateEnd(&stream);
+		throw std::runtime_error("could not compress data");
+	}
+
+	chunk->output.resize(chunk->output.size() - stream.avail_out);
+	chunk->crc = crc32(0L, (const Bytef *) chunk->input.data(), chunk->input.size());
+
+	/* the stream of a chunk that is not last is unfinished by design */
+	deflateEnd(&stream);
+}
+
+
+#ifdef USE_LIBDEFLATE
+
+/*
+ * compressMember compresses a chunk into a gzip member of its own with
+ * libdeflate.
+ */
+void
+ParallelGzipImpl::compressMember(GzipChunk *chunk, int level)
+{
+	struct libdeflate_compressor *compressor = libdeflate_alloc_compressor(level);
+
+	if (compressor == NULL)
+	{
+		throw std::runtime_error("could not initialize compression library");
+	}
+
+	chunk->output.resize(libdeflate_gzip_compress_bound(compressor,
+	                                                    chunk->input.size()));
+
+	size_t outputLength = libdeflate_gzip_compress(compressor, chunk->input.data(),
+	                                               chunk->input.size(),
+	                                               chunk->output.data(),
+	                                               chunk->output.size());
+
+	libdeflate_free_compressor(compressor);
+
+	if (outputLength == 0)
+	{
+		throw std::runtime_error("could not compress data");
+	}
+
+	chunk->output.resize(outputLength);
+}
+
+#endif
+
+
+#ifdef USE_ISAL
+
+/*
+ * compressIsal deflates a chunk with ISA-L into the same raw deflate data
+ * as compress does with zlib.
+ */
+void
+ParallelGzipImpl::compressIsal(GzipChunk *chunk)
+{
+	std::vector<uint8_t> levelBuffer(ISAL_LEVEL_BUFFER_SIZE);
+	struct isal_zstream stream;
+
+	isal_deflate_init(&stream);
+	stream.level = ISAL_COMPRESSION_LEVEL;
+	stream.level_buf = levelBuffer.data();
+	stream.level_buf_size = levelBuffer.size();
+	stream.gzip_flag = IGZIP_DEFLATE;
+	stream.flush = chunk->isLast ? NO_FLUSH : SYNC_FLUSH;
+	stream.end_of_stream = chunk->isLast ? 1 : 0;
+
+	if (!chunk->dictionary.empty() &&
+	    isal_deflate_set_dict(&stream, (uint8_t *) chunk->dictionary.data(),
+	                          chunk->dictionary.size()) != COMP_OK)
+	{
+		throw std::runtime_error("could not set compression dictionary");
+	}
+
+	size_t headerLength = chunk->isFirst ? sizeof(GzipHeader) : 0;
+	size_t outputLength = headerLength;
+
+	chunk->output.resize(headerLength + chunk->input.size() + chunk->input.size() / 8 +
+	                     1024);
+	memcpy(chunk->output.data(), GzipHeader, headerLength);
+
+	stream.next_in = (uint8_t *) chunk->input.data();
+	stream.avail_in = chunk->input.size();
+
+	while (true)
+	{
+		stream.next_out = (uint8_t *) chunk->output.data() + outputLength;
+		stream.avail_out = chunk->output.size() - outputLength;
+
+		if (isal_deflate(&stream) != COMP_OK)
+		{
+			throw std::runtime_error("could not compress data");
+		}
+
+		outputLength = chunk->output.size() - stream.avail_out;
+
+		/* a flush is complete once all input is used and there is output space left */
+		if (stream.avail_in == 0 && stream.avail_out > 0 &&
+		    (!chunk->isLast || stream.internal_state.state == ZSTATE_END))
+		{
+			break;
+		}
+
+		if (stream.avail_out == 0)
+		{
+			chunk->output.resize(2 * chunk->output.size());
+		}
+	}
+
+	chunk->output.resize(outputLength);
+	chunk->crc = crc32(0L, (const Bytef *) chunk->input.data(), chunk->input.size());
+}
+
+#endif
+
+
+/*
+ * pendingChunks returns the number of chunks whose output was not taken.
+ */
+int
+ParallelGzipImpl::pendingChunks()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return chunks.size();
+}
+
+
+/*
+ * takeOutput returns the compressed bytes of the oldest chunk, which remain
+ * valid until the next call. If wait is false, it returns false when the
+ * oldest chunk is not done yet. After the last chunk, the gzip trailer is
+ * added to its output.
+ */
+bool
+ParallelGzipImpl::takeOutput(bool wait, const char **data, int *length)
+{
+	GzipChunk *chunk = NULL;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (!chunks.empty() && !chunks.front()->done && wait)
+		{
+			chunkDone.wait_for(lock, std::chrono::milliseconds(PARALLEL_GZIP_WAIT_INTERVAL_MS));
+
+			if (IsQueryCancelPending())
+			{
+				throw std::runtime_error("canceling statement due to user request");
+			}
+		}
+
+		if (chunks.empty() || !chunks.front()->done)
+		{
+			return false;
+		}
+
+		chunk = chunks.front();
+		chunks.pop_front();
+	}
+
+	delete takenChunk;
+	takenChunk = chunk;
+
+	if (!chunk->error.empty())
+	{
+		throw std::runtime_error(chunk->error);
+	}
+
+	crc = crc32_combine(crc, chunk->crc, chunk->input.size());
+	totalLength += chunk->input.size();
+
+	/* members written by libdeflate have their own trailers */
+	if (chunk->isLast && engine != GZIP_ENGINE_LIBDEFLATE)
+	{
+		unsigned char trailer[8];
+
+		for (int byteIndex = 0; byteIndex < 4; byteIndex++)
+		{
+			trailer[byteIndex] = (crc >> (8 * byteIndex)) & 0xFF;
+			trailer[4 + byteIndex] = (totalLength >> (8 * byteIndex)) & 0xFF;
+		}
+
+		chunk->output.insert(chunk->output.end(), trailer, trailer + sizeof(trailer));
+	}
+
+	*data = chunk->output.data();
+	*length = chunk->output.size();
+
+	return true;
+}
+
+
+/*
+ * CreateParallelGzip creates a gzip compressor that compresses on workerCount
+ * threads.
+ */
+ParallelGzip *
+CreateParallelGzip(int workerCount, int level, bool shareDictionary,
+                   GzipEngineType engine)
+{
+	try
+	{
+		return (ParallelGzip *) new ParallelGzipImpl(workerCount, level, shareDictionary,
+		                                             engine);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return NULL;
+}
+
+
+/*
+ * ParallelGzipWrite adds bytes to the input of the compressor.
+ */
+void
+ParallelGzipWrite(ParallelGzip *compressor, const char *data, int length)
+{
+	try
+	{
+		((ParallelGzipImpl *) compressor)->write(data, length);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * ParallelGzipFinish marks the end of the input.
+ */
+void
+ParallelGzipFinish(ParallelGzip *compressor)
+{
+	try
+	{
+		((ParallelGzipImpl *) compressor)->finish();
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+}
+
+
+/*
+ * ParallelGzipPendingChunks returns the number of chunks that are being
+ * compressed or whose output was not yet taken.
+ */
+int
+ParallelGzipPendingChunks(ParallelGzip *compressor)
+{
+	return ((ParallelGzipImpl *) compressor)->pendingChunks();
+}
+
+
+/*
+ * ParallelGzipTakeOutput returns the next compressed bytes in order, see
+ * ParallelGzipImpl::takeOutput.
+ */
+bool
+ParallelGzipTakeOutput(ParallelGzip *compressor, bool wait, const char **data,
+                       int *length)
+{
+	try
+	{
+		return ((ParallelGzipImpl *) compressor)->takeOutput(wait, data, length);
+	}
+	catch (const std::exception& e)
+	{
+		ThrowPostgresError(e.what());
+	}
+
+	/* unreachable */
+	return false;
+}
+
+
+/*
+ * FreeParallelGzip stops the worker threads and frees the compressor. It does
+ * not raise errors, since it is also used for cleanup on abort.
+ */
+void
+FreeParallelGzip(ParallelGzip *compressor)
+{
+	try
+	{
+		delete (ParallelGzipImpl *) compressor;
+	}
+	catch (...)
+	{
+		/* ignore errors during cleanup */
+	}
+}
+
+#endif
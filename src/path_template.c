@@ -0,0 +1,343 @@
+/*-------------------------------------------------------------------------
+ *
+ * path_template.c
+ *     Parsing of Hive-style partition columns from blob paths.
+ *
+ * A path template such as events/date={date}/region={region}/ describes
+ * a layout in which blobs are stored under directories that encode the
+ * values of partition columns. A placeholder matches a non-empty part of
+ * the path up to the text that follows it in the template, and never
+ * crosses a /. Anything after the end of the template, such as the name of
+ * the blob, is ignored.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+
+#include "lib/stringinfo.h"
+#include "nodes/value.h"
+#include "pgazure/path_template.h"
+
+
+static char * DecodePathValue(char *value, int length);
+static int HexDigitValue(char digit);
+static bool IsPlainPathValue(char *value, char *nextLiteral);
+
+
+/*
+ * ParsePathTemplate parses a path template and throws an error if it is
+ * malformed.
+ */
+PathTemplate *
+ParsePathTemplate(char *templateString)
+{
+	List *literalList = NIL;
+	List *columnNameList = NIL;
+	StringInfo literal = makeStringInfo();
+
+	for (char *current = templateString; *current != '\0'; current++)
+	{
+		if (*current == '}')
+		{
+			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+			                errmsg("unexpected \"}\" in path template \"%s\"",
+			                       templateString)));
+		}
+		else if (*current != '{')
+		{
+			appendStringInfoChar(literal, *current);
+			continue;
+		}
+
+		char *end = strchr(current + 1, '}');
+		if (end == NULL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+			                errmsg("unterminated placeholder in path template \"%s\"",
+			                       templateString)));
+		}
+
+		char *columnName = pnstrdup(current + 1, end - current - 1);
+		ListCell *columnNameCell = NULL;
+
+		if (columnName[0] == '\0' || strpbrk(columnName, "{/") != NULL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+			                errmsg("invalid placeholder in path template \"%s\"",
+			                       templateString)));
+		}
+
+		if (columnNameList != NIL && literal->len == 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+			                errmsg("placeholders in path template \"%s\" must be "
+			                       "separated by text", templateString)));
+		}
+
+		foreach(columnNameCell, columnNameList)
+		{
+			if (strcmp((char *) lfirst(columnNameCell), columnName) == 0)
+			{
+				ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+				                errmsg("column \"%s\" appears more than once in path "
+				                       "template \"%s\"", columnName, templateString)));
+			}
+		}
+
+		literalList = lappend(literalList, pstrdup(literal->data));
+		columnNameList = lappend(columnNameList, columnName);
+		resetStringInfo(literal);
+
+		current = end;
+	}
+
+	literalList = lappend(literalList, pstrdup(literal->data));
+
+	if (columnNameList == NIL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+		                errmsg("path template \"%s\" does not contain a {column} "
+		                       "placeholder", templateString)));
+	}
+
+	PathTemplate *pathTemplate = palloc0(sizeof(PathTemplate));
+	pathTemplate->placeholderCount = list_length(columnNameList);
+	pathTemplate->columnNames = palloc0(pathTemplate->placeholderCount * sizeof(char *));
+	pathTemplate->literals = palloc0((pathTemplate->placeholderCount + 1) *
+	                                 sizeof(char *));
+
+	for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+	     placeholderIndex++)
+	{
+		pathTemplate->columnNames[placeholderIndex] =
+			(char *) list_nth(columnNameList, placeholderIndex);
+	}
+
+	for (int literalIndex = 0; literalIndex <= pathTemplate->placeholderCount;
+	     literalIndex++)
+	{
+		pathTemplate->literals[literalIndex] = (char *) list_nth(literalList, literalIndex);
+	}
+
+	return pathTemplate;
+}
+
+
+/*
+ * MatchPathTemplate checks whether a blob path matches the template and, if
+ * so, stores the decoded value of each placeholder in values. A value is
+ * NULL if the path contains the Hive default partition value.
+ */
+bool
+MatchPathTemplate(PathTemplate *pathTemplate, char *path, char **values)
+{
+	char *current = path;
+	int literalLength = strlen(pathTemplate->literals[0]);
+
+	if (strncmp(current, pathTemplate->literals[0], literalLength) != 0)
+	{
+		return false;
+	}
+
+	current += literalLength;
+
+	for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+	     placeholderIndex++)
+	{
+		char *nextLiteral = pathTemplate->literals[placeholderIndex + 1];
+		char *end = NULL;
+
+		if (nextLiteral[0] == '\0')
+		{
+			/* the template ends with a placeholder, which takes one directory */
+			end = strchr(current, '/');
+			if (end == NULL)
+			{
+				end = current + strlen(current);
+			}
+		}
+		else
+		{
+			end = strstr(current, nextLiteral);
+			if (end == NULL)
+			{
+				return false;
+			}
+		}
+
+		int valueLength = end - current;
+
+		if (valueLength == 0 || memchr(current, '/', valueLength) != NULL)
+		{
+			return false;
+		}
+
+		values[placeholderIndex] = DecodePathValue(current, valueLength);
+
+		current = end + strlen(nextLiteral);
+	}
+
+	return true;
+}
+
+
+/*
+ * DecodePathValue decodes the %XX escapes that Hive uses for special
+ * characters in partition values.
+ */
+static char *
+DecodePathValue(char *value, int length)
+{
+	StringInfo decoded = makeStringInfo();
+
+	for (int index = 0; index < length; index++)
+	{
+		if (value[index] == '%' && index + 2 < length &&
+		    HexDigitValue(value[index + 1]) >= 0 &&
+		    HexDigitValue(value[index + 2]) >= 0)
+		{
+			appendStringInfoChar(decoded, (char) (HexDigitValue(value[index + 1]) * 16 +
+			                                      HexDigitValue(value[index + 2])));
+			index += 2;
+		}
+		else
+		{
+			appendStringInfoChar(decoded, value[index]);
+		}
+	}
+
+	if (strcmp(decoded->data, DEFAULT_PARTITION_VALUE) == 0)
+	{
+		return NULL;
+	}
+
+	return decoded->data;
+}
+
+
+/*
+ * HexDigitValue returns the value of a hexadecimal digit, or -1 if the
+ * character is not one.
+ */
+static int
+HexDigitValue(char digit)
+{
+	if (digit >= '0' && digit <= '9')
+	{
+		return digit - '0';
+	}
+	else if (digit >= 'a' && digit <= 'f')
+	{
+		return digit - 'a' + 10;
+	}
+	else if (digit >= 'A' && digit <= 'F')
+	{
+		return digit - 'A' + 10;
+	}
+
+	return -1;
+}
+
+
+/*
+ * PathTemplateListingPrefixes returns the prefixes under which all blobs that
+ * can match the template are listed, given for each placeholder either NIL
+ * or the list of values that it can have.
+ *
+ * The prefixes extend past each placeholder in order for as long as its
+ * values are known, appear verbatim in paths, and the number of prefixes
+ * stays within maxPrefixCount.
+ */
+List *
+PathTemplateListingPrefixes(PathTemplate *pathTemplate, List **candidateValues,
+                            int maxPrefixCount)
+{
+	List *prefixList = list_make1(pstrdup(pathTemplate->literals[0]));
+
+	for (int placeholderIndex = 0; placeholderIndex < pathTemplate->placeholderCount;
+	     placeholderIndex++)
+	{
+		List *valueList = NIL;
+		char *nextLiteral = pathTemplate->literals[placeholderIndex + 1];
+		ListCell *valueCell = NULL;
+		bool allValuesPlain = true;
+
+		/*
+		 * A placeholder at the end of the template is not followed by a
+		 * separator, so its value would not delimit the prefix.
+		 */
+		if (candidateValues[placeholderIndex] == NIL || nextLiteral[0] == '\0')
+		{
+			break;
+		}
+
+		foreach(valueCell, candidateValues[placeholderIndex])
+		{
+			char *value = (char *) lfirst(valueCell);
+
+			if (!IsPlainPathValue(value, nextLiteral))
+			{
+				allValuesPlain = false;
+				break;
+			}
+
+			valueList = list_append_unique(valueList, makeString(value));
+		}
+
+		if (!allValuesPlain ||
+		    list_length(prefixList) * list_length(valueList) > maxPrefixCount)
+		{
+			break;
+		}
+
+		List *extendedPrefixList = NIL;
+		ListCell *prefixCell = NULL;
+
+		foreach(prefixCell, prefixList)
+		{
+			char *prefix = (char *) lfirst(prefixCell);
+
+			foreach(valueCell, valueList)
+			{
+				char *value = strVal(lfirst(valueCell));
+
+				extendedPrefixList = lappend(extendedPrefixList,
+				                             psprintf("%s%s%s", prefix, value,
+				                                      nextLiteral));
+			}
+		}
+
+		prefixList = extendedPrefixList;
+	}
+
+	return prefixList;
+}
+
+
+/*
+ * IsPlainPathValue returns whether a value appears in paths as is and can
+ * be matched by a placeholder that is followed by nextLiteral.
+ */
+static bool
+IsPlainPathValue(char *value, char *nextLiteral)
+{
+	if (value[0] == '\0' || strcmp(value, DEFAULT_PARTITION_VALUE) == 0 ||
+	    strstr(value, nextLiteral) != NULL)
+	{
+		return false;
+	}
+
+	for (char *current = value; *current != '\0'; current++)
+	{
+		if (!isalnum((unsigned char) *current) && strchr("-_.", *current) == NULL)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
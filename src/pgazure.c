@@ -10,11 +10,24 @@
  */
 
 #include "postgres.h"
+
+#include <float.h>
+#include <limits.h>
+
 #include "fmgr.h"
 #include "miscadmin.h"
 
+#include "pgazure/adaptive_compression.h"
+#include "pgazure/blob_estimates.h"
+#include "pgazure/blob_fdw.h"
+#include "pgazure/blob_scan.h"
+#include "pgazure/blob_stats.h"
 #include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
 #include "pgazure/set_returning_functions.h"
+#include "pgazure/zlib_compression.h"
+#include "pgazure/zstd_compression.h"
+#include "pgazure/zstd_dictionary.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
 
@@ -24,6 +37,13 @@ PG_MODULE_MAGIC;
 
 static char *ConnectionString = NULL;
 
+static const struct config_enum_entry GzipEngineOptions[] = {
+	{ "zlib", GZIP_ENGINE_ZLIB, false },
+	{ "libdeflate", GZIP_ENGINE_LIBDEFLATE, false },
+	{ "isal", GZIP_ENGINE_ISAL, false },
+	{ NULL, 0, false }
+};
+
 
 void _PG_init(void);
 
@@ -43,4 +63,240 @@ _PG_init(void)
 		PGC_USERSET,
 		GUC_SUPERUSER_ONLY,
 		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"azure.enable_blob_scan",
+		gettext_noop("Enables streaming scans of blob_storage_get_blob that only "
+					 "decode the columns used by the query."),
+		NULL,
+		&EnableBlobScan,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomRealVariable(
+		"azure.blob_request_cost",
+		gettext_noop("Sets the planner's estimate of the cost of a request to "
+					 "blob storage."),
+		NULL,
+		&BlobRequestCost,
+		1000.0, 0.0, DBL_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomRealVariable(
+		"azure.blob_transfer_cost",
+		gettext_noop("Sets the planner's estimate of the cost of transferring "
+					 "a page of data from blob storage."),
+		NULL,
+		&BlobTransferCost,
+		4.0, 0.0, DBL_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.blob_metadata_cache_ttl",
+		gettext_noop("Sets the time for which blob sizes and row estimates are "
+					 "cached for planning."),
+		gettext_noop("0 disables caching."),
+		&BlobMetadataCacheTTL,
+		60, 0, INT_MAX / 1000,
+		PGC_USERSET,
+		GUC_UNIT_S,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.max_async_blob_downloads",
+		gettext_noop("Sets the maximum number of blobs that asynchronous foreign "
+					 "scans download in the background at the same time."),
+		gettext_noop("Scans that exceed the limit read their blobs synchronously."),
+		&MaxAsyncBlobDownloads,
+		16, 0, 1024,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.analyze_sample_blob_size",
+		gettext_noop("Sets the blob size above which ANALYZE samples random "
+					 "ranges of a blob instead of reading all of it."),
+		gettext_noop("Only applies to uncompressed csv and tsv blobs. "
+					 "-1 disables sampling."),
+		&AnalyzeSampleBlobSize,
+		65536, -1, INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"azure.enable_blob_stats",
+		gettext_noop("Enables skipping blobs and blocks of rows based on their "
+					 "statistics sidecars."),
+		NULL,
+		&EnableBlobStats,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"azure.write_blob_stats",
+		gettext_noop("Makes blob_storage_put_blob write a statistics sidecar "
+					 "next to each blob."),
+		NULL,
+		&WriteBlobStats,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomStringVariable(
+		"azure.blob_stats_bloom_columns",
+		gettext_noop("Sets the columns for which blob_storage_put_blob adds bloom "
+					 "filters to statistics sidecars."),
+		gettext_noop("Comma-separated list of column names."),
+		&BlobStatsBloomColumns,
+		"",
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomEnumVariable(
+		"azure.gzip_engine",
+		gettext_noop("Sets the library that compresses and decompresses gzip."),
+		gettext_noop("libdeflate is used by gzip threads, isal also in the backend. "
+					 "zlib is used when pgazure is not built with the library."),
+		&GzipEngine,
+		GZIP_ENGINE_ZLIB,
+		GzipEngineOptions,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.gzip_workers",
+		gettext_noop("Sets the number of threads that compress a blob with gzip."),
+		gettext_noop("0 compresses in the backend itself."),
+		&GzipWorkers,
+		0, 0, 64,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"azure.gzip_share_dictionary",
+		gettext_noop("Makes gzip threads use the end of the previous chunk as a "
+					 "dictionary."),
+		gettext_noop("Improves the compression ratio at the cost of copying 32kB "
+					 "per chunk."),
+		&GzipShareDictionary,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.gzip_decompression_workers",
+		gettext_noop("Sets the number of threads that decompress the members of a "
+					 "gzip blob."),
+		gettext_noop("Speeds up reading BGZF and other multi-member gzip blobs. "
+					 "0 decompresses in the backend itself."),
+		&GzipDecompressionWorkers,
+		0, 0, 64,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.zstd_compression_level",
+		gettext_noop("Sets the level at which blobs are compressed with zstd."),
+		gettext_noop("Negative levels are faster, levels above 19 use a lot of "
+					 "memory."),
+		&ZstdCompressionLevel,
+		3, -7, 22,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.zstd_workers",
+		gettext_noop("Sets the number of threads that compress a blob with zstd."),
+		gettext_noop("0 compresses in the backend itself."),
+		&ZstdWorkers,
+		0, 0, 64,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"azure.zstd_long_distance_matching",
+		gettext_noop("Makes zstd look for matches far back in the blob."),
+		NULL,
+		&ZstdLongDistanceMatching,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.zstd_frame_size",
+		gettext_noop("Sets the number of uncompressed bytes per zstd frame."),
+		gettext_noop("With a frame size, blobs are written in the zstd seekable "
+					 "format. 0 writes a single frame."),
+		&ZstdFrameSize,
+		0, 0, 1024 * 1024,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.zstd_dictionary_id",
+		gettext_noop("Sets the ID of the dictionary with which blobs are compressed "
+					 "with zstd."),
+		gettext_noop("Dictionaries are trained with blob_storage_train_zstd_dictionary "
+					 "and stored in the container of the blob. 0 uses no dictionary."),
+		&ZstdDictionaryId,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.adaptive_compression_sample_size",
+		gettext_noop("Sets the number of bytes that compression => 'adaptive' "
+					 "compresses with each candidate format."),
+		NULL,
+		&AdaptiveCompressionSampleSize,
+		4096, 64, 256 * 1024,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"azure.adaptive_compression_upload_bandwidth",
+		gettext_noop("Sets the upload bandwidth in MB/s that compression => "
+					 "'adaptive' assumes until it has measured it."),
+		gettext_noop("The bandwidth is measured while writing a blob, and used "
+					 "for the next blob in the session."),
+		&AdaptiveCompressionUploadBandwidth,
+		100, 1, 100000,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"azure.detect_content_encoding",
+		gettext_noop("Makes compression => 'auto' look at the content-encoding of "
+					 "blobs without a compression suffix."),
+		gettext_noop("Takes an extra request per blob."),
+		&DetectContentEncoding,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	InitializeBlobScan();
 }
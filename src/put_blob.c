@@ -15,6 +15,8 @@
 #include "access/htup_details.h"
 #include "access/tupdesc.h"
 #include "nodes/makefuncs.h"
+#include "pgazure/adaptive_compression.h"
+#include "pgazure/blob_stats.h"
 #include "pgazure/blob_storage.h"
 #include "pgazure/blob_storage_utils.h"
 #include "pgazure/byte_io.h"
@@ -28,6 +30,10 @@
 #include "utils/typcache.h"
 
 
+/* number of rows between measurements of the memory usage */
+#define MEMORY_USAGE_SAMPLE_INTERVAL 1024
+
+
 PG_FUNCTION_INFO_V1(blob_storage_put_blob_sfunc);
 PG_FUNCTION_INFO_V1(blob_storage_put_blob_final);
 
@@ -44,9 +50,40 @@ typedef struct
 	Datum *values;
 	bool *nulls;
 	TupleEncoder *encoder;
+
+	/*
+	 * When the encoder supports batches, rows are collected in batch until
+	 * it is full. Only rows with pass-by-reference columns need to be copied
+	 * into batchContext, since the other values do not point into the record.
+	 */
+	TupleBatch *batch;
+	MemoryContext batchContext;
+	bool batchCopiesRows;
+
+	/* memory used by the tuple encoder (including its per-row context) */
+	MemoryContext encoderContext;
+
+	/* memory used by the compressor and blob writer */
+	MemoryContext pipelineContext;
+
+	/* statistics written to a sidecar after the blob, if azure.write_blob_stats */
+	BlobStatsWriter *statsWriter;
+	char *connectionString;
+	char *containerName;
+	char *path;
+
+	/* memory accounting, reported when the export finishes */
+	uint64 rowCount;
+	Size peakEncoderMemory;
+	Size peakPipelineMemory;
 } BlobStoragePutBlobAggState;
 
 
+static bool TupleDescHasByReferenceColumns(TupleDesc tupleDescriptor);
+static void FlushTupleBatch(BlobStoragePutBlobAggState *aggregateState);
+static void UpdatePeakMemoryUsage(BlobStoragePutBlobAggState *aggregateState);
+
+
 /*
  * blob_storage_put_blob_sfunc is the sfunc (called per tuple) of the
  * blob_storage_put_blob aggregate. On the first call it initializes the
@@ -98,30 +135,68 @@ blob_storage_put_blob_sfunc(PG_FUNCTION_ARGS)
 
 		char *connectionString = AccountStringToConnectionString(accountString);
 
-		ByteSink *byteSink = palloc0(sizeof(ByteSink));
-		WriteBlockBlob(connectionString, containerName, path, byteSink);
+		aggregateState->encoderContext =
+			AllocSetContextCreate(aggContext, "blob_storage_put_blob encoder",
+			                      ALLOCSET_DEFAULT_SIZES);
+		aggregateState->pipelineContext =
+			AllocSetContextCreate(aggContext, "blob_storage_put_blob pipeline",
+			                      ALLOCSET_DEFAULT_SIZES);
 
 		if (strcmp(compressionString, "auto") == 0)
 		{
 			/* TODO: look at the content-type / content-encoding */
-			if (HasSuffix(path, ".gz"))
-			{
-				compressionString = "gzip";
-			}
-			else
-			{
-				compressionString = "none";
-			}
+			compressionString = CompressionStringFromFileName(path);
 		}
 
-		byteSink = BuildCompressor(compressionString, byteSink);
-
 		if (strcmp(encoderString, "auto") == 0)
 		{
 			/* TODO: look at the content-type / content-encoding */
 			encoderString = CodecStringFromFileName(path);
 		}
 
+		if (WriteBlobStats)
+		{
+			aggregateState->statsWriter =
+				CreateBlobStatsWriter(aggregateState->tupleDescriptor,
+				                      BlobStatsBloomColumns);
+			aggregateState->connectionString = connectionString;
+			aggregateState->containerName = containerName;
+			aggregateState->path = path;
+		}
+
+		MemoryContextSwitchTo(aggregateState->pipelineContext);
+
+		ByteSink *blobSink = palloc0(sizeof(ByteSink));
+		WriteBlockBlob(connectionString, containerName, path, blobSink);
+
+		ByteSink *byteSink = blobSink;
+
+		if (aggregateState->statsWriter != NULL)
+		{
+			byteSink = BlobStatsCountStoredBytes(aggregateState->statsWriter, byteSink);
+		}
+
+		if (strcmp(compressionString, "adaptive") == 0)
+		{
+			/* picks a format that agrees with the suffix of the blob name */
+			byteSink = CreateAdaptiveCompressor(byteSink, blobSink,
+			                                    CompressionStringFromFileName(path));
+		}
+		else
+		{
+			byteSink = BuildBlobCompressor(compressionString, byteSink, blobSink,
+			                               connectionString, containerName);
+		}
+
+		if (aggregateState->statsWriter != NULL)
+		{
+			byteSink = BlobStatsCountEncodedBytes(aggregateState->statsWriter, byteSink,
+			                                      CanReadBlobRanges(encoderString,
+			                                                        compressionString));
+		}
+
+		MemoryContextSwitchTo(aggregateState->encoderContext);
+
 		TupleEncoder *encoder = BuildTupleEncoder(encoderString,
 												  aggregateState->tupleDescriptor,
 		                                          byteSink);
@@ -130,6 +205,18 @@ blob_storage_put_blob_sfunc(PG_FUNCTION_ARGS)
 
 		aggregateState->encoder = encoder;
 
+		if (encoder->pushBatch != NULL)
+		{
+			aggregateState->batch = CreateTupleBatch(aggregateState->tupleDescriptor,
+			                                         TUPLE_BATCH_SIZE);
+			aggregateState->batchContext =
+				AllocSetContextCreate(aggregateState->encoderContext,
+				                      "blob_storage_put_blob batch",
+				                      ALLOCSET_DEFAULT_SIZES);
+			aggregateState->batchCopiesRows =
+				TupleDescHasByReferenceColumns(aggregateState->tupleDescriptor);
+		}
+
 		MemoryContextSwitchTo(oldContext);
 	}
 
@@ -140,14 +227,50 @@ blob_storage_put_blob_sfunc(PG_FUNCTION_ARGS)
 	tuple.t_tableOid = InvalidOid;
 	tuple.t_data = rec;
 
-	/* extract the tuple into the values and nulls arrays */
 	TupleDesc tupleDesc = aggregateState->tupleDescriptor;
 	Datum *values = aggregateState->values;
 	bool *nulls = aggregateState->nulls;
-	heap_deform_tuple(&tuple, tupleDesc, values, nulls);
+	TupleBatch *batch = aggregateState->batch;
 
-	/* encode the tuple and write it to the byte sink */
-	aggregateState->encoder->push(aggregateState->encoder->state, values, nulls);
+	if (batch != NULL)
+	{
+		if (aggregateState->batchCopiesRows)
+		{
+			/* the record is only valid during this call, so copy it into the batch */
+			tuple.t_data = MemoryContextAlloc(aggregateState->batchContext,
+			                                  tuple.t_len);
+			memcpy(tuple.t_data, rec, tuple.t_len);
+		}
+
+		heap_deform_tuple(&tuple, tupleDesc, values, nulls);
+		TupleBatchAppendRow(batch, values, nulls);
+		aggregateState->rowCount++;
+
+		if (batch->rowCount == batch->maxRows)
+		{
+			FlushTupleBatch(aggregateState);
+		}
+	}
+	else
+	{
+		/* extract the tuple into the values and nulls arrays */
+		heap_deform_tuple(&tuple, tupleDesc, values, nulls);
+
+		/* encode the tuple and write it to the byte sink */
+		aggregateState->encoder->push(aggregateState->encoder->state, values, nulls);
+		aggregateState->rowCount++;
+
+		if (aggregateState->statsWriter != NULL)
+		{
+			BlobStatsAddRow(aggregateState->statsWriter, values, nulls);
+			BlobStatsRowsEncoded(aggregateState->statsWriter, aggregateState->encoder);
+		}
+
+		if (aggregateState->rowCount % MEMORY_USAGE_SAMPLE_INTERVAL == 0)
+		{
+			UpdatePeakMemoryUsage(aggregateState);
+		}
+	}
 
 	PG_RETURN_POINTER(aggregateState);
 }
@@ -165,9 +288,110 @@ blob_storage_put_blob_final(PG_FUNCTION_ARGS)
 		(BlobStoragePutBlobAggState *) PG_GETARG_POINTER(0);
 	TupleEncoder *encoder = aggregateState->encoder;
 
+	if (aggregateState->batch != NULL && aggregateState->batch->rowCount > 0)
+	{
+		FlushTupleBatch(aggregateState);
+	}
+	else if (aggregateState->batch == NULL)
+	{
+		UpdatePeakMemoryUsage(aggregateState);
+	}
+
 	encoder->finish(encoder->state);
 
+	if (aggregateState->statsWriter != NULL)
+	{
+		WriteBlobStatsSidecar(aggregateState->statsWriter,
+		                      aggregateState->connectionString,
+		                      aggregateState->containerName, aggregateState->path);
+	}
+
+	ereport(DEBUG1, (errmsg("blob_storage_put_blob wrote " UINT64_FORMAT " rows",
+	                        aggregateState->rowCount),
+	                 errdetail("Peak encoder memory: %zu bytes, peak pipeline "
+	                           "memory: %zu bytes, excluding memory allocated by "
+	                           "the blob storage client and compression libraries.",
+	                           aggregateState->peakEncoderMemory,
+	                           aggregateState->peakPipelineMemory)));
+
+	MemoryContextDelete(aggregateState->encoderContext);
+	MemoryContextDelete(aggregateState->pipelineContext);
+
 	ReleaseTupleDesc(aggregateState->tupleDescriptor);
 
 	PG_RETURN_VOID();
 }
+
+
+/*
+ * TupleDescHasByReferenceColumns returns whether any column of the tuple
+ * descriptor has a pass-by-reference type.
+ */
+static bool
+TupleDescHasByReferenceColumns(TupleDesc tupleDescriptor)
+{
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (!attr->attisdropped && !attr->attbyval)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * FlushTupleBatch encodes the rows collected in the batch and frees the
+ * memory used by their copies.
+ */
+static void
+FlushTupleBatch(BlobStoragePutBlobAggState *aggregateState)
+{
+	TupleBatch *batch = aggregateState->batch;
+
+	TupleEncoderPushBatch(aggregateState->encoder, batch);
+
+	if (aggregateState->statsWriter != NULL)
+	{
+		BlobStatsAddBatch(aggregateState->statsWriter, batch);
+		BlobStatsRowsEncoded(aggregateState->statsWriter, aggregateState->encoder);
+	}
+
+	/* measure before freeing the batch, which is part of the encoder memory */
+	UpdatePeakMemoryUsage(aggregateState);
+
+	batch->rowCount = 0;
+	MemoryContextReset(aggregateState->batchContext);
+}
+
+
+/*
+ * UpdatePeakMemoryUsage records the amount of memory currently allocated by
+ * the encoder and the compression/upload pipeline if it exceeds the previous
+ * peak. Walking the memory contexts is not free, so it is called after every
+ * batch, or every MEMORY_USAGE_SAMPLE_INTERVAL rows without batches, which
+ * may miss a short spike on a large row in between.
+ *
+ * Only memory in PostgreSQL memory contexts is seen. The block buffers of
+ * the blob storage client, the contexts of zstd and lz4, and the buffers of
+ * compression threads are allocated with malloc or new and not included.
+ */
+static void
+UpdatePeakMemoryUsage(BlobStoragePutBlobAggState *aggregateState)
+{
+#if PG_VERSION_NUM >= 130000
+	Size encoderMemory = MemoryContextMemAllocated(aggregateState->encoderContext,
+	                                               true);
+	Size pipelineMemory = MemoryContextMemAllocated(aggregateState->pipelineContext,
+	                                                true);
+
+	aggregateState->peakEncoderMemory = Max(aggregateState->peakEncoderMemory,
+	                                        encoderMemory);
+	aggregateState->peakPipelineMemory = Max(aggregateState->peakPipelineMemory,
+	                                         pipelineMemory);
+#endif
+}
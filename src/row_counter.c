@@ -0,0 +1,278 @@
+/*-------------------------------------------------------------------------
+ *
+ * row_counter.c
+ *     Counting rows in csv and tsv data without decoding them. On x86-64,
+ *     buffers are scanned 16 bytes at a time with SSE2, and quotes are
+ *     handled by a prefix XOR of the quote bits, as in simdjson. Otherwise
+ *     we fall back to a scalar scan that skips 8 bytes at a time.
+ *
+ * Rows end at a newline, outside double quotes for csv. A final row that
+ * does not end with a newline also counts. Like the csv decoder, we assume
+ * that quotes inside quoted values are escaped by doubling them.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "pgazure/row_counter.h"
+#include "port/pg_bitutils.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define USE_SSE2_ROW_COUNTER
+#include <emmintrin.h>
+#endif
+
+
+/*
+ * RowCounter contains the state of counting rows in a stream.
+ */
+struct RowCounter
+{
+	RowCounterMode mode;
+
+	/* minimum number of bytes in a range, or 0 for a single range */
+	uint64 rangeSize;
+
+	/* number of bytes seen so far, and the offset at which the row starts */
+	uint64 offset;
+	uint64 rowStart;
+
+	/* whether the end of the bytes seen so far is inside a quoted value */
+	bool inQuotes;
+
+	RowCountRange *currentRange;
+	List *rangeList;
+};
+
+
+static inline void CountRow(RowCounter *counter, uint64 rowEnd);
+static inline bool ChunkHasByte(uint64 chunk, uint8 byte);
+static void CountRowsScalar(RowCounter *counter, const uint8 *bytes, int start,
+                            int end);
+#ifdef USE_SSE2_ROW_COUNTER
+static int CountRowsSSE2(RowCounter *counter, const uint8 *bytes, int length);
+#endif
+
+
+/*
+ * CreateRowCounter creates a row counter. If rangeSize is larger than 0, the
+ * rows are counted per range of at least rangeSize bytes, otherwise for the
+ * stream as a whole.
+ */
+RowCounter *
+CreateRowCounter(RowCounterMode mode, uint64 rangeSize)
+{
+	RowCounter *counter = palloc0(sizeof(RowCounter));
+	counter->mode = mode;
+	counter->rangeSize = rangeSize;
+	counter->currentRange = palloc0(sizeof(RowCountRange));
+
+	return counter;
+}
+
+
+/*
+ * RowCounterAddBytes counts the rows that end in the next bytes of the
+ * stream.
+ */
+void
+RowCounterAddBytes(RowCounter *counter, const char *buffer, int length)
+{
+	const uint8 *bytes = (const uint8 *) buffer;
+	int position = 0;
+
+	if (counter->mode != ROW_COUNTER_WHOLE)
+	{
+#ifdef USE_SSE2_ROW_COUNTER
+		position = CountRowsSSE2(counter, bytes, length);
+#endif
+
+		CountRowsScalar(counter, bytes, position, length);
+	}
+
+	counter->offset += length;
+}
+
+
+/*
+ * RowCounterFinish counts the final row if the stream does not end with a
+ * newline and returns the list of RowCountRange. There is at least one
+ * range, which is empty for an empty stream.
+ */
+List *
+RowCounterFinish(RowCounter *counter)
+{
+	if (counter->offset > counter->rowStart)
+	{
+		CountRow(counter, counter->offset);
+	}
+
+	RowCountRange *range = counter->currentRange;
+
+	if (range->rowCount > 0 || counter->rangeList == NIL)
+	{
+		range->endOffset = counter->offset;
+		counter->rangeList = lappend(counter->rangeList, range);
+	}
+
+	counter->currentRange = NULL;
+
+	return counter->rangeList;
+}
+
+
+/*
+ * CountRow adds a row that ends at rowEnd (after its newline) to the current
+ * range, and starts a new range once the current one has reached its size.
+ */
+static inline void
+CountRow(RowCounter *counter, uint64 rowEnd)
+{
+	RowCountRange *range = counter->currentRange;
+	uint64 rowLength = rowEnd - counter->rowStart;
+
+	if (range->rowCount == 0 || rowLength < range->minRowLength)
+	{
+		range->minRowLength = rowLength;
+	}
+
+	if (rowLength > range->maxRowLength)
+	{
+		range->maxRowLength = rowLength;
+	}
+
+	range->rowCount++;
+	counter->rowStart = rowEnd;
+
+	if (counter->rangeSize > 0 && rowEnd - range->startOffset >= counter->rangeSize)
+	{
+		range->endOffset = rowEnd;
+		counter->rangeList = lappend(counter->rangeList, range);
+
+		counter->currentRange = palloc0(sizeof(RowCountRange));
+		counter->currentRange->startOffset = rowEnd;
+	}
+}
+
+
+/*
+ * ChunkHasByte returns whether any of the 8 bytes in chunk equals byte.
+ */
+static inline bool
+ChunkHasByte(uint64 chunk, uint8 byte)
+{
+	uint64 differences = chunk ^ (UINT64CONST(0x0101010101010101) * byte);
+
+	return ((differences - UINT64CONST(0x0101010101010101)) & ~differences &
+			UINT64CONST(0x8080808080808080)) != 0;
+}
+
+
+/*
+ * CountRowsScalar counts the rows that end between start and end in bytes,
+ * which starts at the current offset of the counter.
+ */
+static void
+CountRowsScalar(RowCounter *counter, const uint8 *bytes, int start, int end)
+{
+	bool isCsv = counter->mode == ROW_COUNTER_CSV;
+	int position = start;
+
+	while (position < end)
+	{
+		/* skip over 8 bytes at a time that have no newlines or quotes */
+		while (end - position >= 8)
+		{
+			uint64 chunk;
+
+			memcpy(&chunk, bytes + position, sizeof(chunk));
+
+			if (ChunkHasByte(chunk, '\n') || (isCsv && ChunkHasByte(chunk, '"')))
+			{
+				break;
+			}
+
+			position += 8;
+		}
+
+		if (position >= end)
+		{
+			break;
+		}
+
+		uint8 byte = bytes[position];
+
+		if (isCsv && byte == '"')
+		{
+			counter->inQuotes = !counter->inQuotes;
+		}
+		else if (byte == '\n' && !counter->inQuotes)
+		{
+			CountRow(counter, counter->offset + position + 1);
+		}
+
+		position++;
+	}
+}
+
+
+#ifdef USE_SSE2_ROW_COUNTER
+
+/*
+ * CountRowsSSE2 counts the rows that end in bytes 16 bytes at a time, and
+ * returns the number of bytes it processed. The remainder, which is shorter
+ * than 16 bytes, is left to the scalar scan.
+ *
+ * Bit i of the prefix XOR of the quote bits is set when byte i comes after
+ * an odd number of quotes in the block, so together with the quote state at
+ * the start of the block it marks the bytes inside quoted values.
+ */
+static int
+CountRowsSSE2(RowCounter *counter, const uint8 *bytes, int length)
+{
+	const __m128i newlines = _mm_set1_epi8('\n');
+	const __m128i quotes = _mm_set1_epi8('"');
+	bool isCsv = counter->mode == ROW_COUNTER_CSV;
+	int position = 0;
+
+	for (; length - position >= 16; position += 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *) (bytes + position));
+		uint32 newlineBits = (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+
+		if (isCsv)
+		{
+			uint32 quotedBits = (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(block, quotes));
+
+			quotedBits ^= quotedBits << 1;
+			quotedBits ^= quotedBits << 2;
+			quotedBits ^= quotedBits << 4;
+			quotedBits ^= quotedBits << 8;
+
+			if (counter->inQuotes)
+			{
+				quotedBits = ~quotedBits;
+			}
+
+			quotedBits &= 0xFFFF;
+
+			newlineBits &= ~quotedBits;
+			counter->inQuotes = (quotedBits & 0x8000) != 0;
+		}
+
+		while (newlineBits != 0)
+		{
+			int bitIndex = pg_rightmost_one_pos32(newlineBits);
+
+			CountRow(counter, counter->offset + position + bitIndex + 1);
+			newlineBits &= newlineBits - 1;
+		}
+	}
+
+	return position;
+}
+
+
+#endif
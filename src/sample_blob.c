@@ -0,0 +1,554 @@
+/*-------------------------------------------------------------------------
+ *
+ * sample_blob.c
+ *     Implementation the blob_storage_sample_blob UDFs
+ *
+ * A sample of a blob is taken by reading random byte ranges of it. Each
+ * range is trimmed to the rows that start and end within it, of which up
+ * to a fixed number is decoded. Since rows after a random offset are
+ * picked with a probability proportional to the length of the row before
+ * them, the sample is only approximately uniform.
+ *
+ * For csv, a range that starts inside a quoted value with newlines cannot
+ * be told apart from one that does not, so ranges that fail to decode are
+ * skipped.
+ *
+ * gzip blobs can be sampled if they have a gzip index (see gzip_index.c), in
+ * which case the ranges are taken from the uncompressed data.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "access/xact.h"
+#if PG_VERSION_NUM >= 150000
+#include "common/pg_prng.h"
+#endif
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/codecs.h"
+#include "pgazure/row_counter.h"
+#include "pgazure/sample_blob.h"
+#include "pgazure/set_returning_functions.h"
+#include "pgazure/storage_account.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+#include "utils/tuplestore.h"
+
+
+/*
+ * SampleTupleStoreContext is passed to AddSampleRowToTupleStore.
+ */
+typedef struct SampleTupleStoreContext
+{
+	Tuplestorestate *tupleStore;
+	TupleDesc tupleDescriptor;
+} SampleTupleStoreContext;
+
+
+static void SampleBlobIntoTuplestore(char *connectionString, char *containerName,
+                                     char *path, char *decoderString,
+                                     char *compressionString, int rangeCount,
+                                     int rowsPerRange, Tuplestorestate *tupleStore,
+                                     TupleDesc tupleDescriptor);
+static void AddSampleRowToTupleStore(void *context, Datum *columnValues,
+                                     bool *columnNulls);
+static List * DecodeSampleRange(char *decoderString, TupleDesc tupleDescriptor,
+                                char *rows, int length, int maxRows);
+static double RandomFraction(void);
+static int CompareOffsets(const void *left, const void *right);
+
+
+PG_FUNCTION_INFO_V1(blob_storage_sample_blob);
+PG_FUNCTION_INFO_V1(blob_storage_sample_blob_anyelement);
+
+
+/*
+ * blob_storage_sample_blob returns a sample of the rows of a blob.
+ *
+ * The tuple is described by a list of output columns in the SQL query.
+ */
+Datum
+blob_storage_sample_blob(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errmsg("connection_string argument is required")));
+	}
+	if (PG_ARGISNULL(1))
+	{
+		ereport(ERROR, (errmsg("container_name argument is required")));
+	}
+	if (PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errmsg("path argument is required")));
+	}
+	if (PG_ARGISNULL(3))
+	{
+		ereport(ERROR, (errmsg("sample_ranges argument is required")));
+	}
+	if (PG_ARGISNULL(4))
+	{
+		ereport(ERROR, (errmsg("rows_per_range argument is required")));
+	}
+	if (PG_ARGISNULL(5))
+	{
+		ereport(ERROR, (errmsg("decoder argument is required")));
+	}
+	if (PG_ARGISNULL(6))
+	{
+		ereport(ERROR, (errmsg("compression argument is required")));
+	}
+
+	char *accountString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *containerName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *path = text_to_cstring(PG_GETARG_TEXT_P(2));
+	int rangeCount = PG_GETARG_INT32(3);
+	int rowsPerRange = PG_GETARG_INT32(4);
+	char *decoderString = text_to_cstring(PG_GETARG_TEXT_P(5));
+	char *compressionString = text_to_cstring(PG_GETARG_TEXT_P(6));
+
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	char *connectionString = AccountStringToConnectionString(accountString);
+
+	SampleBlobIntoTuplestore(connectionString, containerName, path, decoderString,
+	                         compressionString, rangeCount, rowsPerRange, tupleStore,
+	                         tupleDescriptor);
+
+	PG_RETURN_DATUM(0);
+}
+
+
+/*
+ * blob_storage_sample_blob_anyelement returns a sample of the rows of a blob.
+ *
+ * The tuple is described by a dummy argument with the same type as the tuple.
+ */
+Datum
+blob_storage_sample_blob_anyelement(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errmsg("connection_string argument is required")));
+	}
+	if (PG_ARGISNULL(1))
+	{
+		ereport(ERROR, (errmsg("container_name argument is required")));
+	}
+	if (PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errmsg("path argument is required")));
+	}
+	if (PG_ARGISNULL(4))
+	{
+		ereport(ERROR, (errmsg("sample_ranges argument is required")));
+	}
+	if (PG_ARGISNULL(5))
+	{
+		ereport(ERROR, (errmsg("rows_per_range argument is required")));
+	}
+	if (PG_ARGISNULL(6))
+	{
+		ereport(ERROR, (errmsg("decoder argument is required")));
+	}
+	if (PG_ARGISNULL(7))
+	{
+		ereport(ERROR, (errmsg("compression argument is required")));
+	}
+
+	char *accountString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *containerName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *path = text_to_cstring(PG_GETARG_TEXT_P(2));
+	int rangeCount = PG_GETARG_INT32(4);
+	int rowsPerRange = PG_GETARG_INT32(5);
+	char *decoderString = text_to_cstring(PG_GETARG_TEXT_P(6));
+	char *compressionString = text_to_cstring(PG_GETARG_TEXT_P(7));
+
+	Oid typeId = get_fn_expr_argtype(fcinfo->flinfo, 3);
+	TupleDesc tupleDescriptor = TypeGetTupleDesc(typeId, NIL);
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	char *connectionString = AccountStringToConnectionString(accountString);
+
+	SampleBlobIntoTuplestore(connectionString, containerName, path, decoderString,
+	                         compressionString, rangeCount, rowsPerRange, tupleStore,
+	                         tupleDescriptor);
+
+	PG_RETURN_DATUM(0);
+}
+
+
+/*
+ * SampleBlobIntoTuplestore writes a sample of the rows of a blob into a
+ * tuple store.
+ */
+static void
+SampleBlobIntoTuplestore(char *connectionString, char *containerName, char *path,
+                         char *decoderString, char *compressionString, int rangeCount,
+                         int rowsPerRange, Tuplestorestate *tupleStore,
+                         TupleDesc tupleDescriptor)
+{
+	if (rangeCount < 1 || rowsPerRange < 1)
+	{
+		ereport(ERROR, (errmsg("sample_ranges and rows_per_range must be at least 1")));
+	}
+
+	if (strcmp(decoderString, "auto") == 0)
+	{
+		/* csv and tsv blobs are recognized by their suffix, like in get_blob */
+		decoderString = CodecStringFromFileName(path);
+	}
+
+	if (strcmp(compressionString, "auto") == 0)
+	{
+		compressionString = CompressionStringForBlob(connectionString, containerName,
+		                                             path);
+	}
+
+	if (!CanSampleBlob(decoderString, compressionString))
+	{
+		ereport(ERROR, (errmsg("only uncompressed, gzip or zstd csv and tsv blobs can "
+		                       "be sampled")));
+	}
+
+	SampleTupleStoreContext context = {
+		.tupleStore = tupleStore,
+		.tupleDescriptor = tupleDescriptor
+	};
+	uint64 blobSize = GetBlobSize(connectionString, containerName, path);
+	GzipIndex *gzipIndex = NULL;
+	ZstdSeekTable *zstdSeekTable = NULL;
+	double estimatedRowCount = 0;
+
+	if (strcmp(compressionString, "zstd") == 0)
+	{
+		zstdSeekTable = ReadZstdSeekTable(connectionString, containerName, path,
+		                                  blobSize);
+
+		if (zstdSeekTable == NULL)
+		{
+			ereport(ERROR, (errmsg("zstd blob %s does not have a seek table", path),
+			                errhint("Write the blob with azure.zstd_frame_size set.")));
+		}
+	}
+	else if (strcmp(compressionString, "none") != 0)
+	{
+		gzipIndex = ReadGzipIndex(connectionString, containerName, path, blobSize);
+
+		if (gzipIndex == NULL)
+		{
+			ereport(ERROR, (errmsg("gzip blob %s does not have an up-to-date gzip "
+			                       "index", path),
+			                errhint("Use blob_storage_build_gzip_index to build one.")));
+		}
+	}
+
+	SampleBlobRanges(connectionString, containerName, path, blobSize, gzipIndex,
+	                 zstdSeekTable, decoderString, tupleDescriptor, rangeCount, rowsPerRange,
+	                 AddSampleRowToTupleStore, &context, &estimatedRowCount);
+}
+
+
+/*
+ * AddSampleRowToTupleStore adds a sampled row to the tuple store in the
+ * SampleTupleStoreContext.
+ */
+static void
+AddSampleRowToTupleStore(void *context, Datum *columnValues, bool *columnNulls)
+{
+	SampleTupleStoreContext *tupleStoreContext = (SampleTupleStoreContext *) context;
+
+	tuplestore_putvalues(tupleStoreContext->tupleStore,
+	                     tupleStoreContext->tupleDescriptor, columnValues, columnNulls);
+}
+
+
+/*
+ * CanSampleBlob returns whether blobs with the given decoder and compression
+ * can be sampled, which requires reading from any offset and finding the
+ * next row from there. gzip blobs additionally need a gzip index, and zstd
+ * blobs a seek table.
+ */
+bool
+CanSampleBlob(char *decoderString, char *compressionString)
+{
+	return (strcmp(decoderString, "csv") == 0 || strcmp(decoderString, "tsv") == 0) &&
+		   (strcmp(compressionString, "none") == 0 ||
+			strcmp(compressionString, "gzip") == 0 ||
+			strcmp(compressionString, "zstd") == 0);
+}
+
+
+/*
+ * SampleBlobRanges reads rangeCount random byte ranges of a blob of
+ * blobSize bytes, decodes up to rowsPerRange rows from each, and passes
+ * them to processRow. It returns the number of sampled rows and sets
+ * estimatedRowCount to an estimate of the number of rows in the blob,
+ * based on the number of rows per byte in the ranges.
+ *
+ * If gzipIndex or zstdSeekTable is not NULL, the ranges are read from the
+ * uncompressed contents of the blob through the index or seek table.
+ */
+uint64
+SampleBlobRanges(char *connectionString, char *containerName, char *path,
+                 uint64 blobSize, GzipIndex *gzipIndex, ZstdSeekTable *zstdSeekTable,
+                 char *decoderString,
+                 TupleDesc tupleDescriptor, int rangeCount, int rowsPerRange,
+                 BlobSampleRowFunc processRow, void *processRowContext,
+                 double *estimatedRowCount)
+{
+	RowCounterMode counterMode = strcmp(decoderString, "csv") == 0 ?
+								 ROW_COUNTER_CSV : ROW_COUNTER_LINES;
+	uint64 *offsets = palloc(rangeCount * sizeof(uint64));
+	char *rangeBuffer = palloc(BLOB_SAMPLE_RANGE_SIZE);
+	Datum *columnValues = palloc0(Max(tupleDescriptor->natts, 1) * sizeof(Datum));
+	bool *columnNulls = palloc0(Max(tupleDescriptor->natts, 1) * sizeof(bool));
+	uint64 sampledEnd = 0;
+	uint64 sampleRowCount = 0;
+	double countedRows = 0;
+	double countedBytes = 0;
+	int failedRangeCount = 0;
+
+	*estimatedRowCount = 0;
+
+	if (gzipIndex != NULL)
+	{
+		blobSize = gzipIndex->uncompressedSize;
+	}
+	else if (zstdSeekTable != NULL)
+	{
+		blobSize = zstdSeekTable->uncompressedSize;
+	}
+
+	if (blobSize == 0)
+	{
+		return 0;
+	}
+
+	for (int rangeIndex = 0; rangeIndex < rangeCount; rangeIndex++)
+	{
+		offsets[rangeIndex] = (uint64) (RandomFraction() * blobSize);
+	}
+
+	/* read the ranges in order, such that overlapping ranges can be skipped */
+	qsort(offsets, rangeCount, sizeof(uint64), CompareOffsets);
+
+	MemoryContext rangeContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                                   "blob sample range",
+	                                                   ALLOCSET_DEFAULT_SIZES);
+
+	for (int rangeIndex = 0; rangeIndex < rangeCount; rangeIndex++)
+	{
+		uint64 offset = offsets[rangeIndex];
+		ListCell *tupleCell = NULL;
+
+		if (rangeIndex > 0 && offset < sampledEnd)
+		{
+			continue;
+		}
+
+		int rangeLength = (int) Min(blobSize - offset, BLOB_SAMPLE_RANGE_SIZE);
+
+		if (gzipIndex != NULL)
+		{
+			rangeLength = ReadGzipIndexedRange(connectionString, containerName, path,
+			                                   gzipIndex, offset, rangeBuffer,
+			                                   rangeLength);
+		}
+		else if (zstdSeekTable != NULL)
+		{
+			rangeLength = ReadZstdSeekableRange(connectionString, containerName, path,
+			                                    zstdSeekTable, offset, rangeBuffer,
+			                                    rangeLength);
+		}
+		else
+		{
+			rangeLength = ReadBlockBlobRange(connectionString, containerName, path,
+			                                 offset, rangeBuffer, rangeLength);
+		}
+
+		int rowsStart = 0;
+		int rowsEnd = rangeLength;
+
+		if (offset > 0)
+		{
+			/* skip to the start of the next row */
+			char *newline = memchr(rangeBuffer, '\n', rangeLength);
+
+			rowsStart = newline != NULL ? newline - rangeBuffer + 1 : rangeLength;
+		}
+
+		if (offset + rangeLength < blobSize)
+		{
+			/* leave out the row that continues after the range */
+			while (rowsEnd > rowsStart && rangeBuffer[rowsEnd - 1] != '\n')
+			{
+				rowsEnd--;
+			}
+		}
+
+		if (rowsEnd <= rowsStart)
+		{
+			/* no complete row in the range */
+			continue;
+		}
+
+		sampledEnd = offset + rowsEnd;
+
+		MemoryContext oldContext = MemoryContextSwitchTo(rangeContext);
+
+		RowCounter *counter = CreateRowCounter(counterMode, 0);
+		RowCounterAddBytes(counter, rangeBuffer + rowsStart, rowsEnd - rowsStart);
+		RowCountRange *countRange = (RowCountRange *) linitial(RowCounterFinish(counter));
+
+		List *tupleList = DecodeSampleRange(decoderString, tupleDescriptor,
+		                                    rangeBuffer + rowsStart, rowsEnd - rowsStart,
+		                                    rowsPerRange);
+
+		MemoryContextSwitchTo(oldContext);
+
+		if (tupleList == NIL)
+		{
+			failedRangeCount++;
+			MemoryContextReset(rangeContext);
+			continue;
+		}
+
+		countedRows += countRange->rowCount;
+		countedBytes += rowsEnd - rowsStart;
+
+		foreach(tupleCell, tupleList)
+		{
+			HeapTuple tuple = (HeapTuple) lfirst(tupleCell);
+
+			heap_deform_tuple(tuple, tupleDescriptor, columnValues, columnNulls);
+			processRow(processRowContext, columnValues, columnNulls);
+			sampleRowCount++;
+		}
+
+		MemoryContextReset(rangeContext);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	MemoryContextDelete(rangeContext);
+
+	if (countedBytes > 0)
+	{
+		*estimatedRowCount = countedRows * blobSize / countedBytes;
+	}
+
+	ereport(DEBUG1, (errmsg("sampled " UINT64_FORMAT " rows from %s", sampleRowCount,
+	                        path),
+	                 errdetail("%d of %d ranges could not be decoded.",
+	                           failedRangeCount, rangeCount)));
+
+	return sampleRowCount;
+}
+
+
+/*
+ * DecodeSampleRange decodes up to maxRows rows from a buffer of complete rows
+ * and returns them as a list of heap tuples, or NIL if the rows could not be
+ * decoded. Decoding runs in a subtransaction, such that a range that was
+ * split in the middle of a quoted value only loses that range.
+ */
+static List *
+DecodeSampleRange(char *decoderString, TupleDesc tupleDescriptor, char *rows,
+                  int length, int maxRows)
+{
+	MemoryContext oldContext = CurrentMemoryContext;
+	ResourceOwner oldOwner = CurrentResourceOwner;
+	List *volatile tupleList = NIL;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldContext);
+
+	PG_TRY();
+	{
+		Datum *columnValues = palloc0(Max(tupleDescriptor->natts, 1) * sizeof(Datum));
+		bool *columnNulls = palloc0(Max(tupleDescriptor->natts, 1) * sizeof(bool));
+		ByteSource *byteSource = CreateMemoryByteSource(rows, length);
+		TupleDecoder *decoder = BuildTupleDecoder(decoderString, tupleDescriptor,
+		                                          byteSource, NULL, NULL);
+
+		decoder->start(decoder->state);
+
+		while (list_length(tupleList) < maxRows &&
+		       decoder->next(decoder->state, columnValues, columnNulls))
+		{
+			tupleList = lappend(tupleList, heap_form_tuple(tupleDescriptor, columnValues,
+			                                               columnNulls));
+		}
+
+		decoder->finish(decoder->state);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldContext);
+		CurrentResourceOwner = oldOwner;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldContext);
+
+		ErrorData *errorData = CopyErrorData();
+
+		FlushErrorState();
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldContext);
+		CurrentResourceOwner = oldOwner;
+
+		/* only malformed data is expected, anything else (e.g. cancellation) is not */
+		if (ERRCODE_TO_CATEGORY(errorData->sqlerrcode) != ERRCODE_DATA_EXCEPTION)
+		{
+			ReThrowError(errorData);
+		}
+
+		FreeErrorData(errorData);
+		tupleList = NIL;
+	}
+	PG_END_TRY();
+
+	return tupleList;
+}
+
+
+/*
+ * RandomFraction returns a random number in [0, 1).
+ */
+static double
+RandomFraction(void)
+{
+#if PG_VERSION_NUM >= 150000
+	return pg_prng_double(&pg_global_prng_state);
+#else
+	return (double) random() / ((double) MAX_RANDOM_VALUE + 1);
+#endif
+}
+
+
+/*
+ * CompareOffsets is a qsort comparator for uint64 offsets.
+ */
+static int
+CompareOffsets(const void *left, const void *right)
+{
+	uint64 leftOffset = *((const uint64 *) left);
+	uint64 rightOffset = *((const uint64 *) right);
+
+	if (leftOffset < rightOffset)
+	{
+		return -1;
+	}
+
+	return leftOffset > rightOffset ? 1 : 0;
+}
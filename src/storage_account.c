@@ -17,8 +17,7 @@
 char *
 AccountStringToConnectionString(char *accountString)
 {
-	if (memcmp(accountString, CONNECTION_STRING_PREFIX,
-			   strlen(CONNECTION_STRING_PREFIX)) == 0)
+	if (IsConnectionString(accountString))
 	{
 		return accountString;
 	}
@@ -29,6 +28,22 @@ AccountStringToConnectionString(char *accountString)
 }
 
 
+/*
+ * IsConnectionString returns whether accountString is a connection string,
+ * which may contain credentials, rather than the name of a storage account.
+ * Account names cannot contain '=', so we also treat connection strings that
+ * do not start with DefaultEndpointsProtocol, such as ones with a shared
+ * access signature, as connection strings.
+ */
+bool
+IsConnectionString(const char *accountString)
+{
+	return strncmp(accountString, CONNECTION_STRING_PREFIX,
+	               strlen(CONNECTION_STRING_PREFIX)) == 0 ||
+		   strchr(accountString, '=') != NULL;
+}
+
+
 /*
  * GetAccountTuple returns a StorageAccount struct for the given account
  * name containing the connection string, or NULL if the storage account
@@ -63,7 +78,8 @@ GetStorageAccount(const char *accountName)
 
 	if (SPI_processed != 1)
 	{
-		ereport(ERROR, (errmsg("storage account \"%s\" not found", accountName),
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+		                errmsg("storage account \"%s\" not found", accountName),
 						errhint("Use SELECT azure.add_storage_account('%s', "
 		                        "'<connection string>')", accountName)));
 	}
@@ -13,9 +13,11 @@
 #include "miscadmin.h"
 
 #include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
 #include "pgazure/byte_io.h"
 #include "pgazure/codecs.h"
 #include "pgazure/text_codec.h"
+#include "pgazure/utf8_validation.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 
@@ -35,6 +37,12 @@ typedef struct TextDecoderState
 	 */
 	bool valueReturned;
 
+	/* whether the query uses the value, otherwise we return NULL */
+	bool valueProjected;
+
+	/* filter applied to the value, or NULL */
+	TupleDecoderFilter *filter;
+
 	/* OID of the input function used to parse the source data */
 	Oid inputFunctionId;
 	Oid typeIOParam;
@@ -53,16 +61,25 @@ static void TextDecoderFinish(void *state);
  * which contain a single JSON object.
  */
 TupleDecoder *
-CreateTextDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor)
+CreateTextDecoder(ByteSource *byteSource, TupleDesc tupleDescriptor,
+                  bool *projectedColumns, TupleDecoderFilter *filter)
 {
 	if (tupleDescriptor->natts != 1)
 	{
 		ereport(ERROR, (errmsg("can only use text encoder with a single column")));
 	}
 
+	/* in UTF-8 databases, validate the input as it is read */
+	if (GetDatabaseEncoding() == PG_UTF8)
+	{
+		byteSource = CreateUtf8ValidatingSource(byteSource);
+	}
+
 	TextDecoderState *state = palloc0(sizeof(TextDecoderState));
 	state->byteSource = byteSource;
 	state->valueReturned = false;
+	state->valueProjected = projectedColumns == NULL || projectedColumns[0];
+	state->filter = filter;
 
 	Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, 0);
 	Oid valueTypeId = attr->atttypid;
@@ -103,6 +120,14 @@ TextDecoderNext(void *state, Datum *columnValues, bool *columnNulls)
 		return false;
 	}
 
+	if (!decoder->valueProjected)
+	{
+		/* no need to read the blob if the value is not used */
+		columnNulls[0] = true;
+		decoder->valueReturned = true;
+		return true;
+	}
+
 	ByteSource* byteSource = decoder->byteSource;
 	StringInfo text = makeStringInfo();
 	char buffer[65536];
@@ -112,15 +137,18 @@ TextDecoderNext(void *state, Datum *columnValues, bool *columnNulls)
 	{
 		bytesRead = byteSource->read(byteSource->context, buffer, 0, 65536);
 
-		for (int byteIndex = 0; byteIndex < bytesRead; byteIndex++)
-		{
-			appendStringInfoCharMacro(text, buffer[byteIndex]);
-		}
+		appendBinaryStringInfo(text, buffer, bytesRead);
 
 		CHECK_FOR_INTERRUPTS();
 	}
 	while (bytesRead > 0);
 
+	/* UTF-8 input was already validated by the byte source */
+	if (GetDatabaseEncoding() != PG_UTF8)
+	{
+		pg_verifymbstr(text->data, text->len, false);
+	}
+
 	if (text->len == 0)
 	{
 		columnNulls[0] = true;
@@ -135,6 +163,12 @@ TextDecoderNext(void *state, Datum *columnValues, bool *columnNulls)
 	/* there will not be a second row */
 	decoder->valueReturned = true;
 
+	TupleDecoderFilter *filter = decoder->filter;
+	if (filter != NULL && !filter->matches(filter->context, columnValues, columnNulls))
+	{
+		return false;
+	}
+
 	return true;
 }
 
@@ -18,12 +18,19 @@
 #include "pgazure/copy_utils.h"
 #include "pgazure/text_codec.h"
 #include "utils/builtins.h"
+#include "utils/memutils.h"
 
 
 typedef struct TextEncoderState
 {
 	ByteSink *byteSink;
 	FmgrInfo *columnOutputFunctions;
+
+	/* buffer that is reused across rows */
+	StringInfo buffer;
+
+	/* memory context that is reset for every row */
+	MemoryContext rowContext;
 } TextEncoderState;
 
 
@@ -51,6 +58,10 @@ CreateTextEncoder(ByteSink *byteSink, TupleDesc tupleDescriptor)
 	TextEncoderState *state = palloc0(sizeof(TextEncoderState));
 	state->byteSink = byteSink;
 	state->columnOutputFunctions = ColumnOutputFunctions(tupleDescriptor, false);
+	state->buffer = makeStringInfo();
+	state->rowContext = AllocSetContextCreate(CurrentMemoryContext,
+	                                          "Text Encoder Row Context",
+	                                          ALLOCSET_DEFAULT_SIZES);
 
 	TupleEncoder *encoder = CreateTupleEncoder(tupleDescriptor);
 	encoder->state = state;
@@ -83,9 +94,17 @@ TextEncoderPush(void *state, Datum *columnValues, bool *columnNulls)
 	TextEncoderState *encoder = (TextEncoderState *) state;
 	ByteSink *byteSink = encoder->byteSink;
 	FmgrInfo *columnOutputFunctions = encoder->columnOutputFunctions;
-	StringInfo buffer = makeStringInfo();
+	StringInfo buffer = encoder->buffer;
+
+	/* free memory used by the output function for the previous row */
+	MemoryContextReset(encoder->rowContext);
+	resetStringInfo(buffer);
 
-    AppendValueText(buffer, columnOutputFunctions, columnValues, columnNulls);
+	MemoryContext oldContext = MemoryContextSwitchTo(encoder->rowContext);
+
+	AppendValueText(buffer, columnOutputFunctions, columnValues, columnNulls);
+
+	MemoryContextSwitchTo(oldContext);
 
 	byteSink->write(byteSink->context, buffer->data, buffer->len);
 }
@@ -101,6 +120,8 @@ TextEncoderFinish(void *state)
 	ByteSink *byteSink = encoder->byteSink;
 
 	byteSink->close(byteSink->context);
+
+	MemoryContextDelete(encoder->rowContext);
 }
 
 
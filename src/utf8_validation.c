@@ -0,0 +1,520 @@
+/*-------------------------------------------------------------------------
+ *
+ * utf8_validation.c
+ *     Validation of UTF-8 data in bulk. On x86-64 CPUs with SSSE3, buffers
+ *     are validated 16 bytes at a time, otherwise we fall back to a scalar
+ *     validator that skips over ASCII 8 bytes at a time.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "mb/pg_wchar.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/utf8_validation.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define USE_SSSE3_UTF8_VALIDATION
+#include <tmmintrin.h>
+#endif
+
+
+/*
+ * Utf8ValidatingSourceState contains the internal state that is passed to
+ * the read and close functions of the ByteSource.
+ */
+typedef struct Utf8ValidatingSourceState
+{
+	ByteSource *byteSource;
+
+	/* start of a multi-byte sequence that was cut off by the previous read */
+	char pendingBytes[MAX_MULTIBYTE_CHAR_LEN];
+	int pendingLength;
+
+	bool endOfInputReached;
+} Utf8ValidatingSourceState;
+
+
+static int Utf8ValidatingSourceRead(void *context, void *buffer, int minRead,
+                                    int maxRead);
+static void Utf8ValidatingSourceClose(void *context);
+static int Utf8SequenceLength(const uint8 *bytes, int length);
+static int Utf8ValidPrefixLengthScalar(const uint8 *bytes, int length);
+#ifdef USE_SSSE3_UTF8_VALIDATION
+static bool CPUSupportsSSSE3(void);
+static bool Utf8IsValidSSSE3(const uint8 *bytes, int length);
+#endif
+
+
+/*
+ * Utf8IsValid returns whether the buffer consists entirely of complete,
+ * valid UTF-8 sequences. Like PostgreSQL, we treat NUL bytes as invalid.
+ */
+bool
+Utf8IsValid(const char *buffer, int length)
+{
+#ifdef USE_SSSE3_UTF8_VALIDATION
+	if (CPUSupportsSSSE3())
+	{
+		return Utf8IsValidSSSE3((const uint8 *) buffer, length);
+	}
+#endif
+
+	return Utf8ValidPrefixLengthScalar((const uint8 *) buffer, length) == length;
+}
+
+
+/*
+ * Utf8VerifyBuffer throws an error if the buffer is not valid UTF-8.
+ */
+void
+Utf8VerifyBuffer(const char *buffer, int length)
+{
+	if (!Utf8IsValid(buffer, length))
+	{
+		/* find the offending sequence for the error message */
+		int validLength = Utf8ValidPrefixLengthScalar((const uint8 *) buffer, length);
+
+		report_invalid_encoding(PG_UTF8, buffer + validLength, length - validLength);
+	}
+}
+
+
+/*
+ * Utf8IncompleteSuffixLength returns the number of bytes at the end of the
+ * buffer that form the start of a multi-byte sequence that continues beyond
+ * the buffer, or 0 if the buffer does not end in the middle of a sequence.
+ */
+int
+Utf8IncompleteSuffixLength(const char *buffer, int length)
+{
+	const uint8 *bytes = (const uint8 *) buffer;
+
+	for (int suffixLength = 1; suffixLength <= Min(length, 3); suffixLength++)
+	{
+		uint8 currentByte = bytes[length - suffixLength];
+
+		if ((currentByte & 0xC0) == 0x80)
+		{
+			/* continuation byte, look further back for the lead byte */
+			continue;
+		}
+		else if (currentByte >= 0xC0)
+		{
+			int sequenceLength = currentByte >= 0xF0 ? 4 : currentByte >= 0xE0 ? 3 : 2;
+
+			return sequenceLength > suffixLength ? suffixLength : 0;
+		}
+		else
+		{
+			/* ASCII */
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * CreateUtf8ValidatingSource creates a ByteSource that passes through the
+ * bytes from another ByteSource after checking that they are valid UTF-8.
+ * Since entire buffers are validated at once, this is much faster than
+ * validating individual values. Multi-byte sequences that are split across
+ * reads are held back until the rest of the sequence is read.
+ */
+ByteSource *
+CreateUtf8ValidatingSource(ByteSource *byteSource)
+{
+	Utf8ValidatingSourceState *state = palloc0(sizeof(Utf8ValidatingSourceState));
+	state->byteSource = byteSource;
+
+	ByteSource *validatingSource = palloc0(sizeof(ByteSource));
+	validatingSource->context = state;
+	validatingSource->read = Utf8ValidatingSourceRead;
+	validatingSource->close = Utf8ValidatingSourceClose;
+
+	return validatingSource;
+}
+
+
+/*
+ * Utf8ValidatingSourceRead reads from the underlying ByteSource and validates
+ * the bytes before returning them.
+ */
+static int
+Utf8ValidatingSourceRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	Utf8ValidatingSourceState *state = (Utf8ValidatingSourceState *) context;
+	ByteSource *byteSource = state->byteSource;
+	char *outputBuffer = (char *) buffer;
+	int bytesRead = 0;
+	int completeLength = 0;
+
+	Assert(maxRead > MAX_MULTIBYTE_CHAR_LEN);
+
+	/* start with the bytes that were held back by the previous read */
+	memcpy(outputBuffer, state->pendingBytes, state->pendingLength);
+	bytesRead = state->pendingLength;
+	state->pendingLength = 0;
+
+	while (!state->endOfInputReached && bytesRead < maxRead)
+	{
+		int newBytes = byteSource->read(byteSource->context, outputBuffer + bytesRead,
+		                                Max(minRead - bytesRead, 1),
+		                                maxRead - bytesRead);
+		if (newBytes == 0)
+		{
+			state->endOfInputReached = true;
+			break;
+		}
+
+		bytesRead += newBytes;
+
+		completeLength = bytesRead - Utf8IncompleteSuffixLength(outputBuffer, bytesRead);
+		if (completeLength > 0 && completeLength >= minRead)
+		{
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (state->endOfInputReached)
+	{
+		/* an incomplete sequence at the end of the input is an error */
+		completeLength = bytesRead;
+	}
+
+	Utf8VerifyBuffer(outputBuffer, completeLength);
+
+	/* hold back the start of a sequence that continues in the next read */
+	state->pendingLength = bytesRead - completeLength;
+	memcpy(state->pendingBytes, outputBuffer + completeLength, state->pendingLength);
+
+	return completeLength;
+}
+
+
+/*
+ * Utf8ValidatingSourceClose closes the underlying ByteSource.
+ */
+static void
+Utf8ValidatingSourceClose(void *context)
+{
+	Utf8ValidatingSourceState *state = (Utf8ValidatingSourceState *) context;
+	ByteSource *byteSource = state->byteSource;
+
+	byteSource->close(byteSource->context);
+
+	pfree(state);
+}
+
+
+/*
+ * Utf8SequenceLength returns the length of a valid UTF-8 sequence starting
+ * at the given position, or -1 if the bytes do not form a valid sequence.
+ * NUL bytes are treated as invalid, as in PostgreSQL.
+ */
+static int
+Utf8SequenceLength(const uint8 *bytes, int length)
+{
+	uint8 first = bytes[0];
+
+	if (first < 0x80)
+	{
+		return first == 0 ? -1 : 1;
+	}
+	else if (first >= 0xC2 && first <= 0xDF)
+	{
+		if (length < 2 || (bytes[1] & 0xC0) != 0x80)
+		{
+			return -1;
+		}
+
+		return 2;
+	}
+	else if (first >= 0xE0 && first <= 0xEF)
+	{
+		if (length < 3 || (bytes[1] & 0xC0) != 0x80 || (bytes[2] & 0xC0) != 0x80)
+		{
+			return -1;
+		}
+
+		/* reject overlong encodings and surrogates */
+		if ((first == 0xE0 && bytes[1] < 0xA0) || (first == 0xED && bytes[1] > 0x9F))
+		{
+			return -1;
+		}
+
+		return 3;
+	}
+	else if (first >= 0xF0 && first <= 0xF4)
+	{
+		if (length < 4 || (bytes[1] & 0xC0) != 0x80 || (bytes[2] & 0xC0) != 0x80 ||
+			(bytes[3] & 0xC0) != 0x80)
+		{
+			return -1;
+		}
+
+		/* reject overlong encodings and code points above U+10FFFF */
+		if ((first == 0xF0 && bytes[1] < 0x90) || (first == 0xF4 && bytes[1] > 0x8F))
+		{
+			return -1;
+		}
+
+		return 4;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Utf8ValidPrefixLengthScalar returns the length of the longest prefix of
+ * the buffer that consists of valid UTF-8 sequences.
+ */
+static int
+Utf8ValidPrefixLengthScalar(const uint8 *bytes, int length)
+{
+	int offset = 0;
+
+	while (offset < length)
+	{
+		/* skip over ASCII 8 bytes at a time */
+		while (length - offset >= 8)
+		{
+			uint64 chunk;
+
+			memcpy(&chunk, bytes + offset, sizeof(chunk));
+
+			/* stop at non-ASCII or NUL bytes */
+			if ((chunk & UINT64CONST(0x8080808080808080)) != 0 ||
+				((chunk - UINT64CONST(0x0101010101010101)) & ~chunk &
+				 UINT64CONST(0x8080808080808080)) != 0)
+			{
+				break;
+			}
+
+			offset += 8;
+		}
+
+		if (offset >= length)
+		{
+			break;
+		}
+
+		int sequenceLength = Utf8SequenceLength(bytes + offset, length - offset);
+		if (sequenceLength < 0)
+		{
+			break;
+		}
+
+		offset += sequenceLength;
+	}
+
+	return offset;
+}
+
+
+#ifdef USE_SSSE3_UTF8_VALIDATION
+
+/*
+ * CPUSupportsSSSE3 returns whether the CPU we are running on supports the
+ * SSSE3 instructions used by Utf8IsValidSSSE3.
+ */
+static bool
+CPUSupportsSSSE3(void)
+{
+	static int supportsSSSE3 = -1;
+
+	if (supportsSSSE3 < 0)
+	{
+		__builtin_cpu_init();
+		supportsSSSE3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+	}
+
+	return supportsSSSE3 == 1;
+}
+
+
+/* error bits used in the lookup tables of the SIMD validator */
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+
+/*
+ * ClassifyUtf8Block checks every pair of adjacent bytes in input (where the
+ * first byte of the block is paired with the last byte of previousInput)
+ * against the UTF-8 rules using three nibble lookups, and returns a vector
+ * that is non-zero at positions that violate them.
+ *
+ * This is the "lookup" algorithm by John Keiser and Daniel Lemire, as used
+ * in simdjson.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i
+ClassifyUtf8Block(__m128i input, __m128i previousInput)
+{
+	const __m128i lowNibbleMask = _mm_set1_epi8(0x0F);
+
+	const __m128i byte1HighTable = _mm_setr_epi8(
+		/* 0_______ ________: ASCII followed by anything */
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		/* 10______ ________: continuation byte */
+		UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+		/* 1100____ ________: two byte lead */
+		UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+		/* 1101____ ________: two byte lead */
+		UTF8_TOO_SHORT,
+		/* 1110____ ________: three byte lead */
+		UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+		/* 1111____ ________: four byte lead */
+		UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+
+	const __m128i byte1LowTable = _mm_setr_epi8(
+		/* ____0000 ________ */
+		UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+		/* ____0001 ________ */
+		UTF8_CARRY | UTF8_OVERLONG_2,
+		/* ____001_ ________ */
+		UTF8_CARRY,
+		UTF8_CARRY,
+		/* ____0100 ________ */
+		UTF8_CARRY | UTF8_TOO_LARGE,
+		/* ____0101 ________ */
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		/* ____011_ ________ */
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		/* ____1___ ________ */
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		/* ____1101 ________ */
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+
+	const __m128i byte2HighTable = _mm_setr_epi8(
+		/* ________ 0_______: ASCII second byte */
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		/* ________ 1000____ */
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+		UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+		/* ________ 1001____ */
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+		UTF8_TOO_LARGE,
+		/* ________ 101_____ */
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+		UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+		UTF8_TOO_LARGE,
+		/* ________ 11______: lead byte as second byte */
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+	__m128i previous1 = _mm_alignr_epi8(input, previousInput, 16 - 1);
+	__m128i byte1High = _mm_shuffle_epi8(byte1HighTable,
+	                                     _mm_and_si128(_mm_srli_epi16(previous1, 4),
+	                                                   lowNibbleMask));
+	__m128i byte1Low = _mm_shuffle_epi8(byte1LowTable,
+	                                    _mm_and_si128(previous1, lowNibbleMask));
+	__m128i byte2High = _mm_shuffle_epi8(byte2HighTable,
+	                                     _mm_and_si128(_mm_srli_epi16(input, 4),
+	                                                   lowNibbleMask));
+	__m128i specialCases = _mm_and_si128(_mm_and_si128(byte1High, byte1Low),
+	                                     byte2High);
+
+	/* third and fourth bytes of multi-byte sequences must be continuations */
+	__m128i previous2 = _mm_alignr_epi8(input, previousInput, 16 - 2);
+	__m128i previous3 = _mm_alignr_epi8(input, previousInput, 16 - 3);
+	__m128i isThirdByte = _mm_subs_epu8(previous2, _mm_set1_epi8((char) (0xE0 - 0x80)));
+	__m128i isFourthByte = _mm_subs_epu8(previous3, _mm_set1_epi8((char) (0xF0 - 0x80)));
+	__m128i mustBeContinuation = _mm_and_si128(_mm_or_si128(isThirdByte, isFourthByte),
+	                                           _mm_set1_epi8((char) 0x80));
+
+	return _mm_xor_si128(mustBeContinuation, specialCases);
+}
+
+
+/*
+ * Utf8IsValidSSSE3 returns whether the buffer consists entirely of complete,
+ * valid UTF-8 sequences without NUL bytes, processing 16 bytes at a time.
+ */
+__attribute__((target("ssse3")))
+static bool
+Utf8IsValidSSSE3(const uint8 *bytes, int length)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	/* the maximum value of the last 3 bytes for a block to be complete */
+	const __m128i maxCompleteValue = _mm_setr_epi8(
+		(char) 0xFF, (char) 0xFF, (char) 0xFF, (char) 0xFF,
+		(char) 0xFF, (char) 0xFF, (char) 0xFF, (char) 0xFF,
+		(char) 0xFF, (char) 0xFF, (char) 0xFF, (char) 0xFF,
+		(char) 0xFF, (char) (0xF0 - 1), (char) (0xE0 - 1), (char) (0xC0 - 1));
+
+	__m128i error = zero;
+	__m128i previousInput = zero;
+	__m128i previousIncomplete = zero;
+	int offset = 0;
+
+	while (offset < length)
+	{
+		__m128i input;
+
+		if (length - offset >= 16)
+		{
+			input = _mm_loadu_si128((const __m128i *) (bytes + offset));
+		}
+		else
+		{
+			/* pad the last block with spaces, which are valid ASCII */
+			uint8 lastBlock[16];
+
+			memset(lastBlock, ' ', sizeof(lastBlock));
+			memcpy(lastBlock, bytes + offset, length - offset);
+			input = _mm_loadu_si128((const __m128i *) lastBlock);
+		}
+
+		/* NUL bytes are not allowed */
+		error = _mm_or_si128(error, _mm_cmpeq_epi8(input, zero));
+
+		if (_mm_movemask_epi8(input) == 0)
+		{
+			/* all ASCII, only need to check for a sequence cut off by this block */
+			error = _mm_or_si128(error, previousIncomplete);
+			previousIncomplete = zero;
+		}
+		else
+		{
+			error = _mm_or_si128(error, ClassifyUtf8Block(input, previousInput));
+			previousIncomplete = _mm_subs_epu8(input, maxCompleteValue);
+		}
+
+		previousInput = input;
+		offset += 16;
+	}
+
+	/* a sequence at the end of the buffer must be complete */
+	error = _mm_or_si128(error, previousIncomplete);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) == 0xFFFF;
+}
+
+#endif
@@ -8,10 +8,54 @@
  *-------------------------------------------------------------------------
  */
 #include "postgres.h"
+#include "miscadmin.h"
 
 #include "pgazure/byte_io.h"
+#include "pgazure/compression.h"
+#include "pgazure/parallel_gzip.h"
 #include "pgazure/zlib_compression.h"
 
+
+/* library that compresses and decompresses gzip, if pgazure is built with it */
+int GzipEngine = GZIP_ENGINE_ZLIB;
+
+/* number of threads that compress gzip, or 0 to compress in the backend */
+int GzipWorkers = 0;
+
+/* whether gzip threads use the end of the previous chunk as a dictionary */
+bool GzipShareDictionary = true;
+
+
+/*
+ * ActiveGzipEngine returns the engine in azure.gzip_engine if pgazure is
+ * built with it, and zlib otherwise.
+ */
+GzipEngineType
+ActiveGzipEngine(void)
+{
+	switch (GzipEngine)
+	{
+#ifdef USE_LIBDEFLATE
+		case GZIP_ENGINE_LIBDEFLATE:
+#endif
+#ifdef USE_ISAL
+		case GZIP_ENGINE_ISAL:
+#endif
+		case GZIP_ENGINE_ZLIB:
+		{
+			return (GzipEngineType) GzipEngine;
+		}
+
+		default:
+		{
+			ereport(DEBUG1, (errmsg("pgazure is not built with the configured gzip "
+			                        "engine, using zlib")));
+			return GZIP_ENGINE_ZLIB;
+		}
+	}
+}
+
+
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 
@@ -38,19 +82,37 @@ typedef struct ZLibCompressorState
     size_t zlibOutSize;
 } ZLibCompressorState;
 
+/*
+ * ParallelZLibCompressorState contains the internal state of a ByteSink that
+ * compresses on a pool of threads.
+ */
+typedef struct ParallelZLibCompressorState
+{
+	ByteSink *byteSink;
+	ParallelGzip *compressor;
+
+	/* number of chunks that may be compressed ahead of the byteSink */
+	int maxPendingChunks;
+} ParallelZLibCompressorState;
+
 
 static void ZLibWrite(void *context, void *buffer, int bytesToWrite);
 static void ZLibClose(void *context);
 static void DeflateBufferedData(ZLibCompressorState *state, bool flush);
+static void ParallelZLibWrite(void *context, void *buffer, int bytesToWrite);
+static void ParallelZLibClose(void *context);
+static void WriteParallelZLibOutput(ParallelZLibCompressorState *state, bool finished);
+static void FreeParallelGzipCallback(void *arg);
+static int GzipCompressionLevel(int level);
 
 
 /*
  * CreateZLibCompressor creates a ByteSink that compresses the bytes
- * that are written to it and writes the compressed bytes to another
- * ByteSink.
+ * that are written to it at the given level and writes the compressed
+ * bytes to another ByteSink.
  */
 ByteSink *
-CreateZLibCompressor(ByteSink *byteSink)
+CreateZLibCompressor(ByteSink *byteSink, int level)
 {
 	z_streamp zp = (z_streamp) palloc0(sizeof(z_stream));
 	zp->zalloc = Z_NULL;
@@ -69,7 +131,7 @@ CreateZLibCompressor(ByteSink *byteSink)
 	state->zlibOut = (char *) palloc0(ZLIB_OUT_SIZE + 1);
 	state->zlibOutSize = ZLIB_OUT_SIZE;
 
-	if (deflateInit2(zp, DEFAULT_COMPRESSION_LEVEL, Z_DEFLATED,
+	if (deflateInit2(zp, GzipCompressionLevel(level), Z_DEFLATED,
 					 ZLIB_WINDOWSIZE | GZIP_ENCODING, ZLIB_CFACTOR,
 					 Z_DEFAULT_STRATEGY) != Z_OK)
 	{
@@ -89,6 +151,35 @@ CreateZLibCompressor(ByteSink *byteSink)
 }
 
 
+/*
+ * CreateParallelZLibCompressor creates a ByteSink that compresses the bytes
+ * that are written to it as gzip at the given level on workerCount threads,
+ * and writes the compressed bytes to another ByteSink in order.
+ */
+ByteSink *
+CreateParallelZLibCompressor(ByteSink *byteSink, int workerCount, int level)
+{
+	ParallelZLibCompressorState *state = palloc0(sizeof(ParallelZLibCompressorState));
+	state->byteSink = byteSink;
+	state->maxPendingChunks = 2 * workerCount;
+	state->compressor = CreateParallelGzip(workerCount, GzipCompressionLevel(level),
+	                                       GzipShareDictionary, ActiveGzipEngine());
+
+	/* stop the threads when the sink is done or the query fails */
+	MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+	callback->func = FreeParallelGzipCallback;
+	callback->arg = state->compressor;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	ByteSink *compressor = palloc0(sizeof(ByteSink));
+	compressor->context = state;
+	compressor->write = ParallelZLibWrite;
+	compressor->close = ParallelZLibClose;
+
+	return compressor;
+}
+
+
 /*
  * ZLibWrite appends the given buffer to the zlib buffer for compression.
  */
@@ -182,4 +273,87 @@ DeflateBufferedData(ZLibCompressorState *state, bool flush)
 	}
 }
 
+
+/*
+ * ParallelZLibWrite hands the given buffer to the compression threads and
+ * writes out the chunks that are done.
+ */
+static void
+ParallelZLibWrite(void *context, void *buffer, int bytesToWrite)
+{
+	ParallelZLibCompressorState *state = (ParallelZLibCompressorState *) context;
+
+	ParallelGzipWrite(state->compressor, buffer, bytesToWrite);
+
+	WriteParallelZLibOutput(state, false);
+}
+
+
+/*
+ * ParallelZLibClose compresses the last chunk, writes out all remaining
+ * output including the gzip trailer, and closes the underlying ByteSink.
+ * The threads are stopped when the memory context is reset.
+ */
+static void
+ParallelZLibClose(void *context)
+{
+	ParallelZLibCompressorState *state = (ParallelZLibCompressorState *) context;
+	ByteSink *byteSink = state->byteSink;
+
+	ParallelGzipFinish(state->compressor);
+
+	WriteParallelZLibOutput(state, true);
+
+	byteSink->close(byteSink->context);
+}
+
+
+/*
+ * WriteParallelZLibOutput writes the output of compressed chunks to the
+ * byteSink in order. It waits for chunks while too many are pending, or
+ * until all are written when the input is finished.
+ */
+static void
+WriteParallelZLibOutput(ParallelZLibCompressorState *state, bool finished)
+{
+	ByteSink *byteSink = state->byteSink;
+	const char *output = NULL;
+	int outputLength = 0;
+
+	while (ParallelGzipTakeOutput(state->compressor,
+	                              finished || ParallelGzipPendingChunks(state->compressor) >
+	                              state->maxPendingChunks,
+	                              &output, &outputLength))
+	{
+		if (outputLength > 0)
+		{
+			byteSink->write(byteSink->context, (void *) output, outputLength);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+
+/*
+ * GzipCompressionLevel returns the given compression level, or the default
+ * level if it is COMPRESSION_DEFAULT_LEVEL.
+ */
+static int
+GzipCompressionLevel(int level)
+{
+	return level == COMPRESSION_DEFAULT_LEVEL ? DEFAULT_COMPRESSION_LEVEL : level;
+}
+
+
+/*
+ * FreeParallelGzipCallback stops the threads of a parallel gzip compressor
+ * when the memory context in which it was created is reset or deleted.
+ */
+static void
+FreeParallelGzipCallback(void *arg)
+{
+	FreeParallelGzip((ParallelGzip *) arg);
+}
+
 #endif
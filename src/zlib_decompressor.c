@@ -3,6 +3,16 @@
  * zlib_decompressor.c
  *     Compressor that uses libz to decompress a stream of bytes as gzip.
  *
+ * A gzip stream can consist of several concatenated members, which are
+ * decompressed one after the other. With azure.gzip_decompression_workers,
+ * members are decompressed on a pool of threads instead.
+ *
+ * Reads of at least ZLIB_DIRECT_READ_SIZE bytes are inflated directly into
+ * the caller's buffer. Only shorter reads go through a staging buffer, to
+ * avoid calling inflate for a few bytes at a time. The input buffer grows
+ * with the size of the reads, such that large reads also read large blocks
+ * from the source.
+ *
  * Copyright (c), Citus Data, Inc.
  *
  *-------------------------------------------------------------------------
@@ -11,13 +21,25 @@
 #include "miscadmin.h"
 
 #include "pgazure/byte_io.h"
+#include "pgazure/parallel_gunzip.h"
 #include "pgazure/zlib_compression.h"
 
+
+/* number of threads that decompress gzip members, or 0 for the backend */
+int GzipDecompressionWorkers = 0;
+
+
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 
 #define ZLIB_OUT_SIZE	65536
 #define ZLIB_IN_SIZE	65536
+
+/* largest size to which the input buffer grows */
+#define ZLIB_MAX_IN_SIZE (1024 * 1024)
+
+/* smallest read that is inflated directly into the caller's buffer */
+#define ZLIB_DIRECT_READ_SIZE 8192
 #define DEFAULT_COMPRESSION_LEVEL 6
 #define ZLIB_WINDOWSIZE 15
 #define GZIP_DECODING   32
@@ -35,22 +57,52 @@ typedef struct ZLibDecompressorState
     ByteSource *byteSource;
 
 	char *inputBuffer;
+	int inputBufferSize;
 	bool endOfInputReached;
 
+	/* whether inflate may have output left without needing more input */
+	bool outputPending;
+
+	/* staging buffer for short reads, allocated on first use */
 	char *outputBuffer;
+	int outputLength;
 
 	/* up to which byte in the output buffer we've consumed */
 	int outputBufferOffset;
 } ZLibDecompressorState;
 
+/*
+ * ParallelZLibDecompressorState contains the internal state of a ByteSource
+ * that decompresses gzip members on a pool of threads.
+ */
+typedef struct ParallelZLibDecompressorState
+{
+	ByteSource *byteSource;
+	ParallelGunzip *decompressor;
+
+	char *inputBuffer;
+	bool endOfInputReached;
+
+	/* output of the last chunk that was taken, and how much of it we consumed */
+	const char *output;
+	int outputLength;
+	int outputOffset;
+
+	/* number of chunks that may be decompressed ahead of the reader */
+	int maxPendingChunks;
+} ParallelZLibDecompressorState;
+
 
 static int ZLibDecompressorRead(void *context, void *buffer, int minRead, int maxRead);
 static void ZLibDecompressorClose(void *context);
-static bool IsDecompressionDone(ZLibDecompressorState *state);
-static int FlushOutputBufferIntoBuffer(ZLibDecompressorState *state,
-                                       char *buffer, int bufferOffset, int maxRead);
-static void FillInputBufferFromSource(ZLibDecompressorState *state);
-static void DecompressInputBufferIntoOutputBuffer(ZLibDecompressorState *state);
+static int FlushOutputBufferIntoBuffer(ZLibDecompressorState *state, char *buffer,
+                                       int maxRead);
+static void FillInputBufferFromSource(ZLibDecompressorState *state, int readSize);
+static int InflateIntoBuffer(ZLibDecompressorState *state, char *buffer, int length);
+static int ParallelZLibDecompressorRead(void *context, void *buffer, int minRead,
+                                        int maxRead);
+static void ParallelZLibDecompressorClose(void *context);
+static void FreeParallelGunzipCallback(void *arg);
 
 
 /*
@@ -69,8 +121,10 @@ CreateZLibDecompressor(ByteSource *byteSource)
 
 	ZLibDecompressorState *state = palloc0(sizeof(ZLibDecompressorState));
 	state->byteSource = byteSource;
-	state->inputBuffer = palloc0(ZLIB_IN_SIZE);
-	state->outputBuffer = palloc0(ZLIB_OUT_SIZE + 1);
+	state->inputBuffer = palloc(ZLIB_IN_SIZE);
+	state->inputBufferSize = ZLIB_IN_SIZE;
+	state->outputBuffer = NULL;
+	state->outputLength = 0;
 	state->outputBufferOffset = 0;
 	state->zp = zp;
 
@@ -89,36 +143,98 @@ CreateZLibDecompressor(ByteSource *byteSource)
 
 
 /*
- * ZLibDecompressorRead reads bytes of decompressed data.
+ * CreateParallelZLibDecompressor creates a ByteSource that decompresses the
+ * members of the gzip stream coming in from another ByteSource on
+ * workerCount threads. If gzipIndex is not NULL, the stream is split at its
+ * checkpoints.
+ */
+ByteSource *
+CreateParallelZLibDecompressor(ByteSource *byteSource, int workerCount,
+                               GzipIndex *gzipIndex)
+{
+	ParallelZLibDecompressorState *state = palloc0(sizeof(ParallelZLibDecompressorState));
+	state->byteSource = byteSource;
+	state->inputBuffer = palloc(ZLIB_IN_SIZE);
+	state->maxPendingChunks = 2 * workerCount;
+	state->decompressor = CreateParallelGunzip(workerCount, ActiveGzipEngine());
+
+	/* stop the threads when the source is done or the query fails */
+	MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+	callback->func = FreeParallelGunzipCallback;
+	callback->arg = state->decompressor;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	if (gzipIndex != NULL)
+	{
+		for (int pointIndex = 0; pointIndex < gzipIndex->pointCount; pointIndex++)
+		{
+			GzipIndexPoint *point = &gzipIndex->points[pointIndex];
+
+			ParallelGunzipAddCheckpoint(state->decompressor, point->compressedOffset,
+			                            point->bits, point->uncompressedOffset,
+			                            point->window, point->windowLength);
+		}
+	}
+
+	ByteSource *decompressor = palloc0(sizeof(ByteSource));
+	decompressor->context = state;
+	decompressor->read = ParallelZLibDecompressorRead;
+	decompressor->close = ParallelZLibDecompressorClose;
+
+	return decompressor;
+}
+
+
+/*
+ * ZLibDecompressorRead reads up to maxRead bytes of decompressed data into
+ * buffer, and fewer only at the end of the stream.
  */
 static int
 ZLibDecompressorRead(void *context, void *buffer, int minRead, int maxRead)
 {
 	ZLibDecompressorState *state = (ZLibDecompressorState *) context;
 	z_streamp zp = state->zp;
-	int bytesRead = 0;
+	char *output = (char *) buffer;
+
+	/* copy remaining data from the staging buffer */
+	int bytesRead = FlushOutputBufferIntoBuffer(state, output, maxRead);
 
-	while (!IsDecompressionDone(state))
+	while (bytesRead < maxRead)
 	{
-		/* copy remaining data from the output buffer */
-		bytesRead += FlushOutputBufferIntoBuffer(state, (char *) buffer, bytesRead,
-		                                         maxRead - bytesRead);
-		if (bytesRead == maxRead)
+		if (zp->avail_in == 0 && !state->outputPending)
 		{
-			break;
+			if (!state->endOfInputReached)
+			{
+				FillInputBufferFromSource(state, maxRead);
+			}
+
+			if (zp->avail_in == 0)
+			{
+				/* end of the stream */
+				break;
+			}
 		}
 
-		/* output buffer is fully flushed now */
-		zp->avail_out = ZLIB_OUT_SIZE;
-		state->outputBufferOffset = 0;
+		int bytesRequested = maxRead - bytesRead;
 
-		/* if there are no more bytes in the input buffer, read from source */
-		if (zp->avail_in == 0)
+		if (bytesRequested >= ZLIB_DIRECT_READ_SIZE)
 		{
-			FillInputBufferFromSource(state);
+			bytesRead += InflateIntoBuffer(state, output + bytesRead, bytesRequested);
 		}
+		else
+		{
+			if (state->outputBuffer == NULL)
+			{
+				state->outputBuffer = palloc(ZLIB_OUT_SIZE);
+			}
+
+			state->outputLength = InflateIntoBuffer(state, state->outputBuffer,
+			                                        ZLIB_OUT_SIZE);
+			state->outputBufferOffset = 0;
 
-		DecompressInputBufferIntoOutputBuffer(state);
+			bytesRead += FlushOutputBufferIntoBuffer(state, output + bytesRead,
+			                                         bytesRequested);
+		}
 	}
 
 	return bytesRead;
@@ -126,32 +242,13 @@ ZLibDecompressorRead(void *context, void *buffer, int minRead, int maxRead)
 
 
 /*
- * IsDecompressionDone determines whether decompression is finished, meaning there
- * are no more input bytes to read, and the input buffer and output buffers are empty.
- */
-static bool
-IsDecompressionDone(ZLibDecompressorState *state)
-{
-	z_streamp zp = state->zp;
-
-	return state->endOfInputReached &&
-	       zp->avail_in == 0 &&
-	       zp->avail_out == ZLIB_IN_SIZE;
-}
-
-
-/*
- * FlushOutputBufferIntoBuffer copies bytes from the output buffer into buffer
- * until the output buffer is empty or maxRead bytes were copied.
+ * FlushOutputBufferIntoBuffer copies bytes from the staging buffer into
+ * buffer until the staging buffer is empty or maxRead bytes were copied.
  */
 static int
-FlushOutputBufferIntoBuffer(ZLibDecompressorState *state, char *buffer,
-                            int bufferOffset, int maxRead)
+FlushOutputBufferIntoBuffer(ZLibDecompressorState *state, char *buffer, int maxRead)
 {
-	z_streamp zp = state->zp;
-
-	int numBytesInOutputBuffer = ZLIB_OUT_SIZE - zp->avail_out;
-	int bytesRemainingInOutputBuffer = numBytesInOutputBuffer - state->outputBufferOffset;
+	int bytesRemainingInOutputBuffer = state->outputLength - state->outputBufferOffset;
 
 	if (bytesRemainingInOutputBuffer == 0)
 	{
@@ -162,8 +259,7 @@ FlushOutputBufferIntoBuffer(ZLibDecompressorState *state, char *buffer,
 	/* cannot copy more than what's available or what the caller asked for */
 	int bytesCopied = Min(maxRead, bytesRemainingInOutputBuffer);
 
-	memcpy(buffer + bufferOffset, state->outputBuffer + state->outputBufferOffset,
-	       bytesCopied);
+	memcpy(buffer, state->outputBuffer + state->outputBufferOffset, bytesCopied);
 
 	state->outputBufferOffset += bytesCopied;
 
@@ -173,22 +269,35 @@ FlushOutputBufferIntoBuffer(ZLibDecompressorState *state, char *buffer,
 
 /*
  * FillInputBufferFromSource reads bytes from ByteSource until the inputBuffer
- * is full.
+ * is full. The input buffer is first grown to readSize, the size of the
+ * current read, up to ZLIB_MAX_IN_SIZE.
  *
  * The caller must ensure the input buffer is empty before calling the function.
  */
 static void
-FillInputBufferFromSource(ZLibDecompressorState *state)
+FillInputBufferFromSource(ZLibDecompressorState *state, int readSize)
 {
 	z_streamp zp = state->zp;
 	ByteSource *byteSource = state->byteSource;
 
-	while (!state->endOfInputReached && zp->avail_in < ZLIB_IN_SIZE)
+	Assert(zp->avail_in == 0);
+
+	if (readSize > state->inputBufferSize && state->inputBufferSize < ZLIB_MAX_IN_SIZE)
 	{
-		int spaceAvailableInInputBuffer = ZLIB_IN_SIZE - zp->avail_in;
+		state->inputBufferSize = Min(readSize, ZLIB_MAX_IN_SIZE);
+
+		pfree(state->inputBuffer);
+		state->inputBuffer = palloc(state->inputBufferSize);
+	}
+
+	zp->next_in = (void *) state->inputBuffer;
+
+	while (!state->endOfInputReached && (int) zp->avail_in < state->inputBufferSize)
+	{
+		int spaceAvailableInInputBuffer = state->inputBufferSize - zp->avail_in;
 
 		int bytesRead = byteSource->read(byteSource->context,
-		                                 state->inputBuffer + zp->avail_in , 0,
+		                                 state->inputBuffer + zp->avail_in, 0,
 		                                 spaceAvailableInInputBuffer);
 		if (bytesRead == 0)
 		{
@@ -196,8 +305,6 @@ FillInputBufferFromSource(ZLibDecompressorState *state)
 		}
 		else
 		{
-			/* prepare input buffer */
-			zp->next_in = (void *) state->inputBuffer;
 			zp->avail_in += bytesRead;
 		}
 
@@ -207,34 +314,44 @@ FillInputBufferFromSource(ZLibDecompressorState *state)
 
 
 /*
- * DecompressInputBufferIntoOutputBuffer decompressed bytes from the
- * input buffer until the output buffer is full or the end of the
- * stream is reached.
- *
- * The caller must ensure outputBuffer is empty before calling the function.
+ * InflateIntoBuffer decompresses bytes from the input buffer into buffer,
+ * until either is exhausted or the end of a member is reached, and returns
+ * the number of bytes written.
  */
-static void
-DecompressInputBufferIntoOutputBuffer(ZLibDecompressorState *state)
+static int
+InflateIntoBuffer(ZLibDecompressorState *state, char *buffer, int length)
 {
 	z_streamp zp = state->zp;
 
-	if (zp->avail_in == 0)
-	{
-		/* nothing to decompress */
-		return;
-	}
+	zp->next_out = (void *) buffer;
+	zp->avail_out = length;
 
-	Assert(zp->avail_out == ZLIB_OUT_SIZE);
+	int resultCode = inflate(zp, Z_NO_FLUSH);
 
-	zp->next_out = (void *) state->outputBuffer;
+	/* a full buffer may leave output behind in the stream */
+	state->outputPending = zp->avail_out == 0;
 
-	int resultCode = inflate(zp, 0);
-	if (resultCode != Z_OK && resultCode != Z_STREAM_END)
+	if (resultCode == Z_STREAM_END)
+	{
+		/* the stream may continue with another member */
+		if (inflateReset(zp) != Z_OK)
+		{
+			ereport(ERROR, (errmsg("could not reset compression stream: %s", zp->msg)));
+		}
+
+		state->outputPending = false;
+	}
+	else if (resultCode == Z_BUF_ERROR)
+	{
+		/* no output was left after all, inflate needs more input */
+		state->outputPending = false;
+	}
+	else if (resultCode != Z_OK)
 	{
 		ereport(ERROR, (errmsg("could not uncompress data: %s", zp->msg)));
 	}
 
-	state->outputBuffer[ZLIB_OUT_SIZE - zp->avail_out] = '\0';
+	return length - zp->avail_out;
 }
 
 
@@ -257,9 +374,103 @@ ZLibDecompressorClose(void *context)
 	byteSource->close(byteSource->context);
 
 	pfree(state->inputBuffer);
-	pfree(state->outputBuffer);
+	if (state->outputBuffer != NULL)
+	{
+		pfree(state->outputBuffer);
+	}
 	pfree(state->zp);
 	pfree(state);
 }
 
+
+/*
+ * ParallelZLibDecompressorRead copies decompressed chunks into the buffer in
+ * order, while feeding compressed bytes from the source to the threads.
+ */
+static int
+ParallelZLibDecompressorRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	ParallelZLibDecompressorState *state = (ParallelZLibDecompressorState *) context;
+	ByteSource *byteSource = state->byteSource;
+	int bytesRead = 0;
+
+	while (bytesRead < maxRead)
+	{
+		if (state->outputOffset < state->outputLength)
+		{
+			int bytesCopied = Min(maxRead - bytesRead,
+			                      state->outputLength - state->outputOffset);
+
+			memcpy((char *) buffer + bytesRead, state->output + state->outputOffset,
+			       bytesCopied);
+
+			state->outputOffset += bytesCopied;
+			bytesRead += bytesCopied;
+			continue;
+		}
+
+		/* wait for the next chunk once all input is in, or too many are pending */
+		bool wait = state->endOfInputReached ||
+		            ParallelGunzipPendingChunks(state->decompressor) >
+		            state->maxPendingChunks;
+
+		if (ParallelGunzipTakeOutput(state->decompressor, wait, &state->output,
+		                             &state->outputLength))
+		{
+			state->outputOffset = 0;
+			continue;
+		}
+
+		if (state->endOfInputReached)
+		{
+			/* all chunks are taken */
+			break;
+		}
+
+		int inputBytesRead = byteSource->read(byteSource->context, state->inputBuffer,
+		                                      0, ZLIB_IN_SIZE);
+		if (inputBytesRead == 0)
+		{
+			state->endOfInputReached = true;
+			ParallelGunzipFinish(state->decompressor);
+		}
+		else
+		{
+			ParallelGunzipWrite(state->decompressor, state->inputBuffer, inputBytesRead);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return bytesRead;
+}
+
+
+/*
+ * ParallelZLibDecompressorClose closes the underlying ByteSource. The threads
+ * are stopped when the memory context is reset.
+ */
+static void
+ParallelZLibDecompressorClose(void *context)
+{
+	ParallelZLibDecompressorState *state = (ParallelZLibDecompressorState *) context;
+	ByteSource *byteSource = state->byteSource;
+
+	byteSource->close(byteSource->context);
+
+	pfree(state->inputBuffer);
+}
+
+
+/*
+ * FreeParallelGunzipCallback stops the threads of a parallel gzip
+ * decompressor when the memory context in which it was created is reset or
+ * deleted.
+ */
+static void
+FreeParallelGunzipCallback(void *arg)
+{
+	FreeParallelGunzip((ParallelGunzip *) arg);
+}
+
 #endif
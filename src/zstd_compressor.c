@@ -0,0 +1,369 @@
+/*-------------------------------------------------------------------------
+ *
+ * zstd_compressor.c
+ *     Compressor that uses libzstd to compress a stream of bytes.
+ *
+ * When azure.zstd_frame_size is set, the output is split into independent
+ * frames of that many uncompressed bytes, followed by a skippable frame
+ * with a seek table, as in the zstd seekable format. Readers that do not
+ * know the format skip the seek table, and readers that do can start
+ * decompressing at any frame boundary.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "lib/stringinfo.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/compression.h"
+#include "pgazure/zstd_compression.h"
+
+
+/* compression level used by the zstd compressor */
+int ZstdCompressionLevel = 3;
+
+/* number of threads that compress in the background, or 0 to compress inline */
+int ZstdWorkers = 0;
+
+/* whether the zstd compressor looks for matches in a large window */
+bool ZstdLongDistanceMatching = false;
+
+/* number of uncompressed bytes per frame in kB, or 0 for a single frame */
+int ZstdFrameSize = 0;
+
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+
+/* magic numbers of the seek table in the zstd seekable format */
+#define ZSTD_SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+
+/* size of the footer at the end of the seek table */
+#define ZSTD_SEEKABLE_FOOTER_SIZE 9
+
+
+/*
+ * ZstdCompressorState contains the internal state that is passed to the
+ * write and close functions of the ByteSink.
+ */
+typedef struct ZstdCompressorState
+{
+	ByteSink *byteSink;
+
+	ZSTD_CCtx *compressionContext;
+	ZSTD_outBuffer output;
+
+	/* number of uncompressed bytes per frame, or 0 for a single frame */
+	uint64 frameSize;
+
+	/* number of bytes in the current frame */
+	uint64 frameDecompressedBytes;
+	uint64 frameCompressedBytes;
+
+	/* seek table entries of the frames written so far */
+	int frameCount;
+	StringInfo seekTable;
+} ZstdCompressorState;
+
+
+static void ZstdWrite(void *context, void *buffer, int bytesToWrite);
+static void ZstdClose(void *context);
+static void EndZstdFrame(ZstdCompressorState *state);
+static void FlushZstdOutput(ZstdCompressorState *state);
+static void WriteSeekTable(ZstdCompressorState *state);
+static void AppendUInt32LE(StringInfo buffer, uint32 value);
+static void SetZstdParameter(ZSTD_CCtx *compressionContext, ZSTD_cParameter parameter,
+                             int value, char *parameterName);
+static void FreeZstdCompressorCallback(void *arg);
+
+
+/*
+ * CreateZstdCompressor creates a ByteSink that compresses the bytes that
+ * are written to it at the given level, or at azure.zstd_compression_level
+ * if it is COMPRESSION_DEFAULT_LEVEL, and writes the compressed bytes to
+ * another ByteSink. If dictionary is not NULL, frames are compressed with
+ * the dictionary, whose level takes precedence.
+ */
+ByteSink *
+CreateZstdCompressor(ByteSink *byteSink, int level, ZSTD_CDict *dictionary)
+{
+	ZstdCompressorState *state = palloc0(sizeof(ZstdCompressorState));
+
+	ZSTD_CCtx *compressionContext = ZSTD_createCCtx();
+	if (compressionContext == NULL)
+	{
+		ereport(ERROR, (errmsg("could not create zstd compression context")));
+	}
+
+	state->compressionContext = compressionContext;
+
+	/* free the context, and stop its worker threads, if the query fails */
+	MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+	callback->func = FreeZstdCompressorCallback;
+	callback->arg = state;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	if (level == COMPRESSION_DEFAULT_LEVEL)
+	{
+		level = ZstdCompressionLevel;
+	}
+
+	SetZstdParameter(compressionContext, ZSTD_c_compressionLevel, level,
+	                 "compression level");
+	SetZstdParameter(compressionContext, ZSTD_c_checksumFlag, 1, "checksum flag");
+
+	if (dictionary != NULL)
+	{
+		size_t result = ZSTD_CCtx_refCDict(compressionContext, dictionary);
+		if (ZSTD_isError(result))
+		{
+			ereport(ERROR, (errmsg("could not set zstd dictionary: %s",
+			                       ZSTD_getErrorName(result))));
+		}
+	}
+
+	if (ZstdLongDistanceMatching)
+	{
+		SetZstdParameter(compressionContext, ZSTD_c_enableLongDistanceMatching, 1,
+		                 "long distance matching");
+	}
+
+	if (ZstdWorkers > 0)
+	{
+		SetZstdParameter(compressionContext, ZSTD_c_nbWorkers, ZstdWorkers,
+		                 "worker count");
+	}
+
+	state->byteSink = byteSink;
+	state->output.size = ZSTD_CStreamOutSize();
+	state->output.dst = palloc(state->output.size);
+	state->output.pos = 0;
+	state->frameSize = (uint64) ZstdFrameSize * 1024;
+
+	if (state->frameSize > 0)
+	{
+		state->seekTable = makeStringInfo();
+	}
+
+	ByteSink *compressor = palloc0(sizeof(ByteSink));
+	compressor->context = state;
+	compressor->write = ZstdWrite;
+	compressor->close = ZstdClose;
+
+	return compressor;
+}
+
+
+/*
+ * ZstdWrite compresses the given buffer, ending a frame whenever it reaches
+ * the frame size.
+ */
+static void
+ZstdWrite(void *context, void *buffer, int bytesToWrite)
+{
+	ZstdCompressorState *state = (ZstdCompressorState *) context;
+	ZSTD_inBuffer input = { buffer, bytesToWrite, 0 };
+
+	while (input.pos < input.size)
+	{
+		ZSTD_inBuffer frameInput = input;
+
+		if (state->frameSize > 0)
+		{
+			/* do not pass more bytes than fit in the current frame */
+			frameInput.size = Min(input.size, input.pos + (state->frameSize -
+			                                               state->frameDecompressedBytes));
+		}
+
+		size_t result = ZSTD_compressStream2(state->compressionContext, &state->output,
+		                                     &frameInput, ZSTD_e_continue);
+		if (ZSTD_isError(result))
+		{
+			ereport(ERROR, (errmsg("could not compress data: %s",
+			                       ZSTD_getErrorName(result))));
+		}
+
+		state->frameDecompressedBytes += frameInput.pos - input.pos;
+		input.pos = frameInput.pos;
+
+		if (state->output.pos == state->output.size)
+		{
+			FlushZstdOutput(state);
+		}
+
+		if (state->frameSize > 0 && state->frameDecompressedBytes >= state->frameSize)
+		{
+			EndZstdFrame(state);
+		}
+	}
+}
+
+
+/*
+ * ZstdClose ends the last frame, writes the seek table if needed, and closes
+ * the underlying ByteSink.
+ */
+static void
+ZstdClose(void *context)
+{
+	ZstdCompressorState *state = (ZstdCompressorState *) context;
+	ByteSink *byteSink = state->byteSink;
+
+	/* always write at least one frame, such that the output is valid zstd */
+	if (state->frameCount == 0 || state->frameDecompressedBytes > 0)
+	{
+		EndZstdFrame(state);
+	}
+
+	if (state->frameSize > 0)
+	{
+		WriteSeekTable(state);
+	}
+
+	ZSTD_freeCCtx(state->compressionContext);
+	state->compressionContext = NULL;
+
+	byteSink->close(byteSink->context);
+
+	/* the state itself is freed with the memory context, after the callback */
+	pfree(state->output.dst);
+}
+
+
+/*
+ * EndZstdFrame writes out the remainder of the current frame and adds it to
+ * the seek table.
+ */
+static void
+EndZstdFrame(ZstdCompressorState *state)
+{
+	ZSTD_inBuffer input = { NULL, 0, 0 };
+	size_t remainingBytes = 0;
+
+	do
+	{
+		remainingBytes = ZSTD_compressStream2(state->compressionContext, &state->output,
+		                                      &input, ZSTD_e_end);
+		if (ZSTD_isError(remainingBytes))
+		{
+			ereport(ERROR, (errmsg("could not compress data: %s",
+			                       ZSTD_getErrorName(remainingBytes))));
+		}
+
+		FlushZstdOutput(state);
+	}
+	while (remainingBytes != 0);
+
+	if (state->seekTable != NULL)
+	{
+		AppendUInt32LE(state->seekTable, (uint32) state->frameCompressedBytes);
+		AppendUInt32LE(state->seekTable, (uint32) state->frameDecompressedBytes);
+	}
+
+	state->frameCount++;
+	state->frameCompressedBytes = 0;
+	state->frameDecompressedBytes = 0;
+}
+
+
+/*
+ * FlushZstdOutput writes the compressed bytes in the output buffer to the
+ * byteSink.
+ */
+static void
+FlushZstdOutput(ZstdCompressorState *state)
+{
+	ByteSink *byteSink = state->byteSink;
+
+	if (state->output.pos == 0)
+	{
+		return;
+	}
+
+	byteSink->write(byteSink->context, state->output.dst, state->output.pos);
+
+	state->frameCompressedBytes += state->output.pos;
+	state->output.pos = 0;
+}
+
+
+/*
+ * WriteSeekTable writes the seek table of the seekable format as a
+ * skippable frame: an entry with the compressed and decompressed size of
+ * every frame, followed by the number of frames, a descriptor byte without
+ * checksums, and the seekable magic number.
+ */
+static void
+WriteSeekTable(ZstdCompressorState *state)
+{
+	ByteSink *byteSink = state->byteSink;
+	StringInfo seekTableFrame = makeStringInfo();
+
+	AppendUInt32LE(seekTableFrame, ZSTD_SEEKABLE_SKIPPABLE_MAGIC);
+	AppendUInt32LE(seekTableFrame, state->seekTable->len + ZSTD_SEEKABLE_FOOTER_SIZE);
+	appendBinaryStringInfo(seekTableFrame, state->seekTable->data,
+	                       state->seekTable->len);
+	AppendUInt32LE(seekTableFrame, state->frameCount);
+	appendStringInfoChar(seekTableFrame, 0);
+	AppendUInt32LE(seekTableFrame, ZSTD_SEEKABLE_MAGIC);
+
+	byteSink->write(byteSink->context, seekTableFrame->data, seekTableFrame->len);
+}
+
+
+/*
+ * AppendUInt32LE appends a 32-bit integer in little-endian byte order.
+ */
+static void
+AppendUInt32LE(StringInfo buffer, uint32 value)
+{
+	char bytes[4];
+
+	bytes[0] = (char) (value & 0xFF);
+	bytes[1] = (char) ((value >> 8) & 0xFF);
+	bytes[2] = (char) ((value >> 16) & 0xFF);
+	bytes[3] = (char) ((value >> 24) & 0xFF);
+
+	appendBinaryStringInfo(buffer, bytes, 4);
+}
+
+
+/*
+ * SetZstdParameter sets a compression parameter and throws an error if the
+ * library does not accept it, for instance when it was built without
+ * multi-threading support. The context is freed by the reset callback.
+ */
+static void
+SetZstdParameter(ZSTD_CCtx *compressionContext, ZSTD_cParameter parameter, int value,
+                 char *parameterName)
+{
+	size_t result = ZSTD_CCtx_setParameter(compressionContext, parameter, value);
+
+	if (ZSTD_isError(result))
+	{
+		ereport(ERROR, (errmsg("could not set zstd %s to %d: %s", parameterName,
+		                       value, ZSTD_getErrorName(result))));
+	}
+}
+
+/*
+ * FreeZstdCompressorCallback frees the compression context of a compressor
+ * that was not closed when the memory context in which it was created is
+ * reset or deleted, such as after an error.
+ */
+static void
+FreeZstdCompressorCallback(void *arg)
+{
+	ZstdCompressorState *state = (ZstdCompressorState *) arg;
+
+	if (state->compressionContext != NULL)
+	{
+		ZSTD_freeCCtx(state->compressionContext);
+		state->compressionContext = NULL;
+	}
+}
+
+#endif
@@ -0,0 +1,269 @@
+/*-------------------------------------------------------------------------
+ *
+ * zstd_decompressor.c
+ *     Decompressor that uses libzstd to decompress a stream of bytes.
+ *
+ * Streams can consist of multiple frames, and skippable frames such as the
+ * seek table of the seekable format are ignored. Frames that are compressed
+ * with a dictionary are decompressed with the dictionary of the same ID from
+ * the container of the blob.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "pgazure/byte_io.h"
+#include "pgazure/zstd_compression.h"
+#include "pgazure/zstd_dictionary.h"
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+
+
+/* largest size of a zstd frame header */
+#define ZSTD_MAX_FRAME_HEADER_SIZE 18
+
+
+/*
+ * ZstdDecompressorState contains the internal state that is passed to the
+ * read and close functions of the ByteSource.
+ */
+typedef struct ZstdDecompressorState
+{
+	ZSTD_DCtx *decompressionContext;
+
+	ByteSource *byteSource;
+
+	/* container from which dictionaries are loaded, or NULL */
+	char *connectionString;
+	char *containerName;
+
+	/* ID of the dictionary set on decompressionContext, or 0 */
+	uint32 dictionaryId;
+
+	/* whether the next byte of input starts a frame */
+	bool atFrameStart;
+
+	/* compressed bytes read from the byteSource that are not yet consumed */
+	ZSTD_inBuffer input;
+	size_t inputBufferSize;
+	bool endOfInputReached;
+} ZstdDecompressorState;
+
+
+static int ZstdDecompressorRead(void *context, void *buffer, int minRead, int maxRead);
+static void ZstdDecompressorClose(void *context);
+static void FillZstdInputBuffer(ZstdDecompressorState *state);
+static void SetZstdFrameDictionary(ZstdDecompressorState *state);
+static void FreeZstdDecompressorCallback(void *arg);
+
+
+/*
+ * CreateZstdDecompressor creates a ByteSource that decompresses the bytes
+ * coming in from another ByteSource. Dictionaries are loaded from the given
+ * container, unless connectionString is NULL.
+ */
+ByteSource *
+CreateZstdDecompressor(ByteSource *byteSource, char *connectionString,
+                       char *containerName)
+{
+	ZstdDecompressorState *state = palloc0(sizeof(ZstdDecompressorState));
+
+	ZSTD_DCtx *decompressionContext = ZSTD_createDCtx();
+	if (decompressionContext == NULL)
+	{
+		ereport(ERROR, (errmsg("could not create zstd decompression context")));
+	}
+
+	state->decompressionContext = decompressionContext;
+
+	/* free the context if the query fails before the source is closed */
+	MemoryContextCallback *callback = palloc0(sizeof(MemoryContextCallback));
+	callback->func = FreeZstdDecompressorCallback;
+	callback->arg = state;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	state->byteSource = byteSource;
+	state->connectionString = connectionString;
+	state->containerName = containerName;
+	state->atFrameStart = true;
+	state->inputBufferSize = ZSTD_DStreamInSize();
+	state->input.src = palloc(state->inputBufferSize);
+	state->input.size = 0;
+	state->input.pos = 0;
+
+	ByteSource *decompressor = palloc0(sizeof(ByteSource));
+	decompressor->context = state;
+	decompressor->read = ZstdDecompressorRead;
+	decompressor->close = ZstdDecompressorClose;
+
+	return decompressor;
+}
+
+
+/*
+ * ZstdDecompressorRead decompresses bytes directly into the caller's buffer
+ * until it is full or the input ends.
+ */
+static int
+ZstdDecompressorRead(void *context, void *buffer, int minRead, int maxRead)
+{
+	ZstdDecompressorState *state = (ZstdDecompressorState *) context;
+	ZSTD_outBuffer output = { buffer, maxRead, 0 };
+
+	while (output.pos < output.size)
+	{
+		if (state->input.pos == state->input.size && !state->endOfInputReached)
+		{
+			FillZstdInputBuffer(state);
+		}
+
+		if (state->atFrameStart)
+		{
+			SetZstdFrameDictionary(state);
+		}
+
+		size_t previousOutputPos = output.pos;
+		size_t result = ZSTD_decompressStream(state->decompressionContext, &output,
+		                                      &state->input);
+		if (ZSTD_isError(result))
+		{
+			ereport(ERROR, (errmsg("could not uncompress data: %s",
+			                       ZSTD_getErrorName(result))));
+		}
+
+		/* a result of 0 means that a frame is complete and flushed */
+		state->atFrameStart = result == 0;
+
+		if (state->endOfInputReached && state->input.pos == state->input.size &&
+		    output.pos == previousOutputPos)
+		{
+			/* no more input, and nothing left to flush */
+			break;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return (int) output.pos;
+}
+
+
+/*
+ * FillZstdInputBuffer moves the compressed bytes that are not yet consumed
+ * to the start of the input buffer, and reads the next compressed bytes
+ * from the ByteSource after them.
+ */
+static void
+FillZstdInputBuffer(ZstdDecompressorState *state)
+{
+	ByteSource *byteSource = state->byteSource;
+	char *inputBuffer = (char *) state->input.src;
+	size_t remainingBytes = state->input.size - state->input.pos;
+
+	memmove(inputBuffer, inputBuffer + state->input.pos, remainingBytes);
+
+	int bytesRead = byteSource->read(byteSource->context, inputBuffer + remainingBytes,
+	                                 0, state->inputBufferSize - remainingBytes);
+	if (bytesRead == 0)
+	{
+		state->endOfInputReached = true;
+	}
+
+	state->input.size = remainingBytes + bytesRead;
+	state->input.pos = 0;
+}
+
+
+/*
+ * SetZstdFrameDictionary reads the dictionary ID from the header of the
+ * frame that starts the input, and sets the dictionary with that ID on the
+ * decompression context.
+ */
+static void
+SetZstdFrameDictionary(ZstdDecompressorState *state)
+{
+	/* make sure the whole frame header is in the input buffer */
+	while (state->input.size - state->input.pos < ZSTD_MAX_FRAME_HEADER_SIZE &&
+	       !state->endOfInputReached)
+	{
+		FillZstdInputBuffer(state);
+	}
+
+	state->atFrameStart = false;
+
+	/* returns 0 for frames without a dictionary and for skippable frames */
+	uint32 dictionaryId =
+		ZSTD_getDictID_fromFrame((char *) state->input.src + state->input.pos,
+		                         state->input.size - state->input.pos);
+
+	if (dictionaryId == 0 || dictionaryId == state->dictionaryId)
+	{
+		return;
+	}
+
+	if (state->connectionString == NULL)
+	{
+		ereport(ERROR, (errmsg("cannot decompress zstd frames that use dictionary %u "
+		                       "here", dictionaryId)));
+	}
+
+	ZSTD_DDict *dictionary = GetZstdDecompressionDictionary(state->connectionString,
+	                                                        state->containerName,
+	                                                        dictionaryId);
+
+	/* at a frame boundary, so no buffered state is lost */
+	ZSTD_DCtx_reset(state->decompressionContext, ZSTD_reset_session_only);
+
+	size_t result = ZSTD_DCtx_refDDict(state->decompressionContext, dictionary);
+	if (ZSTD_isError(result))
+	{
+		ereport(ERROR, (errmsg("could not set zstd dictionary: %s",
+		                       ZSTD_getErrorName(result))));
+	}
+
+	state->dictionaryId = dictionaryId;
+}
+
+
+/*
+ * ZstdDecompressorClose frees the decompression context and closes the
+ * underlying ByteSource.
+ */
+static void
+ZstdDecompressorClose(void *context)
+{
+	ZstdDecompressorState *state = (ZstdDecompressorState *) context;
+	ByteSource *byteSource = state->byteSource;
+
+	ZSTD_freeDCtx(state->decompressionContext);
+	state->decompressionContext = NULL;
+
+	byteSource->close(byteSource->context);
+
+	/* the state itself is freed with the memory context, after the callback */
+	pfree((void *) state->input.src);
+}
+
+
+/*
+ * FreeZstdDecompressorCallback frees the decompression context of a
+ * decompressor that was not closed when the memory context in which it was
+ * created is reset or deleted, such as after an error.
+ */
+static void
+FreeZstdDecompressorCallback(void *arg)
+{
+	ZstdDecompressorState *state = (ZstdDecompressorState *) arg;
+
+	if (state->decompressionContext != NULL)
+	{
+		ZSTD_freeDCtx(state->decompressionContext);
+		state->decompressionContext = NULL;
+	}
+}
+
+#endif
@@ -0,0 +1,479 @@
+/*-------------------------------------------------------------------------
+ *
+ * zstd_dictionary.c
+ *     Trained zstd dictionaries for compressing many small blobs.
+ *
+ * Small blobs such as JSON documents of a few kB compress poorly on their
+ * own, because the compressor has not yet seen the strings that repeat
+ * across blobs. blob_storage_train_zstd_dictionary trains a dictionary on
+ * a sample of the blobs under a prefix, which zstd primes the compressor
+ * and decompressor with.
+ *
+ * A dictionary is stored as a blob named
+ * pgazure_zstd_dictionaries/<id>.pgazure_zstddict in the container of the
+ * blobs that use it, where <id> is the ID that zstd assigns on training.
+ * When azure.zstd_dictionary_id is set, zstd blobs are compressed with the
+ * dictionary, which records its ID in the header of each frame and in the
+ * pgazure_zstd_dictionary metadata of the blob. Readers take the ID from
+ * the frame header, so they do not need to look at the metadata.
+ *
+ * Each backend keeps the dictionaries it loaded for its lifetime, along with
+ * the digested forms that zstd uses to compress and decompress. Compressors
+ * and decompressors refer to the digested forms, so they are never freed.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#include "pgazure/blob_stats.h"
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/compression.h"
+#include "pgazure/gzip_index.h"
+#include "pgazure/storage_account.h"
+#include "pgazure/zstd_dictionary.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#ifdef USE_ZSTD
+#include <zdict.h>
+
+#include "common/pg_prng.h"
+#endif
+
+
+/* smallest dictionary that can be trained */
+#define ZSTD_DICTIONARY_MIN_SIZE 1024
+
+/* largest dictionary that can be trained */
+#define ZSTD_DICTIONARY_MAX_SIZE (16 * 1024 * 1024)
+
+/* number of bytes of a sample blob that are used for training */
+#define ZSTD_DICTIONARY_MAX_SAMPLE_SIZE (128 * 1024)
+
+/* number of bytes of all sample blobs together that are used for training */
+#define ZSTD_DICTIONARY_MAX_TRAINING_SIZE (256 * 1024 * 1024)
+
+/* ID of the dictionary with which zstd blobs are written, or 0 for none */
+int ZstdDictionaryId = 0;
+
+
+PG_FUNCTION_INFO_V1(blob_storage_train_zstd_dictionary);
+
+
+#ifdef USE_ZSTD
+
+/*
+ * TrainingSampleContext collects a random sample of the names of the blobs
+ * under a prefix using reservoir sampling.
+ */
+typedef struct TrainingSampleContext
+{
+	char **blobNames;
+	int maxBlobCount;
+	int blobCount;
+
+	/* number of blobs that could have been sampled */
+	uint64 listedBlobCount;
+} TrainingSampleContext;
+
+/*
+ * ZstdCompressionDictionary is a dictionary digested for compression at a
+ * compression level.
+ */
+typedef struct ZstdCompressionDictionary
+{
+	int level;
+	ZSTD_CDict *dictionary;
+} ZstdCompressionDictionary;
+
+/*
+ * ZstdDictionaryCacheEntry is a dictionary loaded by the backend.
+ */
+typedef struct ZstdDictionaryCacheEntry
+{
+	char *connectionString;
+	char *containerName;
+	uint32 dictionaryId;
+
+	/* contents of the dictionary blob */
+	char *data;
+	int length;
+
+	/* ZstdCompressionDictionary for each level used so far */
+	List *compressionDictionaries;
+
+	/* dictionary digested for decompression, or NULL */
+	ZSTD_DDict *decompressionDictionary;
+} ZstdDictionaryCacheEntry;
+
+
+/* dictionaries loaded by the backend */
+static List *ZstdDictionaryCache = NIL;
+
+
+static void AddTrainingSampleBlob(void *context, CloudBlob *blob);
+static int AppendTrainingSample(StringInfo samples, char *connectionString,
+                                char *containerName, char *path);
+static ZstdDictionaryCacheEntry * GetZstdDictionary(char *connectionString,
+                                                    char *containerName,
+                                                    uint32 dictionaryId);
+
+#endif
+
+
+/*
+ * blob_storage_train_zstd_dictionary trains a zstd dictionary on a random
+ * sample of the blobs under a prefix and writes it to the container. It
+ * returns the ID of the dictionary.
+ */
+Datum
+blob_storage_train_zstd_dictionary(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errmsg("connection_string argument is required")));
+	}
+	if (PG_ARGISNULL(1))
+	{
+		ereport(ERROR, (errmsg("container_name argument is required")));
+	}
+	if (PG_ARGISNULL(2))
+	{
+		ereport(ERROR, (errmsg("prefix argument is required")));
+	}
+	if (PG_ARGISNULL(3))
+	{
+		ereport(ERROR, (errmsg("sample_blobs argument is required")));
+	}
+	if (PG_ARGISNULL(4))
+	{
+		ereport(ERROR, (errmsg("dictionary_size argument is required")));
+	}
+
+#ifdef USE_ZSTD
+	char *accountString = text_to_cstring(PG_GETARG_TEXT_P(0));
+	char *containerName = text_to_cstring(PG_GETARG_TEXT_P(1));
+	char *prefix = text_to_cstring(PG_GETARG_TEXT_P(2));
+	int sampleBlobCount = PG_GETARG_INT32(3);
+	int dictionarySize = PG_GETARG_INT32(4);
+
+	if (sampleBlobCount < 1)
+	{
+		ereport(ERROR, (errmsg("sample_blobs must be positive")));
+	}
+
+	if (dictionarySize < ZSTD_DICTIONARY_MIN_SIZE ||
+		dictionarySize > ZSTD_DICTIONARY_MAX_SIZE)
+	{
+		ereport(ERROR, (errmsg("dictionary_size must be between %d and %d",
+		                       ZSTD_DICTIONARY_MIN_SIZE, ZSTD_DICTIONARY_MAX_SIZE)));
+	}
+
+	char *connectionString = AccountStringToConnectionString(accountString);
+
+	TrainingSampleContext sampleContext;
+	memset(&sampleContext, 0, sizeof(sampleContext));
+	sampleContext.maxBlobCount = sampleBlobCount;
+	sampleContext.blobNames = palloc0(sampleBlobCount * sizeof(char *));
+
+	ListBlobs(connectionString, containerName, prefix, AddTrainingSampleBlob,
+	          &sampleContext);
+
+	StringInfo samples = makeStringInfo();
+	size_t *sampleSizes = palloc(sampleContext.blobCount * sizeof(size_t));
+	int sampleCount = 0;
+
+	for (int blobIndex = 0; blobIndex < sampleContext.blobCount; blobIndex++)
+	{
+		if (samples->len >= ZSTD_DICTIONARY_MAX_TRAINING_SIZE -
+			ZSTD_DICTIONARY_MAX_SAMPLE_SIZE)
+		{
+			break;
+		}
+
+		int sampleSize = AppendTrainingSample(samples, connectionString, containerName,
+		                                      sampleContext.blobNames[blobIndex]);
+		if (sampleSize > 0)
+		{
+			sampleSizes[sampleCount++] = sampleSize;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (sampleCount == 0)
+	{
+		ereport(ERROR, (errmsg("no blobs to train a zstd dictionary on under prefix "
+		                       "\"%s\"", prefix)));
+	}
+
+	char *dictionary = palloc(dictionarySize);
+	size_t result = ZDICT_trainFromBuffer(dictionary, dictionarySize, samples->data,
+	                                      sampleSizes, sampleCount);
+	if (ZDICT_isError(result))
+	{
+		ereport(ERROR, (errmsg("could not train zstd dictionary: %s",
+		                       ZDICT_getErrorName(result)),
+		                errhint("Training needs many samples that are together much "
+		                        "larger than the dictionary.")));
+	}
+
+	uint32 dictionaryId = ZDICT_getDictID(dictionary, result);
+	char *dictionaryPath = ZstdDictionaryPath(dictionaryId);
+	ByteSink *byteSink = palloc0(sizeof(ByteSink));
+
+	WriteBlockBlob(connectionString, containerName, dictionaryPath, byteSink);
+	byteSink->write(byteSink->context, dictionary, (int) result);
+	byteSink->close(byteSink->context);
+
+	ereport(DEBUG1, (errmsg("trained zstd dictionary %u of %zu bytes on %d of "
+	                        UINT64_FORMAT " blobs", dictionaryId, result, sampleCount,
+	                        sampleContext.listedBlobCount)));
+
+	PG_RETURN_INT64(dictionaryId);
+#else
+	ereport(ERROR, (errmsg("zstd compression requires postgres to be built with zstd")));
+#endif
+}
+
+
+/*
+ * IsZstdDictionaryPath returns whether a blob is a zstd dictionary.
+ */
+bool
+IsZstdDictionaryPath(const char *path)
+{
+	return HasSuffix(path, ZSTD_DICTIONARY_SUFFIX);
+}
+
+
+/*
+ * ZstdDictionaryPath returns the name of the blob of a zstd dictionary.
+ */
+char *
+ZstdDictionaryPath(uint32 dictionaryId)
+{
+	return psprintf("%s%u%s", ZSTD_DICTIONARY_DIRECTORY, dictionaryId,
+	                ZSTD_DICTIONARY_SUFFIX);
+}
+
+
+#ifdef USE_ZSTD
+
+/*
+ * AddTrainingSampleBlob adds a listed blob to the sample in context, which
+ * replaces a random blob once the sample is full.
+ */
+static void
+AddTrainingSampleBlob(void *context, CloudBlob *blob)
+{
+	TrainingSampleContext *sampleContext = (TrainingSampleContext *) context;
+
+	if (blob->size == 0 || IsBlobStatsPath(blob->name) || IsGzipIndexPath(blob->name) ||
+		IsZstdDictionaryPath(blob->name))
+	{
+		return;
+	}
+
+	sampleContext->listedBlobCount++;
+
+	if (sampleContext->blobCount < sampleContext->maxBlobCount)
+	{
+		sampleContext->blobNames[sampleContext->blobCount++] = pstrdup(blob->name);
+		return;
+	}
+
+	uint64 blobIndex = (uint64) (pg_prng_double(&pg_global_prng_state) *
+	                             sampleContext->listedBlobCount);
+
+	if (blobIndex < (uint64) sampleContext->maxBlobCount)
+	{
+		pfree(sampleContext->blobNames[blobIndex]);
+		sampleContext->blobNames[blobIndex] = pstrdup(blob->name);
+	}
+}
+
+
+/*
+ * AppendTrainingSample appends up to ZSTD_DICTIONARY_MAX_SAMPLE_SIZE bytes
+ * of the decompressed contents of a blob to samples, and returns the number
+ * of bytes appended.
+ */
+static int
+AppendTrainingSample(StringInfo samples, char *connectionString, char *containerName,
+                     char *path)
+{
+	int sampleSize = 0;
+	ByteSource *byteSource = palloc0(sizeof(ByteSource));
+
+	ReadBlockBlob(connectionString, containerName, path, byteSource);
+
+	byteSource = BuildBlobDecompressor(CompressionStringFromFileName(path), byteSource,
+	                                   connectionString, containerName, NULL);
+
+	enlargeStringInfo(samples, ZSTD_DICTIONARY_MAX_SAMPLE_SIZE);
+
+	while (sampleSize < ZSTD_DICTIONARY_MAX_SAMPLE_SIZE)
+	{
+		int bytesRead = byteSource->read(byteSource->context,
+		                                 samples->data + samples->len + sampleSize, 1,
+		                                 ZSTD_DICTIONARY_MAX_SAMPLE_SIZE - sampleSize);
+		if (bytesRead == 0)
+		{
+			break;
+		}
+
+		sampleSize += bytesRead;
+	}
+
+	byteSource->close(byteSource->context);
+
+	samples->len += sampleSize;
+	samples->data[samples->len] = '\0';
+
+	return sampleSize;
+}
+
+
+/*
+ * GetZstdCompressionDictionary returns a dictionary from the cache, loading
+ * it from the container if needed, digested for compression at the given
+ * level.
+ */
+ZSTD_CDict *
+GetZstdCompressionDictionary(char *connectionString, char *containerName,
+                             uint32 dictionaryId, int level)
+{
+	ZstdDictionaryCacheEntry *entry = GetZstdDictionary(connectionString, containerName,
+	                                                    dictionaryId);
+	ListCell *dictionaryCell = NULL;
+
+	foreach(dictionaryCell, entry->compressionDictionaries)
+	{
+		ZstdCompressionDictionary *compressionDictionary =
+			(ZstdCompressionDictionary *) lfirst(dictionaryCell);
+
+		if (compressionDictionary->level == level)
+		{
+			return compressionDictionary->dictionary;
+		}
+	}
+
+	ZSTD_CDict *dictionary = ZSTD_createCDict(entry->data, entry->length, level);
+	if (dictionary == NULL)
+	{
+		ereport(ERROR, (errmsg("could not load zstd dictionary %u", dictionaryId)));
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	ZstdCompressionDictionary *compressionDictionary =
+		palloc0(sizeof(ZstdCompressionDictionary));
+	compressionDictionary->level = level;
+	compressionDictionary->dictionary = dictionary;
+
+	entry->compressionDictionaries = lappend(entry->compressionDictionaries,
+	                                         compressionDictionary);
+
+	MemoryContextSwitchTo(oldContext);
+
+	return dictionary;
+}
+
+
+/*
+ * GetZstdDecompressionDictionary returns a dictionary from the cache,
+ * loading it from the container if needed, digested for decompression.
+ */
+ZSTD_DDict *
+GetZstdDecompressionDictionary(char *connectionString, char *containerName,
+                               uint32 dictionaryId)
+{
+	ZstdDictionaryCacheEntry *entry = GetZstdDictionary(connectionString, containerName,
+	                                                    dictionaryId);
+
+	if (entry->decompressionDictionary == NULL)
+	{
+		entry->decompressionDictionary = ZSTD_createDDict(entry->data, entry->length);
+		if (entry->decompressionDictionary == NULL)
+		{
+			ereport(ERROR, (errmsg("could not load zstd dictionary %u", dictionaryId)));
+		}
+	}
+
+	return entry->decompressionDictionary;
+}
+
+
+/*
+ * GetZstdDictionary returns the cache entry of a dictionary, and reads the
+ * dictionary from the container if it is not in the cache.
+ */
+static ZstdDictionaryCacheEntry *
+GetZstdDictionary(char *connectionString, char *containerName, uint32 dictionaryId)
+{
+	ListCell *entryCell = NULL;
+
+	foreach(entryCell, ZstdDictionaryCache)
+	{
+		ZstdDictionaryCacheEntry *entry = (ZstdDictionaryCacheEntry *) lfirst(entryCell);
+
+		if (entry->dictionaryId == dictionaryId &&
+			strcmp(entry->containerName, containerName) == 0 &&
+			strcmp(entry->connectionString, connectionString) == 0)
+		{
+			return entry;
+		}
+	}
+
+	char *dictionaryPath = ZstdDictionaryPath(dictionaryId);
+	size_t dictionarySize = 0;
+
+	if (!GetBlobSizeIfExists(connectionString, containerName, dictionaryPath,
+	                         &dictionarySize))
+	{
+		ereport(ERROR, (errmsg("zstd dictionary %u does not exist in container \"%s\"",
+		                       dictionaryId, containerName),
+		                errdetail("Dictionaries are stored in the blob \"%s\".",
+		                          dictionaryPath)));
+	}
+
+	StringInfo data = ReadBlobContents(connectionString, containerName, dictionaryPath);
+
+	if (ZDICT_getDictID(data->data, data->len) != dictionaryId)
+	{
+		ereport(ERROR, (errmsg("blob \"%s\" is not zstd dictionary %u", dictionaryPath,
+		                       dictionaryId)));
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	ZstdDictionaryCacheEntry *entry = palloc0(sizeof(ZstdDictionaryCacheEntry));
+	entry->connectionString = pstrdup(connectionString);
+	entry->containerName = pstrdup(containerName);
+	entry->dictionaryId = dictionaryId;
+	entry->data = palloc(data->len);
+	entry->length = data->len;
+	memcpy(entry->data, data->data, data->len);
+
+	ZstdDictionaryCache = lappend(ZstdDictionaryCache, entry);
+
+	MemoryContextSwitchTo(oldContext);
+
+	pfree(data->data);
+	pfree(data);
+
+	return entry;
+}
+
+
+#endif
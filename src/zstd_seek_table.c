@@ -0,0 +1,269 @@
+/*-------------------------------------------------------------------------
+ *
+ * zstd_seek_table.c
+ *     Random access into zstd blobs through the seek table of the seekable
+ *     format.
+ *
+ * Blobs written with azure.zstd_frame_size consist of independent frames,
+ * followed by a skippable frame with the compressed and decompressed size
+ * of each frame:
+ *
+ *   <skippable magic:4> <frame size:4>
+ *   <compressed size:4> <decompressed size:4> [<checksum:4>]
+ *   ...
+ *   <frame count:4> <descriptor:1> <seekable magic:4>
+ *
+ * where all integers are little-endian, and the checksums are present if
+ * the top bit of the descriptor is set. The seek table is read from the end
+ * of the blob, and a range of decompressed bytes is read by downloading and
+ * decompressing only the frames that overlap it.
+ *
+ * Copyright (c), Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "pgazure/blob_storage.h"
+#include "pgazure/blob_storage_utils.h"
+#include "pgazure/byte_io.h"
+#include "pgazure/zstd_compression.h"
+#include "pgazure/zstd_seek_table.h"
+#include "utils/memutils.h"
+
+
+/* magic numbers of the seek table in the zstd seekable format */
+#define ZSTD_SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+
+/* sizes of the skippable frame header and of the footer of the seek table */
+#define ZSTD_SKIPPABLE_HEADER_SIZE 8
+#define ZSTD_SEEKABLE_FOOTER_SIZE 9
+
+/* bits of the descriptor byte */
+#define ZSTD_SEEKABLE_CHECKSUM_FLAG 0x80
+#define ZSTD_SEEKABLE_RESERVED_BITS 0x7C
+
+
+#ifdef USE_ZSTD
+static int FindZstdFrame(ZstdSeekTable *seekTable, uint64 offset);
+static uint32 ReadUInt32LE(const char *bytes);
+#endif
+
+
+/*
+ * ReadZstdSeekTable reads the seek table at the end of a zstd blob of
+ * blobSize bytes. Returns NULL if the blob does not end in a seek table, or
+ * if the frames in the table do not add up to the rest of the blob.
+ */
+ZstdSeekTable *
+ReadZstdSeekTable(char *connectionString, char *containerName, char *path,
+                  uint64 blobSize)
+{
+#ifdef USE_ZSTD
+	char footer[ZSTD_SEEKABLE_FOOTER_SIZE];
+
+	if (blobSize < ZSTD_SKIPPABLE_HEADER_SIZE + ZSTD_SEEKABLE_FOOTER_SIZE)
+	{
+		return NULL;
+	}
+
+	int footerLength = ReadBlockBlobRange(connectionString, containerName, path,
+	                                      blobSize - ZSTD_SEEKABLE_FOOTER_SIZE,
+	                                      footer, ZSTD_SEEKABLE_FOOTER_SIZE);
+	if (footerLength != ZSTD_SEEKABLE_FOOTER_SIZE ||
+	    ReadUInt32LE(footer + 5) != ZSTD_SEEKABLE_MAGIC)
+	{
+		return NULL;
+	}
+
+	uint32 frameCount = ReadUInt32LE(footer);
+	uint8 descriptor = (uint8) footer[4];
+	int entrySize = (descriptor & ZSTD_SEEKABLE_CHECKSUM_FLAG) ? 12 : 8;
+
+	if ((descriptor & ZSTD_SEEKABLE_RESERVED_BITS) != 0 || frameCount == 0 ||
+	    frameCount > (blobSize - ZSTD_SKIPPABLE_HEADER_SIZE -
+					  ZSTD_SEEKABLE_FOOTER_SIZE) / entrySize ||
+	    frameCount > MaxAllocSize / entrySize)
+	{
+		return NULL;
+	}
+
+	int entriesLength = (int) frameCount * entrySize;
+	int tableLength = ZSTD_SKIPPABLE_HEADER_SIZE + entriesLength +
+					  ZSTD_SEEKABLE_FOOTER_SIZE;
+	uint64 tableOffset = blobSize - tableLength;
+	char *table = palloc(tableLength);
+
+	if (ReadBlockBlobRange(connectionString, containerName, path, tableOffset, table,
+	                       tableLength) != tableLength ||
+	    ReadUInt32LE(table) != ZSTD_SEEKABLE_SKIPPABLE_MAGIC ||
+	    ReadUInt32LE(table + 4) != (uint32) (entriesLength + ZSTD_SEEKABLE_FOOTER_SIZE))
+	{
+		return NULL;
+	}
+
+	ZstdSeekTable *seekTable = palloc0(sizeof(ZstdSeekTable));
+
+	seekTable->frameCount = (int) frameCount;
+	seekTable->compressedOffsets = palloc((frameCount + 1) * sizeof(uint64));
+	seekTable->uncompressedOffsets = palloc((frameCount + 1) * sizeof(uint64));
+	seekTable->compressedOffsets[0] = 0;
+	seekTable->uncompressedOffsets[0] = 0;
+
+	for (uint32 frameIndex = 0; frameIndex < frameCount; frameIndex++)
+	{
+		char *entry = table + ZSTD_SKIPPABLE_HEADER_SIZE + frameIndex * entrySize;
+
+		seekTable->compressedOffsets[frameIndex + 1] =
+			seekTable->compressedOffsets[frameIndex] + ReadUInt32LE(entry);
+		seekTable->uncompressedOffsets[frameIndex + 1] =
+			seekTable->uncompressedOffsets[frameIndex] + ReadUInt32LE(entry + 4);
+	}
+
+	/* the frames must cover the blob up to the seek table */
+	if (seekTable->compressedOffsets[frameCount] != tableOffset)
+	{
+		ereport(DEBUG1, (errmsg("ignoring seek table of blob \"%s\"", path),
+		                 errdetail("The frames do not add up to the size of the blob.")));
+		return NULL;
+	}
+
+	seekTable->compressedSize = blobSize;
+	seekTable->uncompressedSize = seekTable->uncompressedOffsets[frameCount];
+
+	return seekTable;
+#else
+	return NULL;
+#endif
+}
+
+
+/*
+ * ReadZstdSeekableRange reads up to length decompressed bytes at a
+ * decompressed offset of a zstd blob into buffer, by downloading and
+ * decompressing the frames that overlap the range. It returns the number of
+ * bytes read, which is less than length only at the end of the blob.
+ */
+int
+ReadZstdSeekableRange(char *connectionString, char *containerName, char *path,
+                      ZstdSeekTable *seekTable, uint64 offset, char *buffer, int length)
+{
+#ifdef USE_ZSTD
+	if (offset >= seekTable->uncompressedSize || length <= 0)
+	{
+		return 0;
+	}
+
+	uint64 endOffset = Min(offset + length, seekTable->uncompressedSize);
+	int firstFrame = FindZstdFrame(seekTable, offset);
+	int lastFrame = FindZstdFrame(seekTable, endOffset - 1);
+	uint64 compressedStart = seekTable->compressedOffsets[firstFrame];
+	uint64 compressedLength = seekTable->compressedOffsets[lastFrame + 1] -
+							  compressedStart;
+
+	if (compressedLength > MaxAllocSize)
+	{
+		ereport(ERROR, (errmsg("zstd frames of blob \"%s\" are too large to read "
+		                       "a range from", path)));
+	}
+
+	char *input = palloc(compressedLength);
+	int inputLength = ReadBlockBlobRange(connectionString, containerName, path,
+	                                     compressedStart, input,
+	                                     (int) compressedLength);
+
+	/* the frames may use a dictionary from the container of the blob */
+	ByteSource *decompressor =
+		CreateZstdDecompressor(CreateMemoryByteSource(input, inputLength),
+		                       connectionString, containerName);
+	uint64 bytesToSkip = offset - seekTable->uncompressedOffsets[firstFrame];
+	int bytesToRead = (int) (endOffset - offset);
+	int bytesRead = 0;
+
+	while (bytesToSkip > 0)
+	{
+		int skipLength = (int) Min(bytesToSkip, (uint64) length);
+		int skippedBytes = decompressor->read(decompressor->context, buffer,
+		                                      skipLength, skipLength);
+
+		if (skippedBytes <= 0)
+		{
+			break;
+		}
+
+		bytesToSkip -= skippedBytes;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	while (bytesToSkip == 0 && bytesRead < bytesToRead)
+	{
+		int readLength = decompressor->read(decompressor->context, buffer + bytesRead,
+		                                    bytesToRead - bytesRead,
+		                                    bytesToRead - bytesRead);
+
+		if (readLength <= 0)
+		{
+			break;
+		}
+
+		bytesRead += readLength;
+	}
+
+	decompressor->close(decompressor->context);
+	pfree(input);
+
+	return bytesRead;
+#else
+	ereport(ERROR, (errmsg("zstd compression requires postgres to be built with zstd")));
+#endif
+}
+
+
+#ifdef USE_ZSTD
+
+/*
+ * FindZstdFrame returns the frame that contains a decompressed offset.
+ */
+static int
+FindZstdFrame(ZstdSeekTable *seekTable, uint64 offset)
+{
+	int low = 0;
+	int high = seekTable->frameCount - 1;
+
+	while (low < high)
+	{
+		int middle = low + (high - low + 1) / 2;
+
+		if (seekTable->uncompressedOffsets[middle] <= offset)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return low;
+}
+
+
+/*
+ * ReadUInt32LE reads a 32-bit integer in little-endian byte order.
+ */
+static uint32
+ReadUInt32LE(const char *bytes)
+{
+	const unsigned char *unsignedBytes = (const unsigned char *) bytes;
+
+	return (uint32) unsignedBytes[0] |
+		   ((uint32) unsignedBytes[1] << 8) |
+		   ((uint32) unsignedBytes[2] << 16) |
+		   ((uint32) unsignedBytes[3] << 24);
+}
+
+#endif
@@ -0,0 +1,30 @@
+--
+-- Blob scans, run against Azurite with a container named pgazure
+--
+CREATE EXTENSION pgazure;
+
+\set conn 'DefaultEndpointsProtocol=http;AccountName=devstoreaccount1;AccountKey=Eby8vdM02xNOcqFlqUwJPLlmEtlCDXJ1OUzFT50uSRZ6IFsuFq2UVErCz4I6tq/K1SZFPTOtr/KBHBeksoGMGw==;BlobEndpoint=http://127.0.0.1:10000/devstoreaccount1;'
+
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/customers.csv', c, 'csv')
+FROM (SELECT i, 'customer ' || i FROM generate_series(1, 100) i) c (customer_id, name);
+
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/orders.csv', o, 'csv')
+FROM (SELECT i, i % 100 + 1, 'item ' || i FROM generate_series(1, 20000) i) o (id, customer_id, item);
+
+-- both sides of the join read from a COPY decoder at the same time
+SET enable_mergejoin TO off;
+SET enable_nestloop TO off;
+
+SELECT count(*) AS order_count,
+       count(DISTINCT c.name) AS customer_count,
+       sum(o.id) AS sum_of_order_ids
+FROM azure.blob_storage_get_blob(:'conn', 'pgazure', 'regress/orders.csv')
+     AS o (id int, customer_id int, item text)
+JOIN azure.blob_storage_get_blob(:'conn', 'pgazure', 'regress/customers.csv')
+     AS c (customer_id int, name text)
+ON (o.customer_id = c.customer_id);
+
+RESET enable_mergejoin;
+RESET enable_nestloop;
+
+DROP EXTENSION pgazure;
@@ -0,0 +1,197 @@
+--
+-- Round trips through blob_storage_put_blob and the readers, run against
+-- Azurite with a container named pgazure
+--
+CREATE EXTENSION pgazure;
+
+\set conn 'DefaultEndpointsProtocol=http;AccountName=devstoreaccount1;AccountKey=Eby8vdM02xNOcqFlqUwJPLlmEtlCDXJ1OUzFT50uSRZ6IFsuFq2UVErCz4I6tq/K1SZFPTOtr/KBHBeksoGMGw==;BlobEndpoint=http://127.0.0.1:10000/devstoreaccount1;'
+
+SET datestyle TO 'ISO, MDY';
+
+-- notes contain newlines, quotes and delimiters, names are not ASCII
+CREATE TABLE round_trip_rows AS
+SELECT i AS id,
+       'line ' || i || E'\nwith "quotes",\tcommas and tabs' AS note,
+       U&'caf\00E9 ' || i AS name,
+       i * 1.5 AS amount,
+       DATE '2024-01-01' + i AS day
+FROM generate_series(1, 20000) i;
+
+-- returns the number of rows in a blob and how many differ from round_trip_rows
+CREATE FUNCTION check_round_trip(conn text, path text,
+                                 decoder text DEFAULT 'auto',
+                                 compression text DEFAULT 'auto',
+                                 OUT row_count bigint, OUT mismatches bigint)
+LANGUAGE sql AS $$
+SELECT count(*),
+       count(*) FILTER (WHERE r IS DISTINCT FROM b)
+FROM azure.blob_storage_get_blob(conn, 'pgazure', path, NULL::round_trip_rows,
+                                 decoder, compression) b
+FULL JOIN round_trip_rows r ON (r.id = b.id)
+$$;
+
+-- csv with quoted newlines
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip.csv', r)
+FROM round_trip_rows r;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip.csv');
+
+SELECT row_count
+FROM azure.blob_storage_count_rows(:'conn', 'pgazure', 'regress/round_trip.csv');
+
+SELECT name
+FROM azure.blob_storage_get_blob(:'conn', 'pgazure', 'regress/round_trip.csv',
+                                 NULL::round_trip_rows)
+WHERE id = 1;
+
+-- tsv
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip.tsv', r)
+FROM round_trip_rows r;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip.tsv');
+
+SELECT row_count
+FROM azure.blob_storage_count_rows(:'conn', 'pgazure', 'regress/round_trip.tsv');
+
+-- binary COPY format
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip.bin', r, 'binary')
+FROM round_trip_rows r;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip.bin', 'binary');
+
+-- csv with a header row
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip_header.csv', r,
+                                   'csv_header')
+FROM round_trip_rows r;
+
+SELECT * FROM azure.blob_storage_infer_schema(:'conn', 'pgazure',
+                                              'regress/round_trip_header.csv');
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip_header.csv', 'csv_header');
+
+-- gzip
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip.csv.gz', r)
+FROM round_trip_rows r;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip.csv.gz');
+
+SELECT row_count
+FROM azure.blob_storage_count_rows(:'conn', 'pgazure', 'regress/round_trip.csv.gz');
+
+-- gzip compressed on several threads
+SET azure.gzip_workers TO 4;
+
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip_parallel.csv.gz', r)
+FROM round_trip_rows r;
+
+RESET azure.gzip_workers;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip_parallel.csv.gz');
+
+-- zstd
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip.csv.zst', r)
+FROM round_trip_rows r;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip.csv.zst');
+
+SELECT row_count
+FROM azure.blob_storage_count_rows(:'conn', 'pgazure', 'regress/round_trip.csv.zst');
+
+-- zstd seekable format, sampled through the seek table
+SET azure.zstd_frame_size TO 64;
+
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip_seekable.tsv.zst', r)
+FROM round_trip_rows r;
+
+RESET azure.zstd_frame_size;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip_seekable.tsv.zst');
+
+SELECT count(*) > 0 AS sampled
+FROM azure.blob_storage_sample_blob(:'conn', 'pgazure', 'regress/round_trip_seekable.tsv.zst',
+                                    NULL::round_trip_rows, 10, 5);
+
+-- lz4
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip.csv.lz4', r)
+FROM round_trip_rows r;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip.csv.lz4');
+
+SELECT row_count
+FROM azure.blob_storage_count_rows(:'conn', 'pgazure', 'regress/round_trip.csv.lz4');
+
+-- adaptive compression of a .gz blob writes a gzip member for the sample and one for the rest
+SET azure.adaptive_compression_sample_size TO 64;
+
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip_adaptive.csv.gz', r,
+                                   'csv', 'adaptive')
+FROM round_trip_rows r;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip_adaptive.csv.gz');
+
+SET azure.gzip_decompression_workers TO 2;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip_adaptive.csv.gz');
+
+RESET azure.gzip_decompression_workers;
+
+-- without a compression suffix, readers find the format in the content-encoding
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure', 'regress/round_trip_adaptive.csv', r,
+                                   'csv', 'adaptive')
+FROM round_trip_rows r;
+
+RESET azure.adaptive_compression_sample_size;
+SET azure.detect_content_encoding TO on;
+
+SELECT * FROM check_round_trip(:'conn', 'regress/round_trip_adaptive.csv');
+
+SELECT row_count
+FROM azure.blob_storage_count_rows(:'conn', 'pgazure', 'regress/round_trip_adaptive.csv');
+
+RESET azure.detect_content_encoding;
+
+-- partition columns from a path template
+SELECT azure.blob_storage_put_blob(:'conn', 'pgazure',
+                                   format('regress/events/day=%s/region=%s/part.csv',
+                                          day, region),
+                                   e)
+FROM (SELECT DATE '2024-05-01' + i % 2 AS day,
+             CASE WHEN i % 3 = 0 THEN 'eu' ELSE 'us' END AS region,
+             i AS event_id,
+             'event ' || i AS payload
+      FROM generate_series(1, 1200) i) s,
+     LATERAL (SELECT s.event_id, s.payload) e
+GROUP BY day, region;
+
+CREATE SERVER regress_storage FOREIGN DATA WRAPPER azure_blob
+OPTIONS (container 'pgazure');
+
+CREATE USER MAPPING FOR CURRENT_USER SERVER regress_storage
+OPTIONS (account :'conn');
+
+CREATE FOREIGN TABLE events (
+  event_id bigint,
+  payload text,
+  day date,
+  region text
+)
+SERVER regress_storage
+OPTIONS (path_template 'regress/events/day={day}/region={region}/');
+
+SELECT day, region, count(*), sum(event_id)
+FROM events
+GROUP BY day, region
+ORDER BY day, region;
+
+SELECT count(*) FROM events WHERE region = 'eu';
+
+SELECT count(*) FROM events WHERE day = '2024-05-02' AND region = 'us';
+
+DROP FOREIGN TABLE events;
+DROP USER MAPPING FOR CURRENT_USER SERVER regress_storage;
+DROP SERVER regress_storage;
+DROP FUNCTION check_round_trip(text, text, text, text);
+DROP TABLE round_trip_rows;
+RESET datestyle;
+
+DROP EXTENSION pgazure;